@@ -25,7 +25,10 @@
  */
 
 #include "Application.h"
+#include "BufferPool.h"
 #include "ClothObject.h"
+#include "GpuTracker.h"
+#include "Profiler.h"
 #include "ResourceManager.h"
 
 #include <GLFW/glfw3.h>
@@ -53,6 +56,9 @@ using VertexAttributes = ClothObject::ClothVertex;
 using ClothParameters = ClothObject::ClothParameters;
 
 constexpr float PI = 3.14159265358979323846f;
+// particles along a side of the grid in the gui, cloths that do not fit in
+// single bindings are split into tiles (see ClothTiles)
+constexpr int MAX_CLOTH_SIZE = 2048;
 
 // Custom ImGui widgets
 namespace ImGui {
@@ -92,53 +98,118 @@ bool Application::onInit() {
 
   // init everything in cloth object
   m_clothParams = ClothParameters();
+  m_clothParams.initMesh = RESOURCE_DIR "/plane.obj";
+  m_clothParams.topologyMesh = RESOURCE_DIR "/skirt.obj";
+  m_cloth.m_renderBindGroupLayout = m_clothBindGroupLayout;
   m_cloth.initiateNewCloth(m_clothParams, m_device);
+  m_culler.init(m_device);
+  m_culler.bind(m_cloth, m_device);
+  m_pacer.init(m_device, m_framesInFlight);
   return true;
 }
 
 void Application::onFrame() {
-  glfwPollEvents();
+  PROFILE_ZONE("onFrame");
+  // wait for the gpu before sampling input, so that a full queue does not
+  // add to the input lag
+  int slot;
+  {
+    PROFILE_ZONE("frame pacing");
+    slot = m_pacer.beginFrame();
+  }
+  {
+    PROFILE_ZONE("glfwPollEvents");
+    glfwPollEvents();
+  }
   updateDragInertia();
   updateLightingUniforms();
   // check for cloth parameters updates
-  updateClothParameters();
+  {
+    PROFILE_ZONE("updateClothParameters");
+    updateClothParameters();
+  }
 
-  // run cloth simulation - get next vertex buffer
-  m_cloth.processFrame(m_device);
-  m_vertexCount = m_cloth.numVertices;
+  // run cloth simulation - the simulation thread steps the GPU backend and
+  // publishes what to draw, or the CPU backend and its vertices are uploaded
+  // here, otherwise the GPU step is encoded right here on the GLFW thread
+  bool gpuThread = m_simThread.gpu();
+  if (gpuThread) {
+    m_simThread.update();
+  } else if (m_simThread.running()) {
+    PROFILE_ZONE("uploadSimulationFrame");
+    uploadSimulationFrame();
+  } else {
+    PROFILE_ZONE("processFrame");
+    m_cloth.processFrame(m_device);
+  }
+  // the particle buffers the culling pass reads are not stepped while the
+  // thread runs, and a tiled cloth has no buffer with the whole grid
+  bool culling =
+      m_frustumCulling && !m_simThread.running() && !m_cloth.tiled();
+  updateLodLevel();
+  if (!gpuThread) {
+    SimulationThread::capture(m_cloth, m_lodLevel, m_clothView);
+  }
+  // a rollback of the watchdog halves the time step and the adaptive step
+  // moves it, the gui follows it
+  m_clothParams.deltaT = clothView().parameters.deltaT;
+  if (culling) {
+    m_culler.update(m_queue,
+                    m_uniforms.projectionMatrix * m_uniforms.viewMatrix *
+                        m_uniforms.modelMatrix,
+                    m_cloth, m_lodLevel);
+  }
 
-  // Update uniform buffer
+  // Update the uniform buffer of this frame, the others may still be in use
   m_uniforms.time = static_cast<float>(glfwGetTime());
-  m_queue.writeBuffer(m_uniformBuffer, offsetof(MyUniforms, time),
-                      &m_uniforms.time, sizeof(MyUniforms::time));
+  m_queue.writeBuffer(m_uniformBuffers[slot], 0, &m_uniforms,
+                      sizeof(MyUniforms));
 
   // TextureView nextTexture = m_swapChain.getCurrentTextureView();
-  SurfaceTexture surfaceTexture;
-  m_surface.getCurrentTexture(&surfaceTexture);
-
-  Texture texture = surfaceTexture.texture;
-
-  // Create a view for this surface texture
-  TextureViewDescriptor viewDescriptor;
-  viewDescriptor.label = "Surface texture view";
-  viewDescriptor.format = texture.getFormat();
-  viewDescriptor.dimension = TextureViewDimension::_2D;
-  viewDescriptor.baseMipLevel = 0;
-  viewDescriptor.mipLevelCount = 1;
-  viewDescriptor.baseArrayLayer = 0;
-  viewDescriptor.arrayLayerCount = 1;
-  viewDescriptor.aspect = TextureAspect::All;
-  TextureView nextTexture = texture.createView(viewDescriptor);
+  TextureView nextTexture = nullptr;
+  {
+    PROFILE_ZONE("surface acquire");
+    SurfaceTexture surfaceTexture;
+    m_surface.getCurrentTexture(&surfaceTexture);
+
+    Texture texture = surfaceTexture.texture;
+
+    // Create a view for this surface texture
+    TextureViewDescriptor viewDescriptor;
+    viewDescriptor.label = "Surface texture view";
+    viewDescriptor.format = texture.getFormat();
+    viewDescriptor.dimension = TextureViewDimension::_2D;
+    viewDescriptor.baseMipLevel = 0;
+    viewDescriptor.mipLevelCount = 1;
+    viewDescriptor.baseArrayLayer = 0;
+    viewDescriptor.arrayLayerCount = 1;
+    viewDescriptor.aspect = TextureAspect::All;
+    nextTexture = texture.createView(viewDescriptor);
+  }
 
   if (!nextTexture) {
     std::cerr << "Cannot acquire next swap chain texture" << std::endl;
     return;
   }
 
+  // the buffers of a cloth on the simulation thread are only bound between
+  // beginDraw() and the submit, and not at all while the thread replaces them
+  bool drawCloth = !gpuThread || m_simThread.beginDraw();
+  const SimulationThread::View &view = clothView();
+  if (drawCloth) {
+    updateRenderPipeline(view.parameters);
+  }
+  m_vertexCount = view.numVertices;
+
   CommandEncoderDescriptor commandEncoderDesc;
   commandEncoderDesc.label = "Command Encoder";
   CommandEncoder encoder = m_device.createCommandEncoder(commandEncoderDesc);
 
+  // bounds of the latest step and the draw arguments, all on the gpu
+  if (culling) {
+    m_culler.encode(encoder, m_cloth);
+  }
+
   RenderPassDescriptor renderPassDesc{};
 
   RenderPassColorAttachment renderPassColorAttachment{};
@@ -179,32 +250,76 @@ void Application::onFrame() {
 
   renderPass.setPipeline(m_pipeline);
 
-  renderPass.setVertexBuffer(0, m_cloth.m_vertexBuffer, 0,
-                             m_vertexCount * sizeof(VertexAttributes));
-
   // Set binding group
-  renderPass.setBindGroup(0, m_bindGroup, 0, nullptr);
-
-  renderPass.draw(m_vertexCount, 1, 0, 0);
+  renderPass.setBindGroup(0, m_bindGroups[slot], 0, nullptr);
+
+  if (!drawCloth) {
+    // the cloth shows up again with its new buffers next frame
+  } else if (view.parameters.renderPath ==
+             ClothObject::RenderPath::VertexPulling) {
+    // the vertex shader reads the particles through the triangle list of
+    // the current level of detail
+    renderPass.setBindGroup(1, view.renderBindGroup, 0, nullptr);
+    renderPass.setIndexBuffer(view.indexBuffer, IndexFormat::Uint32, 0,
+                              view.indexBufferBytes);
+    if (culling) {
+      renderPass.drawIndexedIndirect(m_culler.indirectBuffer(),
+                                     ClothCuller::IndexedArgsOffset);
+    } else {
+      renderPass.drawIndexed(view.lodIndexCount[m_lodLevel], 1,
+                             view.lodFirstIndex[m_lodLevel], 0, 0);
+    }
+  } else if (view.tileRows > 0) {
+    // one draw per tile, each from its own vertex buffer
+    for (const SimulationThread::View::Tile &tile : view.tiles) {
+      renderPass.setVertexBuffer(0, tile.vertexBuffer, 0, tile.vertexBytes);
+      renderPass.draw(tile.vertexCount, 1, 0, 0);
+    }
+  } else {
+    renderPass.setVertexBuffer(
+        0, view.vertexBuffer, 0,
+        m_vertexCount *
+            ClothObject::vertexStride(view.parameters.vertexPrecision));
+    if (culling) {
+      renderPass.drawIndirect(m_culler.indirectBuffer(),
+                              ClothCuller::DrawArgsOffset);
+    } else {
+      renderPass.draw(m_vertexCount, 1, 0, 0);
+    }
+  }
 
   // We add the GUI drawing commands to the render pass
-  updateGui(renderPass);
+  {
+    PROFILE_ZONE("ImGui");
+    updateGui(renderPass);
+  }
 
   renderPass.end();
   renderPass.release();
 
   nextTexture.release();
 
-  CommandBufferDescriptor cmdBufferDescriptor{};
-  cmdBufferDescriptor.label = "Command buffer";
-  CommandBuffer command = encoder.finish(cmdBufferDescriptor);
-  encoder.release();
-  m_queue.submit(command);
-  command.release();
+  {
+    PROFILE_ZONE("submit");
+    CommandBufferDescriptor cmdBufferDescriptor{};
+    cmdBufferDescriptor.label = "Command buffer";
+    CommandBuffer command = encoder.finish(cmdBufferDescriptor);
+    encoder.release();
+    m_queue.submit(command);
+    command.release();
+    m_pacer.endFrame(m_queue);
+    // stopped meanwhile if the gui turned the thread off
+    if (gpuThread && drawCloth && m_simThread.gpu()) {
+      m_simThread.endDraw();
+    }
+  }
 
 #ifndef __EMSCRIPTEN__
-  // m_swapChain.present();
-  m_surface.present();
+  {
+    PROFILE_ZONE("present");
+    // m_swapChain.present();
+    m_surface.present();
+  }
 #endif
 
 #ifdef WEBGPU_BACKEND_DAWN
@@ -214,6 +329,11 @@ void Application::onFrame() {
 }
 
 void Application::onFinish() {
+  stopSimulationThread();
+  m_pacer.terminate();
+  m_culler.terminate();
+  m_cloth.terminateAll();
+  BufferPool::releaseIdle();
   terminateGui();
   terminateBindGroup();
   terminateLightingUniforms();
@@ -322,6 +442,9 @@ bool Application::initWindowAndDevice() {
   // Error in Chrome so we hardcode values:
   supportedLimits.limits.minStorageBufferOffsetAlignment = 256;
   supportedLimits.limits.minUniformBufferOffsetAlignment = 256;
+  // the WebGPU defaults, larger cloths are tiled
+  supportedLimits.limits.maxBufferSize = 256 * 1024 * 1024;
+  supportedLimits.limits.maxStorageBufferBindingSize = 128 * 1024 * 1024;
 #else
   adapter.getLimits(&supportedLimits);
 #endif
@@ -331,8 +454,9 @@ bool Application::initWindowAndDevice() {
   requiredLimits.limits.maxVertexAttributes = 6;
   //                                          ^ This was a 4
   requiredLimits.limits.maxVertexBuffers = 1;
-  requiredLimits.limits.maxBufferSize =
-      600 * 600 * 6 * sizeof(VertexAttributes);
+  // as large as the adapter allows, a cloth that still does not fit is split
+  // into tiles (see ClothTiles)
+  requiredLimits.limits.maxBufferSize = supportedLimits.limits.maxBufferSize;
   requiredLimits.limits.maxVertexBufferArrayStride = sizeof(VertexAttributes);
   requiredLimits.limits.minStorageBufferOffsetAlignment =
       supportedLimits.limits.minStorageBufferOffsetAlignment;
@@ -350,13 +474,15 @@ bool Application::initWindowAndDevice() {
   requiredLimits.limits.maxSampledTexturesPerShaderStage = 2;
   //                                                       ^ This was 1
   requiredLimits.limits.maxSamplersPerShaderStage = 1;
-  requiredLimits.limits.maxStorageBuffersPerShaderStage = 2;
+  // particles in and out, vertices and the garment topology
+  requiredLimits.limits.maxStorageBuffersPerShaderStage = 4;
   requiredLimits.limits.maxComputeWorkgroupsPerDimension = 65000;
   requiredLimits.limits.maxComputeWorkgroupSizeX = 1024;
   requiredLimits.limits.maxComputeWorkgroupSizeZ = 64;
   requiredLimits.limits.maxComputeWorkgroupSizeY = 64;
   requiredLimits.limits.maxComputeInvocationsPerWorkgroup = 64;
-  requiredLimits.limits.maxStorageBufferBindingSize = 1000000000;
+  requiredLimits.limits.maxStorageBufferBindingSize =
+      supportedLimits.limits.maxStorageBufferBindingSize;
 
   DeviceDescriptor deviceDesc;
   deviceDesc.label = "My Device";
@@ -473,7 +599,7 @@ bool Application::initDepthBuffer() {
   depthTextureDesc.usage = TextureUsage::RenderAttachment;
   depthTextureDesc.viewFormatCount = 1;
   depthTextureDesc.viewFormats = (WGPUTextureFormat *)&m_depthTextureFormat;
-  m_depthTexture = m_device.createTexture(depthTextureDesc);
+  m_depthTexture = GpuTracker::createTexture(m_device, depthTextureDesc);
   std::cout << "Depth texture: " << m_depthTexture << std::endl;
 
   // Create the view of the depth texture manipulated by the rasterizer
@@ -493,8 +619,7 @@ bool Application::initDepthBuffer() {
 
 void Application::terminateDepthBuffer() {
   m_depthTextureView.release();
-  m_depthTexture.destroy();
-  m_depthTexture.release();
+  GpuTracker::release(m_depthTexture);
 }
 
 bool Application::initRenderPipeline() {
@@ -506,7 +631,9 @@ bool Application::initRenderPipeline() {
   std::cout << "Creating render pipeline..." << std::endl;
   RenderPipelineDescriptor pipelineDesc;
 
-  // Vertex fetch
+  // Vertex fetch - the layout follows the precision the cloth writes its
+  // vertices in (see store_vertex() in compute.wgsl)
+  ClothObject::VertexPrecision precision = m_pipelineVertexPrecision;
   std::vector<VertexAttribute> vertexAttribs(2);
 
   // Position attribute
@@ -519,6 +646,16 @@ bool Application::initRenderPipeline() {
   vertexAttribs[1].format = VertexFormat::Float32x3;
   vertexAttribs[1].offset = offsetof(VertexAttributes, normal);
 
+  // f16 positions carry w = 1 in their fourth half, which the shader drops
+  if (precision != ClothObject::VertexPrecision::Full) {
+    vertexAttribs[0].format = VertexFormat::Float16x4;
+    vertexAttribs[1].offset = 2 * sizeof(uint32_t);
+    vertexAttribs[1].format =
+        precision == ClothObject::VertexPrecision::Half
+            ? VertexFormat::Float16x4
+            : VertexFormat::Snorm16x2;
+  }
+
   // Color attribute
   /*vertexAttribs[2].shaderLocation = 2;
   vertexAttribs[2].format = VertexFormat::Float32x3;
@@ -542,14 +679,25 @@ bool Application::initRenderPipeline() {
   VertexBufferLayout vertexBufferLayout;
   vertexBufferLayout.attributeCount = (uint32_t)vertexAttribs.size();
   vertexBufferLayout.attributes = vertexAttribs.data();
-  vertexBufferLayout.arrayStride = sizeof(VertexAttributes);
+  vertexBufferLayout.arrayStride = ClothObject::vertexStride(precision);
   vertexBufferLayout.stepMode = VertexStepMode::Vertex;
 
   pipelineDesc.vertex.bufferCount = 1;
   pipelineDesc.vertex.buffers = &vertexBufferLayout;
 
   pipelineDesc.vertex.module = m_shaderModule;
-  pipelineDesc.vertex.entryPoint = "vs_main";
+  pipelineDesc.vertex.entryPoint =
+      precision == ClothObject::VertexPrecision::OctNormal ? "vs_main_oct"
+                                                           : "vs_main";
+
+  // vertex pulling reads the particle buffer from group 1 instead
+  bool pulling =
+      m_pipelineRenderPath == ClothObject::RenderPath::VertexPulling;
+  if (pulling) {
+    pipelineDesc.vertex.bufferCount = 0;
+    pipelineDesc.vertex.buffers = nullptr;
+    pipelineDesc.vertex.entryPoint = "vs_pull";
+  }
   pipelineDesc.vertex.constantCount = 0;
   pipelineDesc.vertex.constants = nullptr;
 
@@ -596,20 +744,23 @@ bool Application::initRenderPipeline() {
 
   // Create the pipeline layout
   PipelineLayoutDescriptor layoutDesc{};
-  layoutDesc.bindGroupLayoutCount = 1;
-  layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout *)&m_bindGroupLayout;
-  PipelineLayout layout = m_device.createPipelineLayout(layoutDesc);
-  pipelineDesc.layout = layout;
-
-  m_pipeline = m_device.createRenderPipeline(pipelineDesc);
+  WGPUBindGroupLayout bindGroupLayouts[2] = {m_bindGroupLayout,
+                                             m_clothBindGroupLayout};
+  layoutDesc.bindGroupLayoutCount = pulling ? 2 : 1;
+  layoutDesc.bindGroupLayouts = bindGroupLayouts;
+  m_pipelineLayout = GpuTracker::createPipelineLayout(m_device, layoutDesc);
+  pipelineDesc.layout = m_pipelineLayout;
+
+  m_pipeline = GpuTracker::createRenderPipeline(m_device, pipelineDesc);
   std::cout << "Render pipeline: " << m_pipeline << std::endl;
 
   return m_pipeline != nullptr;
 }
 
 void Application::terminateRenderPipeline() {
-  m_pipeline.release();
-  m_shaderModule.release();
+  GpuTracker::release(m_pipeline);
+  GpuTracker::release(m_pipelineLayout);
+  GpuTracker::release(m_shaderModule);
 }
 
 bool Application::initTextures() {
@@ -653,21 +804,21 @@ bool Application::initTextures() {
 
 void Application::terminateTextures() {
   m_baseColorTextureView.release();
-  m_baseColorTexture.destroy();
-  m_baseColorTexture.release();
+  GpuTracker::release(m_baseColorTexture);
   m_normalTextureView.release();
-  m_normalTexture.destroy();
-  m_normalTexture.release();
+  GpuTracker::release(m_normalTexture);
   m_sampler.release();
 }
 
 bool Application::initUniforms() {
-  // Create uniform buffer
+  // Create one uniform buffer per frame in flight
   BufferDescriptor bufferDesc;
   bufferDesc.size = sizeof(MyUniforms);
   bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
   bufferDesc.mappedAtCreation = false;
-  m_uniformBuffer = m_device.createBuffer(bufferDesc);
+  for (Buffer &buffer : m_uniformBuffers) {
+    buffer = GpuTracker::createBuffer(m_device, bufferDesc);
+  }
 
   // Upload the initial value of the uniforms
   m_uniforms.modelMatrix = mat4x4(1.0);
@@ -677,17 +828,23 @@ bool Application::initUniforms() {
       glm::perspective(45 * PI / 180, 640.0f / 480.0f, 0.01f, 100.0f);
   m_uniforms.time = 1.0f;
   m_uniforms.color = {0.0f, 1.0f, 0.4f, 1.0f};
-  m_queue.writeBuffer(m_uniformBuffer, 0, &m_uniforms, sizeof(MyUniforms));
 
+  // the frame writes them to its own buffer
   updateProjectionMatrix();
   updateViewMatrix();
 
-  return m_uniformBuffer != nullptr;
+  for (const Buffer &buffer : m_uniformBuffers) {
+    if (buffer == nullptr) {
+      return false;
+    }
+  }
+  return true;
 }
 
 void Application::terminateUniforms() {
-  m_uniformBuffer.destroy();
-  m_uniformBuffer.release();
+  for (Buffer &buffer : m_uniformBuffers) {
+    GpuTracker::release(buffer);
+  }
 }
 
 bool Application::initLightingUniforms() {
@@ -696,7 +853,7 @@ bool Application::initLightingUniforms() {
   bufferDesc.size = sizeof(LightingUniforms);
   bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
   bufferDesc.mappedAtCreation = false;
-  m_lightingUniformBuffer = m_device.createBuffer(bufferDesc);
+  m_lightingUniformBuffer = GpuTracker::createBuffer(m_device, bufferDesc);
 
   // Initial values
   m_lightingUniforms.directions[0] = {0.5f, -0.9f, 0.1f, 0.0f};
@@ -710,8 +867,7 @@ bool Application::initLightingUniforms() {
 }
 
 void Application::terminateLightingUniforms() {
-  m_lightingUniformBuffer.destroy();
-  m_lightingUniformBuffer.release();
+  GpuTracker::release(m_lightingUniformBuffer);
 }
 
 void Application::updateLightingUniforms() {
@@ -722,18 +878,130 @@ void Application::updateLightingUniforms() {
   }
 }
 
+void Application::updateLodLevel() {
+  // radius in pixels of the cloth's bounding sphere, from the distance of its
+  // center to the camera and the vertical focal length of the projection
+  // a cloth on the simulation thread picks its levels itself from the radius,
+  // the renderer takes the render level it published
+  bool gpuThread = m_simThread.gpu();
+  vec3 center;
+  float radius;
+  if (gpuThread) {
+    const SimulationThread::View &view = m_simThread.latest().view;
+    center = view.center;
+    radius = view.radius;
+  } else {
+    m_cloth.renderBounds(center, radius);
+  }
+  vec4 viewCenter =
+      m_uniforms.viewMatrix * m_uniforms.modelMatrix * vec4(center, 1.0f);
+  float distance = std::max(-viewCenter.z, radius);
+  int width, height;
+  glfwGetFramebufferSize(m_window, &width, &height);
+  float projectedRadius = radius * m_uniforms.projectionMatrix[1][1] /
+                          distance * 0.5f * (float)height;
+  if (gpuThread) {
+    m_simThread.setProjectedRadius(projectedRadius);
+    m_lodLevel = m_simThread.latest().view.lodLevel;
+    return;
+  }
+  m_cloth.updateSimulationLod(projectedRadius);
+  m_lodLevel = m_cloth.parameters.renderPath ==
+                       ClothObject::RenderPath::VertexPulling
+                   ? m_cloth.lodLevel(projectedRadius)
+                   : 0;
+}
+
 void Application::updateClothParameters() {
-  // checks if parameters need to be updated from gui, and updates them if so,
-  // creating a new cloth
+  // checks if parameters need to be updated from gui, and updates them if so -
+  // the cloth decides whether that takes new uniforms, a resize or a rebuild
+  // - a new vertex layout reaches the render pipeline when the cloth is drawn
   if (m_clothParametersChanged) {
-    m_cloth.updateParameters(m_clothParams);
-    m_cloth.updateUniforms(m_device);
+    if (m_simThread.gpu()) {
+      // the thread owns the cloth and applies the change between two steps
+      m_threadParametersPending = true;
+    } else {
+      ClothObject::ReconfigureTier tier =
+          m_cloth.reconfigure(m_clothParams, m_device);
+      // a resize or rebuild allocates new particle buffers
+      if (tier == ClothObject::ReconfigureTier::Resize ||
+          tier == ClothObject::ReconfigureTier::Rebuild) {
+        m_culler.bind(m_cloth, m_device);
+      }
+      // the CPU backend only feeds the vertex buffer path
+      if (m_simThread.running()) {
+        if (m_cloth.parameters.renderPath ==
+            ClothObject::RenderPath::VertexBuffer) {
+          m_threadParametersPending = true;
+        } else {
+          stopSimulationThread();
+        }
+      }
+    }
     m_clothParametersChanged = false;
   }
-  if (m_clothReset) {
-    m_cloth.initiateNewCloth(m_clothParams, m_device);
-    m_clothReset = false;
+  if (m_threadParametersPending) {
+    m_threadParametersPending = !m_simThread.pushParameters(
+        m_simThread.gpu() ? m_clothParams : m_cloth.parameters);
+  }
+  // the gui shows the parameters as the cloth applied them once the thread
+  // got to the last change, the way an inline reconfigure updates them
+  if (m_simThread.gpu() && !m_threadParametersPending) {
+    const SimulationThread::View &view = m_simThread.latest().view;
+    if (view.revision == m_simThread.pushedRevision() &&
+        view.revision != m_followedRevision) {
+      m_clothParams = view.parameters;
+      m_followedRevision = view.revision;
+    }
+  }
+}
+
+void Application::stopSimulationThread() {
+  bool gpu = m_simThread.gpu();
+  m_simThread.stop();
+  // the thread may have replaced the particle buffers the culler reads
+  if (gpu) {
+    m_culler.bind(m_cloth, m_device);
+  }
+  m_cpuSimulation = false;
+  m_gpuSimulation = false;
+  m_threadParametersPending = false;
+}
+
+const SimulationThread::View &Application::clothView() const {
+  return m_simThread.gpu() ? m_simThread.latest().view : m_clothView;
+}
+
+void Application::updateRenderPipeline(const ClothObject::ClothParameters &p) {
+  // a tiled cloth falls back to the vertex buffer path, so the layout follows
+  // the parameters as the cloth applied them
+  if (p.vertexPrecision == m_pipelineVertexPrecision &&
+      p.renderPath == m_pipelineRenderPath) {
+    return;
+  }
+  m_pipelineVertexPrecision = p.vertexPrecision;
+  m_pipelineRenderPath = p.renderPath;
+  terminateRenderPipeline();
+  initRenderPipeline();
+}
+
+void Application::uploadSimulationFrame() {
+  // a step taken with another size or vertex precision than the cloth's
+  // (before a parameter change reached the thread) is skipped
+  if (!m_simThread.update()) {
+    return;
+  }
+  const SimulationThread::Frame &frame = m_simThread.latest();
+  if (frame.vertexCount != m_cloth.numVertices ||
+      frame.vertexPrecision != m_cloth.parameters.vertexPrecision) {
+    return;
+  }
+  if (m_cloth.tiled()) {
+    m_cloth.m_tiles.writeVertices(m_cloth, m_queue, frame.vertexWords.data());
+    return;
   }
+  m_queue.writeBuffer(m_cloth.m_vertexBuffer, 0, frame.vertexWords.data(),
+                      frame.vertexWords.size() * sizeof(uint32_t));
 }
 
 bool Application::initBindGroupLayout() {
@@ -781,12 +1049,34 @@ bool Application::initBindGroupLayout() {
   BindGroupLayoutDescriptor bindGroupLayoutDesc{};
   bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
   bindGroupLayoutDesc.entries = bindingLayoutEntries.data();
-  m_bindGroupLayout = m_device.createBindGroupLayout(bindGroupLayoutDesc);
+  m_bindGroupLayout =
+      GpuTracker::createBindGroupLayout(m_device, bindGroupLayoutDesc);
+
+  // group 1 of the vertex pulling path - cloth uniforms, the particles and
+  // their normals (the cloth creates the bind groups)
+  std::vector<BindGroupLayoutEntry> clothEntries(3, Default);
+  clothEntries[0].binding = 0;
+  clothEntries[0].visibility = ShaderStage::Vertex;
+  clothEntries[0].buffer.type = BufferBindingType::Uniform;
+  clothEntries[0].buffer.minBindingSize = sizeof(ClothObject::ClothUniforms);
+  for (uint32_t binding = 1; binding < 3; binding++) {
+    clothEntries[binding].binding = binding;
+    clothEntries[binding].visibility = ShaderStage::Vertex;
+    clothEntries[binding].buffer.type = BufferBindingType::ReadOnlyStorage;
+  }
+  BindGroupLayoutDescriptor clothLayoutDesc{};
+  clothLayoutDesc.entryCount = (uint32_t)clothEntries.size();
+  clothLayoutDesc.entries = clothEntries.data();
+  m_clothBindGroupLayout =
+      GpuTracker::createBindGroupLayout(m_device, clothLayoutDesc);
 
-  return m_bindGroupLayout != nullptr;
+  return m_bindGroupLayout != nullptr && m_clothBindGroupLayout != nullptr;
 }
 
-void Application::terminateBindGroupLayout() { m_bindGroupLayout.release(); }
+void Application::terminateBindGroupLayout() {
+  GpuTracker::release(m_bindGroupLayout);
+  GpuTracker::release(m_clothBindGroupLayout);
+}
 
 bool Application::initBindGroup() {
   // Create a binding
@@ -794,7 +1084,6 @@ bool Application::initBindGroup() {
   //                                   ^ This was a 4
 
   bindings[0].binding = 0;
-  bindings[0].buffer = m_uniformBuffer;
   bindings[0].offset = 0;
   bindings[0].size = sizeof(MyUniforms);
 
@@ -818,12 +1107,22 @@ bool Application::initBindGroup() {
   bindGroupDesc.layout = m_bindGroupLayout;
   bindGroupDesc.entryCount = (uint32_t)bindings.size();
   bindGroupDesc.entries = bindings.data();
-  m_bindGroup = m_device.createBindGroup(bindGroupDesc);
-
-  return m_bindGroup != nullptr;
+  // one bind group per frame in flight, they only differ in the uniforms
+  for (size_t i = 0; i < m_bindGroups.size(); i++) {
+    bindings[0].buffer = m_uniformBuffers[i];
+    m_bindGroups[i] = GpuTracker::createBindGroup(m_device, bindGroupDesc);
+    if (m_bindGroups[i] == nullptr) {
+      return false;
+    }
+  }
+  return true;
 }
 
-void Application::terminateBindGroup() { m_bindGroup.release(); }
+void Application::terminateBindGroup() {
+  for (BindGroup &bindGroup : m_bindGroups) {
+    GpuTracker::release(bindGroup);
+  }
+}
 
 void Application::updateProjectionMatrix() {
   // Update projection matrix
@@ -832,9 +1131,6 @@ void Application::updateProjectionMatrix() {
   float ratio = width / (float)height;
   m_uniforms.projectionMatrix =
       glm::perspective(45 * PI / 180, ratio, 0.01f, 100.0f);
-  m_queue.writeBuffer(m_uniformBuffer, offsetof(MyUniforms, projectionMatrix),
-                      &m_uniforms.projectionMatrix,
-                      sizeof(MyUniforms::projectionMatrix));
 }
 
 void Application::updateViewMatrix() {
@@ -844,12 +1140,7 @@ void Application::updateViewMatrix() {
   float sy = sin(m_cameraState.angles.y);
   vec3 position = vec3(cx * cy, sx * cy, sy) * std::exp(-m_cameraState.zoom);
   m_uniforms.viewMatrix = glm::lookAt(position, vec3(0.0f), vec3(0, 0, 1));
-  m_queue.writeBuffer(m_uniformBuffer, offsetof(MyUniforms, viewMatrix),
-                      &m_uniforms.viewMatrix, sizeof(MyUniforms::viewMatrix));
   m_uniforms.cameraWorldPosition = position;
-  m_queue.writeBuffer(
-      m_uniformBuffer, offsetof(MyUniforms, cameraWorldPosition),
-      &m_uniforms.cameraWorldPosition, sizeof(MyUniforms::cameraWorldPosition));
 }
 
 void Application::updateDragInertia() {
@@ -905,14 +1196,211 @@ void Application::updateGui(RenderPassEncoder renderPass) {
   // cloth ui
   {
     bool changed = false;
-    bool resetCloth = false;
+    // the cloth as the simulation thread last published it if it steps there
+    const SimulationThread::View &view = clothView();
     ImGui::Begin("cloth");
-    resetCloth =
-        ImGui::SliderInt("X Particle Count", &m_clothParams.width, 1, 600) ||
-        resetCloth;
-    resetCloth =
-        ImGui::SliderInt("Y Particle Count", &m_clothParams.height, 1, 600) ||
-        resetCloth;
+    changed =
+        ImGui::SliderInt("X Particle Count", &m_clothParams.width, 1,
+                         MAX_CLOTH_SIZE) ||
+        changed;
+    changed =
+        ImGui::SliderInt("Y Particle Count", &m_clothParams.height, 1,
+                         MAX_CLOTH_SIZE) ||
+        changed;
+
+    // switching solver mode rebuilds the cloth so that deterministic runs
+    // always start from frame 0
+    bool deterministic =
+        m_clothParams.solverMode == ClothObject::SolverMode::Deterministic;
+    if (ImGui::Checkbox("Deterministic", &deterministic)) {
+      m_clothParams.solverMode = deterministic
+                                     ? ClothObject::SolverMode::Deterministic
+                                     : ClothObject::SolverMode::Standard;
+      changed = true;
+    }
+    if (deterministic) {
+      ImGui::Text("frame %d, state hash %016llx", view.frame,
+                  (unsigned long long)view.stateHash);
+    }
+
+    // a grid or the triangles of a garment, switching rebuilds the cloth
+    const char *topologies[] = {"Grid", "Garment"};
+    int topology = (int)m_clothParams.topology;
+    if (ImGui::Combo("Topology", &topology, topologies,
+                     IM_ARRAYSIZE(topologies))) {
+      m_clothParams.topology = (ClothObject::Topology)topology;
+      changed = true;
+    }
+    if (view.parameters.topology == ClothObject::Topology::Mesh) {
+      ImGui::Text("%d particles, %d triangles, bandwidth %u",
+                  view.numParticles, view.numVertices / 3,
+                  view.topologyBandwidth);
+    }
+
+    // storage order of the grid particles, the result does not depend on it
+    bool tiled = m_clothParams.particleOrder == GridLayout::Order::MortonTiles;
+    if (m_clothParams.topology == ClothObject::Topology::Grid &&
+        ImGui::Checkbox("Morton tiles", &tiled)) {
+      m_clothParams.particleOrder =
+          tiled ? GridLayout::Order::MortonTiles : GridLayout::Order::RowMajor;
+      changed = true;
+    }
+
+    // rows per storage tile, 0 only tiles a grid too large for the device
+    if (m_clothParams.topology == ClothObject::Topology::Grid) {
+      changed = ImGui::SliderInt("Tile rows", &m_clothParams.tileRows, 0,
+                                 MAX_CLOTH_SIZE) ||
+                changed;
+      if (view.tileRows > 0) {
+        ImGui::Text("%d tiles of %d rows", (int)view.tiles.size(),
+                    view.tileRows);
+      }
+    }
+
+    // storage precision of the particle and vertex buffers, deterministic
+    // runs keep full precision particles
+    const char *particlePrecisions[] = {"Full", "Half velocity"};
+    int particlePrecision = (int)m_clothParams.particlePrecision;
+    if (ImGui::Combo("Particle precision", &particlePrecision,
+                     particlePrecisions, IM_ARRAYSIZE(particlePrecisions))) {
+      m_clothParams.particlePrecision =
+          (ClothObject::ParticlePrecision)particlePrecision;
+      changed = true;
+    }
+    const char *vertexPrecisions[] = {"Full", "Half", "Oct normals"};
+    int vertexPrecision = (int)m_clothParams.vertexPrecision;
+    if (ImGui::Combo("Vertex precision", &vertexPrecision, vertexPrecisions,
+                     IM_ARRAYSIZE(vertexPrecisions))) {
+      m_clothParams.vertexPrecision =
+          (ClothObject::VertexPrecision)vertexPrecision;
+      changed = true;
+    }
+
+    // draw straight from the particle buffer instead of the vertex buffer
+    bool pulling =
+        m_clothParams.renderPath == ClothObject::RenderPath::VertexPulling;
+    if (ImGui::Checkbox("Vertex pulling", &pulling)) {
+      m_clothParams.renderPath = pulling
+                                     ? ClothObject::RenderPath::VertexPulling
+                                     : ClothObject::RenderPath::VertexBuffer;
+      changed = true;
+    }
+    // coarser index buffers for a grid that is small on screen, the
+    // simulation keeps every particle
+    if (pulling && m_clothParams.topology == ClothObject::Topology::Grid) {
+      changed = ImGui::SliderFloat("LOD cell pixels",
+                                   &m_clothParams.lodCellPixels, 0.0f,
+                                   8.0f) ||
+                changed;
+      ImGui::Text("LOD level %d, %u triangles", m_lodLevel,
+                  view.lodIndexCount[m_lodLevel] / 3);
+    }
+
+    // skip the draw on the gpu while the cloth's bounding box is off screen
+    ImGui::Checkbox("Frustum culling", &m_frustumCulling);
+
+    // frames the cpu may run ahead of the gpu, more overlap but more lag
+    if (ImGui::SliderInt("Frames in flight", &m_framesInFlight, 1,
+                         FramePacer::MaxFramesInFlight)) {
+      m_pacer.setLatency(m_framesInFlight);
+    }
+    ImGui::Text("%d in flight, waited %.2f ms", m_pacer.framesInFlight(),
+                m_pacer.lastWaitMs());
+
+#ifndef __EMSCRIPTEN__
+    // the cpu backend on its own thread at a fixed rate, uploaded to the
+    // vertex buffer
+    if (m_clothParams.renderPath == ClothObject::RenderPath::VertexBuffer) {
+      if (ImGui::Checkbox("CPU simulation thread", &m_cpuSimulation)) {
+        bool start = m_cpuSimulation;
+        stopSimulationThread();
+        if (start) {
+          m_simThread.start(m_cloth.parameters, m_stepsPerSecond);
+          m_cpuSimulation = true;
+        }
+      }
+    }
+#ifdef WEBGPU_BACKEND_WGPU
+    // the gpu backend stepped and submitted on the thread, the renderer only
+    // draws what it published
+    if (ImGui::Checkbox("GPU simulation thread", &m_gpuSimulation)) {
+      bool start = m_gpuSimulation;
+      stopSimulationThread();
+      if (start) {
+        m_simThread.startGpu(m_cloth, m_device, m_stepsPerSecond);
+        m_simThread.update();
+        m_gpuSimulation = true;
+      }
+    }
+#endif
+    if (m_simThread.running()) {
+      if (ImGui::SliderInt("Steps per second", &m_stepsPerSecond, 10, 240)) {
+        m_simThread.setStepsPerSecond(m_stepsPerSecond);
+      }
+      const SimulationThread::Frame &frame = m_simThread.latest();
+      ImGui::Text("thread frame %d, step %.2f ms", frame.frame, frame.stepMs);
+    }
+#endif
+
+    // coarse simulation proxy while the grid is small on screen (not in
+    // deterministic runs)
+    if (m_clothParams.topology == ClothObject::Topology::Grid) {
+      changed = ImGui::SliderInt("Simulation LOD step",
+                                 &m_clothParams.simLodStep, 1, 8) ||
+                changed;
+      changed = ImGui::SliderFloat("Simulation LOD cell pixels",
+                                   &m_clothParams.simLodCellPixels, 0.0f,
+                                   8.0f) ||
+                changed;
+      ImGui::Text("%d of %d particles simulated", view.simulatedParticles,
+                  view.numParticles);
+    }
+
+    // statistics reduced on the gpu, they arrive a frame or two late
+    changed = ImGui::SliderInt("Stats interval",
+                               &m_clothParams.statsInterval, 0, 60) ||
+              changed;
+    if (m_clothParams.statsInterval > 0) {
+      const ClothStats::Stats &stats = view.stats;
+      ImGui::Text("frame %d: energy %.4g, max strain %.3f", view.statsFrame,
+                  stats.kineticEnergy, stats.maxStrain);
+      ImGui::Text("max speed %.3g, %u non-finite particles", stats.maxSpeed,
+                  stats.nonFinite);
+      ImGui::Text("max step error %.3g particle distances", stats.maxError);
+      ImGui::Text("center of mass %.3f %.3f %.3f", stats.centerOfMass.x,
+                  stats.centerOfMass.y, stats.centerOfMass.z);
+      ImGui::Text("bounds %.2f %.2f %.2f to %.2f %.2f %.2f",
+                  stats.boundsMin.x, stats.boundsMin.y, stats.boundsMin.z,
+                  stats.boundsMax.x, stats.boundsMax.y, stats.boundsMax.z);
+    }
+
+    // snapshots to roll a diverged cloth back to, checked with the stats
+    changed = ImGui::SliderInt("Snapshot interval",
+                               &m_clothParams.snapshotInterval, 0, 600) ||
+              changed;
+    if (view.rollbacks > 0) {
+      ImGui::Text("%d rollbacks, last divergence at frame %d", view.rollbacks,
+                  view.lastDivergedFrame);
+    }
+
+    // initial state generator, a new one restarts the cloth
+    const char *initialStates[] = {"Flat", "Draped", "Crumpled", "Mesh"};
+    int initialState = (int)m_clothParams.initialState;
+    if (ImGui::Combo("Initial state", &initialState, initialStates,
+                     IM_ARRAYSIZE(initialStates))) {
+      m_clothParams.initialState = (ClothObject::InitialState)initialState;
+      changed = true;
+    }
+    if (m_clothParams.initialState == ClothObject::InitialState::Crumpled) {
+      changed = ImGui::SliderFloat("Crumple amount",
+                                   &m_clothParams.crumpleAmount, 0.0f, 1.0f) ||
+                changed;
+      int seed = (int)m_clothParams.initSeed;
+      if (ImGui::InputInt("Crumple seed", &seed)) {
+        m_clothParams.initSeed = (uint32_t)seed;
+        changed = true;
+      }
+    }
 
     changed =
         ImGui::SliderFloat("Float scale", &m_clothParams.scale, 0.1f, 10.0f) ||
@@ -956,11 +1444,70 @@ void Application::updateGui(RenderPassEncoder renderPass) {
         ImGui::SliderFloat("deltaT", &m_clothParams.deltaT, 0.0015f, 0.02f) ||
         changed;
 
+    // deltaT follows the error estimate of the stats (not in deterministic
+    // runs)
+    changed = ImGui::Checkbox("Adaptive time step",
+                              &m_clothParams.adaptiveStep) ||
+              changed;
+    if (m_clothParams.adaptiveStep) {
+      changed = ImGui::SliderFloat("Min deltaT", &m_clothParams.minDeltaT,
+                                   0.0005f, 0.01f) ||
+                changed;
+      changed = ImGui::SliderFloat("Max deltaT", &m_clothParams.maxDeltaT,
+                                   0.005f, 0.05f) ||
+                changed;
+      changed = ImGui::SliderFloat("Step tolerance",
+                                   &m_clothParams.stepTolerance, 1e-5f, 1e-2f,
+                                   "%.5f", ImGuiSliderFlags_Logarithmic) ||
+                changed;
+      ImGui::Text("simulated time %.2f", view.simTime);
+    }
+
     ImGui::End();
     m_clothParametersChanged = changed;
-    m_clothReset = resetCloth;
   }
 
+  // live WebGPU objects and memory, a count that keeps growing is a leak
+  {
+    ImGui::Begin("GPU memory");
+    GpuTracker::Snapshot stats = GpuTracker::snapshot();
+    ImGui::Text("%-20s %6s %10s %8s", "", "live", "KiB", "created");
+    for (size_t i = 0; i < stats.categories.size(); i++) {
+      const GpuTracker::CategoryStats &category = stats.categories[i];
+      ImGui::Text("%-20s %6lld %10.1f %8llu",
+                  GpuTracker::categoryName((GpuTracker::Category)i),
+                  (long long)category.liveCount, category.liveBytes / 1024.0,
+                  (unsigned long long)category.created);
+    }
+    ImGui::Text("%-20s %6lld %10.1f", "Total", (long long)stats.liveCount(),
+                stats.liveBytes() / 1024.0);
+
+    // buffers handed out in power-of-two size classes, see BufferPool
+    BufferPool::Stats pool = BufferPool::stats();
+    ImGui::Separator();
+    ImGui::Text("Buffer pool: %.1f%% hits over %llu acquires",
+                pool.hitRate() * 100.0, (unsigned long long)pool.acquires);
+    ImGui::Text("%.1f KiB wasted in use, %.1f KiB idle in %u buffers",
+                pool.wastedBytes() / 1024.0, pool.idleBytes / 1024.0,
+                pool.idleBuffers);
+    ImGui::End();
+  }
+
+#ifdef CLOTH_PROFILING
+  // frame phase timings, viewable in chrome://tracing or ui.perfetto.dev
+  {
+    ImGui::Begin("Profiling");
+    static bool exported = false;
+    if (ImGui::Button("Export Chrome trace")) {
+      exported = PROFILE_EXPORT("cloth_trace.json");
+    }
+    if (exported) {
+      ImGui::Text("Wrote cloth_trace.json");
+    }
+    ImGui::End();
+  }
+#endif
+
   {
     bool changed = false;
     ImGui::Begin("Lighting");
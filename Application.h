@@ -1,6 +1,9 @@
 #pragma once
 
+#include "ClothCuller.h"
 #include "ClothObject.h"
+#include "FramePacer.h"
+#include "SimulationThread.h"
 #include <glm/glm.hpp>
 #include <webgpu/webgpu.hpp>
 
@@ -65,6 +68,18 @@ private:
   void updateProjectionMatrix();
   void updateViewMatrix();
   void updateDragInertia();
+  // render and simulation levels of detail of the cloth from its projected
+  // size
+  void updateLodLevel();
+  // uploads the latest step of the simulation thread to the vertex buffer
+  void uploadSimulationFrame();
+  // joins the simulation thread, and takes the cloth back from it
+  void stopSimulationThread();
+  // what to draw and show of the cloth - published by the simulation thread
+  // while it steps the GPU backend, captured from m_cloth otherwise
+  const SimulationThread::View &clothView() const;
+  // rebuilds the render pipeline if the vertex layout of p differs
+  void updateRenderPipeline(const ClothObject::ClothParameters &p);
 
   bool initGui();                                     // called in onInit
   void terminateGui();                                // called in onFinish
@@ -152,7 +167,13 @@ private:
 
   // Render Pipeline
   wgpu::ShaderModule m_shaderModule = nullptr;
+  wgpu::PipelineLayout m_pipelineLayout = nullptr;
   wgpu::RenderPipeline m_pipeline = nullptr;
+  // vertex layout of m_pipeline
+  ClothObject::VertexPrecision m_pipelineVertexPrecision =
+      ClothObject::VertexPrecision::Full;
+  ClothObject::RenderPath m_pipelineRenderPath =
+      ClothObject::RenderPath::VertexBuffer;
 
   // Texture
   wgpu::Sampler m_sampler = nullptr;
@@ -163,24 +184,45 @@ private:
 
   // Geometry
   int m_vertexCount = 0;
+  int m_lodLevel = 0;
 
-  // Uniforms
-  wgpu::Buffer m_uniformBuffer = nullptr;
+  // Uniforms - one buffer per frame in flight, written whole every frame
+  std::array<wgpu::Buffer, FramePacer::MaxFramesInFlight> m_uniformBuffers = {};
   MyUniforms m_uniforms;
   wgpu::Buffer m_lightingUniformBuffer = nullptr;
   LightingUniforms m_lightingUniforms;
   bool m_lightingUniformsChanged = true;
-  bool m_clothParametersChanged = true;
-  bool m_clothReset = true;
+  bool m_clothParametersChanged = false;
 
   // Bind Group Layout
   wgpu::BindGroupLayout m_bindGroupLayout = nullptr;
-
-  // Bind Group
-  wgpu::BindGroup m_bindGroup = nullptr;
+  // cloth particles for the vertex pulling path (group 1)
+  wgpu::BindGroupLayout m_clothBindGroupLayout = nullptr;
+
+  // Bind Group - one per uniform buffer
+  std::array<wgpu::BindGroup, FramePacer::MaxFramesInFlight> m_bindGroups = {};
+
+  // bounds how far the cpu runs ahead of the gpu
+  FramePacer m_pacer;
+  int m_framesInFlight = 2;
+
+  // the CPU backend stepping on its own thread instead of m_cloth, or m_cloth
+  // stepping on it
+  SimulationThread m_simThread;
+  bool m_cpuSimulation = false;
+  bool m_gpuSimulation = false;
+  int m_stepsPerSecond = 60;
+  // parameters the thread's queue had no room for, pushed again next frame
+  bool m_threadParametersPending = false;
+  // last change of the GPU thread that m_clothParams follows
+  uint64_t m_followedRevision = 0;
+  SimulationThread::View m_clothView;
 
   // cloth objects managed here
   ClothObject m_cloth;
+  // draw arguments of m_cloth, written by the gpu
+  ClothCuller m_culler;
+  bool m_frustumCulling = true;
   // this structure is adjusted in the live gui
   ClothParameters m_clothParams;
 
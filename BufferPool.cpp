@@ -0,0 +1,126 @@
+#include "BufferPool.h"
+#include "GpuTracker.h"
+
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+using namespace wgpu;
+using Stats = BufferPool::Stats;
+
+namespace {
+// buffers are only interchangeable on the same device with the same usage
+using PoolKey = std::tuple<const void *, WGPUBufferUsageFlags, uint64_t>;
+
+struct InUseBuffer {
+  PoolKey key;
+  uint64_t requested;
+};
+
+std::mutex s_mutex;
+std::map<PoolKey, std::vector<Buffer>> s_idle;
+std::unordered_map<const void *, InUseBuffer> s_inUse;
+Stats s_stats;
+} // namespace
+
+uint64_t BufferPool::sizeClass(uint64_t size, uint64_t maxBufferSize) {
+  uint64_t sizeClass = MinSizeClass;
+  while (sizeClass < size) {
+    sizeClass *= 2;
+  }
+  // the largest class would not fit on the device, fall back to its limit
+  if (sizeClass > maxBufferSize && size <= maxBufferSize) {
+    sizeClass = maxBufferSize;
+  }
+  return sizeClass;
+}
+
+Buffer BufferPool::acquire(Device &device, uint64_t size,
+                           WGPUBufferUsageFlags usage) {
+  SupportedLimits limits;
+  device.getLimits(&limits);
+  PoolKey key{(WGPUDevice)device, usage,
+              sizeClass(size, limits.limits.maxBufferSize)};
+
+  Buffer buffer = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    s_stats.acquires++;
+    auto it = s_idle.find(key);
+    if (it != s_idle.end() && !it->second.empty()) {
+      buffer = it->second.back();
+      it->second.pop_back();
+      s_stats.hits++;
+      s_stats.idleBytes -= std::get<2>(key);
+      s_stats.idleBuffers--;
+    }
+  }
+
+  if (!buffer) {
+    BufferDescriptor bufferDesc;
+    bufferDesc.size = std::get<2>(key);
+    bufferDesc.usage = usage;
+    bufferDesc.mappedAtCreation = false;
+    buffer = GpuTracker::createBuffer(device, bufferDesc);
+    if (!buffer) {
+      return nullptr;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(s_mutex);
+  s_inUse[(WGPUBuffer)buffer] = {key, size};
+  s_stats.inUseBytes += std::get<2>(key);
+  s_stats.requestedBytes += size;
+  return buffer;
+}
+
+void BufferPool::recycle(Buffer &buffer) {
+  if (!buffer) {
+    return;
+  }
+
+  bool keep = false;
+  {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    auto it = s_inUse.find((WGPUBuffer)buffer);
+    if (it != s_inUse.end()) {
+      const PoolKey &key = it->second.key;
+      s_stats.inUseBytes -= std::get<2>(key);
+      s_stats.requestedBytes -= it->second.requested;
+
+      std::vector<Buffer> &idle = s_idle[key];
+      if (idle.size() < MaxIdlePerClass) {
+        idle.push_back(buffer);
+        s_stats.idleBytes += std::get<2>(key);
+        s_stats.idleBuffers++;
+        keep = true;
+      }
+      s_inUse.erase(it);
+    }
+  }
+
+  // buffers the pool did not hand out, or that do not fit, are freed
+  if (!keep) {
+    GpuTracker::release(buffer);
+  }
+  buffer = nullptr;
+}
+
+void BufferPool::releaseIdle() {
+  std::lock_guard<std::mutex> lock(s_mutex);
+  for (auto &entry : s_idle) {
+    for (Buffer &buffer : entry.second) {
+      GpuTracker::release(buffer);
+    }
+  }
+  s_idle.clear();
+  s_stats.idleBytes = 0;
+  s_stats.idleBuffers = 0;
+}
+
+Stats BufferPool::stats() {
+  std::lock_guard<std::mutex> lock(s_mutex);
+  return s_stats;
+}
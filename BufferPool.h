@@ -0,0 +1,51 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <cstdint>
+
+// Pool of GPU buffers in power-of-two size classes. acquire hands out a
+// buffer of at least the requested size with exactly the requested usage,
+// reusing an idle one of the same class when there is one, and recycle
+// returns it to the pool instead of destroying it. Resizing a cloth back and
+// forth or creating many cloths in a row then stops reallocating.
+//
+// Buffers are created and released through GpuTracker, so idle pooled
+// buffers still count as live there until releaseIdle is called.
+class BufferPool {
+public:
+  struct Stats {
+    uint64_t acquires = 0;
+    uint64_t hits = 0;
+    // bytes handed out (whole size classes) and bytes actually requested
+    uint64_t inUseBytes = 0;
+    uint64_t requestedBytes = 0;
+    // bytes of buffers waiting in the pool
+    uint64_t idleBytes = 0;
+    uint32_t idleBuffers = 0;
+
+    double hitRate() const {
+      return acquires > 0 ? (double)hits / (double)acquires : 0.0;
+    }
+    // rounding loss of the buffers in use
+    uint64_t wastedBytes() const { return inUseBytes - requestedBytes; }
+  };
+
+  // idle buffers kept per device, usage and size class, extra ones are freed
+  static constexpr uint32_t MaxIdlePerClass = 4;
+  // smallest size class
+  static constexpr uint64_t MinSizeClass = 256;
+
+  static wgpu::Buffer acquire(wgpu::Device &device, uint64_t size,
+                              WGPUBufferUsageFlags usage);
+  // returns the buffer to the pool and resets the handle, null is ignored
+  static void recycle(wgpu::Buffer &buffer);
+  // frees every idle buffer - must be called before the device is released
+  static void releaseIdle();
+
+  // power-of-two size class of a request, clamped to the largest buffer the
+  // device accepts
+  static uint64_t sizeClass(uint64_t size, uint64_t maxBufferSize);
+
+  static Stats stats();
+};
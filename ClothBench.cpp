@@ -0,0 +1,859 @@
+// cloth_bench - throughput of the cloth simulation step.
+//
+// Every combination of cloth size (32x32 to 1024x1024), solver mode, particle
+// layout and backend is run until it reaches a minimum wall time, and the
+// steps per second, nanoseconds per particle per step and heap bytes allocated
+// per step are reported, as a table or as JSON (in the spirit of Google
+// Benchmark's --benchmark_format=json). On Linux the CPU backend also reports
+// its last level cache miss rate, read through perf_event_open.
+//
+// --precision picks the storage precisions to run: full, half (f16
+// velocities and vertices) or oct (f16 velocities and positions, octahedral
+// normals). --accuracy N instead runs the CPU backend for N frames at every
+// precision and prints the bytes each one moves per step against its error
+// relative to full precision. --render pull runs the GPU backends with the
+// vertex pulling render path, whose second pass writes one normal per particle
+// instead of the triangle soup (the CPU backend always builds the soup).
+// --sim-lod K steps the GPU backends on the coarse simulation proxy of every
+// K-th particle (see ClothProxy), the full grid is still interpolated from it
+// every step. --tile-rows N stores the grids of the GPU backends in tiles of
+// N rows (see ClothTiles), grids too large for single bindings are always
+// tiled.
+// --stats N runs the GPU statistics reduction every N steps (see
+// ClothStats, off by default) and logs the last result of every GPU run.
+// --batch N also steps N CPU cloths of the benchmarked sizes together (see
+// ClothCPU::processFrames). CPU runs report the utilization of every thread
+// of the work-stealing pool (see TaskScheduler). --numa N also runs the CPU
+// backend with every grid split in row bands across 1 to N NUMA nodes (see
+// NumaPool) and reports the scaling over a single node. --strips N runs it in
+// 1 to N worker processes, each stepping a strip of rows and exchanging halos
+// with its neighbours (see ClothDomain), and checks the gathered state
+// against a single process.
+//
+//   cloth_bench [--backend cpu|gpu|software|all] [--mode standard|
+//                deterministic|all] [--layout row|tiled|all] [--precision
+//                full|half|oct|all] [--render vertex|pull] [--sim-lod K]
+//                [--tile-rows N] [--stats N] [--batch N] [--numa N]
+//                [--strips N] [--min-size N] [--max-size N] [--min-time
+//                seconds] [--json file] [--accuracy frames]
+
+#include "BufferPool.h"
+#include "ClothCPU.h"
+#include "ClothDomain.h"
+#include "ClothObject.h"
+#include "HeadlessDevice.h"
+#include "NumaPool.h"
+#include "TaskScheduler.h"
+
+#include <webgpu/webgpu.hpp>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace wgpu;
+using ClothParameters = ClothObject::ClothParameters;
+using SolverMode = ClothObject::SolverMode;
+using LayoutOrder = GridLayout::Order;
+using ParticlePrecision = ClothObject::ParticlePrecision;
+using VertexPrecision = ClothObject::VertexPrecision;
+using RenderPath = ClothObject::RenderPath;
+using Clock = std::chrono::steady_clock;
+
+// heap accounting - every allocation made by the process goes through here
+static std::atomic<uint64_t> s_allocatedBytes{0};
+
+void *operator new(size_t size) {
+  s_allocatedBytes += size;
+  if (void *ptr = std::malloc(size ? size : 1)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { std::free(ptr); }
+
+// storage precisions of one run
+struct Precision {
+  const char *name;
+  ParticlePrecision particles;
+  VertexPrecision vertices;
+};
+
+static const Precision PRECISIONS[] = {
+    {"full", ParticlePrecision::Full, VertexPrecision::Full},
+    {"half", ParticlePrecision::HalfVelocity, VertexPrecision::Half},
+    {"oct", ParticlePrecision::HalfVelocity, VertexPrecision::OctNormal},
+};
+
+struct BenchOptions {
+  std::vector<std::string> backends = {"cpu", "gpu"};
+  std::vector<SolverMode> modes = {SolverMode::Standard,
+                                   SolverMode::Deterministic};
+  std::vector<LayoutOrder> layouts = {LayoutOrder::RowMajor};
+  std::vector<Precision> precisions = {PRECISIONS[0]};
+  RenderPath renderPath = RenderPath::VertexBuffer;
+  int simLodStep = 1;
+  // rows per tile of the GPU runs, 0 only tiles what the device needs
+  int tileRows = 0;
+  int statsInterval = 0;
+  // cloths of the CPU batch run, 0 skips it
+  int batchCloths = 0;
+  // NUMA nodes the scaling run goes up to, 0 skips it
+  int numaNodes = 0;
+  // worker processes the strip run goes up to, 0 skips it
+  int strips = 0;
+  // frames of the accuracy table, 0 runs the throughput benchmark
+  int accuracyFrames = 0;
+  int minSize = 32;
+  int maxSize = 1024;
+  double minTime = 0.5;
+  int minSteps = 3;
+  std::string jsonPath;
+};
+
+struct BenchResult {
+  std::string name;
+  std::string backend;
+  std::string mode;
+  std::string layout;
+  std::string precision;
+  std::string render;
+  int simLodStep = 1;
+  // tiles of a GPU run's grid, 0 if it was not tiled
+  int tiles = 0;
+  // the largest cloth of a batch
+  int size = 0;
+  int cloths = 1;
+  // particles of all cloths of the run
+  int64_t particles = 0;
+  int steps = 0;
+  double seconds = 0.0;
+  uint64_t allocatedBytes = 0;
+  // last level cache events, only measured for the CPU backend
+  bool cacheCounted = false;
+  uint64_t cacheReferences = 0;
+  uint64_t cacheMisses = 0;
+  // last statistics of a GPU run, statsFrame is 0 without any
+  int statsFrame = 0;
+  ClothStats::Stats stats = {};
+  // threads of the CPU backend's pool, empty for the GPU backends
+  std::vector<TaskScheduler::WorkerStats> workers;
+  // nodes of a NUMA scaling run and its steps per second over one node
+  int numaNodes = 0;
+  double numaScaling = 0.0;
+  // worker processes of a strip run, and whether their state matched a
+  // single process
+  int strips = 0;
+  bool stripsMatch = false;
+
+  double stepsPerSecond() const { return steps / seconds; }
+  double nsPerParticleStep() const {
+    return seconds * 1e9 / ((double)steps * particles);
+  }
+  double bytesPerStep() const { return (double)allocatedBytes / steps; }
+  double cacheMissRate() const {
+    return cacheReferences ? (double)cacheMisses / cacheReferences : 0.0;
+  }
+};
+
+static const char *modeName(SolverMode mode) {
+  return mode == SolverMode::Deterministic ? "deterministic" : "standard";
+}
+
+static const char *layoutName(LayoutOrder layout) {
+  return layout == LayoutOrder::MortonTiles ? "tiled" : "row";
+}
+
+static const char *renderName(RenderPath path) {
+  return path == RenderPath::VertexPulling ? "pull" : "vertex";
+}
+
+// hardware cache counters of this process (and the threads it starts while
+// counting) - perf exposes no portable L2 event, the generic cache events
+// count the last level cache instead
+class CacheCounters {
+public:
+  CacheCounters() {
+#ifdef __linux__
+    m_references = openCounter(PERF_COUNT_HW_CACHE_REFERENCES);
+    m_misses = openCounter(PERF_COUNT_HW_CACHE_MISSES);
+#endif
+  }
+  ~CacheCounters() {
+#ifdef __linux__
+    if (m_references >= 0) {
+      close(m_references);
+    }
+    if (m_misses >= 0) {
+      close(m_misses);
+    }
+#endif
+  }
+
+  // false without perf support or permission (see perf_event_paranoid)
+  bool available() const { return m_references >= 0 && m_misses >= 0; }
+
+  void start() {
+#ifdef __linux__
+    if (available()) {
+      ioctl(m_references, PERF_EVENT_IOC_RESET, 0);
+      ioctl(m_misses, PERF_EVENT_IOC_RESET, 0);
+      ioctl(m_references, PERF_EVENT_IOC_ENABLE, 0);
+      ioctl(m_misses, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+  }
+
+  bool stop(uint64_t &references, uint64_t &misses) {
+#ifdef __linux__
+    if (available()) {
+      ioctl(m_references, PERF_EVENT_IOC_DISABLE, 0);
+      ioctl(m_misses, PERF_EVENT_IOC_DISABLE, 0);
+      return read(m_references, &references, sizeof(references)) ==
+                 sizeof(references) &&
+             read(m_misses, &misses, sizeof(misses)) == sizeof(misses);
+    }
+#endif
+    return false;
+  }
+
+private:
+#ifdef __linux__
+  static int openCounter(uint64_t config) {
+    perf_event_attr attr = {};
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+#endif
+
+  int m_references = -1;
+  int m_misses = -1;
+};
+
+static bool parseArguments(int argc, char **argv, BenchOptions &options) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (i + 1 >= argc) {
+      std::cerr << "Missing value for " << arg << std::endl;
+      return false;
+    }
+    std::string value = argv[++i];
+    if (arg == "--backend") {
+      options.backends = value == "all"
+                             ? std::vector<std::string>{"cpu", "software",
+                                                        "gpu"}
+                             : std::vector<std::string>{value};
+    } else if (arg == "--mode") {
+      options.modes.clear();
+      if (value == "standard" || value == "all") {
+        options.modes.push_back(SolverMode::Standard);
+      }
+      if (value == "deterministic" || value == "all") {
+        options.modes.push_back(SolverMode::Deterministic);
+      }
+    } else if (arg == "--layout") {
+      options.layouts.clear();
+      if (value == "row" || value == "all") {
+        options.layouts.push_back(LayoutOrder::RowMajor);
+      }
+      if (value == "tiled" || value == "all") {
+        options.layouts.push_back(LayoutOrder::MortonTiles);
+      }
+    } else if (arg == "--precision") {
+      options.precisions.clear();
+      for (const Precision &precision : PRECISIONS) {
+        if (value == precision.name || value == "all") {
+          options.precisions.push_back(precision);
+        }
+      }
+    } else if (arg == "--render") {
+      options.renderPath = value == "pull" ? RenderPath::VertexPulling
+                                           : RenderPath::VertexBuffer;
+    } else if (arg == "--sim-lod") {
+      options.simLodStep = std::stoi(value);
+    } else if (arg == "--tile-rows") {
+      options.tileRows = std::stoi(value);
+    } else if (arg == "--stats") {
+      options.statsInterval = std::stoi(value);
+    } else if (arg == "--batch") {
+      options.batchCloths = std::stoi(value);
+    } else if (arg == "--numa") {
+      options.numaNodes = std::stoi(value);
+    } else if (arg == "--strips") {
+      options.strips = std::stoi(value);
+    } else if (arg == "--accuracy") {
+      options.accuracyFrames = std::stoi(value);
+    } else if (arg == "--min-size") {
+      options.minSize = std::stoi(value);
+    } else if (arg == "--max-size") {
+      options.maxSize = std::stoi(value);
+    } else if (arg == "--min-time") {
+      options.minTime = std::stod(value);
+    } else if (arg == "--json") {
+      options.jsonPath = value;
+    } else {
+      std::cerr << "Unknown argument " << arg << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+static ClothParameters benchParameters(int size, SolverMode mode,
+                                       LayoutOrder layout,
+                                       const Precision &precision) {
+  ClothParameters parameters;
+  parameters.width = size;
+  parameters.height = size;
+  parameters.solverMode = mode;
+  parameters.particleOrder = layout;
+  parameters.particlePrecision = precision.particles;
+  parameters.vertexPrecision = precision.vertices;
+  return parameters;
+}
+
+static BenchResult runCpu(const BenchOptions &options,
+                          CacheCounters &counters, int size, SolverMode mode,
+                          LayoutOrder layout, const Precision &precision,
+                          int numaNodes = 0) {
+  BenchResult result;
+  ClothCPU cloth;
+  cloth.numaNodes = numaNodes;
+  cloth.initiateNewCloth(benchParameters(size, mode, layout, precision));
+  // warm up caches and let the vectors reach their final capacity
+  cloth.processFrame();
+
+  uint64_t allocatedBefore = s_allocatedBytes;
+  counters.start();
+  TaskScheduler::instance().takeStats();
+  Clock::time_point start = Clock::now();
+  do {
+    cloth.processFrame();
+    result.steps++;
+    result.seconds =
+        std::chrono::duration<double>(Clock::now() - start).count();
+  } while (result.seconds < options.minTime ||
+           result.steps < options.minSteps);
+  result.cacheCounted =
+      counters.stop(result.cacheReferences, result.cacheMisses);
+  result.allocatedBytes = s_allocatedBytes - allocatedBefore;
+  result.workers = TaskScheduler::instance().takeStats();
+  // the NUMA threads replace the pool, which sat idle
+  if (numaNodes > 0) {
+    result.workers.clear();
+    result.numaNodes = numaNodes;
+  }
+  return result;
+}
+
+static BenchResult runCpuBatch(const BenchOptions &options, SolverMode mode) {
+  // cloths of every benchmarked size in turn, so the tasks of one batch
+  // differ in cost by orders of magnitude
+  BenchResult result;
+  std::vector<ClothCPU> cloths(options.batchCloths);
+  std::vector<ClothCPU *> batch;
+  int size = options.minSize;
+  for (ClothCPU &cloth : cloths) {
+    cloth.initiateNewCloth(benchParameters(size, mode, LayoutOrder::RowMajor,
+                                           PRECISIONS[0]));
+    result.particles += cloth.numParticles;
+    batch.push_back(&cloth);
+    size = size * 2 > options.maxSize ? options.minSize : size * 2;
+  }
+  ClothCPU::processFrames(batch);
+
+  uint64_t allocatedBefore = s_allocatedBytes;
+  TaskScheduler::instance().takeStats();
+  Clock::time_point start = Clock::now();
+  do {
+    ClothCPU::processFrames(batch);
+    result.steps++;
+    result.seconds =
+        std::chrono::duration<double>(Clock::now() - start).count();
+  } while (result.seconds < options.minTime ||
+           result.steps < options.minSteps);
+  result.allocatedBytes = s_allocatedBytes - allocatedBefore;
+  result.workers = TaskScheduler::instance().takeStats();
+  return result;
+}
+
+static BenchResult runCpuStrips(const BenchOptions &options, int size,
+                                int strips) {
+  BenchResult result;
+  ClothParameters parameters = benchParameters(
+      size, SolverMode::Standard, LayoutOrder::RowMajor, PRECISIONS[0]);
+  ClothDomain domain;
+  if (!domain.start(parameters, strips)) {
+    return result;
+  }
+  domain.step(1);
+
+  uint64_t allocatedBefore = s_allocatedBytes;
+  Clock::time_point start = Clock::now();
+  do {
+    domain.step(1);
+    result.steps++;
+    result.seconds =
+        std::chrono::duration<double>(Clock::now() - start).count();
+  } while (result.seconds < options.minTime ||
+           result.steps < options.minSteps);
+  result.allocatedBytes = s_allocatedBytes - allocatedBefore;
+  result.strips = domain.stripCount();
+
+  // the strips together must hold what one process stepping the whole grid
+  // does, bit for bit
+  std::vector<ClothObject::ClothParticle> gathered = domain.gather();
+  domain.stop();
+  ClothCPU reference;
+  reference.initiateNewCloth(parameters);
+  while (reference.frame < domain.frame()) {
+    reference.processFrame();
+  }
+  std::vector<ClothObject::ClothParticle> expected =
+      reference.currentParticles();
+  result.stripsMatch =
+      gathered.size() == expected.size() &&
+      ClothObject::hashParticles(gathered.data(), gathered.size()) ==
+          ClothObject::hashParticles(expected.data(), expected.size());
+  return result;
+}
+
+static BenchResult runGpu(const BenchOptions &options, Device device,
+                          int size, SolverMode mode, LayoutOrder layout,
+                          const Precision &precision) {
+  BenchResult result;
+  ClothObject cloth;
+  ClothParameters parameters =
+      benchParameters(size, mode, layout, precision);
+  parameters.renderPath = options.renderPath;
+  parameters.simLodStep = options.simLodStep;
+  parameters.tileRows = options.tileRows;
+  parameters.statsInterval = options.statsInterval;
+  cloth.initiateNewCloth(parameters, device);
+  result.tiles = (int)cloth.m_tiles.tiles().size();
+  // a cloth of no size on screen always runs on its proxy
+  cloth.updateSimulationLod(0.0f);
+  cloth.processFrame(device);
+  ClothObject::waitIdle(device);
+
+  // steps are submitted in batches so the queue stays busy, the clock only
+  // stops once the GPU has finished them
+  const int batch = 8;
+  uint64_t allocatedBefore = s_allocatedBytes;
+  Clock::time_point start = Clock::now();
+  do {
+    for (int i = 0; i < batch; i++) {
+      cloth.processFrame(device);
+    }
+    ClothObject::waitIdle(device);
+    result.steps += batch;
+    result.seconds =
+        std::chrono::duration<double>(Clock::now() - start).count();
+  } while (result.seconds < options.minTime ||
+           result.steps < options.minSteps);
+  result.allocatedBytes = s_allocatedBytes - allocatedBefore;
+
+  // the queue is idle, so the last mapping has been delivered
+  cloth.m_stats.poll();
+  result.statsFrame = cloth.m_stats.latestFrame();
+  result.stats = cloth.m_stats.latest();
+
+  cloth.terminateAll();
+  return result;
+}
+
+static void writeJson(std::ostream &out,
+                      const std::vector<BenchResult> &results,
+                      const std::string &adapterName) {
+  out << "{\n  \"context\": {\n"
+      << "    \"executable\": \"cloth_bench\",\n"
+      << "    \"adapter\": \"" << adapterName << "\"\n  },\n"
+      << "  \"benchmarks\": [\n";
+  for (size_t i = 0; i < results.size(); i++) {
+    const BenchResult &r = results[i];
+    out << "    {\n"
+        << "      \"name\": \"" << r.name << "\",\n"
+        << "      \"backend\": \"" << r.backend << "\",\n"
+        << "      \"solver_mode\": \"" << r.mode << "\",\n"
+        << "      \"layout\": \"" << r.layout << "\",\n"
+        << "      \"precision\": \"" << r.precision << "\",\n"
+        << "      \"render\": \"" << r.render << "\",\n"
+        << "      \"sim_lod_step\": " << r.simLodStep << ",\n"
+        << "      \"tiles\": " << r.tiles << ",\n"
+        << "      \"width\": " << r.size << ",\n"
+        << "      \"height\": " << r.size << ",\n"
+        << "      \"cloths\": " << r.cloths << ",\n"
+        << "      \"iterations\": " << r.steps << ",\n"
+        << "      \"real_time\": " << r.seconds * 1e9 / r.steps << ",\n"
+        << "      \"time_unit\": \"ns\",\n"
+        << "      \"steps_per_second\": " << r.stepsPerSecond() << ",\n"
+        << "      \"ns_per_particle_step\": " << r.nsPerParticleStep()
+        << ",\n"
+        << "      \"bytes_per_step\": " << r.bytesPerStep();
+    if (r.cacheCounted) {
+      out << ",\n      \"cache_references\": " << r.cacheReferences
+          << ",\n      \"cache_misses\": " << r.cacheMisses;
+    }
+    if (!r.workers.empty()) {
+      out << ",\n      \"worker_utilization\": [";
+      for (size_t w = 0; w < r.workers.size(); w++) {
+        out << (w > 0 ? ", " : "") << r.workers[w].utilization();
+      }
+      out << "]";
+    }
+    if (r.numaNodes > 0) {
+      out << ",\n      \"numa_nodes\": " << r.numaNodes
+          << ",\n      \"numa_scaling\": " << r.numaScaling;
+    }
+    if (r.strips > 0) {
+      out << ",\n      \"strips\": " << r.strips
+          << ",\n      \"strips_match\": "
+          << (r.stripsMatch ? "true" : "false");
+    }
+    if (r.statsFrame > 0) {
+      out << ",\n      \"stats_frame\": " << r.statsFrame
+          << ",\n      \"kinetic_energy\": " << r.stats.kineticEnergy
+          << ",\n      \"max_strain\": " << r.stats.maxStrain
+          << ",\n      \"max_speed\": " << r.stats.maxSpeed
+          << ",\n      \"non_finite\": " << r.stats.nonFinite;
+    }
+    out << "\n"
+        << "    }" << (i + 1 < results.size() ? "," : "") << "\n";
+  }
+  out << "  ]\n}\n";
+}
+
+static void printResult(const BenchResult &result) {
+  std::ostringstream missRate;
+  if (result.cacheCounted) {
+    missRate << std::fixed << std::setprecision(1)
+             << result.cacheMissRate() * 100.0 << "%";
+  } else {
+    missRate << "n/a";
+  }
+  std::cout << std::left << std::setw(56) << result.name << std::right
+            << std::fixed << std::setprecision(1) << std::setw(12)
+            << result.stepsPerSecond() << std::setprecision(2)
+            << std::setw(14) << result.nsPerParticleStep()
+            << std::setprecision(0) << std::setw(14) << result.bytesPerStep()
+            << std::setw(14) << missRate.str() << std::defaultfloat
+            << std::endl;
+  // a pool of one thread runs everything inline
+  if (result.workers.size() > 1) {
+    uint64_t steals = 0;
+    std::cout << "  utilization";
+    for (const TaskScheduler::WorkerStats &worker : result.workers) {
+      std::cout << " " << std::fixed << std::setprecision(0)
+                << worker.utilization() * 100.0 << "%";
+      steals += worker.steals;
+    }
+    std::cout << std::defaultfloat << ", " << steals << " steals"
+              << std::endl;
+  }
+  if (result.numaNodes > 0) {
+    std::cout << "  " << result.numaNodes << " NUMA node"
+              << (result.numaNodes > 1 ? "s" : "") << ", " << std::fixed
+              << std::setprecision(2) << result.numaScaling
+              << "x the steps of one node" << std::defaultfloat << std::endl;
+  }
+  if (result.strips > 0) {
+    std::cout << "  " << result.strips << " strip process"
+              << (result.strips > 1 ? "es" : "") << ", "
+              << (result.stripsMatch ? "matches" : "DIFFERS FROM")
+              << " a single process" << std::endl;
+  }
+  if (result.statsFrame > 0) {
+    const ClothStats::Stats &stats = result.stats;
+    std::cout << "  stats at frame " << result.statsFrame << ": energy "
+              << stats.kineticEnergy << ", max strain " << stats.maxStrain
+              << ", max speed " << stats.maxSpeed << ", " << stats.nonFinite
+              << " non-finite, center " << stats.centerOfMass.x << " "
+              << stats.centerOfMass.y << " " << stats.centerOfMass.z
+              << std::endl;
+  }
+}
+
+static void printAccuracy(const BenchOptions &options) {
+  // every precision against full precision - the particle error is how far
+  // the simulation drifts with f16 velocities, the vertex errors are those of
+  // encoding the full precision vertices. The bytes are the particles read
+  // and written and the vertices written by one step, neighbour reads that
+  // hit the cache are not counted
+  int size = options.minSize;
+  std::cout << "accuracy after " << options.accuracyFrames << " frames, "
+            << size << "x" << size << " cloth" << std::endl;
+  std::cout << std::left << std::setw(10) << "precision" << std::right
+            << std::setw(12) << "B/particle" << std::setw(10) << "B/vertex"
+            << std::setw(12) << "KiB/step" << std::setw(16) << "particle err"
+            << std::setw(16) << "vertex err" << std::setw(16)
+            << "normal err deg" << std::endl;
+
+  ClothCPU reference;
+  reference.initiateNewCloth(benchParameters(
+      size, SolverMode::Standard, LayoutOrder::RowMajor, PRECISIONS[0]));
+  for (int frame = 0; frame < options.accuracyFrames; frame++) {
+    reference.processFrame();
+  }
+  std::vector<ClothObject::ClothParticle> expected =
+      reference.currentParticles();
+
+  for (const Precision &precision : PRECISIONS) {
+    ClothCPU cloth;
+    cloth.initiateNewCloth(benchParameters(size, SolverMode::Standard,
+                                           LayoutOrder::RowMajor, precision));
+    for (int frame = 0; frame < options.accuracyFrames; frame++) {
+      cloth.processFrame();
+    }
+
+    float particleError = 0.0f;
+    std::vector<ClothObject::ClothParticle> particles =
+        cloth.currentParticles();
+    for (size_t i = 0; i < particles.size(); i++) {
+      particleError =
+          std::max(particleError, glm::length(particles[i].position -
+                                              expected[i].position));
+    }
+
+    float vertexError = 0.0f;
+    float normalError = 0.0f;
+    for (const ClothObject::ClothVertex &vertex : reference.vertices) {
+      uint32_t stored[8];
+      ClothObject::packVertex(precision.vertices, vertex, stored);
+      ClothObject::ClothVertex decoded =
+          ClothObject::unpackVertex(precision.vertices, stored);
+      vertexError = std::max(vertexError,
+                             glm::length(decoded.position - vertex.position));
+      // the angle through atan2 stays accurate for nearly equal normals
+      float angle =
+          std::atan2(glm::length(glm::cross(decoded.normal, vertex.normal)),
+                     glm::dot(decoded.normal, vertex.normal));
+      normalError = std::max(normalError, glm::degrees(angle));
+    }
+
+    uint32_t particleBytes = ClothObject::particleStride(precision.particles);
+    uint32_t vertexBytes = ClothObject::vertexStride(precision.vertices);
+    double stepBytes = 2.0 * particleBytes * cloth.numParticles +
+                       (double)vertexBytes * cloth.numVertices;
+    std::cout << std::left << std::setw(10) << precision.name << std::right
+              << std::setw(12) << particleBytes << std::setw(10)
+              << vertexBytes << std::fixed << std::setprecision(1)
+              << std::setw(12) << stepBytes / 1024.0 << std::scientific
+              << std::setprecision(2) << std::setw(16) << particleError
+              << std::setw(16) << vertexError << std::fixed
+              << std::setprecision(3) << std::setw(16) << normalError
+              << std::defaultfloat << std::endl;
+  }
+}
+
+int main(int argc, char **argv) {
+  BenchOptions options;
+  if (!parseArguments(argc, argv, options)) {
+    return 1;
+  }
+  if (options.accuracyFrames > 0) {
+    printAccuracy(options);
+    return 0;
+  }
+
+  Instance instance = wgpuCreateInstance(nullptr);
+  Device gpu = nullptr;
+  Device software = nullptr;
+  std::string adapterName;
+  for (const std::string &backend : options.backends) {
+    if (backend == "gpu" && instance) {
+      gpu = HeadlessDevice::create(instance, false);
+      adapterName = gpu ? HeadlessDevice::lastAdapterName() : "";
+    } else if (backend == "software" && instance) {
+      software = HeadlessDevice::create(instance, true);
+    }
+  }
+
+  CacheCounters counters;
+  std::cout << std::left << std::setw(56) << "benchmark" << std::right
+            << std::setw(12) << "steps/s" << std::setw(14) << "ns/particle"
+            << std::setw(14) << "bytes/step" << std::setw(14) << "cache miss"
+            << std::endl;
+
+  std::vector<BenchResult> results;
+  for (const std::string &backend : options.backends) {
+    Device device = backend == "gpu"        ? gpu
+                    : backend == "software" ? software
+                                            : Device(nullptr);
+    if (backend != "cpu" && !device) {
+      std::cout << "No " << backend << " adapter, skipping" << std::endl;
+      continue;
+    }
+
+    for (SolverMode mode : options.modes) {
+      for (LayoutOrder layout : options.layouts) {
+        for (const Precision &precision : options.precisions) {
+          for (int size = options.minSize; size <= options.maxSize;
+               size *= 2) {
+            BenchResult result =
+                backend == "cpu"
+                    ? runCpu(options, counters, size, mode, layout, precision)
+                    : runGpu(options, device, size, mode, layout, precision);
+            result.backend = backend;
+            result.mode = modeName(mode);
+            result.layout = layoutName(layout);
+            result.precision = precision.name;
+            result.render = renderName(backend == "cpu"
+                                           ? RenderPath::VertexBuffer
+                                           : options.renderPath);
+            result.simLodStep = backend == "cpu" || mode != SolverMode::Standard
+                                    ? 1
+                                    : options.simLodStep;
+            result.size = size;
+            result.particles = (int64_t)size * size;
+            std::ostringstream name;
+            name << "cloth_step/" << backend << "/" << result.mode << "/"
+                 << result.layout << "/" << result.precision << "/"
+                 << result.render << "/";
+            if (result.simLodStep > 1) {
+              name << "lod" << result.simLodStep << "/";
+            }
+            if (result.tiles > 0) {
+              name << "tiles" << result.tiles << "/";
+            }
+            name << size;
+            result.name = name.str();
+
+            printResult(result);
+            results.push_back(result);
+          }
+        }
+      }
+    }
+  }
+
+  // many cloths of very different sizes in one batch of tasks
+  bool cpu = std::find(options.backends.begin(), options.backends.end(),
+                       "cpu") != options.backends.end();
+  if (cpu && options.batchCloths > 0) {
+    for (SolverMode mode : options.modes) {
+      BenchResult result = runCpuBatch(options, mode);
+      result.backend = "cpu";
+      result.mode = modeName(mode);
+      result.layout = layoutName(LayoutOrder::RowMajor);
+      result.precision = PRECISIONS[0].name;
+      result.render = renderName(RenderPath::VertexBuffer);
+      result.size = options.maxSize;
+      result.cloths = options.batchCloths;
+      std::ostringstream name;
+      name << "cloth_batch/cpu/" << result.mode << "/" << options.batchCloths;
+      result.name = name.str();
+      printResult(result);
+      results.push_back(result);
+    }
+  }
+
+  // the same grids split across more and more nodes, each stepping the rows
+  // it first-touched - scaling stays flat on a machine with a single node
+  if (cpu && options.numaNodes > 0) {
+    int available = (int)NumaPool::systemNodes().size();
+    int nodes = std::min(options.numaNodes, available);
+    if (nodes < options.numaNodes) {
+      std::cout << "Only " << available << " NUMA node"
+                << (available > 1 ? "s" : "") << ", scaling up to " << nodes
+                << std::endl;
+    }
+    for (int size = options.minSize; size <= options.maxSize; size *= 2) {
+      double oneNode = 0.0;
+      for (int k = 1; k <= nodes; k++) {
+        BenchResult result =
+            runCpu(options, counters, size, SolverMode::Standard,
+                   LayoutOrder::RowMajor, PRECISIONS[0], k);
+        if (k == 1) {
+          oneNode = result.stepsPerSecond();
+        }
+        result.numaScaling = result.stepsPerSecond() / oneNode;
+        result.backend = "cpu";
+        result.mode = modeName(SolverMode::Standard);
+        result.layout = layoutName(LayoutOrder::RowMajor);
+        result.precision = PRECISIONS[0].name;
+        result.render = renderName(RenderPath::VertexBuffer);
+        result.size = size;
+        result.particles = (int64_t)size * size;
+        std::ostringstream name;
+        name << "cloth_numa/cpu/" << k << "/" << size;
+        result.name = name.str();
+        printResult(result);
+        results.push_back(result);
+      }
+    }
+  }
+
+  // the same grids split in strips across worker processes
+  if (cpu && options.strips > 0) {
+    for (int size = options.minSize; size <= options.maxSize; size *= 2) {
+      for (int k = 1; k <= options.strips; k++) {
+        BenchResult result = runCpuStrips(options, size, k);
+        if (result.steps == 0) {
+          std::cout << "No strip workers, skipping" << std::endl;
+          break;
+        }
+        result.backend = "cpu";
+        result.mode = modeName(SolverMode::Standard);
+        result.layout = layoutName(LayoutOrder::RowMajor);
+        result.precision = PRECISIONS[0].name;
+        result.render = renderName(RenderPath::VertexBuffer);
+        result.size = size;
+        result.particles = (int64_t)size * size;
+        std::ostringstream name;
+        name << "cloth_strips/cpu/" << result.strips << "/" << size;
+        result.name = name.str();
+        printResult(result);
+        results.push_back(result);
+      }
+    }
+  }
+
+  if (!options.jsonPath.empty()) {
+    std::ofstream file(options.jsonPath);
+    writeJson(file, results, adapterName);
+    std::cout << "Wrote " << options.jsonPath << std::endl;
+  }
+
+  // every size reuses the buffers of the previous runs where it can
+  BufferPool::Stats pool = BufferPool::stats();
+  if (pool.acquires > 0) {
+    std::cout << "buffer pool: " << pool.acquires << " acquires, "
+              << std::setprecision(1) << std::fixed << pool.hitRate() * 100.0
+              << "% hits, " << pool.idleBytes / 1024 << " KiB idle"
+              << std::defaultfloat << std::endl;
+  }
+
+  BufferPool::releaseIdle();
+  if (gpu) {
+    gpu.release();
+  }
+  if (software) {
+    software.release();
+  }
+  if (instance) {
+    instance.release();
+  }
+  return 0;
+}
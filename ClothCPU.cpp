@@ -0,0 +1,618 @@
+#include "ClothCPU.h"
+#include "ClothInitializer.h"
+#include "TaskScheduler.h"
+
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+using ClothVertex = ClothCPU::ClothVertex;
+using ClothParticle = ClothCPU::ClothParticle;
+using vec3 = ClothCPU::vec3;
+
+void ClothCPU::initiateNewCloth(const ClothParameters &p) {
+  // initiation function - same initial state as the GPU backend
+  parameters = p;
+  // same cache and fallback as ClothObject::updateParameters
+  if (parameters.topology == Topology::Mesh &&
+      parameters.topologyMesh != m_topologyPath) {
+    topology = ClothTopology();
+    m_topologyPath.clear();
+    if (ClothTopology::loadObj(parameters.topologyMesh, topology)) {
+      m_topologyPath = parameters.topologyMesh;
+    }
+  }
+  if (parameters.topology == Topology::Mesh && m_topologyPath.empty()) {
+    parameters.topology = Topology::Grid;
+  }
+
+  m_rowBegin = m_rowEnd = m_storedBegin = 0;
+  m_strip = false;
+  int storedEnd = 0;
+  if (parameters.topology == Topology::Mesh) {
+    uniforms = ClothObject::computeUniforms(parameters, topology);
+    numParticles = (int)topology.particleCount();
+    numVertices = 3 * (int)topology.triangleCount();
+  } else {
+    // a strip stores its rows and the halo rows around them, row-major so
+    // that every row is contiguous
+    m_rowEnd = storedEnd = parameters.height;
+    if (stripEnd > stripBegin) {
+      m_rowBegin = std::clamp(stripBegin, 0, parameters.height);
+      m_rowEnd = std::clamp(stripEnd, m_rowBegin, parameters.height);
+      m_storedBegin = std::max(m_rowBegin - HaloRows, 0);
+      storedEnd = std::min(m_rowEnd + HaloRows, parameters.height);
+    }
+    m_strip = storedEnd - m_storedBegin < parameters.height;
+    if (m_strip) {
+      parameters.particleOrder = GridLayout::Order::RowMajor;
+    }
+    uniforms = ClothObject::computeUniforms(parameters);
+    numParticles = parameters.width * (storedEnd - m_storedBegin);
+    // the quads below the stepped rows, the last row has none
+    int quadRows = std::min(m_rowEnd, parameters.height - 1) - m_rowBegin;
+    numVertices = 3 * 2 * (parameters.width - 1) * std::max(quadRows, 0);
+  }
+  layout = ClothObject::gridLayout(parameters);
+  if (m_strip) {
+    layout.height = (uint32_t)(storedEnd - m_storedBegin);
+  }
+  frame = 0;
+  simTime = 0.0;
+
+  std::vector<ClothInitializer::MeshVertex> mesh;
+  if (parameters.initialState == ClothObject::InitialState::Mesh) {
+    ClothInitializer::loadMesh(parameters.initMesh, mesh);
+  }
+  // a garment has no rows to band, it always runs on the work-stealing pool,
+  // and a serial instance starts no threads at all
+  int nodes = std::min(numaNodes, (int)NumaPool::systemNodes().size());
+  if (serial || nodes <= 0 || parameters.topology != Topology::Grid) {
+    m_numa.reset();
+  } else if (!m_numa || m_numa->nodeCount() != nodes) {
+    m_numa = std::make_unique<NumaPool>();
+    m_numa->start(nodes);
+  }
+  // fresh allocations so the pages are only placed by the writes below
+  for (ParticleBuffer &buffer : particleBuffers) {
+    ParticleBuffer().swap(buffer);
+    buffer.resize(numParticles);
+  }
+  VertexBuffer().swap(vertices);
+  vertices.resize(numVertices);
+  auto touchParticles = [&](int begin, int end) {
+    for (ParticleBuffer &buffer : particleBuffers) {
+      std::fill(buffer.begin() + begin, buffer.begin() + end, ClothParticle{});
+    }
+  };
+  auto touchVertices = [&](int begin, int end) {
+    std::fill(vertices.begin() + begin, vertices.begin() + end, ClothVertex{});
+  };
+  if (m_numa) {
+    // each node writes its bands first, the same ones processFrame gives it
+    m_numa->run(numParticles, particleRowItems(), touchParticles);
+    m_numa->run(numVertices, vertexRowItems(), touchVertices);
+  } else {
+    touchParticles(0, numParticles);
+    touchVertices(0, numVertices);
+  }
+  // both buffers start from the same state
+  if (parameters.topology == Topology::Mesh) {
+    ClothInitializer::generate(parameters, topology, particleBuffers[0].data());
+  } else if (m_strip) {
+    ClothInitializer::generateStrip(parameters, mesh, m_storedBegin, storedEnd,
+                                    particleBuffers[0].data());
+  } else {
+    ClothInitializer::generate(parameters, mesh, particleBuffers[0].data(),
+                               serial);
+  }
+  std::copy(particleBuffers[0].begin(), particleBuffers[0].end(),
+            particleBuffers[1].begin());
+
+  ClothObject::advanceUniforms(parameters, simTime, uniforms);
+  lastStateHash = hashState();
+}
+
+ClothObject::ReconfigureTier ClothCPU::reconfigure(const ClothParameters &p) {
+  ClothObject::ReconfigureTier tier =
+      ClothObject::reconfigureTier(parameters, p);
+  if (tier == ClothObject::ReconfigureTier::Uniforms) {
+    parameters = p;
+    uniforms = parameters.topology == Topology::Mesh
+                   ? ClothObject::computeUniforms(parameters, topology)
+                   : ClothObject::computeUniforms(parameters);
+    ClothObject::advanceUniforms(parameters, simTime, uniforms);
+  } else if (tier != ClothObject::ReconfigureTier::None) {
+    initiateNewCloth(p);
+  }
+  return tier;
+}
+
+void ClothCPU::processFrame() {
+  // update function that runs every frame, alternating input and output
+  // buffers exactly like ClothObject::initBindGroup does
+  stepParticles();
+  buildVertices();
+
+  // a strip only holds part of the state, its hash is taken by ClothDomain
+  if (parameters.solverMode == SolverMode::Deterministic && !m_strip) {
+    lastStateHash = hashState();
+  }
+}
+
+template <typename Body>
+void ClothCPU::runPass(int count, int rowItems, int grain, const Body &body) {
+  // every particle and vertex only writes its own output, so the ranges run
+  // in any order on the work-stealing pool (or on the bands of the NUMA
+  // nodes) with the same result
+  if (serial) {
+    body(0, count);
+  } else if (m_numa) {
+    m_numa->run(count, rowItems, body);
+  } else {
+    TaskScheduler::parallelFor(count, grain, body);
+  }
+}
+
+void ClothCPU::stepParticles() {
+  frame += 1;
+  simTime += parameters.deltaT;
+  ClothObject::advanceUniforms(parameters, simTime, uniforms);
+
+  const ParticleBuffer &src = particleBuffers[frame % 2];
+  ParticleBuffer &dst = particleBuffers[1 - (frame % 2)];
+
+  // only the stepped rows, the halo rows are copied in afterwards
+  int first = (m_rowBegin - m_storedBegin) * parameters.width;
+  int count = parameters.topology == Topology::Mesh
+                  ? numParticles
+                  : (m_rowEnd - m_rowBegin) * parameters.width;
+  runPass(count, particleRowItems(), ParticleGrain, [&](int begin, int end) {
+    for (int index = first + begin; index < first + end; index++) {
+      simulateParticle(src, dst, index);
+    }
+  });
+}
+
+void ClothCPU::buildVertices() {
+  const ParticleBuffer &dst = particleBuffers[1 - (frame % 2)];
+  runPass(numVertices, vertexRowItems(), VertexGrain, [&](int begin, int end) {
+    for (int index = begin; index < end; index++) {
+      if (parameters.topology == Topology::Mesh) {
+        garmentParticleToVertex(dst, index);
+      } else {
+        particleToVertex(dst, index);
+      }
+    }
+  });
+}
+
+void ClothCPU::processFrames(const std::vector<ClothCPU *> &cloths) {
+  // one task per cloth, each splits its own passes - idle threads steal from
+  // the large cloths once the small ones are done
+  TaskScheduler::parallelFor((int)cloths.size(), 1, [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      cloths[i]->processFrame();
+    }
+  });
+}
+
+std::vector<ClothParticle> ClothCPU::currentParticles() const {
+  std::vector<ClothParticle> grid;
+  ClothObject::toGridOrder(layout, particleBuffers[1 - (frame % 2)].data(),
+                           numParticles, grid);
+  return grid;
+}
+
+uint64_t ClothCPU::hashState() {
+  // the hash is taken in grid order, which a row-major state already is
+  const ClothParticle *stored = particleBuffers[1 - (frame % 2)].data();
+  if (layout.order == GridLayout::Order::RowMajor) {
+    return ClothObject::hashParticles(stored, numParticles);
+  }
+  ClothObject::toGridOrder(layout, stored, numParticles, m_gridScratch);
+  return ClothObject::hashParticles(m_gridScratch.data(), numParticles);
+}
+
+ClothParticle *ClothCPU::currentRow(int row) {
+  return particleBuffers[1 - (frame % 2)].data() +
+         (size_t)(row - m_storedBegin) * parameters.width;
+}
+
+int ClothCPU::particleIndex(int x, int y) const {
+  return (int)layout.index((uint32_t)x, (uint32_t)(y - m_storedBegin));
+}
+
+void ClothCPU::particleCoords(int index, int &x, int &y) const {
+  uint32_t cx, cy;
+  layout.coords((uint32_t)index, cx, cy);
+  x = (int)cx;
+  y = (int)cy + m_storedBegin;
+}
+
+int ClothCPU::particleRowItems() const {
+  // a row of Morton tiles is stored contiguously, a band may not split it
+  int rows = layout.order == GridLayout::Order::MortonTiles
+                 ? (int)GridLayout::TileSize
+                 : 1;
+  return parameters.width * rows;
+}
+
+int ClothCPU::vertexRowItems() const {
+  // two triangles per quad, in the same row order as the particles
+  int rows = layout.order == GridLayout::Order::MortonTiles
+                 ? (int)GridLayout::TileSize
+                 : 1;
+  return 6 * (parameters.width - 1) * rows;
+}
+
+vec3 ClothCPU::forces(const ParticleBuffer &src, int index,
+                      const vec3 &current_pos) const {
+  // see forces() in compute.wgsl - the summation order must stay identical
+  int width = (int)uniforms.width;
+  int height = (int)uniforms.height;
+
+  // get particle location
+  int x, y;
+  particleCoords(index, x, y);
+
+  // rest dist determines when forces begin to be applied
+  float rest_dist = uniforms.particleDist * 0.95f;
+
+  // spring constants
+  float k1 = uniforms.closeSpringStrength / uniforms.particleScale;
+  float k2 = uniforms.farSpringStrength / uniforms.particleScale;
+
+  // short springs to all 8 surrounding particles
+  vec3 near_force = vec3(0.0f);
+  for (int addy = -1; addy < 2; addy++) {
+    for (int addx = -1; addx < 2; addx++) {
+      float diag_dist = 1.0f;
+      if (std::abs(addx) + std::abs(addy) == 2) {
+        diag_dist = 1.41421356237f; // sqrt(2)
+      }
+
+      // getting adjacent particles
+      int indx = x + addx;
+      int indy = y + addy;
+
+      // check bounds
+      if (indx >= 0 && indx < width && indy >= 0 && indy < height &&
+          (addx != 0 || addy != 0)) {
+        vec3 diff = current_pos - src[particleIndex(indx, indy)].position;
+        float dist = glm::length(diff);
+        if (rest_dist * diag_dist < dist) {
+          near_force += (diff / dist) * (rest_dist * diag_dist - dist) * k1;
+        }
+      }
+    }
+  }
+
+  // repeated spring equations to the diagonal particles two steps away
+  vec3 far_force = vec3(0.0f);
+  for (int addy = -1; addy < 2; addy += 2) {
+    for (int addx = -1; addx < 2; addx += 2) {
+      int farx = x + 2 * addx;
+      int fary = y + 2 * addy;
+
+      if (farx >= 0 && farx < width && fary >= 0 && fary < height) {
+        vec3 diff = current_pos - src[particleIndex(farx, fary)].position;
+        float dist = glm::length(diff);
+        if (rest_dist * 1.41421356237f * 2.0f > dist) {
+          far_force +=
+              (diff / dist) * (rest_dist * 1.41421356237f * 2.0f - dist) * k2;
+        }
+      }
+    }
+  }
+
+  vec3 total_force = near_force + far_force;
+  addExternalForces(total_force, current_pos);
+
+  // lock top row of particles
+  float multiplier = 1.0f;
+  if (y == (int)(uniforms.height - 1.0f)) {
+    multiplier = 0.0f;
+  }
+
+  return total_force * multiplier;
+}
+
+void ClothCPU::addExternalForces(vec3 &total_force,
+                                 const vec3 &current_pos) const {
+  // apply force from the moving sphere by direction from center
+  vec3 sphere_pos = vec3(uniforms.sphereX, uniforms.sphereY, uniforms.sphereZ);
+  vec3 sphere_dist = current_pos - sphere_pos;
+  if (glm::length(sphere_dist) < uniforms.sphereRadius) {
+    float sphere_diff = uniforms.sphereRadius - glm::length(sphere_dist);
+    total_force +=
+        glm::normalize(sphere_dist) * sphere_diff * sphere_diff * 200.0f *
+        uniforms.forceScale;
+  }
+
+  // gravity
+  total_force.y -= 9.8f * uniforms.particleMass;
+
+  // wind calculation
+  total_force += uniforms.wind_dir * 0.0005f * uniforms.particleScale *
+                 uniforms.wind_strength * uniforms.forceScale;
+}
+
+vec3 ClothCPU::garmentForces(const ParticleBuffer &src, int index,
+                             const vec3 &current_pos) const {
+  // see forces() in compute_mesh.wgsl
+  float k1 = uniforms.closeSpringStrength / uniforms.particleScale;
+  float k2 = uniforms.farSpringStrength / uniforms.particleScale;
+
+  // near springs along the mesh edges
+  vec3 near_force = vec3(0.0f);
+  for (uint32_t s = topology.nearOffsets[index];
+       s < topology.nearOffsets[index + 1]; s++) {
+    const ClothTopology::Spring &spring = topology.nearSprings[s];
+    float rest_dist = spring.restLength * uniforms.particleScale * 0.95f;
+    vec3 diff = current_pos - src[spring.neighbor].position;
+    float dist = glm::length(diff);
+    if (rest_dist < dist) {
+      near_force += (diff / dist) * (rest_dist - dist) * k1;
+    }
+  }
+
+  // far springs across the edges only push apart
+  vec3 far_force = vec3(0.0f);
+  for (uint32_t s = topology.farOffsets[index];
+       s < topology.farOffsets[index + 1]; s++) {
+    const ClothTopology::Spring &spring = topology.farSprings[s];
+    float rest_dist = spring.restLength * uniforms.particleScale * 0.95f;
+    vec3 diff = current_pos - src[spring.neighbor].position;
+    float dist = glm::length(diff);
+    if (rest_dist > dist) {
+      far_force += (diff / dist) * (rest_dist - dist) * k2;
+    }
+  }
+
+  vec3 total_force = near_force + far_force;
+  addExternalForces(total_force, current_pos);
+
+  // pinned particles hold the garment up
+  float multiplier = 1.0f;
+  if (topology.flags[index] & ClothTopology::Pinned) {
+    multiplier = 0.0f;
+  }
+
+  return total_force * multiplier;
+}
+
+void ClothCPU::garmentConstraints(const ParticleBuffer &src, int index,
+                                  vec3 &vPos) const {
+  // see the constraint loop of main() in compute_mesh.wgsl
+  if (topology.flags[index] & ClothTopology::Pinned) {
+    return;
+  }
+  for (uint32_t s = topology.nearOffsets[index];
+       s < topology.nearOffsets[index + 1]; s++) {
+    const ClothTopology::Spring &spring = topology.nearSprings[s];
+    const vec3 &other = src[spring.neighbor].position;
+    float rest_dist = spring.restLength * uniforms.particleScale;
+    vec3 diff = vPos - other;
+
+    // if distance is too far or too low, position is fixed
+    if (glm::length(diff) < uniforms.minStretch * rest_dist) {
+      vPos = other + glm::normalize(diff) * rest_dist * uniforms.minStretch;
+    } else if (glm::length(diff) > uniforms.maxStretch * rest_dist) {
+      vPos = other + glm::normalize(diff) * rest_dist * uniforms.maxStretch;
+    }
+  }
+}
+
+void ClothCPU::simulateParticle(const ParticleBuffer &src,
+                                ParticleBuffer &dst, int index) const {
+  // see main() in compute.wgsl
+  vec3 vPos = src[index].position;
+  vec3 vVel = src[index].velocity;
+
+  // RK4 integration
+  float dt = uniforms.deltaT;
+  bool garment = parameters.topology == Topology::Mesh;
+  auto force = [&](const vec3 &pos) {
+    return garment ? garmentForces(src, index, pos) : forces(src, index, pos);
+  };
+
+  vec3 k0 = dt * vVel;
+  vec3 l0 = dt * force(vPos);
+  vec3 k1 = dt * (vVel + l0 * 0.5f);
+  vec3 l1 = dt * force(vPos + k0 * 0.5f);
+  vec3 k2 = dt * (vVel + l1 * 0.5f);
+  vec3 l2 = dt * force(vPos + k1 * 0.5f);
+  vec3 k3 = dt * (vVel + l2);
+  vec3 l3 = dt * force(vPos + k2);
+
+  // integration step
+  vPos = vPos + (k0 + 2.0f * k1 + 2.0f * k2 + k3) / 6.0f;
+  vVel = vVel + (l0 + 2.0f * l1 + 2.0f * l2 + l3) / 6.0f;
+
+  // convert index to position
+  int width = (int)uniforms.width;
+  int height = (int)uniforms.height;
+  int ix, iy;
+  particleCoords(index, ix, iy);
+
+  // constraint loop
+  if (garment) {
+    garmentConstraints(src, index, vPos);
+  } else if (iy < height - 1) {
+    for (int addx = -1; addx < 2; addx++) {
+      for (int addy = -1; addy < 2; addy++) {
+        int indx = ix + addx;
+        int indy = iy + addy;
+        if (indx >= 0 && indx < width && indy >= 0 && indy < height &&
+            (addx != 0 || addy != 0)) {
+          const vec3 &other = src[particleIndex(indx, indy)].position;
+          vec3 diff = vPos - other;
+          float diag_dist = 1.0f;
+          if (std::abs(addx) + std::abs(addy) == 2) {
+            diag_dist = 1.41421356237f;
+          }
+          diag_dist *= uniforms.particleDist;
+
+          // if distance is too far or too low, position is fixed
+          if (glm::length(diff) < uniforms.minStretch * diag_dist) {
+            vPos = other +
+                   glm::normalize(diff) * diag_dist * uniforms.minStretch;
+          } else if (glm::length(diff) > uniforms.maxStretch * diag_dist) {
+            vPos = other +
+                   glm::normalize(diff) * diag_dist * uniforms.maxStretch;
+          }
+        }
+      }
+    }
+  }
+
+  // deterministic mode - WGSL round() rounds half to even, which matches
+  // nearbyint in the default rounding mode
+  if (uniforms.quantization > 0.0f) {
+    float q = uniforms.quantization;
+    vPos = vec3(std::nearbyint(vPos.x / q), std::nearbyint(vPos.y / q),
+                std::nearbyint(vPos.z / q)) *
+           q;
+    vVel = vec3(std::nearbyint(vVel.x / q), std::nearbyint(vVel.y / q),
+                std::nearbyint(vVel.z / q)) *
+           q;
+  }
+
+  // half velocity storage keeps only what three f16 can hold, like
+  // store_particle() in compute.wgsl
+  if (uniforms.particlePrecision ==
+      (uint32_t)ClothObject::ParticlePrecision::HalfVelocity) {
+    vVel = vec3(glm::unpackHalf2x16(glm::packHalf2x16(glm::vec2(vVel))),
+                glm::unpackHalf1x16(glm::packHalf1x16(vVel.z)));
+  }
+
+  // write particle output
+  dst[index].position = vPos;
+  dst[index].velocity = vVel;
+}
+
+glm::ivec2 ClothCPU::trianglePosConversion(int square_pos) const {
+  // see triangle_pos_conversion() in compute.wgsl
+  if (square_pos == 1 || square_pos == 3) {
+    return glm::ivec2(0, 1); // down one
+  } else if (square_pos == 2 || square_pos == 5) {
+    return glm::ivec2(1, 0); // right one
+  } else if (square_pos == 4) {
+    return glm::ivec2(1, 1); // down and right one
+  }
+  return glm::ivec2(0, 0); // corner case
+}
+
+void ClothCPU::particleToVertex(const ParticleBuffer &dst, int index) {
+  // see particle_to_vertex() in compute.wgsl
+  int cell = index / 6;
+  int cellsPerRow = (int)uniforms.width - 1;
+  glm::ivec2 cellPos =
+      glm::ivec2(cell % cellsPerRow, m_rowBegin + cell / cellsPerRow);
+
+  int square_pos = index % 6;
+  glm::ivec2 vPos = cellPos + trianglePosConversion(square_pos);
+  vec3 vpos = dst[particleIndex(vPos.x, vPos.y)].position;
+  vec3 norm = normalsByAverage(dst, vPos, vpos);
+
+  // switch dimensions
+  vec3 nv = vec3(vpos[2], vpos[0], vpos[1]);
+  vec3 nn = vec3(norm[2], norm[0], norm[1]);
+  storeVertex(index, nv / (0.3f * uniforms.particleScale), nn);
+}
+
+void ClothCPU::garmentParticleToVertex(const ParticleBuffer &dst,
+                                       int index) {
+  // see particle_to_vertex() in compute_mesh.wgsl
+  uint32_t vIdx = topology.triangles[index];
+  vec3 vpos = dst[vIdx].position;
+
+  // area weighted average of the faces around the particle
+  vec3 total_norm = vec3(0.0f);
+  for (uint32_t f = topology.faceOffsets[vIdx];
+       f < topology.faceOffsets[vIdx + 1]; f++) {
+    const uint32_t *triangle = &topology.triangles[3 * topology.faces[f]];
+    vec3 a = dst[triangle[0]].position;
+    vec3 b = dst[triangle[1]].position;
+    vec3 c = dst[triangle[2]].position;
+    total_norm += glm::cross(b - a, c - a);
+  }
+  vec3 norm = glm::normalize(total_norm);
+
+  // switch dimensions
+  vec3 nv = vec3(vpos[2], vpos[0], vpos[1]);
+  vec3 nn = vec3(norm[2], norm[0], norm[1]);
+  storeVertex(index, nv / (0.3f * uniforms.particleScale), nn);
+}
+
+void ClothCPU::storeVertex(int index, const vec3 &position,
+                           const vec3 &normal) {
+  // vertices hold what the vertex buffer would, see store_vertex() in
+  // compute.wgsl
+  ClothVertex vertex;
+  vertex.position = position;
+  vertex.garbage1 = 0.0f;
+  vertex.normal = normal;
+  vertex.garbage2 = 0.0f;
+  if (parameters.vertexPrecision != ClothObject::VertexPrecision::Full) {
+    uint32_t stored[8];
+    ClothObject::packVertex(parameters.vertexPrecision, vertex, stored);
+    vertex = ClothObject::unpackVertex(parameters.vertexPrecision, stored);
+  }
+  vertices[index] = vertex;
+}
+
+vec3 ClothCPU::normalsByAverage(const ParticleBuffer &dst,
+                                const glm::ivec2 &cellPos,
+                                const vec3 &vpos) const {
+  // see normals_by_average() in compute.wgsl
+  int width = (int)uniforms.width;
+  int height = (int)uniforms.height;
+
+  int x = cellPos.x;
+  int y = cellPos.y;
+
+  vec3 up_particle = vec3(0.0f);
+  vec3 down_particle = vec3(0.0f);
+  vec3 left_particle = vec3(0.0f);
+  vec3 right_particle = vec3(0.0f);
+
+  if (y > 0) {
+    up_particle =
+        glm::normalize(vpos - dst[particleIndex(x, y - 1)].position);
+  }
+  if (y < height - 1) {
+    down_particle =
+        glm::normalize(vpos - dst[particleIndex(x, y + 1)].position);
+  }
+  if (x > 0) {
+    left_particle =
+        glm::normalize(vpos - dst[particleIndex(x - 1, y)].position);
+  }
+  if (x < width - 1) {
+    right_particle =
+        glm::normalize(vpos - dst[particleIndex(x + 1, y)].position);
+  }
+
+  vec3 total_norm = vec3(0.0f);
+  if (y > 0 && x < width - 1) {
+    total_norm += glm::cross(up_particle, right_particle) *
+                  std::acos(glm::dot(up_particle, right_particle));
+  }
+  if (y < height - 1 && x < width - 1) {
+    total_norm += glm::cross(right_particle, down_particle) *
+                  std::acos(glm::dot(right_particle, down_particle));
+  }
+  if (y < height - 1 && x > 0) {
+    total_norm += glm::cross(down_particle, left_particle) *
+                  std::acos(glm::dot(down_particle, left_particle));
+  }
+  if (y > 0 && x > 0) {
+    total_norm += glm::cross(left_particle, up_particle) *
+                  std::acos(glm::dot(left_particle, up_particle));
+  }
+
+  return glm::normalize(total_norm);
+}
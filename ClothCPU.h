@@ -0,0 +1,146 @@
+#pragma once
+
+#include "ClothObject.h"
+#include "NumaPool.h"
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// CPU reference implementation of the cloth simulation. It mirrors the
+// kernels in compute.wgsl (compute_mesh.wgsl for a garment) operation for
+// operation, so it can run headless and serve as a known-good result to check
+// the GPU backend against.
+class ClothCPU {
+public:
+  // (Just aliases to make notations lighter)
+  using vec3 = glm::vec3;
+  using ClothParticle = ClothObject::ClothParticle;
+  using ClothVertex = ClothObject::ClothVertex;
+  using ClothParameters = ClothObject::ClothParameters;
+  using ClothUniforms = ClothObject::ClothUniforms;
+  using SolverMode = ClothObject::SolverMode;
+  using Topology = ClothObject::Topology;
+  // resized without being written, see initiateNewCloth
+  using ParticleBuffer =
+      std::vector<ClothParticle, FirstTouchAllocator<ClothParticle>>;
+  using VertexBuffer =
+      std::vector<ClothVertex, FirstTouchAllocator<ClothVertex>>;
+
+  // two particle buffers that alternate each frame - one input, one output
+  std::array<ParticleBuffer, 2> particleBuffers;
+  VertexBuffer vertices;
+
+  // connectivity of a garment
+  ClothTopology topology;
+  // storage order of the particle buffers
+  GridLayout layout;
+
+  // data structure members
+  ClothParameters parameters = ClothParameters();
+  ClothUniforms uniforms = ClothUniforms();
+
+  int numParticles = 0;
+  int numVertices = 0;
+  int frame = 0;
+  // sum of the steps, see ClothObject::simTime
+  double simTime = 0.0;
+
+  // NUMA nodes to split a grid across (0 uses the work-stealing pool) - each
+  // node first-touches and then steps its own band of rows, read at the next
+  // initiateNewCloth
+  int numaNodes = 0;
+
+  // rows of the grid this instance simulates, 0 and 0 for all of them (read
+  // at the next initiateNewCloth). The HaloRows rows on each side of the strip
+  // are stored too but belong to the neighbouring strips, which must copy them
+  // in between stepParticles() and buildVertices() - see ClothDomain
+  int stripBegin = 0;
+  int stripEnd = 0;
+  // rows the springs of forces() reach
+  static constexpr int HaloRows = 2;
+  // runs everything, initialization included, on the calling thread - for a
+  // process that is one of many, or a forked one without the parent's pools
+  bool serial = false;
+
+  // hash of the last simulated state (only updated in deterministic mode)
+  uint64_t lastStateHash = 0;
+
+  // functions
+  void initiateNewCloth(const ClothParameters &p);
+  // applies new parameters like ClothObject::reconfigure - a change that only
+  // reaches the uniforms keeps the simulation running, any other restarts it
+  ClothObject::ReconfigureTier reconfigure(const ClothParameters &p);
+  void processFrame();
+  // the two halves of processFrame - the first advances the particles, the
+  // second builds the vertices from them
+  void stepParticles();
+  void buildVertices();
+  // steps a batch of cloths of any sizes together
+  static void processFrames(const std::vector<ClothCPU *> &cloths);
+
+  // items of one task of the particle and vertex passes
+  static constexpr int ParticleGrain = 256;
+  static constexpr int VertexGrain = 1024;
+
+  // particle state written by the last simulation step, in grid order
+  std::vector<ClothParticle> currentParticles() const;
+  // a stored row of that state, rows of a strip are contiguous
+  ClothParticle *currentRow(int row);
+  // rows stepped by this instance
+  int rowBegin() const { return m_rowBegin; }
+  int rowEnd() const { return m_rowEnd; }
+
+private:
+  // first pass - one RK4 step and the stretch constraints for one particle
+  void simulateParticle(const ParticleBuffer &src, ParticleBuffer &dst,
+                        int index) const;
+  vec3 forces(const ParticleBuffer &src, int index,
+              const vec3 &current_pos) const;
+  // sphere, gravity and wind, shared by both topologies
+  void addExternalForces(vec3 &total_force, const vec3 &current_pos) const;
+
+  // garment versions of the kernels, see compute_mesh.wgsl
+  vec3 garmentForces(const ParticleBuffer &src, int index,
+                     const vec3 &current_pos) const;
+  void garmentConstraints(const ParticleBuffer &src, int index,
+                          vec3 &vPos) const;
+  void garmentParticleToVertex(const ParticleBuffer &dst, int index);
+
+  // second pass - convert particles into vertices and faces
+  void particleToVertex(const ParticleBuffer &dst, int index);
+  // writes a vertex at the precision of the vertex buffer
+  void storeVertex(int index, const vec3 &position, const vec3 &normal);
+  vec3 normalsByAverage(const ParticleBuffer &dst, const glm::ivec2 &cellPos,
+                        const vec3 &vpos) const;
+  glm::ivec2 trianglePosConversion(int square_pos) const;
+  // storage index of the particle at grid position (x, y) and back
+  int particleIndex(int x, int y) const;
+  void particleCoords(int index, int &x, int &y) const;
+  // hash of the state written by the last step, without allocating
+  uint64_t hashState();
+  // runs body over [0, count) on the NUMA bands, the pool or inline
+  template <typename Body>
+  void runPass(int count, int rowItems, int grain, const Body &body);
+  // particles and vertices of one band of grid rows, the NUMA partition unit
+  int particleRowItems() const;
+  int vertexRowItems() const;
+
+  // threads pinned to numaNodes nodes, null without NUMA partitioning
+  std::unique_ptr<NumaPool> m_numa;
+
+  // stepped rows and the first stored one, which is where the layout starts
+  int m_rowBegin = 0;
+  int m_rowEnd = 0;
+  int m_storedBegin = 0;
+  bool m_strip = false;
+
+  // file the garment topology was loaded from, see ClothObject::m_topologyPath
+  std::string m_topologyPath;
+  // grid order copy of a tiled state for hashState(), kept between frames
+  std::vector<ClothParticle> m_gridScratch;
+};
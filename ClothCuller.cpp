@@ -0,0 +1,161 @@
+#include "ClothCuller.h"
+#include "ClothObject.h"
+#include "GpuTracker.h"
+#include "ResourceManager.h"
+
+#include <vector>
+
+using namespace wgpu;
+
+void ClothCuller::init(wgpu::Device &device) {
+  m_shaderModule =
+      ResourceManager::loadShaderModule(RESOURCE_DIR "/cull.wgsl", device);
+
+  BufferDescriptor bufferDesc;
+  bufferDesc.size = sizeof(CullUniforms);
+  bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+  bufferDesc.mappedAtCreation = false;
+  m_uniformBuffer = GpuTracker::createBuffer(device, bufferDesc);
+
+  bufferDesc.label = "cloth bounds";
+  bufferDesc.size = 8 * sizeof(uint32_t);
+  bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Storage;
+  m_boundsBuffer = GpuTracker::createBuffer(device, bufferDesc);
+  // an empty box - every key is above the min keys and below the max keys
+  uint32_t empty[8] = {~0u, ~0u, ~0u, 0u, 0u, 0u, 0u, 0u};
+  device.getQueue().writeBuffer(m_boundsBuffer, 0, empty, sizeof(empty));
+
+  bufferDesc.label = "cloth draw arguments";
+  bufferDesc.size = 16 * sizeof(uint32_t);
+  bufferDesc.usage =
+      BufferUsage::CopyDst | BufferUsage::Storage | BufferUsage::Indirect;
+  m_indirectBuffer = GpuTracker::createBuffer(device, bufferDesc);
+
+  std::vector<BindGroupLayoutEntry> bindings(4, Default);
+
+  // cull parameters
+  bindings[0].binding = 0;
+  bindings[0].visibility = ShaderStage::Compute;
+  bindings[0].buffer.type = BufferBindingType::Uniform;
+  bindings[0].buffer.minBindingSize = sizeof(CullUniforms);
+
+  // latest particles
+  bindings[1].binding = 1;
+  bindings[1].visibility = ShaderStage::Compute;
+  bindings[1].buffer.type = BufferBindingType::ReadOnlyStorage;
+
+  // bounds and draw arguments
+  bindings[2].binding = 2;
+  bindings[2].visibility = ShaderStage::Compute;
+  bindings[2].buffer.type = BufferBindingType::Storage;
+  bindings[3].binding = 3;
+  bindings[3].visibility = ShaderStage::Compute;
+  bindings[3].buffer.type = BufferBindingType::Storage;
+
+  BindGroupLayoutDescriptor bindGroupLayoutDesc;
+  bindGroupLayoutDesc.entryCount = (uint32_t)bindings.size();
+  bindGroupLayoutDesc.entries = bindings.data();
+  m_bindGroupLayout =
+      GpuTracker::createBindGroupLayout(device, bindGroupLayoutDesc);
+
+  PipelineLayoutDescriptor pipelineLayoutDesc;
+  pipelineLayoutDesc.bindGroupLayoutCount = 1;
+  pipelineLayoutDesc.bindGroupLayouts =
+      (WGPUBindGroupLayout *)&m_bindGroupLayout;
+  m_pipelineLayout =
+      GpuTracker::createPipelineLayout(device, pipelineLayoutDesc);
+
+  ComputePipelineDescriptor pipelineDesc;
+  pipelineDesc.compute.constantCount = 0;
+  pipelineDesc.compute.constants = nullptr;
+  pipelineDesc.compute.module = m_shaderModule;
+  pipelineDesc.layout = m_pipelineLayout;
+  pipelineDesc.compute.entryPoint = "particle_bounds";
+  m_boundsPipeline = GpuTracker::createComputePipeline(device, pipelineDesc);
+  pipelineDesc.compute.entryPoint = "cull_draw";
+  m_cullPipeline = GpuTracker::createComputePipeline(device, pipelineDesc);
+}
+
+void ClothCuller::bind(ClothObject &cloth, wgpu::Device &device) {
+  for (int parity = 0; parity < 2; parity++) {
+    GpuTracker::release(m_bindGroups[parity]);
+    // a tiled cloth has no buffer with the whole grid, it is never culled
+    if (cloth.tiled()) {
+      continue;
+    }
+
+    std::vector<BindGroupEntry> entries(4, Default);
+    entries[0].binding = 0;
+    entries[0].buffer = m_uniformBuffer;
+    entries[0].offset = 0;
+    entries[0].size = sizeof(CullUniforms);
+
+    entries[1].binding = 1;
+    entries[1].buffer = cloth.particleBuffers[1 - parity];
+    entries[1].offset = 0;
+    entries[1].size = cloth.m_bufferSize;
+
+    entries[2].binding = 2;
+    entries[2].buffer = m_boundsBuffer;
+    entries[2].offset = 0;
+    entries[2].size = m_boundsBuffer.getSize();
+
+    entries[3].binding = 3;
+    entries[3].buffer = m_indirectBuffer;
+    entries[3].offset = 0;
+    entries[3].size = m_indirectBuffer.getSize();
+
+    BindGroupDescriptor bindGroupDesc;
+    bindGroupDesc.layout = m_bindGroupLayout;
+    bindGroupDesc.entryCount = (uint32_t)entries.size();
+    bindGroupDesc.entries = (WGPUBindGroupEntry *)entries.data();
+    m_bindGroups[parity] = GpuTracker::createBindGroup(device, bindGroupDesc);
+  }
+}
+
+void ClothCuller::update(wgpu::Queue &queue, const glm::mat4x4 &clipFromWorld,
+                         const ClothObject &cloth, int lodLevel) {
+  const ClothObject::ClothParameters &p = cloth.parameters;
+  CullUniforms u;
+  u.clipFromWorld = clipFromWorld;
+  u.particleCount = (uint32_t)cloth.numParticles;
+  u.particleWords =
+      ClothObject::particleStride(ClothObject::particlePrecision(p)) /
+      sizeof(uint32_t);
+  u.indexCount = cloth.m_lodIndexCount[lodLevel];
+  u.firstIndex = cloth.m_lodFirstIndex[lodLevel];
+  u.vertexCount = (uint32_t)cloth.numVertices;
+  u.particleScale = p.scale;
+  u.garbage[0] = u.garbage[1] = 0.0f;
+  queue.writeBuffer(m_uniformBuffer, 0, &u, sizeof(CullUniforms));
+}
+
+void ClothCuller::encode(wgpu::CommandEncoder &encoder,
+                         const ClothObject &cloth) {
+  ComputePassDescriptor computePassDesc;
+  computePassDesc.timestampWrites = nullptr;
+  computePassDesc.label = "cloth culling";
+  ComputePassEncoder computePass = encoder.beginComputePass(computePassDesc);
+  computePass.setBindGroup(0, m_bindGroups[cloth.frame % 2], 0, nullptr);
+
+  // one invocation per particle, then a single one for the frustum test
+  computePass.setPipeline(m_boundsPipeline);
+  ClothObject::dispatchLinear(computePass, (uint32_t)cloth.numParticles);
+  computePass.setPipeline(m_cullPipeline);
+  computePass.dispatchWorkgroups(1, 1, 1);
+  computePass.end();
+}
+
+void ClothCuller::terminate() {
+  for (BindGroup &bindGroup : m_bindGroups) {
+    GpuTracker::release(bindGroup);
+  }
+  GpuTracker::release(m_boundsPipeline);
+  GpuTracker::release(m_cullPipeline);
+  GpuTracker::release(m_pipelineLayout);
+  GpuTracker::release(m_bindGroupLayout);
+  GpuTracker::release(m_shaderModule);
+  GpuTracker::release(m_uniformBuffer);
+  GpuTracker::release(m_boundsBuffer);
+  GpuTracker::release(m_indirectBuffer);
+}
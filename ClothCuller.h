@@ -0,0 +1,76 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <webgpu/webgpu.hpp>
+
+#include <array>
+#include <cstdint>
+
+class ClothObject;
+
+// GPU frustum culling of a cloth. Every frame a compute pass reduces the
+// latest particle positions to a render space bounding box (one atomic
+// min/max per workgroup, on order preserving integer keys of the floats) and
+// a single invocation tests the box against the view frustum and writes the
+// indirect draw arguments - the instance count drops to 0 for a cloth that is
+// off screen, so it costs no vertex processing and the CPU never reads the
+// bounds back.
+//
+// The arguments hold both a drawIndexedIndirect (vertex pulling path) and a
+// drawIndirect (vertex buffer path) call. The kernels are in
+// resources/cull.wgsl.
+class ClothCuller {
+public:
+  // cull shader uniform data structure
+  struct CullUniforms {
+    // projection * view * model
+    glm::mat4x4 clipFromWorld;
+
+    uint32_t particleCount;
+    // words per particle, see ClothObject::particleStride
+    uint32_t particleWords;
+    // draw of the current level of detail
+    uint32_t indexCount;
+    uint32_t firstIndex;
+
+    uint32_t vertexCount;
+    // the vertex shaders divide positions by 0.3 * particleScale
+    float particleScale;
+    float garbage[2];
+  };
+
+  // byte offsets of both calls in indirectBuffer()
+  static constexpr uint64_t IndexedArgsOffset = 0;
+  static constexpr uint64_t DrawArgsOffset = 32;
+
+  void init(wgpu::Device &device);
+  void terminate();
+
+  // bind groups over the particle buffers, needed again whenever the cloth
+  // reallocates them (resize or rebuild) - none for a tiled cloth
+  void bind(ClothObject &cloth, wgpu::Device &device);
+
+  void update(wgpu::Queue &queue, const glm::mat4x4 &clipFromWorld,
+              const ClothObject &cloth, int lodLevel);
+  // bounds and culling of the latest simulation step, encoded before the
+  // render pass
+  void encode(wgpu::CommandEncoder &encoder, const ClothObject &cloth);
+
+  wgpu::Buffer indirectBuffer() const { return m_indirectBuffer; }
+
+private:
+  wgpu::Buffer m_uniformBuffer = nullptr;
+  // min and max keys of the box and the non-finite flag, reset by the
+  // culling kernel
+  wgpu::Buffer m_boundsBuffer = nullptr;
+  wgpu::Buffer m_indirectBuffer = nullptr;
+
+  wgpu::ShaderModule m_shaderModule = nullptr;
+  wgpu::BindGroupLayout m_bindGroupLayout = nullptr;
+  wgpu::PipelineLayout m_pipelineLayout = nullptr;
+  wgpu::ComputePipeline m_boundsPipeline = nullptr;
+  wgpu::ComputePipeline m_cullPipeline = nullptr;
+  // m_bindGroups[i] reads the output of the simulation step of parity i,
+  // like ClothObject::m_renderBindGroups
+  std::array<wgpu::BindGroup, 2> m_bindGroups = {nullptr, nullptr};
+};
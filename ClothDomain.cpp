@@ -0,0 +1,266 @@
+#include "ClothDomain.h"
+
+#include <algorithm>
+#include <iostream>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace {
+// a worker is told what to do over its control socket
+enum class Command : uint32_t { Step = 0, Gather, Quit };
+
+struct Message {
+  Command command;
+  uint32_t frames;
+};
+
+#ifndef _WIN32
+#ifdef MSG_NOSIGNAL
+// a worker that died shows up as a failed send, not as SIGPIPE
+constexpr int SendFlags = MSG_NOSIGNAL;
+#else
+constexpr int SendFlags = 0;
+#endif
+
+bool sendAll(int socket, const void *data, size_t bytes) {
+  const char *next = (const char *)data;
+  while (bytes > 0) {
+    ssize_t sent = send(socket, next, bytes, SendFlags);
+    if (sent < 0 && errno == EINTR) {
+      continue;
+    }
+    if (sent <= 0) {
+      return false;
+    }
+    next += sent;
+    bytes -= (size_t)sent;
+  }
+  return true;
+}
+
+bool recvAll(int socket, void *data, size_t bytes) {
+  char *next = (char *)data;
+  while (bytes > 0) {
+    ssize_t received = recv(socket, next, bytes, 0);
+    if (received < 0 && errno == EINTR) {
+      continue;
+    }
+    if (received <= 0) {
+      return false;
+    }
+    next += received;
+    bytes -= (size_t)received;
+  }
+  return true;
+}
+#endif
+} // namespace
+
+void ClothDomain::stripRows(int height, int part, int parts, int &begin,
+                            int &end) {
+  begin = (int)((long long)height * part / parts);
+  end = (int)((long long)height * (part + 1) / parts);
+}
+
+#ifdef _WIN32
+bool ClothDomain::start(const ClothParameters &, int) {
+  std::cerr << "Strip worker processes need a POSIX system" << std::endl;
+  return false;
+}
+
+void ClothDomain::stop() {}
+
+bool ClothDomain::step(int) { return false; }
+
+std::vector<ClothDomain::ClothParticle> ClothDomain::gather() { return {}; }
+
+void ClothDomain::workerMain(const ClothParameters &, int, int, int, int,
+                             int) {}
+
+bool ClothDomain::exchangeHalos(ClothCPU &, int, int) { return false; }
+#else
+bool ClothDomain::start(const ClothParameters &p, int strips) {
+  stop();
+  if (p.topology != ClothObject::Topology::Grid) {
+    std::cerr << "Only grid cloths can be split into strips" << std::endl;
+    return false;
+  }
+  strips = std::clamp(strips, 1, std::max(p.height / ClothCPU::HaloRows, 1));
+  m_width = p.width;
+  m_height = p.height;
+  m_frame = 0;
+
+  // control sockets to every worker and one link between each pair of
+  // neighbouring strips, all made before the first fork
+  std::vector<int> control(2 * strips, -1);
+  std::vector<int> links(2 * (strips - 1), -1);
+  bool created = true;
+  for (int i = 0; i < strips && created; i++) {
+    created = socketpair(AF_UNIX, SOCK_STREAM, 0, &control[2 * i]) == 0;
+  }
+  for (int i = 0; i + 1 < strips && created; i++) {
+    created = socketpair(AF_UNIX, SOCK_STREAM, 0, &links[2 * i]) == 0;
+  }
+  auto closeAll = [](std::vector<int> &sockets, int keep1, int keep2) {
+    for (int &socket : sockets) {
+      if (socket >= 0 && socket != keep1 && socket != keep2) {
+        close(socket);
+        socket = -1;
+      }
+    }
+  };
+  if (!created) {
+    std::cerr << "Could not create the strip sockets" << std::endl;
+    closeAll(control, -1, -1);
+    closeAll(links, -1, -1);
+    return false;
+  }
+
+  for (int i = 0; i < strips; i++) {
+    Worker worker;
+    stripRows(p.height, i, strips, worker.rowBegin, worker.rowEnd);
+    worker.control = control[2 * i];
+    // strip i holds the second end of the link above it, the first of the
+    // link below it
+    int up = i > 0 ? links[2 * (i - 1) + 1] : -1;
+    int down = i + 1 < strips ? links[2 * i] : -1;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+      // the worker keeps its own three sockets, nothing else of the parent
+      // runs in it - it never returns from here
+      int own = control[2 * i + 1];
+      closeAll(control, own, -1);
+      closeAll(links, up, down);
+      workerMain(p, worker.rowBegin, worker.rowEnd, own, up, down);
+      _exit(0);
+    }
+    if (pid < 0) {
+      std::cerr << "Could not start strip worker " << i << std::endl;
+      // the workers already started own the parent ends until stop()
+      for (int j = 0; j < strips; j++) {
+        close(control[2 * j + 1]);
+        if (j >= i) {
+          close(control[2 * j]);
+        }
+      }
+      closeAll(links, -1, -1);
+      stop();
+      return false;
+    }
+    worker.pid = (int)pid;
+    m_workers.push_back(worker);
+  }
+
+  // the parent only keeps its ends of the control sockets
+  for (int i = 0; i < strips; i++) {
+    close(control[2 * i + 1]);
+  }
+  closeAll(links, -1, -1);
+  return true;
+}
+
+void ClothDomain::stop() {
+  Message quit = {Command::Quit, 0};
+  for (Worker &worker : m_workers) {
+    sendAll(worker.control, &quit, sizeof(quit));
+    close(worker.control);
+  }
+  for (Worker &worker : m_workers) {
+    int status = 0;
+    waitpid((pid_t)worker.pid, &status, 0);
+  }
+  m_workers.clear();
+}
+
+bool ClothDomain::step(int frames) {
+  // all strips step at once, they only wait on each other for the halos
+  Message message = {Command::Step, (uint32_t)frames};
+  bool ok = true;
+  for (Worker &worker : m_workers) {
+    ok = sendAll(worker.control, &message, sizeof(message)) && ok;
+  }
+  for (Worker &worker : m_workers) {
+    uint32_t frame = 0;
+    ok = recvAll(worker.control, &frame, sizeof(frame)) && ok;
+    m_frame = (int)frame;
+  }
+  return ok;
+}
+
+std::vector<ClothDomain::ClothParticle> ClothDomain::gather() {
+  std::vector<ClothParticle> grid((size_t)m_width * m_height);
+  Message message = {Command::Gather, 0};
+  for (Worker &worker : m_workers) {
+    size_t rows = (size_t)(worker.rowEnd - worker.rowBegin);
+    if (!sendAll(worker.control, &message, sizeof(message)) ||
+        !recvAll(worker.control, &grid[(size_t)worker.rowBegin * m_width],
+                 rows * m_width * sizeof(ClothParticle))) {
+      std::cerr << "Lost strip worker " << worker.pid << std::endl;
+      return {};
+    }
+  }
+  return grid;
+}
+
+void ClothDomain::workerMain(const ClothParameters &p, int rowBegin,
+                             int rowEnd, int control, int up, int down) {
+  // each process is one of many, and a forked child has none of the threads
+  // of the parent's pools - the cloth is set up and stepped on this thread
+  ClothCPU cloth;
+  cloth.stripBegin = rowBegin;
+  cloth.stripEnd = rowEnd;
+  cloth.serial = true;
+  cloth.initiateNewCloth(p);
+
+  Message message;
+  while (recvAll(control, &message, sizeof(message))) {
+    if (message.command == Command::Step) {
+      for (uint32_t i = 0; i < message.frames; i++) {
+        cloth.stepParticles();
+        if (!exchangeHalos(cloth, up, down)) {
+          return;
+        }
+        cloth.buildVertices();
+      }
+      uint32_t frame = (uint32_t)cloth.frame;
+      if (!sendAll(control, &frame, sizeof(frame))) {
+        return;
+      }
+    } else if (message.command == Command::Gather) {
+      size_t bytes =
+          (size_t)(rowEnd - rowBegin) * p.width * sizeof(ClothParticle);
+      if (!sendAll(control, cloth.currentRow(rowBegin), bytes)) {
+        return;
+      }
+    } else {
+      return;
+    }
+  }
+}
+
+bool ClothDomain::exchangeHalos(ClothCPU &cloth, int up, int down) {
+  // the upper strip of a pair sends first and the lower one receives first,
+  // so along the grid every exchange finds its partner ready
+  int halo = ClothCPU::HaloRows;
+  size_t bytes = (size_t)halo * cloth.parameters.width * sizeof(ClothParticle);
+  if (up >= 0) {
+    if (!recvAll(up, cloth.currentRow(cloth.rowBegin() - halo), bytes) ||
+        !sendAll(up, cloth.currentRow(cloth.rowBegin()), bytes)) {
+      return false;
+    }
+  }
+  if (down >= 0) {
+    if (!sendAll(down, cloth.currentRow(cloth.rowEnd() - halo), bytes) ||
+        !recvAll(down, cloth.currentRow(cloth.rowEnd()), bytes)) {
+      return false;
+    }
+  }
+  return true;
+}
+#endif
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "ClothCPU.h"
+
+#include <cstdint>
+#include <vector>
+
+// A grid cloth split into horizontal strips, each simulated by its own CPU
+// backend worker process. This is how a cloth too large for one device (or
+// one process) runs: every strip only stores its own rows and the
+// ClothCPU::HaloRows rows on each side, and after every step it sends its
+// first and last rows to the neighbouring strips over a local socket and
+// receives their edge rows in return. The result is the same as stepping the
+// whole grid in one ClothCPU.
+//
+// Neighbours exchange in a fixed order - the upper strip of a pair sends
+// first - so no socket ever waits on a full buffer. Workers are forked, and
+// only on POSIX systems.
+class ClothDomain {
+public:
+  using ClothParticle = ClothObject::ClothParticle;
+  using ClothParameters = ClothObject::ClothParameters;
+
+  ~ClothDomain() { stop(); }
+
+  // forks one worker per strip of a grid cloth, strips are clamped so that
+  // each has at least HaloRows rows - false if the workers cannot be started
+  bool start(const ClothParameters &p, int strips);
+  void stop();
+  bool running() const { return !m_workers.empty(); }
+
+  int stripCount() const { return (int)m_workers.size(); }
+  int frame() const { return m_frame; }
+
+  // steps every strip frames times, returns once all of them are done
+  bool step(int frames);
+  // particle state of the last step, gathered from the strips in grid order
+  std::vector<ClothParticle> gather();
+
+  // rows [begin, end) of strip part of parts of a grid
+  static void stripRows(int height, int part, int parts, int &begin,
+                        int &end);
+
+private:
+  struct Worker {
+    int pid = -1;
+    // socket to the worker, commands go in and replies come back
+    int control = -1;
+    int rowBegin = 0;
+    int rowEnd = 0;
+  };
+
+  // the main loop of a worker process, up and down are the sockets to the
+  // neighbouring strips (-1 at the edges of the grid)
+  static void workerMain(const ClothParameters &p, int rowBegin, int rowEnd,
+                         int control, int up, int down);
+  static bool exchangeHalos(ClothCPU &cloth, int up, int down);
+
+  std::vector<Worker> m_workers;
+  int m_width = 0;
+  int m_height = 0;
+  int m_frame = 0;
+};
@@ -0,0 +1,219 @@
+#include "ClothInitializer.h"
+#include "ParallelFor.h"
+#include "ResourceManager.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+using vec3 = ClothInitializer::vec3;
+using InitUniforms = ClothInitializer::InitUniforms;
+using MeshVertex = ClothInitializer::MeshVertex;
+using InitialState = ClothInitializer::InitialState;
+
+InitUniforms ClothInitializer::computeUniforms(const ClothParameters &p,
+                                               uint32_t meshVertexCount) {
+  // fill in the init uniform datastructure from a set of cloth parameters
+  InitUniforms u;
+  u.width = (uint32_t)p.width;
+  u.height = (uint32_t)p.height;
+  u.generator = (uint32_t)p.initialState;
+  u.seed = p.initSeed;
+
+  // same layout as ClothObject::fillGridRows
+  u.particleDist = p.scale / p.height;
+  u.offsetX = p.width % 2 == 1 ? 0.0f : u.particleDist / 2.0f;
+  u.offsetY = p.height % 2 == 1 ? 0.0f : u.particleDist / 2.0f;
+  u.amount = p.crumpleAmount;
+
+  // the draped cloth wraps the sphere where it is on the first frame
+  ClothObject::ClothUniforms simulation = ClothObject::computeUniforms(p);
+  ClothObject::advanceUniforms(p, 0.0, simulation);
+  u.collider =
+      vec3(simulation.sphereX, simulation.sphereY, simulation.sphereZ);
+  u.colliderRadius = p.sphereRadius;
+
+  u.meshVertexCount = meshVertexCount;
+  u.particleOrder = (uint32_t)ClothObject::gridLayout(p).order;
+  u.particlePrecision = (uint32_t)ClothObject::particlePrecision(p);
+  u.garbage[0] = 0.0f;
+  return u;
+}
+
+bool ClothInitializer::loadMesh(const path &path,
+                                std::vector<MeshVertex> &vertices) {
+  vertices.clear();
+  std::vector<ResourceManager::VertexAttributes> vertexData;
+  if (path.empty() ||
+      !ResourceManager::loadGeometryFromObj(path, vertexData)) {
+    return false;
+  }
+
+  vertices.reserve(vertexData.size());
+  for (const ResourceManager::VertexAttributes &vertex : vertexData) {
+    MeshVertex meshVertex;
+    meshVertex.position = vertex.position;
+    meshVertex.u = vertex.uv.x;
+    meshVertex.v = vertex.uv.y;
+    meshVertex.garbage[0] = meshVertex.garbage[1] = meshVertex.garbage[2] = 0;
+    vertices.push_back(meshVertex);
+  }
+  return true;
+}
+
+uint32_t ClothInitializer::hash(uint32_t value) {
+  uint32_t state = value * 747796405u + 2891336453u;
+  uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+  return (word >> 22u) ^ word;
+}
+
+void ClothInitializer::generate(const ClothParameters &p,
+                                const std::vector<MeshVertex> &mesh,
+                                ClothParticle *particles, bool serial) {
+  InitUniforms u = computeUniforms(p, (uint32_t)mesh.size());
+  GridLayout layout = ClothObject::gridLayout(p);
+  auto run = [&](const std::function<void(int begin, int end)> &rows) {
+    if (serial) {
+      rows(0, p.height);
+    } else {
+      ParallelFor::run(p.height, 64, rows);
+    }
+  };
+  if (layout.order == GridLayout::Order::RowMajor) {
+    run([&](int rowBegin, int rowEnd) {
+      generateRows(p, u, mesh, particles + (size_t)rowBegin * p.width,
+                   rowBegin, rowEnd);
+    });
+    return;
+  }
+
+  // other layouts are generated row by row, then moved into place
+  std::vector<ClothParticle> grid((size_t)p.width * p.height);
+  run([&](int rowBegin, int rowEnd) {
+    generateRows(p, u, mesh, grid.data() + (size_t)rowBegin * p.width,
+                 rowBegin, rowEnd);
+    for (int row = rowBegin; row < rowEnd; row++) {
+      for (int col = 0; col < p.width; col++) {
+        particles[layout.index(col, row)] = grid[(size_t)row * p.width + col];
+      }
+    }
+  });
+}
+
+void ClothInitializer::generateStrip(const ClothParameters &p,
+                                     const std::vector<MeshVertex> &mesh,
+                                     int rowBegin, int rowEnd,
+                                     ClothParticle *particles) {
+  // a worker process is one of many, it generates on its own thread
+  InitUniforms u = computeUniforms(p, (uint32_t)mesh.size());
+  generateRows(p, u, mesh, particles, rowBegin, rowEnd);
+}
+
+void ClothInitializer::generate(const ClothParameters &p,
+                                const ClothTopology &topology,
+                                ClothParticle *particles) {
+  for (size_t i = 0; i < topology.particleCount(); i++) {
+    particles[i].position = topology.restPositions[i] * p.scale;
+    particles[i].garbage1 = 0.0f;
+    particles[i].velocity = vec3(0.0f, 0.0f, 0.0f);
+    particles[i].garbage2 = 0.0f;
+  }
+}
+
+void ClothInitializer::generateRows(const ClothParameters &p,
+                                    const InitUniforms &u,
+                                    const std::vector<MeshVertex> &mesh,
+                                    ClothParticle *particles, int rowBegin,
+                                    int rowEnd) {
+  // see init_particles() in init.wgsl - start from the flat grid and move
+  // every particle according to the generator
+  ClothObject::fillGridRows(p, particles, rowBegin, rowEnd);
+  if (p.initialState == InitialState::Flat) {
+    return;
+  }
+
+  for (int row = rowBegin; row < rowEnd; row++) {
+    for (int col = 0; col < p.width; col++) {
+      vec3 &pos = particles[(size_t)(row - rowBegin) * p.width + col].position;
+      switch (p.initialState) {
+      case InitialState::Draped:
+        pos = drapedPosition(u, pos);
+        break;
+      case InitialState::Crumpled:
+        pos.z = crumpleHeight(u, col, row);
+        break;
+      case InitialState::Mesh:
+        pos = meshPosition(u, mesh, pos, col, row);
+        break;
+      default:
+        break;
+      }
+    }
+  }
+}
+
+float ClothInitializer::latticeHeight(const InitUniforms &u, uint32_t cx,
+                                      uint32_t cy) {
+  // random height in [-1, 1) of one crumple lattice point
+  uint32_t h = hash(cx ^ hash(cy ^ hash(u.seed)));
+  return (float)h / 4294967296.0f * 2.0f - 1.0f;
+}
+
+float ClothInitializer::crumpleHeight(const InitUniforms &u, uint32_t ix,
+                                      uint32_t iy) {
+  uint32_t cx = ix / CrumpleCell;
+  uint32_t cy = iy / CrumpleCell;
+  // smoothstep weights between the four surrounding lattice points
+  float fx = (float)(ix % CrumpleCell) / (float)CrumpleCell;
+  float fy = (float)(iy % CrumpleCell) / (float)CrumpleCell;
+  fx = fx * fx * (3.0f - 2.0f * fx);
+  fy = fy * fy * (3.0f - 2.0f * fy);
+  float bottom = glm::mix(latticeHeight(u, cx, cy),
+                          latticeHeight(u, cx + 1, cy), fx);
+  float top = glm::mix(latticeHeight(u, cx, cy + 1),
+                       latticeHeight(u, cx + 1, cy + 1), fx);
+  float cellLength = (float)CrumpleCell * u.particleDist;
+  return glm::mix(bottom, top, fy) * u.amount * cellLength;
+}
+
+vec3 ClothInitializer::drapedPosition(const InitUniforms &u,
+                                      const vec3 &gridPos) {
+  // the cloth lies in the plane of the sphere center and wraps the half of
+  // the sphere facing -z, half a particle away from its surface
+  float radius = u.colliderRadius + u.particleDist * 0.5f;
+  float dx = gridPos.x - u.collider.x;
+  float dy = gridPos.y - u.collider.y;
+  float d2 = dx * dx + dy * dy;
+  float z = u.collider.z;
+  if (d2 < radius * radius) {
+    z -= std::sqrt(radius * radius - d2);
+  }
+  return vec3(gridPos.x, gridPos.y, z);
+}
+
+vec3 ClothInitializer::meshPosition(const InitUniforms &u,
+                                    const std::vector<MeshVertex> &mesh,
+                                    const vec3 &gridPos, uint32_t ix,
+                                    uint32_t iy) {
+  // the particle's grid coordinates are looked up in the mesh uv layout and
+  // the position is interpolated inside the triangle that contains them
+  float uvx = (float)ix / (float)(std::max(u.width, 2u) - 1u);
+  float uvy = (float)iy / (float)(std::max(u.height, 2u) - 1u);
+  for (size_t i = 0; i + 2 < mesh.size(); i += 3) {
+    const MeshVertex &a = mesh[i];
+    const MeshVertex &b = mesh[i + 1];
+    const MeshVertex &c = mesh[i + 2];
+    float area = (b.u - a.u) * (c.v - a.v) - (c.u - a.u) * (b.v - a.v);
+    if (area == 0.0f) {
+      continue;
+    }
+    float wb = ((uvx - a.u) * (c.v - a.v) - (c.u - a.u) * (uvy - a.v)) / area;
+    float wc = ((b.u - a.u) * (uvy - a.v) - (uvx - a.u) * (b.v - a.v)) / area;
+    float wa = 1.0f - wb - wc;
+    if (wa >= -1e-5f && wb >= -1e-5f && wc >= -1e-5f) {
+      return wa * a.position + wb * b.position + wc * c.position;
+    }
+  }
+  // outside the uv layout - keep the flat grid
+  return gridPos;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "ClothObject.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+// Initial state generators. The GPU backend runs them in resources/init.wgsl
+// (ClothObject::generateInitialState) so a large cloth is never built on the
+// CPU, and this is the CPU equivalent used by the CPU backend and by the
+// deterministic mode. Both follow the same steps - only the float rounding of
+// the GPU can differ.
+class ClothInitializer {
+public:
+  // (Just aliases to make notations lighter)
+  using path = std::filesystem::path;
+  using vec3 = glm::vec3;
+  using ClothParticle = ClothObject::ClothParticle;
+  using ClothParameters = ClothObject::ClothParameters;
+  using InitialState = ClothObject::InitialState;
+
+  // mesh vertex of the mesh generator, triangles are consecutive triplets
+  struct MeshVertex {
+    vec3 position;
+    float u;
+    float v;
+    // padding to the 32 byte array stride of the shader
+    float garbage[3];
+  };
+
+  // init shader uniform data structure
+  struct InitUniforms {
+    uint32_t width;
+    uint32_t height;
+    uint32_t generator;
+    uint32_t seed;
+
+    float particleDist;
+    float offsetX;
+    float offsetY;
+    float amount;
+
+    vec3 collider;
+    float colliderRadius;
+
+    uint32_t meshVertexCount;
+    // GridLayout::Order and ParticlePrecision of the particle buffer
+    uint32_t particleOrder;
+    uint32_t particlePrecision;
+    float garbage[1];
+  };
+
+  // crumple folds are interpolated between random heights every CrumpleCell
+  // particles
+  static constexpr uint32_t CrumpleCell = 8;
+
+  static InitUniforms computeUniforms(const ClothParameters &p,
+                                      uint32_t meshVertexCount);
+
+  // loads the triangles of an .obj file with their uvs, returns false (and no
+  // triangles) if it cannot be read
+  static bool loadMesh(const path &path, std::vector<MeshVertex> &vertices);
+
+  // writes the initial state of every particle in the storage order of the
+  // cloth, rows are spread over threads unless serial
+  static void generate(const ClothParameters &p,
+                       const std::vector<MeshVertex> &mesh,
+                       ClothParticle *particles, bool serial = false);
+
+  // writes rows [rowBegin, rowEnd) of the grid in row-major order on the
+  // calling thread, particles holding the first of them - the strip of one
+  // ClothDomain worker or the stored rows of one tile (see ClothTiles)
+  static void generateStrip(const ClothParameters &p,
+                            const std::vector<MeshVertex> &mesh, int rowBegin,
+                            int rowEnd, ClothParticle *particles);
+
+  // a garment starts still, in its rest shape at the cloth scale
+  static void generate(const ClothParameters &p, const ClothTopology &topology,
+                       ClothParticle *particles);
+
+  // integer hash shared with the shader (PCG output permutation)
+  static uint32_t hash(uint32_t value);
+
+private:
+  // particles holds row rowBegin
+  static void generateRows(const ClothParameters &p, const InitUniforms &u,
+                           const std::vector<MeshVertex> &mesh,
+                           ClothParticle *particles, int rowBegin, int rowEnd);
+  static float latticeHeight(const InitUniforms &u, uint32_t cx, uint32_t cy);
+  static float crumpleHeight(const InitUniforms &u, uint32_t ix, uint32_t iy);
+  static vec3 drapedPosition(const InitUniforms &u, const vec3 &gridPos);
+  static vec3 meshPosition(const InitUniforms &u,
+                           const std::vector<MeshVertex> &mesh,
+                           const vec3 &gridPos, uint32_t ix, uint32_t iy);
+};
@@ -1,4 +1,6 @@
 #include "ClothObject.h"
+#include "BufferPool.h"
+#include "ClothInitializer.h"
 
 #include <GLFW/glfw3.h>
 #include <glfw3webgpu.h>
@@ -8,160 +10,956 @@
 #define GLM_FORCE_LEFT_HANDED
 #include <glm/ext.hpp>
 #include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
 #include <glm/gtx/polar_coordinates.hpp>
 
 #include <backends/imgui_impl_glfw.h>
 #include <backends/imgui_impl_wgpu.h>
 #include <imgui.h>
 
+#ifdef __EMSCRIPTEN__
+#include <emscripten.h>
+#endif
+#ifdef WEBGPU_BACKEND_WGPU
+#include <webgpu/wgpu.h>
+#endif
+
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
+#include <cmath>
+#include <cstring>
+#include <iostream>
 
 using namespace wgpu;
 using ClothVertex = ClothObject::ClothVertex;
 using ClothParticle = ClothObject::ClothParticle;
 using ClothUniforms = ClothObject::ClothUniforms;
+using ClothParameters = ClothObject::ClothParameters;
+
+// fixed point step used by the deterministic solver mode (2^-16 world units)
+constexpr float DETERMINISTIC_QUANTUM = 1.0f / 65536.0f;
+// default maxComputeWorkgroupsPerDimension
+constexpr uint32_t MAX_WORKGROUPS_PER_DIMENSION = 65535;
 
 void ClothObject::initiateNewCloth(ClothParameters &p, wgpu::Device &device) {
   // initiation function
+  // free the previous cloth first - every GUI reset comes through here
+  terminateAll();
   // set cloth parameters
   updateParameters(p);
+  chooseTiles(p, device);
   // init functions
   initBuffers(device);
+  initUniforms(device);
   initBindGroupLayout(device);
   initComputePipeline(device);
+  initInitPipeline(device);
   initBindGroup(device);
+  writeIndices(device);
+  initComponents(device);
 
   // fill in uniform and particle buffers
   updateUniforms(device);
   fillBuffer(device);
+  if (!tiled()) {
+    m_watchdog.init(*this, device);
+  }
+}
+
+void ClothObject::chooseTiles(ClothParameters &p, wgpu::Device &device) {
+  // a grid too wide for even the smallest tile is narrowed instead of being
+  // built with bindings the device rejects
+  uint64_t limit = ClothTiles::bindingLimit(device);
+  int maxWidth = ClothTiles::maxWidth(*this, limit);
+  if (parameters.topology == Topology::Grid && parameters.width > maxWidth) {
+    std::cerr << "Rows of a " << parameters.width
+              << " particle wide cloth do not fit in a tile, narrowing it to "
+              << maxWidth << std::endl;
+    p.width = maxWidth;
+    parameters.width = maxWidth;
+    updateDerivedParameters();
+  }
+  m_tileRows = ClothTiles::rowsPerTile(*this, limit);
+  if (tiled()) {
+    keepTiledParameters(p);
+  }
+}
+
+void ClothObject::keepTiledParameters(ClothParameters &p) {
+  // tiles are full rows, stored row-major, and only the vertex buffer path
+  // draws them - the statistics that adapt the step are not available
+  bool changed = false;
+  if (parameters.particleOrder != GridLayout::Order::RowMajor ||
+      parameters.renderPath != RenderPath::VertexBuffer) {
+    std::cerr << "Tiled cloths are stored row-major and drawn from vertex "
+                 "buffers"
+              << std::endl;
+    p.particleOrder = parameters.particleOrder = GridLayout::Order::RowMajor;
+    p.renderPath = parameters.renderPath = RenderPath::VertexBuffer;
+    changed = true;
+  }
+  if (adaptiveStep(parameters)) {
+    std::cerr << "Tiled cloths have no statistics, keeping a fixed time step"
+              << std::endl;
+    p.adaptiveStep = parameters.adaptiveStep = false;
+    changed = true;
+  }
+  if (changed) {
+    updateDerivedParameters();
+  }
+}
+
+void ClothObject::initComponents(wgpu::Device &device) {
+  // a tiled cloth has no buffer holding the whole grid, which the proxy and
+  // the statistics bind
+  if (tiled()) {
+    m_tiles.init(*this, device, m_tileRows);
+    return;
+  }
+  if (simulationLod(parameters)) {
+    m_proxy.init(*this, device);
+  }
+  m_stats.init(*this, device);
 }
 
 void ClothObject::processFrame(wgpu::Device &device) {
   // update function that runs every frame
 
+  // statistics of earlier frames that have arrived meanwhile, a diverged
+  // cloth rewinds the frame count before it is advanced
+  m_stats.poll();
+  m_watchdog.check(*this, device);
+  updateTimeStep();
+
   frame += 1;
-  currentT += parameters.deltaT;
+  simTime += parameters.deltaT;
 
   // uniform update happens every frame to update time
   updateUniforms(device);
-  // repeat bindgroup inititation to switch which buffer is input and output
-  initBindGroup(device);
+  if (m_proxy.initialized()) {
+    m_proxy.beginFrame(*this, device);
+  }
 
   // simulation step
   computePass(device);
+
+  // deterministic runs record a hash of every frame so runs can be diffed
+  if (parameters.solverMode == SolverMode::Deterministic) {
+    lastStateHash = readStateHash(device);
+  }
 }
 
 void ClothObject::updateParameters(ClothParameters &p) {
   // fill in new parameters, calculate extra determined parameters, and fill in
   // uniform datastructure (but not buffer)
+  // a garment is loaded and reordered once per file and kept across restarts,
+  // a file that cannot be read falls back to the grid
+  if (p.topology == Topology::Mesh && p.topologyMesh != m_topologyPath) {
+    m_topology = ClothTopology();
+    m_topologyPath.clear();
+    if (ClothTopology::loadObj(p.topologyMesh, m_topology)) {
+      m_topologyPath = p.topologyMesh;
+    } else {
+      std::cerr << "Could not load garment " << p.topologyMesh << std::endl;
+    }
+  }
+  if (p.topology == Topology::Mesh && m_topologyPath.empty()) {
+    p.topology = Topology::Grid;
+  }
   parameters = p;
-
-  numParticles = parameters.width * parameters.height;
-  m_bufferSize = numParticles * sizeof(ClothParticle);
-  numVertices = 3 * 2 * (parameters.width - 1) * (parameters.height - 1);
-  totalMass = parameters.scale * parameters.massScale;
-  particleMass = totalMass / numParticles;
-  particleDist = parameters.scale / parameters.height;
+  updateDerivedParameters();
 
   currentT = 0;
   frame = 0;
+  simTime = 0.0;
+  m_timeStepResults = 0;
+}
+
+void ClothObject::updateDerivedParameters() {
+  // values determined by the parameters, including the uniform datastructure
+  if (parameters.topology == Topology::Mesh) {
+    numParticles = (int)m_topology.particleCount();
+    numVertices = 3 * (int)m_topology.triangleCount();
+  } else {
+    numParticles = parameters.width * parameters.height;
+    numVertices = 3 * 2 * (parameters.width - 1) * (parameters.height - 1);
+  }
+  m_bufferSize =
+      numParticles * particleStride(particlePrecision(parameters));
+  totalMass = parameters.scale * parameters.massScale;
+  particleMass = totalMass / numParticles;
 
   // update uniforms
-  uniforms.width = (float)parameters.width;
-  uniforms.height = (float)parameters.height;
+  if (parameters.topology == Topology::Mesh) {
+    uniforms = computeUniforms(parameters, m_topology);
+  } else {
+    uniforms = computeUniforms(parameters);
+  }
+  particleDist = uniforms.particleDist;
+}
 
-  uniforms.particleDist = particleDist;
-  uniforms.particleMass = particleMass;
-  uniforms.particleScale = parameters.scale;
+ClothObject::ReconfigureTier
+ClothObject::reconfigureTier(const ClothParameters &from,
+                             const ClothParameters &to) {
+  // the solver mode, topology, storage precisions and render path decide the
+  // shaders, layouts and buffer strides, the grid
+  // size decides the buffers and bind groups, everything else only reaches
+  // the uniforms
+  if (from.solverMode != to.solverMode || from.topology != to.topology ||
+      from.topologyMesh != to.topologyMesh ||
+      from.particlePrecision != to.particlePrecision ||
+      from.vertexPrecision != to.vertexPrecision ||
+      from.renderPath != to.renderPath) {
+    return ReconfigureTier::Rebuild;
+  }
+  // a new initial state or layout restarts the cloth the same way a new size
+  // does - a garment's size comes from its mesh, not from width and height
+  bool grid = to.topology == Topology::Grid;
+  if ((grid && (from.width != to.width || from.height != to.height)) ||
+      from.particleOrder != to.particleOrder ||
+      from.tileRows != to.tileRows || from.simLodStep != to.simLodStep ||
+      from.initialState != to.initialState || from.initSeed != to.initSeed ||
+      from.crumpleAmount != to.crumpleAmount || from.initMesh != to.initMesh) {
+    return ReconfigureTier::Resize;
+  }
+  if (from.scale != to.scale || from.massScale != to.massScale ||
+      from.maxStretch != to.maxStretch || from.minStretch != to.minStretch ||
+      from.closeSpringStrength != to.closeSpringStrength ||
+      from.farSpringStrength != to.farSpringStrength ||
+      from.wind_dir != to.wind_dir || from.wind_strength != to.wind_strength ||
+      from.sphereRadius != to.sphereRadius ||
+      from.spherePeriod != to.spherePeriod ||
+      from.sphereRange != to.sphereRange || from.deltaT != to.deltaT ||
+      from.lodCellPixels != to.lodCellPixels ||
+      from.simLodCellPixels != to.simLodCellPixels ||
+      from.statsInterval != to.statsInterval ||
+      from.snapshotInterval != to.snapshotInterval ||
+      from.adaptiveStep != to.adaptiveStep ||
+      from.minDeltaT != to.minDeltaT || from.maxDeltaT != to.maxDeltaT ||
+      from.stepTolerance != to.stepTolerance) {
+    return ReconfigureTier::Uniforms;
+  }
+  return ReconfigureTier::None;
+}
+
+ClothObject::ReconfigureTier ClothObject::reconfigure(ClothParameters &p,
+                                                      wgpu::Device &device) {
+  // apply a parameter change from the gui without rebuilding more than needed
+  ReconfigureTier tier = reconfigureTier(parameters, p);
+  switch (tier) {
+  case ReconfigureTier::Rebuild:
+    initiateNewCloth(p, device);
+    break;
+  case ReconfigureTier::Resize:
+    resize(p, device);
+    break;
+  case ReconfigureTier::Uniforms:
+    // the simulation keeps running, only the uniform buffer is rewritten
+    parameters = p;
+    updateDerivedParameters();
+    if (tiled()) {
+      keepTiledParameters(p);
+    }
+    updateUniforms(device);
+    break;
+  case ReconfigureTier::None:
+    break;
+  }
+  return tier;
+}
+
+void ClothObject::resize(ClothParameters &p, wgpu::Device &device) {
+  // restart the cloth with a new grid size, keeping pipelines and layouts
+  RenderPath renderPath = parameters.renderPath;
+  updateParameters(p);
+  chooseTiles(p, device);
+  // a grid that became tiled leaves the pulling path, which takes new
+  // pipelines
+  if (parameters.renderPath != renderPath) {
+    initiateNewCloth(p, device);
+    return;
+  }
+  m_proxy.terminate();
+  m_stats.terminate();
+  m_watchdog.terminate();
+  m_tiles.terminate();
+
+  // buffers are reallocated only when the new grid does not fit, shrinking
+  // reuses them - a tiled grid has its own
+  bool indicesFit = m_indexBuffer == nullptr ||
+                    indexBufferBytes() <= m_indexBuffer.getSize();
+  if (tiled() || m_vertexBuffer == nullptr ||
+      numParticles > m_particleCapacity ||
+      vertexBufferBytes() > m_vertexBuffer.getSize() || !indicesFit) {
+    terminateBuffers();
+    initBuffers(device);
+  }
+
+  // bind groups cover exactly the particles and vertices in use
+  terminateBindGroups();
+  initBindGroup(device);
+  writeIndices(device);
+  initComponents(device);
+
+  updateUniforms(device);
+  fillBuffer(device);
+  if (!tiled()) {
+    m_watchdog.init(*this, device);
+  }
+}
+
+ClothUniforms ClothObject::computeUniforms(const ClothParameters &p) {
+  // fill in the uniform datastructure from a set of cloth parameters
+  ClothUniforms u;
+  int particleCount = p.width * p.height;
+  float mass = p.scale * p.massScale / particleCount;
 
-  uniforms.maxStretch = parameters.maxStretch;
-  uniforms.minStretch = parameters.minStretch;
+  u.width = (float)p.width;
+  u.height = (float)p.height;
 
-  uniforms.closeSpringStrength = parameters.closeSpringStrength;
-  uniforms.farSpringStrength = parameters.farSpringStrength;
+  u.particleDist = p.scale / p.height;
+  u.particleMass = mass;
+  u.particleScale = p.scale;
 
-  uniforms.wind_strength = parameters.wind_strength;
-  uniforms.wind_dir = parameters.wind_dir;
+  u.maxStretch = p.maxStretch;
+  u.minStretch = p.minStretch;
 
-  uniforms.sphereRadius = parameters.sphereRadius;
-  uniforms.sphereX = 0;
-  uniforms.sphereY = 0;
-  uniforms.sphereZ = -5;
+  u.closeSpringStrength = p.closeSpringStrength;
+  u.farSpringStrength = p.farSpringStrength;
 
-  uniforms.deltaT = parameters.deltaT;
-  uniforms.currentT = currentT;
+  u.wind_strength = p.wind_strength;
+  u.wind_dir = p.wind_dir;
+
+  u.sphereRadius = p.sphereRadius;
+  u.sphereX = 0;
+  u.sphereY = 0;
+  u.sphereZ = -5;
+
+  u.deltaT = p.deltaT;
+  u.currentT = 0;
+
+  u.quantization = p.solverMode == SolverMode::Deterministic
+                       ? DETERMINISTIC_QUANTUM
+                       : 0.0f;
+
+  u.particleOrder = (uint32_t)gridLayout(p).order;
+  u.particlePrecision = (uint32_t)particlePrecision(p);
+  u.vertexPrecision = (uint32_t)p.vertexPrecision;
+  u.forceScale = 1.0f;
+
+  // an untiled cloth stores and steps the whole grid
+  u.tileFirstRow = 0;
+  u.tileRowBegin = 0;
+  u.tileRowEnd = (uint32_t)p.height;
+  u.tileRows = (uint32_t)p.height;
+  return u;
 }
 
-void ClothObject::fillBuffer(wgpu::Device &device) {
-  // fill in the particle buffers with initial particle values based on width
-  // and height and particleDist
+ClothUniforms ClothObject::computeUniforms(const ClothParameters &p,
+                                          const ClothTopology &topology) {
+  // the garment kernel takes its rest lengths from the topology, particleDist
+  // is only their mean at the current scale
+  ClothUniforms u = computeUniforms(p);
+  float particleCount = (float)std::max<size_t>(topology.particleCount(), 1);
+  u.particleMass = p.scale * p.massScale / particleCount;
+  u.particleDist = topology.meanRestLength() * p.scale;
+  return u;
+}
+
+void ClothObject::advanceUniforms(const ClothParameters &p, double time,
+                                  ClothUniforms &u) {
+  // the time is the sum of the steps so far, which follows a step that
+  // changes mid-run. A float step summed in double is exact for any reachable
+  // frame count, so a fixed step still gives exactly frame * deltaT and every
+  // deterministic run sees the same inputs
+  u.currentT = (float)time;
+
+  // calculate sphere position - a triangle wave over 2 * spherePeriod
+  double period = std::max(2.0 * (double)p.spherePeriod, 1e-6);
+  double phase = std::fmod(time, period) / period;
+  float sphere_period = (float)(2.0 * phase - 1.0);
+  float sphere_sign = sphere_period < 0.0f ? -1.0f : 1.0f;
+  u.sphereZ =
+      p.sphereRange * (1.0f + sphere_sign * (sphere_period * 2.0f) - 2.0f);
+}
 
-  std::vector<ClothParticle> particleData;
-  std::vector<ClothParticle> particleData2;
+GridLayout ClothObject::gridLayout(const ClothParameters &p) {
+  GridLayout layout;
+  layout.width = (uint32_t)p.width;
+  layout.height = (uint32_t)p.height;
+  layout.order = p.topology == Topology::Grid ? p.particleOrder
+                                              : GridLayout::Order::RowMajor;
+  return layout;
+}
+
+void ClothObject::toGridOrder(const GridLayout &layout,
+                              const ClothParticle *stored, size_t count,
+                              std::vector<ClothParticle> &grid) {
+  if (layout.order == GridLayout::Order::RowMajor) {
+    grid.assign(stored, stored + count);
+    return;
+  }
+  grid.resize(count);
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t x, y;
+    layout.coords(i, x, y);
+    grid[(size_t)y * layout.width + x] = stored[i];
+  }
+}
+
+void ClothObject::fillGridRows(const ClothParameters &p,
+                               ClothParticle *particles, int rowBegin,
+                               int rowEnd) {
+  // initial particle values based on width and height and particleDist
+  float particleDist = p.scale / p.height;
 
   // center grid on 0,0
   float offsetX = particleDist / 2.0f;
-  if (parameters.width % 2 == 1) {
+  if (p.width % 2 == 1) {
     offsetX = 0;
   }
   float offsetY = particleDist / 2.0f;
-  if (parameters.height % 2 == 1) {
+  if (p.height % 2 == 1) {
     offsetY = 0;
   }
 
-  // grid initialization
-  for (int y = -(parameters.height) / 2; y < (parameters.height + 1) / 2; y++) {
-    for (int x = -(parameters.width) / 2; x < (parameters.width + 1) / 2; x++) {
-      ClothParticle particle;
-      particle.position =
+  // grid initialization - row r holds y = r - height / 2
+  for (int row = rowBegin; row < rowEnd; row++) {
+    int y = row - p.height / 2;
+    ClothParticle *particle = particles + (size_t)(row - rowBegin) * p.width;
+    for (int x = -(p.width) / 2; x < (p.width + 1) / 2; x++) {
+      particle->position =
           vec3(x * particleDist + offsetX, y * particleDist + offsetY, 0.0f);
-      particle.velocity = vec3(0.0f, 0.0f, 0.0f);
+      particle->garbage1 = 0.0f;
+      particle->velocity = vec3(0.0f, 0.0f, 0.0f);
+      particle->garbage2 = 0.0f;
+      particle++;
+    }
+  }
+}
 
-      particleData.push_back(particle);
+ClothObject::ParticlePrecision
+ClothObject::particlePrecision(const ClothParameters &p) {
+  // f16 velocities cannot hold the fixed point grid of the deterministic mode
+  return p.solverMode == SolverMode::Deterministic ? ParticlePrecision::Full
+                                                   : p.particlePrecision;
+}
 
-      // second particle buffer is copied
-      ClothParticle particle2;
-      particle2.position =
-          vec3(x * particleDist + offsetX, y * particleDist + offsetY, 0.0f);
-      particle2.velocity = vec3(0.0f, 0.0f, 0.0f);
+uint32_t ClothObject::particleStride(ParticlePrecision precision) {
+  // position and two f16 velocity words, or the padded ClothParticle
+  return precision == ParticlePrecision::HalfVelocity
+             ? 5 * sizeof(uint32_t)
+             : sizeof(ClothParticle);
+}
+
+uint32_t ClothObject::vertexStride(VertexPrecision precision) {
+  // f16 position (w = 1), then f16 normal or one octahedral snorm16 pair
+  switch (precision) {
+  case VertexPrecision::Half:
+    return 4 * sizeof(uint32_t);
+  case VertexPrecision::OctNormal:
+    return 3 * sizeof(uint32_t);
+  default:
+    return sizeof(ClothVertex);
+  }
+}
+
+void ClothObject::packParticles(ParticlePrecision precision,
+                                const ClothParticle *particles, size_t count,
+                                void *stored) {
+  if (precision == ParticlePrecision::Full) {
+    std::memcpy(stored, particles, count * sizeof(ClothParticle));
+    return;
+  }
+  uint32_t *words = (uint32_t *)stored;
+  for (size_t i = 0; i < count; i++, words += 5) {
+    const ClothParticle &particle = particles[i];
+    std::memcpy(words, &particle.position, 3 * sizeof(float));
+    words[3] = glm::packHalf2x16(glm::vec2(particle.velocity));
+    words[4] = glm::packHalf2x16(glm::vec2(particle.velocity.z, 0.0f));
+  }
+}
+
+void ClothObject::unpackParticles(ParticlePrecision precision,
+                                  const void *stored, size_t count,
+                                  ClothParticle *particles) {
+  if (precision == ParticlePrecision::Full) {
+    std::memcpy(particles, stored, count * sizeof(ClothParticle));
+    return;
+  }
+  const uint32_t *words = (const uint32_t *)stored;
+  for (size_t i = 0; i < count; i++, words += 5) {
+    ClothParticle &particle = particles[i];
+    std::memcpy(&particle.position, words, 3 * sizeof(float));
+    particle.garbage1 = 0.0f;
+    particle.velocity = vec3(glm::unpackHalf2x16(words[3]),
+                             glm::unpackHalf2x16(words[4]).x);
+    particle.garbage2 = 0.0f;
+  }
+}
+
+void ClothObject::packVertex(VertexPrecision precision,
+                             const ClothVertex &vertex, uint32_t *stored) {
+  if (precision == VertexPrecision::Full) {
+    std::memcpy(stored, &vertex, sizeof(ClothVertex));
+    return;
+  }
+  const vec3 &n = vertex.normal;
+  stored[0] = glm::packHalf2x16(glm::vec2(vertex.position));
+  stored[1] = glm::packHalf2x16(glm::vec2(vertex.position.z, 1.0f));
+  if (precision == VertexPrecision::Half) {
+    stored[2] = glm::packHalf2x16(glm::vec2(n));
+    stored[3] = glm::packHalf2x16(glm::vec2(n.z, 0.0f));
+    return;
+  }
+  // octahedral mapping, the lower hemisphere is folded over the diagonals
+  vec2 oct = vec2(n) / (std::abs(n.x) + std::abs(n.y) + std::abs(n.z));
+  if (n.z < 0.0f) {
+    oct = (1.0f - glm::abs(vec2(oct.y, oct.x))) *
+          vec2(oct.x >= 0.0f ? 1.0f : -1.0f, oct.y >= 0.0f ? 1.0f : -1.0f);
+  }
+  stored[2] = glm::packSnorm2x16(oct);
+}
 
-      particleData2.push_back(particle2);
+ClothVertex ClothObject::unpackVertex(VertexPrecision precision,
+                                      const uint32_t *stored) {
+  ClothVertex vertex;
+  if (precision == VertexPrecision::Full) {
+    std::memcpy(&vertex, stored, sizeof(ClothVertex));
+    return vertex;
+  }
+  vertex.position = vec3(glm::unpackHalf2x16(stored[0]),
+                         glm::unpackHalf2x16(stored[1]).x);
+  vertex.garbage1 = 0.0f;
+  if (precision == VertexPrecision::Half) {
+    vertex.normal = vec3(glm::unpackHalf2x16(stored[2]),
+                         glm::unpackHalf2x16(stored[3]).x);
+  } else {
+    // see oct_decode() in shader.wgsl
+    vec2 oct = glm::unpackSnorm2x16(stored[2]);
+    vec3 n = vec3(oct, 1.0f - std::abs(oct.x) - std::abs(oct.y));
+    float t = std::max(-n.z, 0.0f);
+    n.x += n.x >= 0.0f ? -t : t;
+    n.y += n.y >= 0.0f ? -t : t;
+    vertex.normal = glm::normalize(n);
+  }
+  vertex.garbage2 = 0.0f;
+  return vertex;
+}
+
+uint64_t ClothObject::hashParticles(const ClothParticle *particles,
+                                    size_t count) {
+  // FNV-1a over the position and velocity bits - padding is skipped since the
+  // shader never writes it
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < count; i++) {
+    const float values[6] = {
+        particles[i].position.x, particles[i].position.y,
+        particles[i].position.z, particles[i].velocity.x,
+        particles[i].velocity.y, particles[i].velocity.z};
+    for (float value : values) {
+      uint32_t bits;
+      std::memcpy(&bits, &value, sizeof(bits));
+      for (int b = 0; b < 4; b++) {
+        hash ^= (bits >> (8 * b)) & 0xffu;
+        hash *= 1099511628211ull;
+      }
     }
   }
+  return hash;
+}
+
+void ClothObject::pollDevice(wgpu::Device &device) {
+  // let the backend fire pending callbacks
+#if defined(__EMSCRIPTEN__)
+  (void)device;
+  emscripten_sleep(1);
+#elif defined(WEBGPU_BACKEND_DAWN)
+  device.tick();
+#elif defined(WEBGPU_BACKEND_WGPU)
+  wgpuDevicePoll(device, false, nullptr);
+#else
+  (void)device;
+#endif
+}
+
+void ClothObject::waitIdle(wgpu::Device &device) {
+  // blocks until all the work submitted so far has completed on the GPU
+  std::atomic<bool> done{false};
+  auto callbackHandle = device.getQueue().onSubmittedWorkDone(
+      [&](QueueWorkDoneStatus) { done = true; });
+  while (!done) {
+    pollDevice(device);
+  }
+}
+
+void ClothObject::fillBuffer(wgpu::Device &device) {
+  // fill in the particle buffers with the initial state of the cloth, the
+  // tiles of a tiled cloth fill themselves
+  if (tiled()) {
+    m_tiles.fill(*this, device);
+    return;
+  }
+
+  // Standard grid runs generate it on the GPU, so not even a large cloth is
+  // built on the CPU or uploaded
+  if (parameters.solverMode != SolverMode::Deterministic &&
+      parameters.topology == Topology::Grid) {
+    generateInitialState(device);
+    lastStateHash = 0;
+    return;
+  }
+
+  // Deterministic runs must start from the exact same bits as the CPU backend
+  // and a garment starts from its loaded rest shape, so the state is generated
+  // on the CPU straight into a staging buffer that is mapped at creation (the
+  // pooled particle buffers may be reused, so they cannot be), then copied
+  // into both ping-pong buffers on the GPU
+  std::vector<ClothInitializer::MeshVertex> mesh;
+  if (parameters.initialState == InitialState::Mesh) {
+    ClothInitializer::loadMesh(parameters.initMesh, mesh);
+  }
+
+  uint64_t particleBytes = m_bufferSize;
+  BufferDescriptor stagingDesc;
+  stagingDesc.label = "particle init staging";
+  stagingDesc.size = particleBytes;
+  stagingDesc.usage = BufferUsage::CopySrc;
+  stagingDesc.mappedAtCreation = true;
+  Buffer staging = GpuTracker::createBuffer(device, stagingDesc);
+
+  // half velocity particles are generated aside, then packed into the mapping
+  ParticlePrecision precision = particlePrecision(parameters);
+  void *mapped = staging.getMappedRange(0, particleBytes);
+  std::vector<ClothParticle> unpacked;
+  if (precision != ParticlePrecision::Full) {
+    unpacked.resize(numParticles);
+  }
+  ClothParticle *particleData = unpacked.empty()
+                                    ? (ClothParticle *)mapped
+                                    : unpacked.data();
+  if (parameters.topology == Topology::Mesh) {
+    ClothInitializer::generate(parameters, m_topology, particleData);
+  } else {
+    ClothInitializer::generate(parameters, mesh, particleData);
+  }
+  if (!unpacked.empty()) {
+    packParticles(precision, particleData, numParticles, mapped);
+  }
+  // only deterministic runs report the state hash, always over the grid order
+  lastStateHash = 0;
+  if (parameters.solverMode == SolverMode::Deterministic) {
+    toGridOrder(gridLayout(parameters), particleData, numParticles,
+                m_readbackData);
+    lastStateHash = hashParticles(m_readbackData.data(), numParticles);
+  }
+  staging.unmap();
+
+  // both buffers start from the same state
+  CommandEncoderDescriptor encoderDesc = Default;
+  encoderDesc.label = "particle init encoder";
+  CommandEncoder encoder = device.createCommandEncoder(encoderDesc);
+  encoder.copyBufferToBuffer(staging, 0, particleBuffers[0], 0,
+                             particleBytes);
+  encoder.copyBufferToBuffer(staging, 0, particleBuffers[1], 0,
+                             particleBytes);
+  CommandBuffer commands = encoder.finish(CommandBufferDescriptor{});
+  encoder.release();
+  device.getQueue().submit(commands);
+  commands.release();
+
+  // destroying after submission is fine, the copies still see the data
+  GpuTracker::release(staging);
+}
+
+void ClothObject::generateInitialState(wgpu::Device &device) {
+  // only the generator mesh (a few kilobytes) and the uniforms are uploaded
+  std::vector<ClothInitializer::MeshVertex> mesh;
+  if (parameters.initialState == InitialState::Mesh) {
+    ClothInitializer::loadMesh(parameters.initMesh, mesh);
+  }
+
+  ClothInitializer::InitUniforms initUniforms =
+      ClothInitializer::computeUniforms(parameters, (uint32_t)mesh.size());
+  Queue queue = device.getQueue();
+  queue.writeBuffer(m_initUniformBuffer, 0, &initUniforms,
+                    sizeof(ClothInitializer::InitUniforms));
+
+  // the mesh binding cannot be empty, other generators get a dummy vertex
+  uint64_t meshBytes = std::max<size_t>(mesh.size(), 1) *
+                       sizeof(ClothInitializer::MeshVertex);
+  Buffer meshBuffer = BufferPool::acquire(
+      device, meshBytes, BufferUsage::Storage | BufferUsage::CopyDst);
+  if (!mesh.empty()) {
+    queue.writeBuffer(meshBuffer, 0, mesh.data(), meshBytes);
+  }
+
+  std::vector<BindGroupEntry> entries(3, Default);
+  entries[0].binding = 0;
+  entries[0].buffer = m_initUniformBuffer;
+  entries[0].offset = 0;
+  entries[0].size = sizeof(ClothInitializer::InitUniforms);
+
+  entries[1].binding = 1;
+  entries[1].buffer = particleBuffers[0];
+  entries[1].offset = 0;
+  entries[1].size = m_bufferSize;
+
+  entries[2].binding = 2;
+  entries[2].buffer = meshBuffer;
+  entries[2].offset = 0;
+  entries[2].size = meshBytes;
+
+  BindGroupDescriptor bindGroupDesc;
+  bindGroupDesc.layout = m_initBindGroupLayout;
+  bindGroupDesc.entryCount = (uint32_t)entries.size();
+  bindGroupDesc.entries = (WGPUBindGroupEntry *)entries.data();
+  BindGroup bindGroup = GpuTracker::createBindGroup(device, bindGroupDesc);
+
+  CommandEncoderDescriptor encoderDesc = Default;
+  encoderDesc.label = "particle init encoder";
+  CommandEncoder encoder = device.createCommandEncoder(encoderDesc);
+
+  ComputePassDescriptor computePassDesc;
+  computePassDesc.timestampWrites = nullptr;
+  computePassDesc.label = "particle init pass";
+  ComputePassEncoder computePass = encoder.beginComputePass(computePassDesc);
+  computePass.setPipeline(m_initPipeline);
+  computePass.setBindGroup(0, bindGroup, 0, nullptr);
+  dispatchLinear(computePass, numParticles);
+  computePass.end();
+
+  // both buffers start from the same state
+  encoder.copyBufferToBuffer(particleBuffers[0], 0, particleBuffers[1], 0,
+                             m_bufferSize);
+  CommandBuffer commands = encoder.finish(CommandBufferDescriptor{});
+  encoder.release();
+  queue.submit(commands);
+  commands.release();
 
-  // write to buffers
-  device.getQueue().writeBuffer(particleBuffers[0], 0, particleData.data(),
-                                numParticles * sizeof(ClothParticle));
-  device.getQueue().writeBuffer(particleBuffers[1], 0, particleData2.data(),
-                                numParticles * sizeof(ClothParticle));
+  // the submitted pass keeps what it uses alive
+  GpuTracker::release(bindGroup);
+  BufferPool::recycle(meshBuffer);
 }
 
 void ClothObject::initBuffers(wgpu::Device &device) {
-  // initialize buffer objects
+  // initialize buffer objects - they come from the buffer pool, so they can be
+  // larger than the cloth and the spare room is kept as capacity
   //
+  // a tiled cloth keeps its particles and vertices in the tiles
+  if (tiled()) {
+    m_particleCapacity = 0;
+    return;
+  }
+
   // Create input/output buffers
-  BufferDescriptor bufferDesc;
-  bufferDesc.mappedAtCreation = false;
-  bufferDesc.size = numParticles * sizeof(ClothParticle);
-  bufferDesc.usage = BufferUsage::Storage | BufferUsage::CopyDst;
-  particleBuffers[0] = device.createBuffer(bufferDesc);
-  particleBuffers[1] = device.createBuffer(bufferDesc);
+  uint64_t particleBytes = m_bufferSize;
+  WGPUBufferUsageFlags particleUsage =
+      BufferUsage::Storage | BufferUsage::CopyDst | BufferUsage::CopySrc;
+  particleBuffers[0] =
+      BufferPool::acquire(device, particleBytes, particleUsage);
+  particleBuffers[1] =
+      BufferPool::acquire(device, particleBytes, particleUsage);
 
   // Create vertex buffer
-  BufferDescriptor vbufferDesc;
-  vbufferDesc.size = numVertices * sizeof(ClothVertex);
-  vbufferDesc.usage =
+  WGPUBufferUsageFlags vertexUsage =
       BufferUsage::CopyDst | BufferUsage::Storage | BufferUsage::Vertex;
-  vbufferDesc.mappedAtCreation = false;
-  m_vertexBuffer = device.createBuffer(vbufferDesc);
+  m_vertexBuffer =
+      BufferPool::acquire(device, vertexBufferBytes(), vertexUsage);
+
+  // the pulling path draws the particles through static triangle lists, one
+  // per level of detail
+  if (parameters.renderPath == RenderPath::VertexPulling) {
+    m_indexBuffer =
+        BufferPool::acquire(device, indexBufferBytes(),
+                            BufferUsage::CopyDst | BufferUsage::Index);
+  }
+
+  // a garment's connectivity is uploaded once, it never changes
+  if (parameters.topology == Topology::Mesh) {
+    std::vector<uint32_t> words = m_topology.pack();
+    BufferDescriptor topologyDesc;
+    topologyDesc.label = "garment topology";
+    topologyDesc.size = words.size() * sizeof(uint32_t);
+    topologyDesc.usage = BufferUsage::Storage;
+    topologyDesc.mappedAtCreation = true;
+    m_topologyBuffer = GpuTracker::createBuffer(device, topologyDesc);
+    std::memcpy(m_topologyBuffer.getMappedRange(0, topologyDesc.size),
+                words.data(), topologyDesc.size);
+    m_topologyBuffer.unmap();
+  }
+
+  m_particleCapacity = (int)(particleBuffers[0].getSize() /
+                             particleStride(particlePrecision(parameters)));
+}
+
+uint64_t ClothObject::vertexBufferBytes() const {
+  // the pulling path only keeps one packed normal per particle
+  if (parameters.renderPath == RenderPath::VertexPulling) {
+    return (uint64_t)numParticles * sizeof(uint32_t);
+  }
+  return (uint64_t)numVertices * vertexStride(parameters.vertexPrecision);
+}
+
+void ClothObject::triangleIndices(const ClothParameters &p,
+                                  const ClothTopology &topology, int step,
+                                  std::vector<uint32_t> &indices) {
+  // a garment already is a triangle list
+  indices.clear();
+  if (p.topology == Topology::Mesh) {
+    if (step == 1) {
+      indices = topology.triangles;
+    }
+    return;
+  }
+
+  // two triangles per cell of step x step particles, corners in the order of
+  // triangle_pos_conversion() in compute.wgsl - the last cell of a row or
+  // column is cut short so that the cloth keeps its edges
+  GridLayout layout = gridLayout(p);
+  indices.reserve(lodIndexCount(p, topology, step));
+  for (int y0 = 0; y0 + 1 < p.height; y0 += step) {
+    int y1 = std::min(y0 + step, p.height - 1);
+    for (int x0 = 0; x0 + 1 < p.width; x0 += step) {
+      int x1 = std::min(x0 + step, p.width - 1);
+      uint32_t corners[6] = {layout.index(x0, y0), layout.index(x0, y1),
+                             layout.index(x1, y0), layout.index(x0, y1),
+                             layout.index(x1, y1), layout.index(x1, y0)};
+      indices.insert(indices.end(), corners, corners + 6);
+    }
+  }
+}
+
+uint32_t ClothObject::lodIndexCount(const ClothParameters &p,
+                                    const ClothTopology &topology, int step) {
+  if (p.topology == Topology::Mesh) {
+    return step == 1 ? (uint32_t)topology.triangles.size() : 0;
+  }
+  uint32_t cellsX = (std::max(p.width - 1, 0) + step - 1) / step;
+  uint32_t cellsY = (std::max(p.height - 1, 0) + step - 1) / step;
+  return 6 * cellsX * cellsY;
+}
+
+uint64_t ClothObject::indexBufferBytes() const {
+  uint64_t count = 0;
+  for (int level = 0; level < LodLevels; level++) {
+    count += lodIndexCount(parameters, m_topology, 1 << level);
+  }
+  return count * sizeof(uint32_t);
+}
+
+void ClothObject::writeIndices(wgpu::Device &device) {
+  // every level goes into the same buffer, one after the other
+  if (m_indexBuffer == nullptr) {
+    return;
+  }
+  std::vector<uint32_t> indices;
+  std::vector<uint32_t> level;
+  for (int l = 0; l < LodLevels; l++) {
+    triangleIndices(parameters, m_topology, 1 << l, level);
+    m_lodFirstIndex[l] = (uint32_t)indices.size();
+    m_lodIndexCount[l] = (uint32_t)level.size();
+    indices.insert(indices.end(), level.begin(), level.end());
+  }
+  device.getQueue().writeBuffer(m_indexBuffer, 0, indices.data(),
+                                indices.size() * sizeof(uint32_t));
+}
+
+void ClothObject::renderBounds(vec3 &center, float &radius) const {
+  // the rest shape is centered on 0,0, the vertex shaders divide by
+  // 0.3 * particleScale (= scale) after switching the axes
+  center = vec3(0.0f);
+  float extent = 0.0f;
+  if (parameters.topology == Topology::Mesh) {
+    for (const vec3 &position : m_topology.restPositions) {
+      extent = std::max(extent, glm::length(position) * parameters.scale);
+    }
+  } else {
+    extent = 0.5f * particleDist *
+             glm::length(vec2(parameters.width - 1, parameters.height - 1));
+  }
+  radius = extent / (0.3f * parameters.scale);
+}
 
+bool ClothObject::adaptiveStep(const ClothParameters &p) {
+  return p.adaptiveStep && p.solverMode != SolverMode::Deterministic;
+}
+
+void ClothObject::updateTimeStep() {
+  if (!adaptiveStep(parameters) ||
+      m_stats.resultCount() == m_timeStepResults) {
+    return;
+  }
+  m_timeStepResults = m_stats.resultCount();
+  ClothStats::Stats stats = m_stats.latest();
+  // a diverged state is the watchdog's business
+  if (stats.nonFinite > 0 || !std::isfinite(stats.maxError)) {
+    return;
+  }
+
+  // the estimate is the distance to a second order step, its error grows
+  // with deltaT^3 - the result is a frame or two old, so the step only grows
+  // slowly but may shrink fast
+  float factor = 1.1f;
+  if (stats.maxError > 0.0f) {
+    factor = 0.9f * std::cbrt(parameters.stepTolerance / stats.maxError);
+  }
+  factor = std::clamp(factor, 0.2f, 1.1f);
+  float deltaT = std::clamp(parameters.deltaT * factor, parameters.minDeltaT,
+                            parameters.maxDeltaT);
+  if (deltaT != parameters.deltaT) {
+    parameters.deltaT = deltaT;
+    updateDerivedParameters();
+  }
+}
+
+bool ClothObject::simulationLod(const ClothParameters &p) {
+  return p.topology == Topology::Grid && p.simLodStep > 1 && p.width > 1 &&
+         p.height > 1 && p.solverMode != SolverMode::Deterministic;
+}
+
+void ClothObject::updateSimulationLod(float projectedRadius) {
+  if (!m_proxy.initialized()) {
+    return;
+  }
+  int cells = std::max(parameters.width, parameters.height) - 1;
+  float cellPixels = 2.0f * projectedRadius / cells;
+  float threshold = parameters.simLodCellPixels;
+  if (m_proxy.active()) {
+    threshold *= 1.5f;
+  }
+  m_proxy.request(cellPixels < threshold);
+}
+
+int ClothObject::simulatedParticles() const {
+  return m_proxy.active() ? (int)m_proxy.particleCount() : numParticles;
+}
+
+int ClothObject::lodLevel(float projectedRadius) const {
+  // projected size of one grid cell, the cloth's longer side spans about the
+  // diameter of its bounding sphere
+  if (parameters.topology == Topology::Mesh || parameters.lodCellPixels <= 0) {
+    return 0;
+  }
+  int cells = std::max(std::max(parameters.width, parameters.height) - 1, 1);
+  float cellPixels = 2.0f * projectedRadius / cells;
+  int level = 0;
+  while (level + 1 < LodLevels &&
+         cellPixels * (1 << level) < parameters.lodCellPixels) {
+    level++;
+  }
+  return level;
+}
+
+void ClothObject::initUniforms(wgpu::Device &device) {
   // create uniform buffer
   BufferDescriptor ubufferDesc;
   ubufferDesc.size = sizeof(ClothUniforms);
   ubufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
   ubufferDesc.mappedAtCreation = false;
-  m_uniformBuffer = device.createBuffer(ubufferDesc);
+  m_uniformBuffer = GpuTracker::createBuffer(device, ubufferDesc);
 }
 
 void ClothObject::initBindGroupLayout(wgpu::Device &device) {
@@ -190,124 +988,240 @@ void ClothObject::initBindGroupLayout(wgpu::Device &device) {
   BindGroupLayoutDescriptor bindGroupLayoutDesc;
   bindGroupLayoutDesc.entryCount = (uint32_t)bindings.size();
   bindGroupLayoutDesc.entries = bindings.data();
-  m_bindGroupLayouts[0] = device.createBindGroupLayout(bindGroupLayoutDesc);
+  m_bindGroupLayouts[0] =
+      GpuTracker::createBindGroupLayout(device, bindGroupLayoutDesc);
 
-  // group 1 is dedicated to just the vertex buffer
+  // group 1 is dedicated to the vertex buffer, and the topology of a garment
 
-  std::vector<BindGroupLayoutEntry> vBindings(1, Default);
+  bool garment = parameters.topology == Topology::Mesh;
+  std::vector<BindGroupLayoutEntry> vBindings(garment ? 2 : 1, Default);
   vBindings[0].binding = 0;
   vBindings[0].visibility = ShaderStage::Compute;
   vBindings[0].buffer.type = BufferBindingType::Storage;
+  if (garment) {
+    vBindings[1].binding = 1;
+    vBindings[1].visibility = ShaderStage::Compute;
+    vBindings[1].buffer.type = BufferBindingType::ReadOnlyStorage;
+  }
 
   // bind group 1 init
   BindGroupLayoutDescriptor vertexBindGroupLayoutDesc;
   vertexBindGroupLayoutDesc.entryCount = (uint32_t)vBindings.size();
   vertexBindGroupLayoutDesc.entries = vBindings.data();
   m_bindGroupLayouts[1] =
-      device.createBindGroupLayout(vertexBindGroupLayoutDesc);
+      GpuTracker::createBindGroupLayout(device, vertexBindGroupLayoutDesc);
 }
 
 void ClothObject::updateUniforms(wgpu::Device &device) {
   // updates uniforms and fills the buffer with the new uniform values
-
-  uniforms.currentT = currentT;
-
-  // calculate sphere position
-  float sphere_period = (fmod(currentT, parameters.spherePeriod * 2.0f) -
-                         parameters.spherePeriod) /
-                        parameters.spherePeriod;
-  float sphere_sign = sphere_period < 0.0f ? -1.0f : 1.0f;
-  uniforms.sphereZ = parameters.sphereRange *
-                     (1.0f + sphere_sign * (sphere_period * 2.0f) - 2.0f);
+  currentT = (float)simTime;
+  advanceUniforms(parameters, simTime, uniforms);
 
   // write to buffer
   device.getQueue().writeBuffer(m_uniformBuffer, 0, &uniforms,
                                 sizeof(ClothUniforms));
+  if (tiled()) {
+    m_tiles.writeUniforms(*this, device);
+  }
 }
 
 void ClothObject::initComputePipeline(wgpu::Device &device) {
   // describe and init compute pass pipeline
   // 2 separate passes are described
 
-  // shader loading
-  ShaderModule computeShaderModule =
-      ResourceManager::loadShaderModule(RESOURCE_DIR "/compute.wgsl", device);
+  // shader loading - garments have their own kernels with the same entry
+  // points
+  const char *shaderPath = parameters.topology == Topology::Mesh
+                               ? RESOURCE_DIR "/compute_mesh.wgsl"
+                               : RESOURCE_DIR "/compute.wgsl";
+  m_shaderModule = ResourceManager::loadShaderModule(shaderPath, device);
 
   // Create compute pipeline layout
   PipelineLayoutDescriptor pipelineLayoutDesc;
   pipelineLayoutDesc.bindGroupLayoutCount = 2;
   pipelineLayoutDesc.bindGroupLayouts =
       (WGPUBindGroupLayout *)&m_bindGroupLayouts;
-  m_pipelineLayout = device.createPipelineLayout(pipelineLayoutDesc);
+  m_pipelineLayout =
+      GpuTracker::createPipelineLayout(device, pipelineLayoutDesc);
 
   // first pass - particle simulation
   ComputePipelineDescriptor computePass1;
   computePass1.compute.constantCount = 0;
   computePass1.compute.constants = nullptr;
   computePass1.compute.entryPoint = "main";
-  computePass1.compute.module = computeShaderModule;
+  computePass1.compute.module = m_shaderModule;
   computePass1.layout = m_pipelineLayout;
-  m_pipeline = device.createComputePipeline(computePass1);
+  m_pipeline = GpuTracker::createComputePipeline(device, computePass1);
 
   // second pass - particles to vertices
   ComputePipelineDescriptor computePass2;
   computePass2.compute.constantCount = 0;
   computePass2.compute.constants = nullptr;
-  computePass2.compute.entryPoint = "particle_to_vertex";
-  computePass2.compute.module = computeShaderModule;
+  computePass2.compute.entryPoint =
+      parameters.renderPath == RenderPath::VertexPulling ? "particle_normals"
+                                                         : "particle_to_vertex";
+  computePass2.compute.module = m_shaderModule;
   computePass2.layout = m_pipelineLayout;
-  m_vertexPipeline = device.createComputePipeline(computePass2);
+  m_vertexPipeline = GpuTracker::createComputePipeline(device, computePass2);
 }
 
-void ClothObject::initBindGroup(wgpu::Device &device) {
-  // describe and init bind groups
+void ClothObject::initInitPipeline(wgpu::Device &device) {
+  // describe and init the initial state generator, it has its own bind group
+  // since it writes a single particle buffer and reads the generator mesh
+  m_initShaderModule =
+      ResourceManager::loadShaderModule(RESOURCE_DIR "/init.wgsl", device);
 
-  // Create compute bind group
-  std::vector<BindGroupEntry> entries(3, Default);
+  BufferDescriptor ubufferDesc;
+  ubufferDesc.size = sizeof(ClothInitializer::InitUniforms);
+  ubufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+  ubufferDesc.mappedAtCreation = false;
+  m_initUniformBuffer = GpuTracker::createBuffer(device, ubufferDesc);
 
-  // group 0 - particle buffers
+  std::vector<BindGroupLayoutEntry> bindings(3, Default);
 
-  // uniform buffer
-  entries[0].binding = 0;
-  entries[0].buffer = m_uniformBuffer;
-  entries[0].offset = 0;
-  entries[0].size = sizeof(ClothUniforms);
+  // generator parameters
+  bindings[0].binding = 0;
+  bindings[0].visibility = ShaderStage::Compute;
+  bindings[0].buffer.type = BufferBindingType::Uniform;
+  bindings[0].buffer.minBindingSize = sizeof(ClothInitializer::InitUniforms);
 
-  // alternate input and output buffers based on odd and even frame counts
-  //
-  // Input buffer
-  entries[1].binding = 1;
-  entries[1].buffer = particleBuffers[frame % 2];
-  entries[1].offset = 0;
-  entries[1].size = numParticles * sizeof(ClothParticle);
+  // output particle buffer
+  bindings[1].binding = 1;
+  bindings[1].buffer.type = BufferBindingType::Storage;
+  bindings[1].visibility = ShaderStage::Compute;
 
-  // Output buffer
-  entries[2].binding = 2;
-  entries[2].buffer = particleBuffers[1 - (frame % 2)];
-  entries[2].offset = 0;
-  entries[2].size = numParticles * sizeof(ClothParticle);
+  // generator mesh
+  bindings[2].binding = 2;
+  bindings[2].buffer.type = BufferBindingType::ReadOnlyStorage;
+  bindings[2].visibility = ShaderStage::Compute;
 
-  // write first group descriptor
-  BindGroupDescriptor bindGroupDesc;
-  bindGroupDesc.layout = m_bindGroupLayouts[0];
-  bindGroupDesc.entryCount = (uint32_t)entries.size();
-  bindGroupDesc.entries = (WGPUBindGroupEntry *)entries.data();
-  m_bindGroup = device.createBindGroup(bindGroupDesc);
+  BindGroupLayoutDescriptor bindGroupLayoutDesc;
+  bindGroupLayoutDesc.entryCount = (uint32_t)bindings.size();
+  bindGroupLayoutDesc.entries = bindings.data();
+  m_initBindGroupLayout =
+      GpuTracker::createBindGroupLayout(device, bindGroupLayoutDesc);
 
-  // group 1 - vertex buffer
-  std::vector<BindGroupEntry> ventries(1, Default);
+  PipelineLayoutDescriptor pipelineLayoutDesc;
+  pipelineLayoutDesc.bindGroupLayoutCount = 1;
+  pipelineLayoutDesc.bindGroupLayouts =
+      (WGPUBindGroupLayout *)&m_initBindGroupLayout;
+  m_initPipelineLayout =
+      GpuTracker::createPipelineLayout(device, pipelineLayoutDesc);
+
+  ComputePipelineDescriptor initPass;
+  initPass.compute.constantCount = 0;
+  initPass.compute.constants = nullptr;
+  initPass.compute.entryPoint = "init_particles";
+  initPass.compute.module = m_initShaderModule;
+  initPass.layout = m_initPipelineLayout;
+  m_initPipeline = GpuTracker::createComputePipeline(device, initPass);
+}
+
+void ClothObject::initBindGroup(wgpu::Device &device) {
+  // describe and init bind groups, the tiles of a tiled cloth have their
+  // own (ClothTiles::init)
+  if (tiled()) {
+    return;
+  }
+
+  // group 0 - particle buffers, one bind group per direction so that
+  // switching input and output each frame needs no new objects
+  for (int parity = 0; parity < 2; parity++) {
+    std::vector<BindGroupEntry> entries(3, Default);
+
+    // uniform buffer
+    entries[0].binding = 0;
+    entries[0].buffer = m_uniformBuffer;
+    entries[0].offset = 0;
+    entries[0].size = sizeof(ClothUniforms);
+
+    // Input buffer
+    entries[1].binding = 1;
+    entries[1].buffer = particleBuffers[parity];
+    entries[1].offset = 0;
+    entries[1].size = m_bufferSize;
+
+    // Output buffer
+    entries[2].binding = 2;
+    entries[2].buffer = particleBuffers[1 - parity];
+    entries[2].offset = 0;
+    entries[2].size = m_bufferSize;
+
+    BindGroupDescriptor bindGroupDesc;
+    bindGroupDesc.layout = m_bindGroupLayouts[0];
+    bindGroupDesc.entryCount = (uint32_t)entries.size();
+    bindGroupDesc.entries = (WGPUBindGroupEntry *)entries.data();
+    m_bindGroups[parity] = GpuTracker::createBindGroup(device, bindGroupDesc);
+  }
+
+  // group 1 - vertex buffer and garment topology
+  bool garment = parameters.topology == Topology::Mesh;
+  std::vector<BindGroupEntry> ventries(garment ? 2 : 1, Default);
 
   ventries[0].binding = 0;
   ventries[0].buffer = m_vertexBuffer;
   ventries[0].offset = 0;
-  ventries[0].size = numVertices * sizeof(ClothVertex);
+  ventries[0].size = vertexBufferBytes();
+
+  if (garment) {
+    ventries[1].binding = 1;
+    ventries[1].buffer = m_topologyBuffer;
+    ventries[1].offset = 0;
+    ventries[1].size = m_topologyBuffer.getSize();
+  }
 
   // write second group descriptor
   BindGroupDescriptor vbindGroupDesc;
-  bindGroupDesc.layout = m_bindGroupLayouts[1];
-  bindGroupDesc.entryCount = (uint32_t)ventries.size();
-  bindGroupDesc.entries = (WGPUBindGroupEntry *)ventries.data();
-  m_vertexBindGroup = device.createBindGroup(bindGroupDesc);
+  vbindGroupDesc.layout = m_bindGroupLayouts[1];
+  vbindGroupDesc.entryCount = (uint32_t)ventries.size();
+  vbindGroupDesc.entries = (WGPUBindGroupEntry *)ventries.data();
+  m_vertexBindGroup = GpuTracker::createBindGroup(device, vbindGroupDesc);
+
+  // render groups of the pulling path - the particles written by
+  // m_bindGroups[parity] and their normals
+  if (parameters.renderPath != RenderPath::VertexPulling ||
+      m_renderBindGroupLayout == nullptr) {
+    return;
+  }
+  for (int parity = 0; parity < 2; parity++) {
+    std::vector<BindGroupEntry> rentries(3, Default);
+
+    rentries[0].binding = 0;
+    rentries[0].buffer = m_uniformBuffer;
+    rentries[0].offset = 0;
+    rentries[0].size = sizeof(ClothUniforms);
+
+    rentries[1].binding = 1;
+    rentries[1].buffer = particleBuffers[1 - parity];
+    rentries[1].offset = 0;
+    rentries[1].size = m_bufferSize;
+
+    rentries[2].binding = 2;
+    rentries[2].buffer = m_vertexBuffer;
+    rentries[2].offset = 0;
+    rentries[2].size = vertexBufferBytes();
+
+    BindGroupDescriptor rbindGroupDesc;
+    rbindGroupDesc.layout = m_renderBindGroupLayout;
+    rbindGroupDesc.entryCount = (uint32_t)rentries.size();
+    rbindGroupDesc.entries = (WGPUBindGroupEntry *)rentries.data();
+    m_renderBindGroups[parity] =
+        GpuTracker::createBindGroup(device, rbindGroupDesc);
+  }
+}
+
+void ClothObject::dispatchLinear(wgpu::ComputePassEncoder &pass,
+                                 uint32_t invocationCount) {
+  // dispatches invocationCount threads of 64, folding the workgroups into a
+  // second dimension once they exceed the per-dimension limit - the kernels
+  // rebuild the linear index from num_workgroups
+  uint32_t workgroupSize = 64;
+  uint32_t workgroupCount =
+      (invocationCount + workgroupSize - 1) / workgroupSize;
+  uint32_t workgroupsX = std::min(workgroupCount, MAX_WORKGROUPS_PER_DIMENSION);
+  uint32_t workgroupsY = (workgroupCount + workgroupsX - 1) / workgroupsX;
+  pass.dispatchWorkgroups(std::max(workgroupsX, 1u), std::max(workgroupsY, 1u),
+                          1);
 }
 
 void ClothObject::computePass(wgpu::Device &device) {
@@ -320,22 +1234,35 @@ void ClothObject::computePass(wgpu::Device &device) {
   encoderDesc.label = "compute pass encoder";
   CommandEncoder encoder = device.createCommandEncoder(encoderDesc);
 
-  // run the first compute pass
-  ComputePassDescriptor computePassDesc;
-  computePassDesc.timestampWrites = nullptr;
-  computePassDesc.label = "compute pass 1";
-  ComputePassEncoder computePass = encoder.beginComputePass(computePassDesc);
-
-  computePass.setPipeline(m_pipeline);
-  computePass.setBindGroup(0, m_bindGroup, 0, nullptr);
-  computePass.setBindGroup(1, m_vertexBindGroup, 0, nullptr);
+  // every tile steps its own rows, nothing else binds the whole grid
+  if (tiled()) {
+    m_tiles.encodeStep(*this, encoder);
+    CommandBuffer commands = encoder.finish(CommandBufferDescriptor{});
+    queue.submit(commands);
+    return;
+  }
 
-  uint32_t invocationCount = m_bufferSize / sizeof(float);
-  uint32_t workgroupSize = 64;
-  uint32_t workgroupCount =
-      (invocationCount + workgroupSize - 1) / workgroupSize;
-  computePass.dispatchWorkgroups(workgroupCount, 1, 1);
-  computePass.end();
+  // the input buffer alternates on odd and even frame counts
+  BindGroup bindGroup = m_bindGroups[frame % 2];
+
+  if (m_proxy.active()) {
+    // the coarse proxy replaces the first pass and fills the output buffer
+    m_proxy.encodeStep(*this, encoder);
+  } else {
+    // run the first compute pass
+    ComputePassDescriptor computePassDesc;
+    computePassDesc.timestampWrites = nullptr;
+    computePassDesc.label = "compute pass 1";
+    ComputePassEncoder computePass = encoder.beginComputePass(computePassDesc);
+
+    computePass.setPipeline(m_pipeline);
+    computePass.setBindGroup(0, bindGroup, 0, nullptr);
+    computePass.setBindGroup(1, m_vertexBindGroup, 0, nullptr);
+
+    // one invocation per particle
+    dispatchLinear(computePass, numParticles);
+    computePass.end();
+  }
 
   // run the second compute pass
   ComputePassDescriptor computePassDesc2;
@@ -344,65 +1271,170 @@ void ClothObject::computePass(wgpu::Device &device) {
   ComputePassEncoder computePass2 = encoder.beginComputePass(computePassDesc2);
 
   computePass2.setPipeline(m_vertexPipeline);
-  computePass2.setBindGroup(0, m_bindGroup, 0, nullptr);
+  computePass2.setBindGroup(0, bindGroup, 0, nullptr);
   computePass2.setBindGroup(1, m_vertexBindGroup, 0, nullptr);
 
-  uint32_t invocationCount2 = m_bufferSize / sizeof(float);
-  uint32_t workgroupSize2 = 64;
-  uint32_t workgroupCount2 =
-      (invocationCount2 + workgroupSize2 - 1) / workgroupSize2;
-  computePass2.dispatchWorkgroups(workgroupCount2, 1, 1);
+  // one invocation per vertex, or per particle normal when pulling
+  dispatchLinear(computePass2,
+                 parameters.renderPath == RenderPath::VertexPulling
+                     ? numParticles
+                     : numVertices);
   computePass2.end();
 
+  // statistics of the new state, every statsInterval frames
+  bool stats = parameters.statsInterval > 0 &&
+               frame % parameters.statsInterval == 0 &&
+               m_stats.encode(*this, encoder);
+
+  m_watchdog.encodeSnapshot(*this, encoder);
+
   // submit compute shader commands
   CommandBuffer commands = encoder.finish(CommandBufferDescriptor{});
   queue.submit(commands);
+  if (stats) {
+    m_stats.afterSubmit();
+  }
+}
+
+bool ClothObject::readParticles(wgpu::Device &device,
+                                std::vector<ClothParticle> &out) {
+  // copies the last simulated state into the readback buffer and waits for
+  // the mapping - this stalls the pipeline, so it is meant for headless runs
+  if (tiled()) {
+    std::vector<uint32_t> words(m_bufferSize / sizeof(uint32_t));
+    if (!m_tiles.readStored(*this, device, words.data())) {
+      return false;
+    }
+    unpackStored(words.data(), out);
+    return true;
+  }
+  if (!m_readbackBuffer ||
+      m_readbackBuffer.getSize() < (uint64_t)m_bufferSize) {
+    BufferPool::recycle(m_readbackBuffer);
+    m_readbackBuffer = BufferPool::acquire(
+        device, m_bufferSize, BufferUsage::MapRead | BufferUsage::CopyDst);
+  }
+
+  // the last step wrote into the buffer that was not its input
+  CommandEncoderDescriptor encoderDesc = Default;
+  encoderDesc.label = "state readback encoder";
+  CommandEncoder encoder = device.createCommandEncoder(encoderDesc);
+  encoder.copyBufferToBuffer(particleBuffers[1 - (frame % 2)], 0,
+                             m_readbackBuffer, 0, m_bufferSize);
+  CommandBuffer commands = encoder.finish(CommandBufferDescriptor{});
+  encoder.release();
+  device.getQueue().submit(commands);
+  commands.release();
+
+  // the callback may fire in a poll of another thread
+  std::atomic<bool> done{false};
+  bool success = false;
+  auto callbackHandle = m_readbackBuffer.mapAsync(
+      MapMode::Read, 0, m_bufferSize, [&](BufferMapAsyncStatus status) {
+        success = status == BufferMapAsyncStatus::Success;
+        done = true;
+      });
+  while (!done) {
+    pollDevice(device);
+  }
+  if (!success) {
+    return false;
+  }
+
+  unpackStored(m_readbackBuffer.getConstMappedRange(0, m_bufferSize), out);
+  m_readbackBuffer.unmap();
+  return true;
+}
+
+void ClothObject::unpackStored(const void *stored,
+                               std::vector<ClothParticle> &out) const {
+  ParticlePrecision precision = particlePrecision(parameters);
+  if (precision == ParticlePrecision::Full) {
+    toGridOrder(gridLayout(parameters), (const ClothParticle *)stored,
+                numParticles, out);
+  } else {
+    std::vector<ClothParticle> particles(numParticles);
+    unpackParticles(precision, stored, numParticles, particles.data());
+    toGridOrder(gridLayout(parameters), particles.data(), numParticles, out);
+  }
+}
+
+uint64_t ClothObject::readStateHash(wgpu::Device &device) {
+  // hashes the last simulated state
+  if (!readParticles(device, m_readbackData)) {
+    return 0;
+  }
+  return hashParticles(m_readbackData.data(), numParticles);
 }
 
 // -------------- MEMORY TERMINATION ----------------------
 
 void ClothObject::terminateAll() {
-  // free members on termination
+  // free members on termination - safe to call on an empty or already
+  // terminated cloth
+  m_proxy.terminate();
+  m_stats.terminate();
+  m_watchdog.terminate();
+  m_tiles.terminate();
+  m_tileRows = 0;
   terminateBindGroups();
   terminateUniforms();
   terminateComputePipeline();
+  terminateInitPipeline();
   terminateBindGroupLayouts();
   terminateBuffers();
 }
 
 void ClothObject::terminateComputePipeline() {
   // release pipelines
-  m_pipeline.release();
-  m_shaderModule.release();
+  GpuTracker::release(m_pipeline);
+  GpuTracker::release(m_vertexPipeline);
+  GpuTracker::release(m_pipelineLayout);
+  GpuTracker::release(m_shaderModule);
+}
+
+void ClothObject::terminateInitPipeline() {
+  // release the initial state generator
+  GpuTracker::release(m_initPipeline);
+  GpuTracker::release(m_initPipelineLayout);
+  GpuTracker::release(m_initBindGroupLayout);
+  GpuTracker::release(m_initShaderModule);
+  GpuTracker::release(m_initUniformBuffer);
 }
 
 void ClothObject::terminateBindGroups() {
   // release bind groups
-  m_bindGroup.release();
-  m_vertexBindGroup.release();
+  for (wgpu::BindGroup &bindGroup : m_bindGroups) {
+    GpuTracker::release(bindGroup);
+  }
+  GpuTracker::release(m_vertexBindGroup);
+  for (wgpu::BindGroup &bindGroup : m_renderBindGroups) {
+    GpuTracker::release(bindGroup);
+  }
 }
 
 void ClothObject::terminateBindGroupLayouts() {
   // release bind group layouts
   for (wgpu::BindGroupLayout &layout : m_bindGroupLayouts) {
-    layout.release();
+    GpuTracker::release(layout);
   }
 }
 
 void ClothObject::terminateUniforms() {
   // release uniform buffers
-  m_uniformBuffer.destroy();
-  m_uniformBuffer.release();
+  GpuTracker::release(m_uniformBuffer);
 }
 
 void ClothObject::terminateBuffers() {
-  // release particle and vertex buffers
+  // particle, vertex and readback buffers go back to the pool
   for (wgpu::Buffer &pbuffer : particleBuffers) {
-    pbuffer.destroy();
-    pbuffer.release();
+    BufferPool::recycle(pbuffer);
   }
-
-  m_vertexBuffer.release();
+  BufferPool::recycle(m_vertexBuffer);
+  BufferPool::recycle(m_indexBuffer);
+  BufferPool::recycle(m_readbackBuffer);
+  GpuTracker::release(m_topologyBuffer);
+  m_particleCapacity = 0;
 }
 
 // ---------------------------------------------------------------------------------------------------
@@ -3,8 +3,17 @@
 #include <glm/glm.hpp>
 #include <webgpu/webgpu.hpp>
 
+#include <ClothProxy.h>
+#include <ClothStats.h>
+#include <ClothTiles.h>
+#include <ClothTopology.h>
+#include <ClothWatchdog.h>
+#include <GpuTracker.h>
+#include <GridLayout.h>
 #include <ResourceManager.h>
 #include <array>
+#include <cstdint>
+#include <string>
 #include <vector>
 
 class ClothObject {
@@ -19,19 +28,48 @@ public:
   std::array<wgpu::Buffer, 2> particleBuffers = {nullptr, nullptr};
   wgpu::Buffer m_vertexBuffer = nullptr;
   wgpu::Buffer m_uniformBuffer = nullptr;
+  // packed ClothTopology of a garment (null for the grid)
+  wgpu::Buffer m_topologyBuffer = nullptr;
+  // triangle lists over the particle buffer, used by the vertex pulling path
+  wgpu::Buffer m_indexBuffer = nullptr;
   wgpu::ShaderModule m_shaderModule = nullptr;
 
   // webgpu data structures
   wgpu::BindGroupLayout m_bindGroupLayouts[2] = {nullptr, nullptr};
-  wgpu::BindGroup m_bindGroup = nullptr;
+  // one simulation bind group per ping-pong direction, indexed by the parity
+  // of the frame (m_bindGroups[i] reads particleBuffers[i])
+  std::array<wgpu::BindGroup, 2> m_bindGroups = {nullptr, nullptr};
   wgpu::BindGroup m_vertexBindGroup = nullptr;
   wgpu::PipelineLayout m_pipelineLayout = nullptr;
   wgpu::ComputePipeline m_pipeline = nullptr;
   wgpu::PipelineLayout m_vertexPipelineLayout = nullptr;
   wgpu::ComputePipeline m_vertexPipeline = nullptr;
 
+  // render side of the vertex pulling path - the layout belongs to the
+  // renderer, the bind groups follow the parity of the frame like m_bindGroups
+  // (m_renderBindGroups[i] reads the output of m_bindGroups[i])
+  wgpu::BindGroupLayout m_renderBindGroupLayout = nullptr;
+  std::array<wgpu::BindGroup, 2> m_renderBindGroups = {nullptr, nullptr};
+
+  // render levels of detail - level l draws every 2^l-th row and column of
+  // the grid, garments only have level 0
+  static constexpr int LodLevels = 4;
+  // first index and index count of each level in m_indexBuffer
+  std::array<uint32_t, LodLevels> m_lodFirstIndex = {};
+  std::array<uint32_t, LodLevels> m_lodIndexCount = {};
+
+  // initial state generator (resources/init.wgsl)
+  wgpu::ShaderModule m_initShaderModule = nullptr;
+  wgpu::BindGroupLayout m_initBindGroupLayout = nullptr;
+  wgpu::PipelineLayout m_initPipelineLayout = nullptr;
+  wgpu::ComputePipeline m_initPipeline = nullptr;
+  wgpu::Buffer m_initUniformBuffer = nullptr;
+
   // buffer size used in initialization
   int m_bufferSize = 0;
+  // particles the current buffers can hold - a resize only reallocates when
+  // the new cloth does not fit
+  int m_particleCapacity = 0;
 
   // vertex output structure for compute shader
   struct ClothVertex {
@@ -51,6 +89,29 @@ public:
     float garbage2;
   };
 
+  // solver modes - deterministic mode snaps the integrated state to a fixed
+  // point grid and hashes the particle state every frame for regression runs
+  enum class SolverMode { Standard = 0, Deterministic = 1 };
+
+  // initial state generators (see ClothInitializer and resources/init.wgsl)
+  enum class InitialState { Flat = 0, Draped, Crumpled, Mesh };
+
+  // cloth connectivity - the width x height grid, or the triangles of an
+  // .obj garment (see ClothTopology)
+  enum class Topology { Grid = 0, Mesh };
+
+  // storage precision of the particle buffers - half velocities keep the f32
+  // position but store the velocity as three f16 (20 instead of 32 bytes)
+  enum class ParticlePrecision { Full = 0, HalfVelocity };
+  // storage precision of the vertex buffer - f16 position and normal (16
+  // bytes), or f16 position and an octahedral snorm16 normal (12 bytes)
+  enum class VertexPrecision { Full = 0, Half, OctNormal };
+
+  // how the renderer gets the cloth - a triangle soup written by the second
+  // compute pass, or a vertex shader that reads the particle buffer through
+  // m_indexBuffer, with only an octahedral normal per particle computed
+  enum class RenderPath { VertexBuffer = 0, VertexPulling };
+
   // fixed cloth parameter structure
   struct ClothParameters {
     int width = 100;
@@ -71,6 +132,57 @@ public:
     float spherePeriod = 150.0f;
     float sphereRange = 2.0f;
     float deltaT = 0.008f;
+
+    SolverMode solverMode = SolverMode::Standard;
+
+    // initial state - the crumple folds are amount times as high as wide,
+    // the mesh generator samples initMesh (an .obj file) through its uvs
+    InitialState initialState = InitialState::Flat;
+    uint32_t initSeed = 1;
+    float crumpleAmount = 0.3f;
+    std::string initMesh;
+
+    // a garment ignores width, height and the initial state - it starts from
+    // its rest shape, scale units high
+    Topology topology = Topology::Grid;
+    std::string topologyMesh;
+
+    // how the grid is stored in the particle buffers (see GridLayout)
+    GridLayout::Order particleOrder = GridLayout::Order::RowMajor;
+    // rows per tile of a grid split into tiles (see ClothTiles) - 0 only
+    // splits a grid that does not fit in single bindings of the device
+    int tileRows = 0;
+
+    // deterministic runs always store full precision particles
+    ParticlePrecision particlePrecision = ParticlePrecision::Full;
+    VertexPrecision vertexPrecision = VertexPrecision::Full;
+
+    RenderPath renderPath = RenderPath::VertexBuffer;
+    // level of detail of the pulling path - a grid is drawn at the coarsest
+    // level whose cells still cover lodCellPixels on screen (0 draws every
+    // particle)
+    float lodCellPixels = 0.0f;
+
+    // simulation level of detail of a grid - while its cells cover less than
+    // simLodCellPixels on screen, a proxy of every simLodStep-th particle is
+    // simulated instead (1 disables it, deterministic runs never use it)
+    int simLodStep = 1;
+    float simLodCellPixels = 1.0f;
+
+    // frames between two statistics reductions (see ClothStats), 0 turns
+    // them off
+    int statsInterval = 1;
+    // frames between two snapshots of the divergence watchdog (see
+    // ClothWatchdog), 0 turns it off - it also needs the statistics
+    int snapshotInterval = 60;
+
+    // adaptive time step - deltaT follows the error estimate of the
+    // statistics towards stepTolerance (in particle distances per step),
+    // within [minDeltaT, maxDeltaT] (deterministic runs keep a fixed step)
+    bool adaptiveStep = false;
+    float minDeltaT = 0.001f;
+    float maxDeltaT = 0.02f;
+    float stepTolerance = 0.001f;
   };
 
   // compute shader uniform data structure
@@ -98,9 +210,32 @@ public:
     float deltaT;
     float currentT;
     vec3 wind_dir;
-    float garbage1; // garbage for vec3
+    // fixed point step applied to the integrated state (0 disables snapping)
+    float quantization;
+
+    // GridLayout::Order of the particle buffers
+    uint32_t particleOrder;
+    // ParticlePrecision and VertexPrecision of the buffers
+    uint32_t particlePrecision;
+    uint32_t vertexPrecision;
+    // multiplies the wind and sphere forces, a simulation proxy particle
+    // stands for several particles (see ClothProxy)
+    float forceScale;
+
+    // grid rows in the particle buffers of a tile (see ClothTiles) - they
+    // hold tileRows rows from tileFirstRow on, the kernels step rows
+    // [tileRowBegin, tileRowEnd) of them, all of the grid for an untiled cloth
+    uint32_t tileFirstRow;
+    uint32_t tileRowBegin;
+    uint32_t tileRowEnd;
+    uint32_t tileRows;
   };
 
+  // work needed to apply a parameter change, from cheapest to most expensive:
+  // rewriting the uniforms, resizing the particle grid (buffers are only
+  // reallocated when they grow) or rebuilding every WebGPU object
+  enum class ReconfigureTier { None = 0, Uniforms, Resize, Rebuild };
+
   // data structure members
   ClothParameters parameters = ClothParameters();
   ClothUniforms uniforms = ClothUniforms();
@@ -112,26 +247,148 @@ public:
   float particleMass = totalMass / numParticles;
   float particleDist = parameters.scale / parameters.height;
 
-  // time variables
+  // connectivity of a garment, and the file it was loaded from (empty while
+  // none is loaded)
+  ClothTopology m_topology;
+  std::string m_topologyPath;
+
+  // coarse simulation proxy of a grid
+  ClothProxy m_proxy;
+
+  // tiles of a grid too large for single bindings, and their rows (0 while
+  // the cloth is not tiled)
+  ClothTiles m_tiles;
+  int m_tileRows = 0;
+  bool tiled() const { return m_tileRows > 0; }
+
+  // energy, strain and bounds of the latest state, read back asynchronously
+  ClothStats m_stats;
+  // rolls a diverged cloth back to a snapshot with a smaller time step
+  ClothWatchdog m_watchdog;
+
+  // time variables - simTime sums the steps, so a step that changes mid-run
+  // (the GUI, updateTimeStep() or a watchdog rollback) does not move the time
   float currentT = 0.0f;
   int frame = 0;
+  double simTime = 0.0;
+  // statistics results updateTimeStep() has already used
+  int m_timeStepResults = 0;
   vec3 sphere_pos = vec3(0.0f, 0.0f, -1.0f);
 
+  // state readback buffer and hash of the last simulated state (updated every
+  // frame in deterministic mode)
+  wgpu::Buffer m_readbackBuffer = nullptr;
+  std::vector<ClothParticle> m_readbackData;
+  uint64_t lastStateHash = 0;
+
+  // shared with the CPU backend so that both derive identical inputs
+  static ClothUniforms computeUniforms(const ClothParameters &p);
+  // garments spread the mass over their own particle count
+  static ClothUniforms computeUniforms(const ClothParameters &p,
+                                       const ClothTopology &topology);
+  // time and sphere position after the steps that sum up to time
+  static void advanceUniforms(const ClothParameters &p, double time,
+                              ClothUniforms &u);
+  // storage layout of a cloth, garments are always stored in their own order
+  static GridLayout gridLayout(const ClothParameters &p);
+  // copies stored particles into row-major grid order
+  static void toGridOrder(const GridLayout &layout,
+                          const ClothParticle *stored, size_t count,
+                          std::vector<ClothParticle> &grid);
+  // row-major rows [rowBegin, rowEnd), particles holding the first of them
+  static void fillGridRows(const ClothParameters &p, ClothParticle *particles,
+                           int rowBegin, int rowEnd);
+
+  // particle precision actually used, deterministic runs need full precision
+  static ParticlePrecision particlePrecision(const ClothParameters &p);
+  // bytes per particle and per vertex in the buffers
+  static uint32_t particleStride(ParticlePrecision precision);
+  static uint32_t vertexStride(VertexPrecision precision);
+  // conversions between ClothParticle and the stored words, the CPU side of
+  // store_particle() in compute.wgsl
+  static void packParticles(ParticlePrecision precision,
+                            const ClothParticle *particles, size_t count,
+                            void *stored);
+  static void unpackParticles(ParticlePrecision precision, const void *stored,
+                              size_t count, ClothParticle *particles);
+  // same for one vertex, see store_vertex() in compute.wgsl
+  static void packVertex(VertexPrecision precision, const ClothVertex &vertex,
+                         uint32_t *stored);
+  static ClothVertex unpackVertex(VertexPrecision precision,
+                                  const uint32_t *stored);
+  // triangle list of a cloth as storage indices of its particles, in the
+  // vertex order of the triangle soup, keeping every step-th grid row and
+  // column
+  static void triangleIndices(const ClothParameters &p,
+                              const ClothTopology &topology, int step,
+                              std::vector<uint32_t> &indices);
+  static uint32_t lodIndexCount(const ClothParameters &p,
+                                const ClothTopology &topology, int step);
+  static uint64_t hashParticles(const ClothParticle *particles, size_t count);
+
+  // process pending callbacks (map requests, submitted work) on the device
+  static void pollDevice(wgpu::Device &device);
+  // block until the queue has finished all submitted work
+  static void waitIdle(wgpu::Device &device);
+  // 1D dispatch of 64-wide workgroups that stays within the dimension limit
+  static void dispatchLinear(wgpu::ComputePassEncoder &pass,
+                             uint32_t invocationCount);
+
   // functions
   void updateParameters(ClothParameters &p);
+  void updateDerivedParameters();
+
+  static ReconfigureTier reconfigureTier(const ClothParameters &from,
+                                         const ClothParameters &to);
+  // applies new parameters using the cheapest tier that covers the change
+  ReconfigureTier reconfigure(ClothParameters &p, wgpu::Device &device);
+  void resize(ClothParameters &p, wgpu::Device &device);
 
   void processFrame(wgpu::Device &device);
   void computePass(wgpu::Device &device);
 
+  void initUniforms(wgpu::Device &device);
   void updateUniforms(wgpu::Device &device);
   void terminateUniforms();
 
   void fillBuffer(wgpu::Device &device);
+  // runs the initial state generator into both particle buffers on the GPU
+  void generateInitialState(wgpu::Device &device);
   void initBuffers(wgpu::Device &device);
   void terminateBuffers();
 
+  // size of m_vertexBuffer for the current cloth and render path
+  uint64_t vertexBufferBytes() const;
+  uint64_t indexBufferBytes() const;
+  // uploads triangleIndices() of every level for the vertex pulling path
+  void writeIndices(wgpu::Device &device);
+
+  // bounding sphere of the rest shape in render space
+  void renderBounds(vec3 &center, float &radius) const;
+  // level of detail to draw when the bounding sphere's radius covers
+  // projectedRadius pixels on screen
+  int lodLevel(float projectedRadius) const;
+
+  // whether deltaT follows the error estimate
+  static bool adaptiveStep(const ClothParameters &p);
+  // scales deltaT by the latest error estimate, once per new statistics
+  // result
+  void updateTimeStep();
+
+  // whether a cloth gets a simulation proxy
+  static bool simulationLod(const ClothParameters &p);
+  // requests the proxy when the cloth is small on screen, with some
+  // hysteresis so that it does not flicker between both
+  void updateSimulationLod(float projectedRadius);
+  // particles stepped by the simulation each frame
+  int simulatedParticles() const;
+
   void initBindGroup(wgpu::Device &device);
   void terminateBindGroups();
+  // render bind group holding the latest particle state
+  wgpu::BindGroup renderBindGroup() const {
+    return m_renderBindGroups[frame % 2];
+  }
 
   void initBindGroupLayout(wgpu::Device &device);
   void terminateBindGroupLayouts();
@@ -139,6 +396,23 @@ public:
   void initComputePipeline(wgpu::Device &device);
   void terminateComputePipeline();
 
+  void initInitPipeline(wgpu::Device &device);
+  void terminateInitPipeline();
+
+  // copies the latest particle state back to the CPU in grid order (blocking)
+  bool readParticles(wgpu::Device &device, std::vector<ClothParticle> &out);
+  // grid order particles of the stored words of the whole cloth
+  void unpackStored(const void *stored, std::vector<ClothParticle> &out) const;
+  uint64_t readStateHash(wgpu::Device &device);
+
+  // splits the grid into tiles if the device needs it or p asks for it -
+  // tiles are stored row-major and drawn from vertex buffers, p follows
+  void chooseTiles(ClothParameters &p, wgpu::Device &device);
+  // turns off what a tiled cloth cannot do, in the parameters and in p
+  void keepTiledParameters(ClothParameters &p);
+  // the proxy and statistics of the cloth, or its tiles
+  void initComponents(wgpu::Device &device);
+
   void initiateNewCloth(ClothParameters &p, wgpu::Device &device);
   void terminateAll();
 };
@@ -0,0 +1,260 @@
+#include "ClothProxy.h"
+#include "BufferPool.h"
+#include "ClothObject.h"
+#include "GpuTracker.h"
+#include "ResourceManager.h"
+
+#include <algorithm>
+#include <vector>
+
+using namespace wgpu;
+using ClothUniforms = ClothObject::ClothUniforms;
+using ClothParameters = ClothObject::ClothParameters;
+
+void ClothProxy::init(ClothObject &cloth, wgpu::Device &device) {
+  const ClothParameters &p = cloth.parameters;
+  m_step = (uint32_t)std::max(p.simLodStep, 1);
+  m_proxyWidth = proxySize((uint32_t)p.width, m_step);
+  m_proxyHeight = proxySize((uint32_t)p.height, m_step);
+  m_proxyBytes = (uint64_t)particleCount() *
+                 ClothObject::particleStride(ClothObject::particlePrecision(p));
+
+  // proxy state, a fraction 1 / step^2 of the cloth
+  WGPUBufferUsageFlags particleUsage =
+      BufferUsage::Storage | BufferUsage::CopyDst | BufferUsage::CopySrc;
+  for (Buffer &buffer : m_proxyBuffers) {
+    buffer = BufferPool::acquire(device, m_proxyBytes, particleUsage);
+  }
+  m_detailBuffer =
+      BufferPool::acquire(device, (uint64_t)cloth.numParticles * 16,
+                          BufferUsage::Storage | BufferUsage::CopyDst);
+
+  BufferDescriptor ubufferDesc;
+  ubufferDesc.size = sizeof(ClothUniforms);
+  ubufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+  ubufferDesc.mappedAtCreation = false;
+  m_uniformBuffer = GpuTracker::createBuffer(device, ubufferDesc);
+  ubufferDesc.size = sizeof(LodUniforms);
+  m_lodUniformBuffer = GpuTracker::createBuffer(device, ubufferDesc);
+
+  initPipelines(device);
+  initBindGroups(cloth, device);
+
+  // a new cloth always starts at full resolution
+  m_wanted = false;
+  m_active = false;
+  m_entering = false;
+  m_framesActive = 0;
+}
+
+void ClothProxy::initPipelines(wgpu::Device &device) {
+  m_shaderModule =
+      ResourceManager::loadShaderModule(RESOURCE_DIR "/lod.wgsl", device);
+
+  std::vector<BindGroupLayoutEntry> bindings(4, Default);
+
+  // lod parameters
+  bindings[0].binding = 0;
+  bindings[0].visibility = ShaderStage::Compute;
+  bindings[0].buffer.type = BufferBindingType::Uniform;
+  bindings[0].buffer.minBindingSize = sizeof(LodUniforms);
+
+  // full particles, proxy particles and detail offsets
+  for (uint32_t binding = 1; binding < 4; binding++) {
+    bindings[binding].binding = binding;
+    bindings[binding].visibility = ShaderStage::Compute;
+    bindings[binding].buffer.type = BufferBindingType::Storage;
+  }
+
+  BindGroupLayoutDescriptor bindGroupLayoutDesc;
+  bindGroupLayoutDesc.entryCount = (uint32_t)bindings.size();
+  bindGroupLayoutDesc.entries = bindings.data();
+  m_bindGroupLayout =
+      GpuTracker::createBindGroupLayout(device, bindGroupLayoutDesc);
+
+  PipelineLayoutDescriptor pipelineLayoutDesc;
+  pipelineLayoutDesc.bindGroupLayoutCount = 1;
+  pipelineLayoutDesc.bindGroupLayouts =
+      (WGPUBindGroupLayout *)&m_bindGroupLayout;
+  m_pipelineLayout =
+      GpuTracker::createPipelineLayout(device, pipelineLayoutDesc);
+
+  ComputePipelineDescriptor pipelineDesc;
+  pipelineDesc.compute.constantCount = 0;
+  pipelineDesc.compute.constants = nullptr;
+  pipelineDesc.compute.module = m_shaderModule;
+  pipelineDesc.layout = m_pipelineLayout;
+  pipelineDesc.compute.entryPoint = "restrict_to_proxy";
+  m_restrictPipeline = GpuTracker::createComputePipeline(device, pipelineDesc);
+  pipelineDesc.compute.entryPoint = "capture_detail";
+  m_detailPipeline = GpuTracker::createComputePipeline(device, pipelineDesc);
+  pipelineDesc.compute.entryPoint = "prolong_to_full";
+  m_prolongPipeline = GpuTracker::createComputePipeline(device, pipelineDesc);
+}
+
+void ClothProxy::initBindGroups(ClothObject &cloth, wgpu::Device &device) {
+  for (int parity = 0; parity < 2; parity++) {
+    // proxy simulation, same layout as the cloth's own group 0
+    std::vector<BindGroupEntry> entries(3, Default);
+    entries[0].binding = 0;
+    entries[0].buffer = m_uniformBuffer;
+    entries[0].offset = 0;
+    entries[0].size = sizeof(ClothUniforms);
+
+    entries[1].binding = 1;
+    entries[1].buffer = m_proxyBuffers[parity];
+    entries[1].offset = 0;
+    entries[1].size = m_proxyBytes;
+
+    entries[2].binding = 2;
+    entries[2].buffer = m_proxyBuffers[1 - parity];
+    entries[2].offset = 0;
+    entries[2].size = m_proxyBytes;
+
+    BindGroupDescriptor bindGroupDesc;
+    bindGroupDesc.layout = cloth.m_bindGroupLayouts[0];
+    bindGroupDesc.entryCount = (uint32_t)entries.size();
+    bindGroupDesc.entries = (WGPUBindGroupEntry *)entries.data();
+    m_simBindGroups[parity] =
+        GpuTracker::createBindGroup(device, bindGroupDesc);
+
+    // transfers between the full grid and the proxy of the same parity
+    std::vector<BindGroupEntry> lentries(4, Default);
+    lentries[0].binding = 0;
+    lentries[0].buffer = m_lodUniformBuffer;
+    lentries[0].offset = 0;
+    lentries[0].size = sizeof(LodUniforms);
+
+    lentries[1].binding = 1;
+    lentries[1].buffer = cloth.particleBuffers[parity];
+    lentries[1].offset = 0;
+    lentries[1].size = cloth.m_bufferSize;
+
+    lentries[2].binding = 2;
+    lentries[2].buffer = m_proxyBuffers[parity];
+    lentries[2].offset = 0;
+    lentries[2].size = m_proxyBytes;
+
+    lentries[3].binding = 3;
+    lentries[3].buffer = m_detailBuffer;
+    lentries[3].offset = 0;
+    lentries[3].size = (uint64_t)cloth.numParticles * 16;
+
+    BindGroupDescriptor lbindGroupDesc;
+    lbindGroupDesc.layout = m_bindGroupLayout;
+    lbindGroupDesc.entryCount = (uint32_t)lentries.size();
+    lbindGroupDesc.entries = (WGPUBindGroupEntry *)lentries.data();
+    m_lodBindGroups[parity] =
+        GpuTracker::createBindGroup(device, lbindGroupDesc);
+  }
+}
+
+void ClothProxy::beginFrame(ClothObject &cloth, wgpu::Device &device) {
+  if (m_wanted != m_active) {
+    // leaving needs no work, the full grid already holds the interpolated
+    // proxy
+    m_active = m_wanted;
+    m_entering = m_active;
+    m_framesActive = 0;
+  }
+  if (!m_active) {
+    return;
+  }
+
+  // the cloth's uniforms of this frame on the coarse grid - each proxy
+  // particle stands for step^2 particles
+  float area = (float)(m_step * m_step);
+  ClothUniforms u = cloth.uniforms;
+  u.width = (float)m_proxyWidth;
+  u.height = (float)m_proxyHeight;
+  u.tileRowEnd = m_proxyHeight;
+  u.tileRows = m_proxyHeight;
+  u.particleDist *= (float)m_step;
+  u.particleMass *= area;
+  u.forceScale = area;
+  Queue queue = device.getQueue();
+  queue.writeBuffer(m_uniformBuffer, 0, &u, sizeof(ClothUniforms));
+
+  LodUniforms l;
+  l.fullWidth = (uint32_t)cloth.parameters.width;
+  l.fullHeight = (uint32_t)cloth.parameters.height;
+  l.proxyWidth = m_proxyWidth;
+  l.proxyHeight = m_proxyHeight;
+  l.step = m_step;
+  l.rowOffset = (int32_t)(l.fullHeight - 1) -
+                (int32_t)((m_proxyHeight - 1) * m_step);
+  l.particleOrder = cloth.uniforms.particleOrder;
+  l.particlePrecision = cloth.uniforms.particlePrecision;
+  l.detailWeight =
+      std::max(0.0f, 1.0f - (float)m_framesActive / (float)FadeFrames);
+  l.garbage[0] = l.garbage[1] = l.garbage[2] = 0.0f;
+  queue.writeBuffer(m_lodUniformBuffer, 0, &l, sizeof(LodUniforms));
+  m_framesActive++;
+}
+
+void ClothProxy::dispatch(wgpu::CommandEncoder &encoder,
+                          wgpu::ComputePipeline pipeline,
+                          wgpu::BindGroup bindGroup, uint32_t invocationCount,
+                          const char *label) {
+  ComputePassDescriptor computePassDesc;
+  computePassDesc.timestampWrites = nullptr;
+  computePassDesc.label = label;
+  ComputePassEncoder computePass = encoder.beginComputePass(computePassDesc);
+  computePass.setPipeline(pipeline);
+  computePass.setBindGroup(0, bindGroup, 0, nullptr);
+  ClothObject::dispatchLinear(computePass, invocationCount);
+  computePass.end();
+}
+
+void ClothProxy::encodeStep(ClothObject &cloth,
+                            wgpu::CommandEncoder &encoder) {
+  // the proxy follows the parity of the cloth - it reads the proxy of the
+  // input buffer and its result is spread into the output buffer
+  int parity = cloth.frame % 2;
+  if (m_entering) {
+    dispatch(encoder, m_restrictPipeline, m_lodBindGroups[parity],
+             particleCount(), "proxy restrict");
+    dispatch(encoder, m_detailPipeline, m_lodBindGroups[parity],
+             (uint32_t)cloth.numParticles, "proxy detail");
+    m_entering = false;
+  }
+
+  // the regular simulation kernel on the coarse grid
+  ComputePassDescriptor computePassDesc;
+  computePassDesc.timestampWrites = nullptr;
+  computePassDesc.label = "proxy simulation";
+  ComputePassEncoder computePass = encoder.beginComputePass(computePassDesc);
+  computePass.setPipeline(cloth.m_pipeline);
+  computePass.setBindGroup(0, m_simBindGroups[parity], 0, nullptr);
+  computePass.setBindGroup(1, cloth.m_vertexBindGroup, 0, nullptr);
+  ClothObject::dispatchLinear(computePass, particleCount());
+  computePass.end();
+
+  dispatch(encoder, m_prolongPipeline, m_lodBindGroups[1 - parity],
+           (uint32_t)cloth.numParticles, "proxy prolong");
+}
+
+void ClothProxy::terminate() {
+  for (BindGroup &bindGroup : m_simBindGroups) {
+    GpuTracker::release(bindGroup);
+  }
+  for (BindGroup &bindGroup : m_lodBindGroups) {
+    GpuTracker::release(bindGroup);
+  }
+  GpuTracker::release(m_restrictPipeline);
+  GpuTracker::release(m_detailPipeline);
+  GpuTracker::release(m_prolongPipeline);
+  GpuTracker::release(m_pipelineLayout);
+  GpuTracker::release(m_bindGroupLayout);
+  GpuTracker::release(m_shaderModule);
+  GpuTracker::release(m_uniformBuffer);
+  GpuTracker::release(m_lodUniformBuffer);
+  for (Buffer &buffer : m_proxyBuffers) {
+    BufferPool::recycle(buffer);
+  }
+  BufferPool::recycle(m_detailBuffer);
+  m_active = false;
+  m_wanted = false;
+  m_proxyWidth = 0;
+  m_proxyHeight = 0;
+}
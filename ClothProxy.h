@@ -0,0 +1,115 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <array>
+#include <cstdint>
+
+class ClothObject;
+
+// Simulation level of detail of a grid cloth. A cloth that is small on screen
+// runs the simulation on a coarse proxy grid holding every step-th particle
+// of every step-th row, and the full grid is re-interpolated from it after
+// every proxy step so that rendering, readback and a later switch back to the
+// full grid never see the difference.
+//
+// The proxy keeps the spacing a uniform step * particleDist: its columns
+// start at column 0 and its rows end at the pinned top row, so up to step - 1
+// virtual particles extend past the right and bottom edges, extrapolated from
+// the edge when the proxy is taken. Each proxy particle carries the mass of
+// step^2 particles and the external forces scale with it (forceScale), the
+// springs need no rescaling since a 2D spring grid keeps its stiffness when
+// the spacing grows. Switching to the proxy keeps the detail the proxy cannot
+// represent as an offset that fades out over FadeFrames frames, so neither
+// direction pops.
+//
+// The kernels are in resources/lod.wgsl, the proxy itself is stepped by the
+// regular simulation pipeline of the cloth.
+class ClothProxy {
+public:
+  // lod shader uniform data structure
+  struct LodUniforms {
+    uint32_t fullWidth;
+    uint32_t fullHeight;
+    uint32_t proxyWidth;
+    uint32_t proxyHeight;
+
+    uint32_t step;
+    // full grid row of proxy row 0, zero or negative
+    int32_t rowOffset;
+    // GridLayout::Order and ParticlePrecision of both grids
+    uint32_t particleOrder;
+    uint32_t particlePrecision;
+
+    // weight of the fine detail captured when the proxy was taken
+    float detailWeight;
+    float garbage[3];
+  };
+
+  static constexpr int FadeFrames = 30;
+
+  // proxy particles along a grid side of size particles
+  static uint32_t proxySize(uint32_t size, uint32_t step) {
+    return (size - 1 + step - 1) / step + 1;
+  }
+
+  // allocates the proxy of a cloth whose buffers and layouts exist
+  void init(ClothObject &cloth, wgpu::Device &device);
+  void terminate();
+  bool initialized() const { return m_proxyBuffers[0] != nullptr; }
+
+  // the proxy is entered or left at the start of the next frame
+  void request(bool coarse) { m_wanted = coarse; }
+  // takes the proxy from the full grid again, after the full grid was
+  // replaced (see ClothWatchdog)
+  void retake() {
+    m_entering = m_active;
+    m_framesActive = 0;
+  }
+  bool active() const { return m_active; }
+  uint32_t particleCount() const { return m_proxyWidth * m_proxyHeight; }
+
+  // switches to or from the proxy if requested and writes the uniforms of
+  // the frame
+  void beginFrame(ClothObject &cloth, wgpu::Device &device);
+  // encodes one proxy step in place of the full simulation pass, leaving the
+  // interpolated full grid in the output buffer of the frame
+  void encodeStep(ClothObject &cloth, wgpu::CommandEncoder &encoder);
+
+private:
+  void initPipelines(wgpu::Device &device);
+  void initBindGroups(ClothObject &cloth, wgpu::Device &device);
+  void dispatch(wgpu::CommandEncoder &encoder, wgpu::ComputePipeline pipeline,
+                wgpu::BindGroup bindGroup, uint32_t invocationCount,
+                const char *label);
+
+  uint32_t m_step = 1;
+  uint32_t m_proxyWidth = 0;
+  uint32_t m_proxyHeight = 0;
+  uint64_t m_proxyBytes = 0;
+
+  bool m_wanted = false;
+  bool m_active = false;
+  // the proxy has to be taken from the full grid this frame
+  bool m_entering = false;
+  int m_framesActive = 0;
+
+  // ping-pong proxy state, simulated with the bind groups of the cloth's
+  // layout (m_simBindGroups[i] reads m_proxyBuffers[i])
+  std::array<wgpu::Buffer, 2> m_proxyBuffers = {nullptr, nullptr};
+  wgpu::Buffer m_uniformBuffer = nullptr;
+  std::array<wgpu::BindGroup, 2> m_simBindGroups = {nullptr, nullptr};
+
+  // fine detail offsets of the full grid, one vec4 per particle
+  wgpu::Buffer m_detailBuffer = nullptr;
+  wgpu::Buffer m_lodUniformBuffer = nullptr;
+  // m_lodBindGroups[i] pairs particleBuffers[i] with m_proxyBuffers[i]
+  std::array<wgpu::BindGroup, 2> m_lodBindGroups = {nullptr, nullptr};
+
+  wgpu::ShaderModule m_shaderModule = nullptr;
+  wgpu::BindGroupLayout m_bindGroupLayout = nullptr;
+  wgpu::PipelineLayout m_pipelineLayout = nullptr;
+  wgpu::ComputePipeline m_restrictPipeline = nullptr;
+  wgpu::ComputePipeline m_detailPipeline = nullptr;
+  wgpu::ComputePipeline m_prolongPipeline = nullptr;
+};
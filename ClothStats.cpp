@@ -0,0 +1,279 @@
+#include "ClothStats.h"
+#include "BufferPool.h"
+#include "ClothObject.h"
+#include "GpuTracker.h"
+#include "ResourceManager.h"
+
+#include <vector>
+
+using namespace wgpu;
+
+void ClothStats::init(ClothObject &cloth, wgpu::Device &device) {
+  m_device = device;
+  m_garment = cloth.parameters.topology == ClothObject::Topology::Mesh;
+  // one partial per workgroup of 64 particles
+  m_partialCount = ((uint32_t)cloth.numParticles + 63) / 64;
+
+  m_partialBuffer = BufferPool::acquire(
+      device, (uint64_t)m_partialCount * sizeof(Stats), BufferUsage::Storage);
+
+  BufferDescriptor bufferDesc;
+  bufferDesc.size = sizeof(StatsUniforms);
+  bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+  bufferDesc.mappedAtCreation = false;
+  m_uniformBuffer = GpuTracker::createBuffer(device, bufferDesc);
+
+  bufferDesc.size = sizeof(Stats);
+  bufferDesc.usage = BufferUsage::Storage | BufferUsage::CopySrc;
+  m_resultBuffer = GpuTracker::createBuffer(device, bufferDesc);
+  bufferDesc.label = "stats readback";
+  bufferDesc.usage = BufferUsage::MapRead | BufferUsage::CopyDst;
+  for (Readback &readback : m_readbacks) {
+    readback.buffer = GpuTracker::createBuffer(device, bufferDesc);
+  }
+
+  initPipelines(device);
+  initBindGroups(cloth, device);
+
+  std::lock_guard<std::mutex> lock(m_resultLock);
+  m_latest = Stats();
+  m_latestFrame = 0;
+}
+
+void ClothStats::initPipelines(wgpu::Device &device) {
+  m_shaderModule =
+      ResourceManager::loadShaderModule(RESOURCE_DIR "/stats.wgsl", device);
+
+  // the topology binding only exists for a garment, like in the cloth's own
+  // group 1
+  std::vector<BindGroupLayoutEntry> bindings(m_garment ? 5 : 4, Default);
+
+  // stats parameters
+  bindings[0].binding = 0;
+  bindings[0].visibility = ShaderStage::Compute;
+  bindings[0].buffer.type = BufferBindingType::Uniform;
+  bindings[0].buffer.minBindingSize = sizeof(StatsUniforms);
+
+  // latest particles
+  bindings[1].binding = 1;
+  bindings[1].visibility = ShaderStage::Compute;
+  bindings[1].buffer.type = BufferBindingType::ReadOnlyStorage;
+
+  // partial and final summaries
+  bindings[2].binding = 2;
+  bindings[2].visibility = ShaderStage::Compute;
+  bindings[2].buffer.type = BufferBindingType::Storage;
+  bindings[3].binding = 3;
+  bindings[3].visibility = ShaderStage::Compute;
+  bindings[3].buffer.type = BufferBindingType::Storage;
+  bindings[3].buffer.minBindingSize = sizeof(Stats);
+
+  if (m_garment) {
+    bindings[4].binding = 4;
+    bindings[4].visibility = ShaderStage::Compute;
+    bindings[4].buffer.type = BufferBindingType::ReadOnlyStorage;
+  }
+
+  BindGroupLayoutDescriptor bindGroupLayoutDesc;
+  bindGroupLayoutDesc.entryCount = (uint32_t)bindings.size();
+  bindGroupLayoutDesc.entries = bindings.data();
+  m_bindGroupLayout =
+      GpuTracker::createBindGroupLayout(device, bindGroupLayoutDesc);
+
+  PipelineLayoutDescriptor pipelineLayoutDesc;
+  pipelineLayoutDesc.bindGroupLayoutCount = 1;
+  pipelineLayoutDesc.bindGroupLayouts =
+      (WGPUBindGroupLayout *)&m_bindGroupLayout;
+  m_pipelineLayout =
+      GpuTracker::createPipelineLayout(device, pipelineLayoutDesc);
+
+  ComputePipelineDescriptor pipelineDesc;
+  pipelineDesc.compute.constantCount = 0;
+  pipelineDesc.compute.constants = nullptr;
+  pipelineDesc.compute.module = m_shaderModule;
+  pipelineDesc.layout = m_pipelineLayout;
+  pipelineDesc.compute.entryPoint = m_garment ? "reduce_mesh" : "reduce_grid";
+  m_particlePipeline = GpuTracker::createComputePipeline(device, pipelineDesc);
+  pipelineDesc.compute.entryPoint = "reduce_partials";
+  m_partialPipeline = GpuTracker::createComputePipeline(device, pipelineDesc);
+}
+
+void ClothStats::initBindGroups(ClothObject &cloth, wgpu::Device &device) {
+  for (int parity = 0; parity < 2; parity++) {
+    std::vector<BindGroupEntry> entries(m_garment ? 5 : 4, Default);
+    entries[0].binding = 0;
+    entries[0].buffer = m_uniformBuffer;
+    entries[0].offset = 0;
+    entries[0].size = sizeof(StatsUniforms);
+
+    entries[1].binding = 1;
+    entries[1].buffer = cloth.particleBuffers[1 - parity];
+    entries[1].offset = 0;
+    entries[1].size = cloth.m_bufferSize;
+
+    entries[2].binding = 2;
+    entries[2].buffer = m_partialBuffer;
+    entries[2].offset = 0;
+    entries[2].size = (uint64_t)m_partialCount * sizeof(Stats);
+
+    entries[3].binding = 3;
+    entries[3].buffer = m_resultBuffer;
+    entries[3].offset = 0;
+    entries[3].size = sizeof(Stats);
+
+    if (m_garment) {
+      entries[4].binding = 4;
+      entries[4].buffer = cloth.m_topologyBuffer;
+      entries[4].offset = 0;
+      entries[4].size = cloth.m_topologyBuffer.getSize();
+    }
+
+    BindGroupDescriptor bindGroupDesc;
+    bindGroupDesc.layout = m_bindGroupLayout;
+    bindGroupDesc.entryCount = (uint32_t)entries.size();
+    bindGroupDesc.entries = (WGPUBindGroupEntry *)entries.data();
+    m_bindGroups[parity] = GpuTracker::createBindGroup(device, bindGroupDesc);
+  }
+}
+
+void ClothStats::writeUniforms(ClothObject &cloth, wgpu::Device &device) {
+  // the mass and spacing follow the live parameters
+  const ClothObject::ClothParameters &p = cloth.parameters;
+  StatsUniforms u;
+  u.width = (uint32_t)p.width;
+  u.height = (uint32_t)p.height;
+  u.particleCount = (uint32_t)cloth.numParticles;
+  u.particleWords =
+      ClothObject::particleStride(ClothObject::particlePrecision(p)) /
+      sizeof(uint32_t);
+  u.particleOrder = cloth.uniforms.particleOrder;
+  u.particlePrecision = cloth.uniforms.particlePrecision;
+  u.partialCount = m_partialCount;
+  u.garbage1 = 0;
+  u.particleMass = cloth.uniforms.particleMass;
+  u.particleDist = cloth.uniforms.particleDist;
+  u.particleScale = cloth.uniforms.particleScale;
+  u.garbage2 = 0.0f;
+  device.getQueue().writeBuffer(m_uniformBuffer, 0, &u,
+                                sizeof(StatsUniforms));
+}
+
+bool ClothStats::encode(ClothObject &cloth, wgpu::CommandEncoder &encoder) {
+  Readback *free = nullptr;
+  for (Readback &readback : m_readbacks) {
+    if (!readback.copied && !readback.mapping) {
+      free = &readback;
+      break;
+    }
+  }
+  if (!free) {
+    return false;
+  }
+  writeUniforms(cloth, m_device);
+
+  ComputePassDescriptor computePassDesc;
+  computePassDesc.timestampWrites = nullptr;
+  computePassDesc.label = "cloth stats";
+  ComputePassEncoder computePass = encoder.beginComputePass(computePassDesc);
+  computePass.setBindGroup(0, m_bindGroups[cloth.frame % 2], 0, nullptr);
+  computePass.setPipeline(m_particlePipeline);
+  ClothObject::dispatchLinear(computePass, (uint32_t)cloth.numParticles);
+  computePass.setPipeline(m_partialPipeline);
+  computePass.dispatchWorkgroups(1, 1, 1);
+  computePass.end();
+
+  encoder.copyBufferToBuffer(m_resultBuffer, 0, free->buffer, 0,
+                             sizeof(Stats));
+  free->frame = cloth.frame;
+  free->generation = m_generation;
+  free->copied = true;
+  return true;
+}
+
+void ClothStats::afterSubmit() {
+  for (Readback &readback : m_readbacks) {
+    if (!readback.copied) {
+      continue;
+    }
+    readback.copied = false;
+    readback.mapping = true;
+    Readback *slot = &readback;
+    readback.callback = readback.buffer.mapAsync(
+        MapMode::Read, 0, sizeof(Stats),
+        [this, slot](BufferMapAsyncStatus status) {
+          // the slot is free again once it is unmapped
+          if (status != BufferMapAsyncStatus::Success) {
+            slot->mapping = false;
+            return;
+          }
+          {
+            // results can arrive out of order, keep the newest
+            std::lock_guard<std::mutex> lock(m_resultLock);
+            if (slot->generation == m_generation &&
+                slot->frame > m_latestFrame) {
+              m_latest = *(const Stats *)slot->buffer.getConstMappedRange(
+                  0, sizeof(Stats));
+              m_latestFrame = slot->frame;
+              m_resultCount++;
+            }
+          }
+          slot->buffer.unmap();
+          slot->mapping = false;
+        });
+  }
+}
+
+void ClothStats::poll() {
+  for (const Readback &readback : m_readbacks) {
+    if (readback.mapping) {
+      ClothObject::pollDevice(m_device);
+      return;
+    }
+  }
+}
+
+ClothStats::Stats ClothStats::latest() const {
+  std::lock_guard<std::mutex> lock(m_resultLock);
+  return m_latest;
+}
+
+int ClothStats::latestFrame() const {
+  std::lock_guard<std::mutex> lock(m_resultLock);
+  return m_latestFrame;
+}
+
+int ClothStats::resultCount() const {
+  std::lock_guard<std::mutex> lock(m_resultLock);
+  return m_resultCount;
+}
+
+void ClothStats::discard() {
+  std::lock_guard<std::mutex> lock(m_resultLock);
+  m_generation++;
+  m_latest = Stats();
+  m_latestFrame = 0;
+}
+
+void ClothStats::terminate() {
+  // the callbacks must fire before their buffers and handles go away
+  for (Readback &readback : m_readbacks) {
+    while (readback.mapping) {
+      ClothObject::pollDevice(m_device);
+    }
+    readback.copied = false;
+    readback.callback.reset();
+    GpuTracker::release(readback.buffer);
+  }
+  for (BindGroup &bindGroup : m_bindGroups) {
+    GpuTracker::release(bindGroup);
+  }
+  GpuTracker::release(m_particlePipeline);
+  GpuTracker::release(m_partialPipeline);
+  GpuTracker::release(m_pipelineLayout);
+  GpuTracker::release(m_bindGroupLayout);
+  GpuTracker::release(m_shaderModule);
+  GpuTracker::release(m_uniformBuffer);
+  GpuTracker::release(m_resultBuffer);
+  BufferPool::recycle(m_partialBuffer);
+  m_partialCount = 0;
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <webgpu/webgpu.hpp>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+class ClothObject;
+
+// Per-frame statistics of a cloth, reduced on the GPU: kinetic energy,
+// largest spring strain, bounding box, center of mass, largest speed, largest
+// error estimate of the integrator and the number of particles that are no
+// longer finite. Every 64-wide workgroup reduces its particles in shared
+// memory to one partial summary, then a single workgroup reduces the partials
+// (resources/stats.wgsl).
+//
+// The summary is copied into one of a small ring of staging buffers and
+// mapped asynchronously, so the results arrive a frame or two late and the
+// simulation never waits for them. A frame whose staging buffers are all
+// still in flight is skipped. The mappings may complete in a poll of another
+// thread using the device, so the results are guarded by a lock.
+class ClothStats {
+public:
+  // (Just aliases to make notations lighter)
+  using vec3 = glm::vec3;
+
+  // final summary, must match Summary in stats.wgsl
+  struct Stats {
+    vec3 boundsMin;
+    float kineticEnergy;
+    vec3 boundsMax;
+    // largest length / rest length of a near spring
+    float maxStrain;
+    vec3 centerOfMass;
+    float maxSpeed;
+    // finite particles, and particles with a nan or infinite component
+    uint32_t particleCount;
+    uint32_t nonFinite;
+    // in particle distances, see store_particle() in compute.wgsl
+    float maxError;
+    uint32_t garbage;
+  };
+
+  // stats shader uniform data structure
+  struct StatsUniforms {
+    uint32_t width;
+    uint32_t height;
+    uint32_t particleCount;
+    uint32_t particleWords;
+
+    uint32_t particleOrder;
+    uint32_t particlePrecision;
+    uint32_t partialCount;
+    uint32_t garbage1;
+
+    float particleMass;
+    float particleDist;
+    float particleScale;
+    float garbage2;
+  };
+
+  // staging buffers in flight at most
+  static constexpr int ReadbackSlots = 3;
+
+  // allocates the reduction of a cloth whose buffers exist
+  void init(ClothObject &cloth, wgpu::Device &device);
+  // waits for the mappings still in flight before releasing everything
+  void terminate();
+  bool initialized() const { return m_partialBuffer != nullptr; }
+
+  // encodes the reduction of the state the cloth's step of this frame leaves
+  // in its output buffer, returns false if no staging buffer was free
+  bool encode(ClothObject &cloth, wgpu::CommandEncoder &encoder);
+  // starts mapping what encode() copied, once the commands are submitted
+  void afterSubmit();
+  // lets finished mappings deliver their results
+  void poll();
+  // forgets the latest result and drops the ones still in flight, for a
+  // cloth whose frame count went back
+  void discard();
+
+  // the most recent result, frame is 0 until the first one arrives
+  Stats latest() const;
+  int latestFrame() const;
+  // counts the results that arrived, to tell a new one from the last
+  int resultCount() const;
+
+private:
+  void initPipelines(wgpu::Device &device);
+  void initBindGroups(ClothObject &cloth, wgpu::Device &device);
+  void writeUniforms(ClothObject &cloth, wgpu::Device &device);
+
+  struct Readback {
+    wgpu::Buffer buffer = nullptr;
+    // frame of the copy, and whether it is copied but not yet mapped
+    int frame = 0;
+    // results of an older generation are dropped
+    int generation = 0;
+    bool copied = false;
+    std::atomic<bool> mapping{false};
+    std::unique_ptr<wgpu::BufferMapCallback> callback;
+  };
+
+  wgpu::Device m_device = nullptr;
+  bool m_garment = false;
+  uint32_t m_partialCount = 0;
+
+  wgpu::Buffer m_uniformBuffer = nullptr;
+  // one Stats per first level workgroup, then the final one
+  wgpu::Buffer m_partialBuffer = nullptr;
+  wgpu::Buffer m_resultBuffer = nullptr;
+  std::array<Readback, ReadbackSlots> m_readbacks;
+
+  wgpu::ShaderModule m_shaderModule = nullptr;
+  wgpu::BindGroupLayout m_bindGroupLayout = nullptr;
+  wgpu::PipelineLayout m_pipelineLayout = nullptr;
+  wgpu::ComputePipeline m_particlePipeline = nullptr;
+  wgpu::ComputePipeline m_partialPipeline = nullptr;
+  // m_bindGroups[i] reads the output of the simulation step of parity i
+  std::array<wgpu::BindGroup, 2> m_bindGroups = {nullptr, nullptr};
+
+  mutable std::mutex m_resultLock;
+  Stats m_latest = {};
+  int m_latestFrame = 0;
+  int m_resultCount = 0;
+  int m_generation = 0;
+};
@@ -0,0 +1,357 @@
+#include "ClothTiles.h"
+#include "BufferPool.h"
+#include "ClothInitializer.h"
+#include "ClothObject.h"
+#include "GpuTracker.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+using namespace wgpu;
+using ClothParticle = ClothObject::ClothParticle;
+using ClothUniforms = ClothObject::ClothUniforms;
+using ClothParameters = ClothObject::ClothParameters;
+
+uint64_t ClothTiles::bindingLimit(wgpu::Device &device) {
+  SupportedLimits supportedLimits;
+  if (!device.getLimits(&supportedLimits)) {
+    return UINT64_MAX;
+  }
+  return std::min(supportedLimits.limits.maxStorageBufferBindingSize,
+                  supportedLimits.limits.maxBufferSize);
+}
+
+int ClothTiles::rowsPerTile(const ClothObject &cloth,
+                            uint64_t maxBindingBytes) {
+  const ClothParameters &p = cloth.parameters;
+  if (p.topology != ClothObject::Topology::Grid) {
+    return 0;
+  }
+  bool fits = (uint64_t)cloth.m_bufferSize <= maxBindingBytes &&
+              cloth.vertexBufferBytes() <= maxBindingBytes;
+  if (p.tileRows <= 0 && fits) {
+    return 0;
+  }
+
+  // a tile holds its rows and both halos in the particle buffers, and one
+  // row of quads per row in the vertex buffer
+  uint64_t particleRowBytes =
+      (uint64_t)p.width *
+      ClothObject::particleStride(ClothObject::particlePrecision(p));
+  uint64_t vertexRowBytes = (uint64_t)6 * std::max(p.width - 1, 1) *
+                            ClothObject::vertexStride(p.vertexPrecision);
+  int64_t maxRows =
+      std::min<int64_t>((int64_t)(maxBindingBytes / particleRowBytes) -
+                            2 * HaloRows,
+                        (int64_t)(maxBindingBytes / vertexRowBytes));
+  int64_t rows = p.tileRows > 0 ? std::min<int64_t>(p.tileRows, maxRows)
+                                : maxRows;
+  // every tile fills the halos of its neighbours from its own rows, which
+  // maxWidth() leaves room for
+  rows = std::max<int64_t>(rows, 2 * HaloRows);
+  return rows >= p.height ? 0 : (int)rows;
+}
+
+int ClothTiles::maxWidth(const ClothObject &cloth, uint64_t maxBindingBytes) {
+  // the smallest tile has 2 * HaloRows rows of its own and both halos in the
+  // particle buffers, and a row of quads per row in the vertex buffer
+  const ClothParameters &p = cloth.parameters;
+  const uint64_t minRows = 2 * HaloRows;
+  uint64_t particleWidth =
+      maxBindingBytes /
+      ((minRows + 2 * HaloRows) *
+       ClothObject::particleStride(ClothObject::particlePrecision(p)));
+  uint64_t vertexWidth =
+      maxBindingBytes /
+          (minRows * 6 * ClothObject::vertexStride(p.vertexPrecision)) +
+      1;
+  uint64_t width = std::min(particleWidth, vertexWidth);
+  return (int)std::clamp<uint64_t>(width, 2, INT32_MAX);
+}
+
+void ClothTiles::init(ClothObject &cloth, wgpu::Device &device,
+                      int tileRows) {
+  const ClothParameters &p = cloth.parameters;
+  ClothObject::ParticlePrecision precision =
+      ClothObject::particlePrecision(p);
+  m_particleRowBytes =
+      (uint64_t)p.width * ClothObject::particleStride(precision);
+  uint32_t vertexStride = ClothObject::vertexStride(p.vertexPrecision);
+
+  // rows are spread evenly, so no tile is much smaller than tileRows
+  int count = (p.height + tileRows - 1) / tileRows;
+  m_tiles.resize(count);
+  WGPUBufferUsageFlags particleUsage =
+      BufferUsage::Storage | BufferUsage::CopyDst | BufferUsage::CopySrc;
+  WGPUBufferUsageFlags vertexUsage =
+      BufferUsage::CopyDst | BufferUsage::Storage | BufferUsage::Vertex;
+  for (int i = 0; i < count; i++) {
+    Tile &tile = m_tiles[i];
+    tile.rowBegin = (int)((int64_t)p.height * i / count);
+    tile.rowEnd = (int)((int64_t)p.height * (i + 1) / count);
+    tile.firstRow = std::max(tile.rowBegin - HaloRows, 0);
+    tile.rows = std::min(tile.rowEnd + HaloRows, p.height) - tile.firstRow;
+    tile.particleBytes = (uint64_t)tile.rows * m_particleRowBytes;
+    // the quads between each stepped row and the row above it
+    int quadRows = std::min(tile.rowEnd, p.height - 1) - tile.rowBegin;
+    tile.vertexCount = (uint32_t)(6 * (p.width - 1) * quadRows);
+    tile.vertexBytes = (uint64_t)tile.vertexCount * vertexStride;
+
+    for (Buffer &buffer : tile.particleBuffers) {
+      buffer = BufferPool::acquire(device, tile.particleBytes, particleUsage);
+    }
+    tile.vertexBuffer =
+        BufferPool::acquire(device, tile.vertexBytes, vertexUsage);
+
+    BufferDescriptor ubufferDesc;
+    ubufferDesc.size = sizeof(ClothUniforms);
+    ubufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+    ubufferDesc.mappedAtCreation = false;
+    tile.uniformBuffer = GpuTracker::createBuffer(device, ubufferDesc);
+
+    // same layouts as the cloth's own bind groups
+    for (int parity = 0; parity < 2; parity++) {
+      std::vector<BindGroupEntry> entries(3, Default);
+      entries[0].binding = 0;
+      entries[0].buffer = tile.uniformBuffer;
+      entries[0].offset = 0;
+      entries[0].size = sizeof(ClothUniforms);
+
+      entries[1].binding = 1;
+      entries[1].buffer = tile.particleBuffers[parity];
+      entries[1].offset = 0;
+      entries[1].size = tile.particleBytes;
+
+      entries[2].binding = 2;
+      entries[2].buffer = tile.particleBuffers[1 - parity];
+      entries[2].offset = 0;
+      entries[2].size = tile.particleBytes;
+
+      BindGroupDescriptor bindGroupDesc;
+      bindGroupDesc.layout = cloth.m_bindGroupLayouts[0];
+      bindGroupDesc.entryCount = (uint32_t)entries.size();
+      bindGroupDesc.entries = (WGPUBindGroupEntry *)entries.data();
+      tile.bindGroups[parity] =
+          GpuTracker::createBindGroup(device, bindGroupDesc);
+    }
+
+    std::vector<BindGroupEntry> ventries(1, Default);
+    ventries[0].binding = 0;
+    ventries[0].buffer = tile.vertexBuffer;
+    ventries[0].offset = 0;
+    ventries[0].size = tile.vertexBytes;
+
+    BindGroupDescriptor vbindGroupDesc;
+    vbindGroupDesc.layout = cloth.m_bindGroupLayouts[1];
+    vbindGroupDesc.entryCount = (uint32_t)ventries.size();
+    vbindGroupDesc.entries = (WGPUBindGroupEntry *)ventries.data();
+    tile.vertexBindGroup = GpuTracker::createBindGroup(device, vbindGroupDesc);
+  }
+}
+
+void ClothTiles::fill(ClothObject &cloth, wgpu::Device &device) {
+  // the initial state generator of the GPU writes whole grids, so a tiled
+  // cloth is generated tile by tile on the CPU - stored rows included, the
+  // halos start out in sync
+  const ClothParameters &p = cloth.parameters;
+  std::vector<ClothInitializer::MeshVertex> mesh;
+  if (p.initialState == ClothObject::InitialState::Mesh) {
+    ClothInitializer::loadMesh(p.initMesh, mesh);
+  }
+  ClothObject::ParticlePrecision precision =
+      ClothObject::particlePrecision(p);
+  bool deterministic = p.solverMode == ClothObject::SolverMode::Deterministic;
+  if (deterministic) {
+    cloth.m_readbackData.resize(cloth.numParticles);
+  }
+
+  CommandEncoderDescriptor encoderDesc = Default;
+  encoderDesc.label = "tile init encoder";
+  CommandEncoder encoder = device.createCommandEncoder(encoderDesc);
+  std::vector<Buffer> stagings;
+  std::vector<ClothParticle> particles;
+  for (Tile &tile : m_tiles) {
+    particles.resize((size_t)tile.rows * p.width);
+    ClothInitializer::generateStrip(p, mesh, tile.firstRow,
+                                    tile.firstRow + tile.rows,
+                                    particles.data());
+    if (deterministic) {
+      std::copy_n(particles.begin() + (tile.rowBegin - tile.firstRow) *
+                                          (size_t)p.width,
+                  (size_t)(tile.rowEnd - tile.rowBegin) * p.width,
+                  cloth.m_readbackData.begin() +
+                      (size_t)tile.rowBegin * p.width);
+    }
+
+    BufferDescriptor stagingDesc;
+    stagingDesc.label = "tile init staging";
+    stagingDesc.size = tile.particleBytes;
+    stagingDesc.usage = BufferUsage::CopySrc;
+    stagingDesc.mappedAtCreation = true;
+    Buffer staging = GpuTracker::createBuffer(device, stagingDesc);
+    ClothObject::packParticles(precision, particles.data(), particles.size(),
+                               staging.getMappedRange(0, tile.particleBytes));
+    staging.unmap();
+    for (Buffer &buffer : tile.particleBuffers) {
+      encoder.copyBufferToBuffer(staging, 0, buffer, 0, tile.particleBytes);
+    }
+    stagings.push_back(staging);
+  }
+  CommandBuffer commands = encoder.finish(CommandBufferDescriptor{});
+  encoder.release();
+  device.getQueue().submit(commands);
+  commands.release();
+
+  // destroying after submission is fine, the copies still see the data
+  for (Buffer &staging : stagings) {
+    GpuTracker::release(staging);
+  }
+  cloth.lastStateHash =
+      deterministic ? ClothObject::hashParticles(cloth.m_readbackData.data(),
+                                                 cloth.numParticles)
+                    : 0;
+}
+
+void ClothTiles::writeUniforms(ClothObject &cloth, wgpu::Device &device) {
+  Queue queue = device.getQueue();
+  for (const Tile &tile : m_tiles) {
+    ClothUniforms u = cloth.uniforms;
+    u.tileFirstRow = (uint32_t)tile.firstRow;
+    u.tileRowBegin = (uint32_t)tile.rowBegin;
+    u.tileRowEnd = (uint32_t)tile.rowEnd;
+    u.tileRows = (uint32_t)tile.rows;
+    queue.writeBuffer(tile.uniformBuffer, 0, &u, sizeof(ClothUniforms));
+  }
+}
+
+void ClothTiles::encodeStep(ClothObject &cloth,
+                            wgpu::CommandEncoder &encoder) {
+  int parity = cloth.frame % 2;
+  int width = cloth.parameters.width;
+
+  ComputePassDescriptor computePassDesc;
+  computePassDesc.timestampWrites = nullptr;
+  computePassDesc.label = "tile pass 1";
+  ComputePassEncoder computePass = encoder.beginComputePass(computePassDesc);
+  computePass.setPipeline(cloth.m_pipeline);
+  for (const Tile &tile : m_tiles) {
+    computePass.setBindGroup(0, tile.bindGroups[parity], 0, nullptr);
+    computePass.setBindGroup(1, tile.vertexBindGroup, 0, nullptr);
+    ClothObject::dispatchLinear(computePass,
+                                (uint32_t)((tile.rowEnd - tile.rowBegin) *
+                                           width));
+  }
+  computePass.end();
+
+  // each pair of neighbours swaps its edge rows - the previous tile's last
+  // rows go into the halo below the next one, and the next tile's first rows
+  // into the halo above the previous one
+  uint64_t haloBytes = (uint64_t)HaloRows * m_particleRowBytes;
+  for (size_t i = 0; i + 1 < m_tiles.size(); i++) {
+    const Tile &previous = m_tiles[i];
+    const Tile &next = m_tiles[i + 1];
+    const Buffer &previousOut = previous.particleBuffers[1 - parity];
+    const Buffer &nextOut = next.particleBuffers[1 - parity];
+    int below = next.rowBegin - HaloRows;
+    encoder.copyBufferToBuffer(previousOut, rowOffset(previous, below),
+                               nextOut, rowOffset(next, below), haloBytes);
+    encoder.copyBufferToBuffer(nextOut, rowOffset(next, next.rowBegin),
+                               previousOut,
+                               rowOffset(previous, previous.rowEnd),
+                               haloBytes);
+  }
+
+  ComputePassDescriptor computePassDesc2;
+  computePassDesc2.timestampWrites = nullptr;
+  computePassDesc2.label = "tile pass 2";
+  ComputePassEncoder computePass2 = encoder.beginComputePass(computePassDesc2);
+  computePass2.setPipeline(cloth.m_vertexPipeline);
+  for (const Tile &tile : m_tiles) {
+    computePass2.setBindGroup(0, tile.bindGroups[parity], 0, nullptr);
+    computePass2.setBindGroup(1, tile.vertexBindGroup, 0, nullptr);
+    ClothObject::dispatchLinear(computePass2, tile.vertexCount);
+  }
+  computePass2.end();
+}
+
+bool ClothTiles::readStored(ClothObject &cloth, wgpu::Device &device,
+                            void *stored) {
+  // one tile at a time through a readback buffer of the largest tile
+  uint64_t readbackBytes = 0;
+  for (const Tile &tile : m_tiles) {
+    readbackBytes = std::max(readbackBytes, tile.particleBytes);
+  }
+  if (!m_readbackBuffer || m_readbackBuffer.getSize() < readbackBytes) {
+    BufferPool::recycle(m_readbackBuffer);
+    m_readbackBuffer = BufferPool::acquire(
+        device, readbackBytes, BufferUsage::MapRead | BufferUsage::CopyDst);
+  }
+
+  int parity = cloth.frame % 2;
+  for (const Tile &tile : m_tiles) {
+    uint64_t offset = rowOffset(tile, tile.rowBegin);
+    uint64_t bytes = (uint64_t)(tile.rowEnd - tile.rowBegin) *
+                     m_particleRowBytes;
+    CommandEncoderDescriptor encoderDesc = Default;
+    encoderDesc.label = "tile readback encoder";
+    CommandEncoder encoder = device.createCommandEncoder(encoderDesc);
+    encoder.copyBufferToBuffer(tile.particleBuffers[1 - parity], offset,
+                               m_readbackBuffer, 0, bytes);
+    CommandBuffer commands = encoder.finish(CommandBufferDescriptor{});
+    encoder.release();
+    device.getQueue().submit(commands);
+    commands.release();
+
+    // the callback may fire in a poll of another thread
+    std::atomic<bool> done{false};
+    bool success = false;
+    auto callbackHandle = m_readbackBuffer.mapAsync(
+        MapMode::Read, 0, bytes, [&](BufferMapAsyncStatus status) {
+          success = status == BufferMapAsyncStatus::Success;
+          done = true;
+        });
+    while (!done) {
+      ClothObject::pollDevice(device);
+    }
+    if (!success) {
+      return false;
+    }
+    std::memcpy((char *)stored + (uint64_t)tile.rowBegin * m_particleRowBytes,
+                m_readbackBuffer.getConstMappedRange(0, bytes), bytes);
+    m_readbackBuffer.unmap();
+  }
+  return true;
+}
+
+void ClothTiles::writeVertices(ClothObject &cloth, wgpu::Queue &queue,
+                               const uint32_t *words) {
+  // the soup is ordered by quad rows, each tile holds a run of them
+  const ClothParameters &p = cloth.parameters;
+  uint64_t rowBytes = (uint64_t)6 * (p.width - 1) *
+                      ClothObject::vertexStride(p.vertexPrecision);
+  for (const Tile &tile : m_tiles) {
+    if (tile.vertexBytes > 0) {
+      queue.writeBuffer(tile.vertexBuffer, 0,
+                        (const char *)words + tile.rowBegin * rowBytes,
+                        tile.vertexBytes);
+    }
+  }
+}
+
+void ClothTiles::terminate() {
+  for (Tile &tile : m_tiles) {
+    for (BindGroup &bindGroup : tile.bindGroups) {
+      GpuTracker::release(bindGroup);
+    }
+    GpuTracker::release(tile.vertexBindGroup);
+    GpuTracker::release(tile.uniformBuffer);
+    for (Buffer &buffer : tile.particleBuffers) {
+      BufferPool::recycle(buffer);
+    }
+    BufferPool::recycle(tile.vertexBuffer);
+  }
+  m_tiles.clear();
+  BufferPool::recycle(m_readbackBuffer);
+  m_particleRowBytes = 0;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+class ClothObject;
+
+// Storage of a grid cloth too large for single bindings. The particle and
+// vertex buffers of a cloth are each bound whole, so the device's
+// maxStorageBufferBindingSize (and maxBufferSize) cap its size - a larger
+// grid is split into horizontal tiles of whole rows, each with its own
+// ping-pong particle buffers, vertex buffer, uniforms and bind groups.
+//
+// A tile stores its own rows and the HaloRows rows on each side (the far
+// springs reach two rows), the simulation kernels step only its own rows and
+// offset their indices by the tile uniforms. After the particle pass the
+// edge rows of every tile are copied into the halos of its neighbours on the
+// GPU, before the vertex pass and the next step read them - the result is
+// the same as stepping the whole grid at once.
+//
+// Tiles are stored row-major and are drawn with one draw per tile. Whatever
+// binds the whole particle state - the simulation proxy, the statistics and
+// the watchdog, culling and the vertex pulling path - is not available on a
+// tiled cloth.
+class ClothTiles {
+public:
+  static constexpr int HaloRows = 2;
+
+  struct Tile {
+    // grid rows stored in the buffers, and the rows the tile steps
+    int firstRow = 0;
+    int rows = 0;
+    int rowBegin = 0;
+    int rowEnd = 0;
+
+    uint64_t particleBytes = 0;
+    uint32_t vertexCount = 0;
+    uint64_t vertexBytes = 0;
+
+    // same ping-pong scheme as the cloth (bindGroups[i] reads
+    // particleBuffers[i])
+    std::array<wgpu::Buffer, 2> particleBuffers = {nullptr, nullptr};
+    wgpu::Buffer vertexBuffer = nullptr;
+    wgpu::Buffer uniformBuffer = nullptr;
+    std::array<wgpu::BindGroup, 2> bindGroups = {nullptr, nullptr};
+    wgpu::BindGroup vertexBindGroup = nullptr;
+  };
+
+  // largest buffer a kernel can bind on the device
+  static uint64_t bindingLimit(wgpu::Device &device);
+  // rows per tile of a cloth, 0 if it fits in single bindings and is not
+  // asked for tiles (ClothParameters::tileRows)
+  static int rowsPerTile(const ClothObject &cloth, uint64_t maxBindingBytes);
+  // widest grid whose rows still fit in a tile with its halos
+  static int maxWidth(const ClothObject &cloth, uint64_t maxBindingBytes);
+
+  // allocates the tiles of a cloth whose layouts and pipelines exist
+  void init(ClothObject &cloth, wgpu::Device &device, int tileRows);
+  void terminate();
+  bool initialized() const { return !m_tiles.empty(); }
+
+  const std::vector<Tile> &tiles() const { return m_tiles; }
+
+  // generates the initial state of every tile on the CPU and uploads it
+  void fill(ClothObject &cloth, wgpu::Device &device);
+  // cloth uniforms of the frame with the rows of each tile
+  void writeUniforms(ClothObject &cloth, wgpu::Device &device);
+  // encodes both simulation passes of every tile and the halo copies
+  void encodeStep(ClothObject &cloth, wgpu::CommandEncoder &encoder);
+  // copies the stepped rows of every tile back in grid order as stored words
+  // (ClothObject::m_bufferSize bytes), blocking
+  bool readStored(ClothObject &cloth, wgpu::Device &device, void *stored);
+  // uploads a triangle soup of the whole cloth (from the CPU backend) into
+  // the vertex buffers of the tiles
+  void writeVertices(ClothObject &cloth, wgpu::Queue &queue,
+                     const uint32_t *words);
+
+private:
+  // byte offset of grid row row in the particle buffers of a tile
+  uint64_t rowOffset(const Tile &tile, int row) const {
+    return (uint64_t)(row - tile.firstRow) * m_particleRowBytes;
+  }
+
+  std::vector<Tile> m_tiles;
+  uint64_t m_particleRowBytes = 0;
+  wgpu::Buffer m_readbackBuffer = nullptr;
+};
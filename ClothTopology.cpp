@@ -0,0 +1,274 @@
+#include "ClothTopology.h"
+#include "ResourceManager.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <set>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+
+using vec3 = ClothTopology::vec3;
+using Spring = ClothTopology::Spring;
+
+namespace {
+// turns per-particle lists into CSR offsets and a flat entry list
+template <typename T>
+void flatten(const std::vector<std::vector<T>> &lists,
+             std::vector<uint32_t> &offsets, std::vector<T> &entries) {
+  offsets.assign(1, 0);
+  entries.clear();
+  for (const std::vector<T> &list : lists) {
+    entries.insert(entries.end(), list.begin(), list.end());
+    offsets.push_back((uint32_t)entries.size());
+  }
+}
+} // namespace
+
+bool ClothTopology::loadObj(const path &path, ClothTopology &topology) {
+  topology = ClothTopology();
+  std::vector<ResourceManager::VertexAttributes> vertexData;
+  if (!ResourceManager::loadGeometryFromObj(path, vertexData)) {
+    return false;
+  }
+
+  // the loader turns the file's y up into z up, the cloth is simulated y up
+  // again - vertices at the same position (uv seams) become one particle
+  std::map<std::tuple<float, float, float>, uint32_t> welded;
+  std::vector<vec3> positions;
+  std::vector<uint32_t> triangleIndices;
+  for (size_t i = 0; i + 2 < vertexData.size(); i += 3) {
+    uint32_t corners[3];
+    for (int c = 0; c < 3; c++) {
+      const vec3 &p = vertexData[i + c].position;
+      vec3 position = vec3(p.x, p.z, -p.y);
+      auto inserted = welded.emplace(
+          std::make_tuple(position.x, position.y, position.z),
+          (uint32_t)positions.size());
+      if (inserted.second) {
+        positions.push_back(position);
+      }
+      corners[c] = inserted.first->second;
+    }
+    // drop triangles that welding collapsed
+    if (corners[0] != corners[1] && corners[1] != corners[2] &&
+        corners[0] != corners[2]) {
+      triangleIndices.insert(triangleIndices.end(), corners, corners + 3);
+    }
+  }
+  if (triangleIndices.empty()) {
+    return false;
+  }
+
+  // center and scale to one unit high (or wide, for a flat garment)
+  vec3 low = positions[0];
+  vec3 high = positions[0];
+  for (const vec3 &position : positions) {
+    low = glm::min(low, position);
+    high = glm::max(high, position);
+  }
+  vec3 extent = high - low;
+  float size = extent.y > 0.0f ? extent.y : std::max(extent.x, extent.z);
+  vec3 center = (low + high) * 0.5f;
+  for (vec3 &position : positions) {
+    position = (position - center) / size;
+  }
+
+  topology.build(positions, triangleIndices);
+  topology.reorder(topology.reverseCuthillMcKee());
+  return true;
+}
+
+void ClothTopology::build(const std::vector<vec3> &positions,
+                          const std::vector<uint32_t> &triangleIndices) {
+  restPositions = positions;
+  triangles = triangleIndices;
+  size_t count = positions.size();
+
+  // every edge with the vertices opposite to it, an edge shared by two
+  // triangles gives a bending (far) spring between its opposite vertices
+  std::unordered_map<uint64_t, uint32_t> firstOpposite;
+  std::vector<std::set<uint32_t>> near(count);
+  std::vector<std::set<uint32_t>> far(count);
+  std::vector<std::vector<uint32_t>> incident(count);
+  for (size_t t = 0; t < triangleCount(); t++) {
+    for (int c = 0; c < 3; c++) {
+      uint32_t a = triangles[3 * t + c];
+      uint32_t b = triangles[3 * t + (c + 1) % 3];
+      uint32_t opposite = triangles[3 * t + (c + 2) % 3];
+      near[a].insert(b);
+      near[b].insert(a);
+      incident[a].push_back((uint32_t)t);
+
+      uint64_t key = ((uint64_t)std::min(a, b) << 32) | std::max(a, b);
+      auto inserted = firstOpposite.emplace(key, opposite);
+      uint32_t other = inserted.first->second;
+      if (!inserted.second && other != opposite) {
+        far[opposite].insert(other);
+        far[other].insert(opposite);
+      }
+    }
+  }
+
+  // neighbours are stored by increasing index, which is also the order the
+  // kernels sum the forces in
+  auto springLists = [&](const std::vector<std::set<uint32_t>> &sets) {
+    std::vector<std::vector<Spring>> lists(count);
+    for (size_t i = 0; i < count; i++) {
+      for (uint32_t neighbor : sets[i]) {
+        float restLength =
+            glm::length(restPositions[i] - restPositions[neighbor]);
+        lists[i].push_back({neighbor, restLength});
+      }
+    }
+    return lists;
+  };
+  flatten(springLists(near), nearOffsets, nearSprings);
+  flatten(springLists(far), farOffsets, farSprings);
+  flatten(incident, faceOffsets, faces);
+
+  // the top of the garment holds it up
+  float top = -INFINITY;
+  for (const vec3 &position : restPositions) {
+    top = std::max(top, position.y);
+  }
+  flags.assign(count, 0);
+  for (size_t i = 0; i < count; i++) {
+    if (restPositions[i].y >= top - 0.01f) {
+      flags[i] |= Pinned;
+    }
+  }
+}
+
+std::vector<uint32_t> ClothTopology::reverseCuthillMcKee() const {
+  // breadth-first numbering from a low degree particle, visiting neighbours
+  // by increasing degree, then reversed - each disconnected piece in turn
+  size_t count = particleCount();
+  auto degree = [&](uint32_t i) {
+    return nearOffsets[i + 1] - nearOffsets[i];
+  };
+
+  std::vector<uint32_t> order;
+  order.reserve(count);
+  std::vector<bool> visited(count, false);
+  std::vector<uint32_t> neighbors;
+  while (order.size() < count) {
+    uint32_t start = 0;
+    bool found = false;
+    for (uint32_t i = 0; i < count; i++) {
+      if (!visited[i] && (!found || degree(i) < degree(start))) {
+        start = i;
+        found = true;
+      }
+    }
+
+    size_t head = order.size();
+    order.push_back(start);
+    visited[start] = true;
+    while (head < order.size()) {
+      uint32_t current = order[head++];
+      neighbors.clear();
+      for (uint32_t s = nearOffsets[current]; s < nearOffsets[current + 1];
+           s++) {
+        uint32_t neighbor = nearSprings[s].neighbor;
+        if (!visited[neighbor]) {
+          visited[neighbor] = true;
+          neighbors.push_back(neighbor);
+        }
+      }
+      std::stable_sort(neighbors.begin(), neighbors.end(),
+                       [&](uint32_t a, uint32_t b) {
+                         return degree(a) < degree(b);
+                       });
+      order.insert(order.end(), neighbors.begin(), neighbors.end());
+    }
+  }
+
+  std::reverse(order.begin(), order.end());
+  return order;
+}
+
+void ClothTopology::reorder(const std::vector<uint32_t> &order) {
+  std::vector<uint32_t> newIndex(order.size());
+  std::vector<vec3> positions(order.size());
+  for (size_t i = 0; i < order.size(); i++) {
+    newIndex[order[i]] = (uint32_t)i;
+    positions[i] = restPositions[order[i]];
+  }
+
+  // triangles follow their first particle, so the vertex pass reads the
+  // particles in about the same order as the simulation
+  std::vector<std::array<uint32_t, 3>> renumbered(triangleCount());
+  for (size_t t = 0; t < renumbered.size(); t++) {
+    for (int c = 0; c < 3; c++) {
+      renumbered[t][c] = newIndex[triangles[3 * t + c]];
+    }
+  }
+  std::stable_sort(renumbered.begin(), renumbered.end(),
+                   [](const std::array<uint32_t, 3> &a,
+                      const std::array<uint32_t, 3> &b) {
+                     return *std::min_element(a.begin(), a.end()) <
+                            *std::min_element(b.begin(), b.end());
+                   });
+  std::vector<uint32_t> triangleIndices;
+  triangleIndices.reserve(triangles.size());
+  for (const std::array<uint32_t, 3> &triangle : renumbered) {
+    triangleIndices.insert(triangleIndices.end(), triangle.begin(),
+                           triangle.end());
+  }
+
+  build(positions, triangleIndices);
+}
+
+uint32_t ClothTopology::bandwidth() const {
+  uint32_t result = 0;
+  for (uint32_t i = 0; i < particleCount(); i++) {
+    for (uint32_t s = nearOffsets[i]; s < nearOffsets[i + 1]; s++) {
+      uint32_t neighbor = nearSprings[s].neighbor;
+      result = std::max(result, neighbor > i ? neighbor - i : i - neighbor);
+    }
+  }
+  return result;
+}
+
+float ClothTopology::meanRestLength() const {
+  double sum = 0.0;
+  for (const Spring &spring : nearSprings) {
+    sum += spring.restLength;
+  }
+  return nearSprings.empty() ? 0.0f : (float)(sum / nearSprings.size());
+}
+
+std::vector<uint32_t> ClothTopology::pack() const {
+  std::vector<uint32_t> words(SectionCount, 0);
+  auto section = [&](Section name) { words[name] = (uint32_t)words.size(); };
+  auto appendSprings = [&](const std::vector<Spring> &springs) {
+    for (const Spring &spring : springs) {
+      uint32_t restBits;
+      std::memcpy(&restBits, &spring.restLength, sizeof(restBits));
+      words.push_back(spring.neighbor);
+      words.push_back(restBits);
+    }
+  };
+
+  section(NearOffsets);
+  words.insert(words.end(), nearOffsets.begin(), nearOffsets.end());
+  section(NearSprings);
+  appendSprings(nearSprings);
+  section(FarOffsets);
+  words.insert(words.end(), farOffsets.begin(), farOffsets.end());
+  section(FarSprings);
+  appendSprings(farSprings);
+  section(FaceOffsets);
+  words.insert(words.end(), faceOffsets.begin(), faceOffsets.end());
+  section(Faces);
+  words.insert(words.end(), faces.begin(), faces.end());
+  section(Triangles);
+  words.insert(words.end(), triangles.begin(), triangles.end());
+  section(Flags);
+  words.insert(words.end(), flags.begin(), flags.end());
+  return words;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+// Connectivity of an unstructured (triangle mesh) cloth, the alternative to
+// the implicit width x height grid. Every particle has a CSR list of near
+// springs (the mesh edges) and far springs (the two vertices opposite each
+// interior edge, which resist bending), plus the list of triangles it belongs
+// to for the normals. Particles are numbered in reverse Cuthill-McKee order so
+// that neighbours sit close in memory, like the rows of the grid.
+//
+// The kernels in compute_mesh.wgsl read the packed form (see pack).
+class ClothTopology {
+public:
+  // (Just aliases to make notations lighter)
+  using path = std::filesystem::path;
+  using vec3 = glm::vec3;
+
+  struct Spring {
+    uint32_t neighbor;
+    // rest length at unit cloth scale
+    float restLength;
+  };
+
+  // sections of the packed buffer - its first SectionCount words hold the
+  // word offset of each section (must match compute_mesh.wgsl)
+  enum Section : uint32_t {
+    NearOffsets = 0,
+    NearSprings,
+    FarOffsets,
+    FarSprings,
+    FaceOffsets,
+    Faces,
+    Triangles,
+    Flags,
+    SectionCount
+  };
+
+  // particle flags
+  static constexpr uint32_t Pinned = 1;
+
+  // rest shape, centered on 0,0 and one unit high (y up, like the grid)
+  std::vector<vec3> restPositions;
+  // three particle indices per triangle
+  std::vector<uint32_t> triangles;
+
+  // CSR adjacency, the springs of particle i are [offsets[i], offsets[i+1])
+  std::vector<uint32_t> nearOffsets;
+  std::vector<Spring> nearSprings;
+  std::vector<uint32_t> farOffsets;
+  std::vector<Spring> farSprings;
+  // triangles around each particle
+  std::vector<uint32_t> faceOffsets;
+  std::vector<uint32_t> faces;
+
+  std::vector<uint32_t> flags;
+
+  size_t particleCount() const { return restPositions.size(); }
+  size_t triangleCount() const { return triangles.size() / 3; }
+
+  // loads an .obj garment, welds its vertices, builds the adjacency and
+  // reorders it - returns false (and an empty topology) on failure
+  static bool loadObj(const path &path, ClothTopology &topology);
+
+  // builds every list from a rest shape and its triangles, the particles
+  // within 1% of the top are pinned like the top row of the grid
+  void build(const std::vector<vec3> &positions,
+             const std::vector<uint32_t> &triangleIndices);
+
+  // particle order that keeps springs short, order[newIndex] = oldIndex
+  std::vector<uint32_t> reverseCuthillMcKee() const;
+  // renumbers the particles and rebuilds the lists
+  void reorder(const std::vector<uint32_t> &order);
+
+  // largest index distance between two particles joined by a near spring
+  uint32_t bandwidth() const;
+  float meanRestLength() const;
+
+  // header and sections in one array of 32 bit words for a storage buffer
+  std::vector<uint32_t> pack() const;
+};
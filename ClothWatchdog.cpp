@@ -0,0 +1,121 @@
+#include "ClothWatchdog.h"
+#include "BufferPool.h"
+#include "ClothObject.h"
+
+#include <cmath>
+#include <iostream>
+#include <utility>
+
+using namespace wgpu;
+
+void ClothWatchdog::init(ClothObject &cloth, wgpu::Device &device) {
+  m_snapshotBytes = (uint64_t)cloth.m_bufferSize;
+  for (Buffer &buffer : m_snapshots) {
+    buffer = BufferPool::acquire(device, m_snapshotBytes,
+                                 BufferUsage::CopySrc | BufferUsage::CopyDst);
+  }
+
+  // the initial state is good by definition
+  CommandEncoderDescriptor encoderDesc = Default;
+  encoderDesc.label = "snapshot encoder";
+  CommandEncoder encoder = device.createCommandEncoder(encoderDesc);
+  encoder.copyBufferToBuffer(cloth.particleBuffers[1 - (cloth.frame % 2)], 0,
+                             m_snapshots[0], 0, m_snapshotBytes);
+  CommandBuffer commands = encoder.finish(CommandBufferDescriptor{});
+  encoder.release();
+  device.getQueue().submit(commands);
+  commands.release();
+
+  m_good = 0;
+  m_goodFrame = cloth.frame;
+  m_goodTime = cloth.simTime;
+  m_pendingFrame = -1;
+  m_checkedFrame = 0;
+  m_halvings = 0;
+  m_rollbacks = 0;
+  m_lastDivergedFrame = 0;
+}
+
+bool ClothWatchdog::healthy(const ClothStats::Stats &stats, float deltaT,
+                            float scale) {
+  // a particle that crosses the whole cloth in one step has exploded
+  return stats.nonFinite == 0 && std::isfinite(stats.kineticEnergy) &&
+         stats.maxStrain <= MaxStrain && stats.maxSpeed * deltaT <= scale;
+}
+
+bool ClothWatchdog::check(ClothObject &cloth, wgpu::Device &device) {
+  const ClothStats &stats = cloth.m_stats;
+  if (!initialized() || stats.latestFrame() <= m_checkedFrame) {
+    return false;
+  }
+  m_checkedFrame = stats.latestFrame();
+
+  if (!healthy(stats.latest(), cloth.parameters.deltaT,
+               cloth.parameters.scale)) {
+    m_lastDivergedFrame = m_checkedFrame;
+    rollback(cloth, device);
+    return true;
+  }
+  // a diverged cloth does not recover, a healthy later frame vouches for
+  // the pending snapshot
+  if (m_pendingFrame >= 0 && m_checkedFrame >= m_pendingFrame) {
+    m_good = 1 - m_good;
+    m_goodFrame = m_pendingFrame;
+    m_goodTime = m_pendingTime;
+    m_pendingFrame = -1;
+  }
+  return false;
+}
+
+void ClothWatchdog::encodeSnapshot(ClothObject &cloth,
+                                   wgpu::CommandEncoder &encoder) {
+  int interval = cloth.parameters.snapshotInterval;
+  if (!initialized() || interval <= 0 || cloth.frame % interval != 0 ||
+      m_pendingFrame >= 0) {
+    return;
+  }
+  encoder.copyBufferToBuffer(cloth.particleBuffers[1 - (cloth.frame % 2)], 0,
+                             m_snapshots[1 - m_good], 0, m_snapshotBytes);
+  m_pendingFrame = cloth.frame;
+  m_pendingTime = cloth.simTime;
+}
+
+void ClothWatchdog::rollback(ClothObject &cloth, wgpu::Device &device) {
+  // the good state becomes the output of its own frame again, which is the
+  // input of the next step
+  CommandEncoderDescriptor encoderDesc = Default;
+  encoderDesc.label = "rollback encoder";
+  CommandEncoder encoder = device.createCommandEncoder(encoderDesc);
+  encoder.copyBufferToBuffer(m_snapshots[m_good], 0,
+                             cloth.particleBuffers[1 - (m_goodFrame % 2)], 0,
+                             m_snapshotBytes);
+  CommandBuffer commands = encoder.finish(CommandBufferDescriptor{});
+  encoder.release();
+  device.getQueue().submit(commands);
+  commands.release();
+
+  cloth.frame = m_goodFrame;
+  cloth.simTime = m_goodTime;
+  if (m_halvings < MaxHalvings) {
+    cloth.parameters.deltaT *= 0.5f;
+    cloth.updateDerivedParameters();
+    m_halvings++;
+  }
+  // whatever is still in flight belongs to the diverged run
+  cloth.m_stats.discard();
+  cloth.m_proxy.retake();
+  m_pendingFrame = -1;
+  m_checkedFrame = 0;
+  m_rollbacks++;
+
+  std::cerr << "Cloth diverged at frame " << m_lastDivergedFrame
+            << ", rolled back to frame " << m_goodFrame << " with deltaT "
+            << cloth.parameters.deltaT << std::endl;
+}
+
+void ClothWatchdog::terminate() {
+  for (Buffer &buffer : m_snapshots) {
+    BufferPool::recycle(buffer);
+  }
+  m_pendingFrame = -1;
+}
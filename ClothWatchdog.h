@@ -0,0 +1,66 @@
+#pragma once
+
+#include <ClothStats.h>
+#include <webgpu/webgpu.hpp>
+
+#include <array>
+#include <cstdint>
+
+class ClothObject;
+
+// Divergence watchdog of a cloth. Every snapshotInterval frames the new state
+// is copied into a snapshot buffer on the GPU. The snapshot only counts as
+// good once the statistics of that frame or a later one (see ClothStats)
+// show a healthy cloth - no nan or infinite particle, no spring stretched
+// past MaxStrain and no particle crossing the whole cloth in one step. When
+// the statistics show a diverged cloth, the last good snapshot is copied back,
+// the frame count and simulated time rewind to it and the time step is halved
+// (at most MaxHalvings times) before the simulation carries on.
+//
+// The statistics arrive a frame or two late, so a few diverged frames can
+// still reach the screen before the rollback - the frustum culling pass (see
+// ClothCuller) skips the draw of any state with a non-finite particle.
+class ClothWatchdog {
+public:
+  // largest length / rest length of a spring in a healthy cloth
+  static constexpr float MaxStrain = 10.0f;
+  static constexpr int MaxHalvings = 6;
+
+  // allocates the snapshots and takes the first one from the initial state
+  void init(ClothObject &cloth, wgpu::Device &device);
+  void terminate();
+  bool initialized() const { return m_snapshots[0] != nullptr; }
+
+  static bool healthy(const ClothStats::Stats &stats, float deltaT,
+                      float scale);
+
+  // checks statistics that arrived since the last call, promotes the pending
+  // snapshot they vouch for or rolls the cloth back - returns true on a
+  // rollback
+  bool check(ClothObject &cloth, wgpu::Device &device);
+  // copies the state the step of this frame leaves in the output buffer
+  // every snapshotInterval frames
+  void encodeSnapshot(ClothObject &cloth, wgpu::CommandEncoder &encoder);
+
+  int rollbacks() const { return m_rollbacks; }
+  int lastDivergedFrame() const { return m_lastDivergedFrame; }
+
+private:
+  void rollback(ClothObject &cloth, wgpu::Device &device);
+
+  uint64_t m_snapshotBytes = 0;
+  // the good snapshot and the one waiting for statistics
+  std::array<wgpu::Buffer, 2> m_snapshots = {nullptr, nullptr};
+  int m_good = 0;
+  int m_goodFrame = 0;
+  double m_goodTime = 0.0;
+  // frame of the pending snapshot, -1 without one
+  int m_pendingFrame = -1;
+  double m_pendingTime = 0.0;
+  // statistics up to this frame have been looked at
+  int m_checkedFrame = 0;
+
+  int m_halvings = 0;
+  int m_rollbacks = 0;
+  int m_lastDivergedFrame = 0;
+};
@@ -0,0 +1,55 @@
+#include "FramePacer.h"
+#include "ClothObject.h"
+
+#include <algorithm>
+#include <chrono>
+
+using namespace wgpu;
+
+void FramePacer::init(wgpu::Device &device, int latency) {
+  m_device = device;
+  m_submitted = 0;
+  m_completed = 0;
+  m_lastWaitMs = 0.0;
+  setLatency(latency);
+}
+
+void FramePacer::setLatency(int latency) {
+  m_latency = std::clamp(latency, 1, MaxFramesInFlight);
+}
+
+int FramePacer::beginFrame() {
+  auto begin = std::chrono::steady_clock::now();
+#ifndef __EMSCRIPTEN__
+  // the browser paces the frames itself, and a busy wait would block it
+  waitUntilInFlight(m_latency - 1);
+#endif
+  m_lastWaitMs = std::chrono::duration<double, std::milli>(
+                     std::chrono::steady_clock::now() - begin)
+                     .count();
+  return slot();
+}
+
+void FramePacer::endFrame(wgpu::Queue &queue) {
+  // the slot is free, beginFrame() waited for the frame that used it
+  m_fences[slot()] = queue.onSubmittedWorkDone(
+      [this](QueueWorkDoneStatus) { m_completed++; });
+  m_submitted++;
+}
+
+void FramePacer::waitUntilInFlight(int frames) {
+  while (framesInFlight() > frames) {
+    ClothObject::pollDevice(m_device);
+  }
+}
+
+void FramePacer::terminate() {
+  // the callbacks must fire before the pacer goes away
+  if (m_device) {
+    waitUntilInFlight(0);
+  }
+  for (auto &fence : m_fences) {
+    fence.reset();
+  }
+  m_device = nullptr;
+}
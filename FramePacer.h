@@ -0,0 +1,56 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+// Bounds the frames the CPU may run ahead of the GPU. After each frame is
+// submitted, an onSubmittedWorkDone fence marks it done once the queue gets
+// there. Before the next frame starts (and samples input), beginFrame() waits
+// until fewer than latency() frames are still in flight.
+//
+// With a latency of 1 the CPU waits for the previous frame, so input is never
+// more than a frame old. With 2 or 3 the GUI, uniforms and encoding of a frame
+// overlap the GPU work of the ones before it, at the cost of as many frames of
+// input lag. Resources written every frame, like the render uniforms, get one
+// copy per slot() so that no frame in flight is ever overwritten.
+class FramePacer {
+public:
+  static constexpr int MaxFramesInFlight = 3;
+
+  void init(wgpu::Device &device, int latency);
+  // waits for every frame still in flight
+  void terminate();
+
+  // clamped to [1, MaxFramesInFlight], applies from the next beginFrame()
+  void setLatency(int latency);
+  int latency() const { return m_latency; }
+
+  // waits until the new frame may start, returns its slot
+  int beginFrame();
+  // sets the fence of the frame, once its commands are submitted
+  void endFrame(wgpu::Queue &queue);
+
+  // slot of the current frame, in [0, MaxFramesInFlight)
+  int slot() const { return (int)(m_submitted % MaxFramesInFlight); }
+  int framesInFlight() const { return (int)(m_submitted - m_completed); }
+  // milliseconds beginFrame() last spent waiting for the GPU
+  double lastWaitMs() const { return m_lastWaitMs; }
+
+private:
+  void waitUntilInFlight(int frames);
+
+  wgpu::Device m_device = nullptr;
+  int m_latency = 2;
+  // frames submitted, and frames whose fence fired - fences fire in order,
+  // in a poll of any thread using the device (see SimulationThread)
+  uint64_t m_submitted = 0;
+  std::atomic<uint64_t> m_completed{0};
+  std::array<std::unique_ptr<wgpu::QueueWorkDoneCallback>, MaxFramesInFlight>
+      m_fences;
+  double m_lastWaitMs = 0.0;
+};
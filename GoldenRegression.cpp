@@ -0,0 +1,666 @@
+#include "GoldenRegression.h"
+#include "BufferPool.h"
+#include "ClothCPU.h"
+#include "ClothInitializer.h"
+#include "GpuTracker.h"
+#include "HeadlessDevice.h"
+#include "NumaPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <thread>
+#include <utility>
+
+using namespace wgpu;
+using vec3 = GoldenRegression::vec3;
+using ClothParticle = GoldenRegression::ClothParticle;
+using SolverMode = ClothObject::SolverMode;
+using InitialState = ClothObject::InitialState;
+
+// golden file header, followed by frames * particleCount * 3 floats
+constexpr char GOLDEN_MAGIC[8] = {'C', 'L', 'O', 'T', 'H', 'G', 'L', 'D'};
+constexpr uint32_t GOLDEN_VERSION = 1;
+
+bool GoldenRegression::parseArguments(int argc, char **argv,
+                                      Options &options) {
+  bool requested = false;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "--golden-compare") {
+      options.record = false;
+      options.directory.clear();
+      requested = true;
+    } else if ((arg == "--golden-record" || arg == "--golden-check") &&
+               hasValue) {
+      options.record = arg == "--golden-record";
+      options.directory = argv[++i];
+      requested = true;
+    } else if ((arg == "--golden-frames" || arg == "--golden-tolerance") &&
+               hasValue) {
+      std::string value = argv[++i];
+      try {
+        if (arg == "--golden-frames") {
+          options.frames = std::stoi(value);
+        } else {
+          options.tolerance = std::stof(value);
+        }
+      } catch (const std::exception &) {
+        options.invalid = true;
+      }
+      // a NaN tolerance would pass every frame
+      if (options.frames < 1 || !(options.tolerance >= 0.0f)) {
+        options.invalid = true;
+      }
+      if (options.invalid) {
+        std::cerr << "Invalid value " << value << " for " << arg
+                  << std::endl;
+        return true;
+      }
+    }
+  }
+  return requested;
+}
+
+std::vector<GoldenRegression::Preset> GoldenRegression::presets() {
+  // small cloths so the whole harness runs in seconds - every preset runs in
+  // deterministic mode so that reruns on one backend are bit-identical
+  std::vector<Preset> presets;
+
+  Preset base;
+  base.name = "default";
+  base.parameters.width = 32;
+  base.parameters.height = 32;
+  base.parameters.solverMode = SolverMode::Deterministic;
+  presets.push_back(base);
+
+  Preset wide = base;
+  wide.name = "wide";
+  wide.parameters.width = 64;
+  wide.parameters.height = 16;
+  presets.push_back(wide);
+
+  Preset windy = base;
+  windy.name = "windy";
+  windy.parameters.wind_strength = 80.0f;
+  windy.parameters.wind_dir = vec3(0.3f, 0.0f, 1.0f);
+  presets.push_back(windy);
+
+  Preset stretchy = base;
+  stretchy.name = "stretchy";
+  stretchy.parameters.maxStretch = 1.6f;
+  stretchy.parameters.minStretch = 0.3f;
+  stretchy.parameters.deltaT = 0.016f;
+  presets.push_back(stretchy);
+
+  Preset sphere = base;
+  sphere.name = "sphere";
+  sphere.parameters.sphereRadius = 1.0f;
+  sphere.parameters.spherePeriod = 1.0f;
+  presets.push_back(sphere);
+
+  // same cloth as the default one stored in Morton tiles, the states of both
+  // must be identical
+  Preset tiled = base;
+  tiled.name = "tiled";
+  tiled.parameters.particleOrder = GridLayout::Order::MortonTiles;
+  tiled.sameAs = base.name;
+  presets.push_back(tiled);
+
+  Preset garment = base;
+  garment.name = "garment";
+  garment.parameters.topology = ClothObject::Topology::Mesh;
+  garment.parameters.topologyMesh = RESOURCE_DIR "/skirt.obj";
+  presets.push_back(garment);
+
+  return presets;
+}
+
+bool GoldenRegression::writeGolden(
+    const path &path, int particleCount,
+    const std::vector<std::vector<vec3>> &frames) {
+  std::ofstream file(path, std::ios::binary);
+  if (!file.is_open()) {
+    return false;
+  }
+
+  int32_t header[2] = {particleCount, (int32_t)frames.size()};
+  file.write(GOLDEN_MAGIC, sizeof(GOLDEN_MAGIC));
+  file.write((const char *)&GOLDEN_VERSION, sizeof(GOLDEN_VERSION));
+  file.write((const char *)header, sizeof(header));
+  for (const std::vector<vec3> &positions : frames) {
+    file.write((const char *)positions.data(),
+               particleCount * sizeof(vec3));
+  }
+  return file.good();
+}
+
+bool GoldenRegression::readGolden(const path &path, int particleCount,
+                                  std::vector<std::vector<vec3>> &frames) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) {
+    return false;
+  }
+
+  char magic[sizeof(GOLDEN_MAGIC)];
+  uint32_t version = 0;
+  int32_t header[2] = {0, 0};
+  file.read(magic, sizeof(magic));
+  file.read((char *)&version, sizeof(version));
+  file.read((char *)header, sizeof(header));
+  if (!file || std::memcmp(magic, GOLDEN_MAGIC, sizeof(magic)) != 0 ||
+      version != GOLDEN_VERSION || header[0] != particleCount) {
+    return false;
+  }
+
+  frames.assign(header[1], std::vector<vec3>(particleCount));
+  for (std::vector<vec3> &positions : frames) {
+    file.read((char *)positions.data(), particleCount * sizeof(vec3));
+  }
+  return file.good();
+}
+
+std::vector<vec3>
+GoldenRegression::positions(const std::vector<ClothParticle> &state) {
+  std::vector<vec3> positions;
+  positions.reserve(state.size());
+  for (const ClothParticle &particle : state) {
+    positions.push_back(particle.position);
+  }
+  return positions;
+}
+
+GoldenRegression::FrameError
+GoldenRegression::compare(const std::vector<vec3> &golden,
+                          const std::vector<ClothParticle> &state) {
+  // distance between golden and simulated position of every particle
+  FrameError error;
+  if (golden.size() != state.size() || golden.empty()) {
+    error.maxError = error.rmsError = INFINITY;
+    return error;
+  }
+
+  double sumSquared = 0.0;
+  for (size_t i = 0; i < golden.size(); i++) {
+    float distance = glm::length(state[i].position - golden[i]);
+    // NaNs must fail the comparison instead of being skipped by max()
+    if (std::isnan(distance)) {
+      distance = INFINITY;
+    }
+    error.maxError = std::max(error.maxError, distance);
+    sumSquared += (double)distance * distance;
+  }
+  error.rmsError = (float)std::sqrt(sumSquared / golden.size());
+  return error;
+}
+
+bool GoldenRegression::checkFrame(const Options &options, const Preset &preset,
+                                  const char *backendName, int frame,
+                                  const std::vector<vec3> &golden,
+                                  const std::vector<ClothParticle> &state) {
+  FrameError error = compare(golden, state);
+  bool passed = error.maxError <= options.tolerance;
+  std::cout << std::left << std::setw(10) << preset.name << std::setw(10)
+            << backendName << std::right << std::setw(6) << frame
+            << std::scientific << std::setprecision(3) << std::setw(12)
+            << error.maxError << std::setw(12) << error.rmsError
+            << std::defaultfloat << (passed ? "" : "  FAIL") << std::endl;
+  return passed;
+}
+
+bool GoldenRegression::checkGpu(
+    const Options &options, const Preset &preset, const char *backendName,
+    Device device, const std::vector<std::vector<vec3>> &reference) {
+  ClothObject cloth;
+  ClothParameters parameters = preset.parameters;
+  cloth.initiateNewCloth(parameters, device);
+
+  bool passed = true;
+  std::vector<ClothParticle> state;
+  for (int frame = 1; frame <= options.frames; frame++) {
+    cloth.processFrame(device);
+    if (!cloth.readParticles(device, state)) {
+      std::cerr << "Could not read back particles from " << backendName
+                << std::endl;
+      passed = false;
+      break;
+    }
+    passed = checkFrame(options, preset, backendName, frame,
+                        reference[frame - 1], state) &&
+             passed;
+  }
+
+  cloth.terminateAll();
+  return passed;
+}
+
+bool GoldenRegression::checkResets(const char *backendName, Device device) {
+  // a reset must free everything the previous cloth created, so after each
+  // one the tracker has to be back at the same live counts and bytes - the
+  // same goes for a resize round trip, and a resize that outgrows the buffers
+  // must not change the number of live objects
+  const int resets = 5;
+  const int framesPerReset = 3;
+  GpuTracker::Snapshot baseline = GpuTracker::snapshot();
+
+  ClothObject cloth;
+  ClothParameters parameters = presets().front().parameters;
+  GpuTracker::Snapshot steady;
+  bool passed = true;
+  for (int reset = 0; reset <= resets; reset++) {
+    cloth.initiateNewCloth(parameters, device);
+    for (int frame = 0; frame < framesPerReset; frame++) {
+      cloth.processFrame(device);
+    }
+    ClothObject::waitIdle(device);
+
+    GpuTracker::Snapshot current = GpuTracker::snapshot();
+    if (reset == 0) {
+      steady = current;
+    } else if (!current.sameLiveState(steady)) {
+      std::cout << backendName << ": reset " << reset << " holds "
+                << current.liveCount() << " objects ("
+                << current.liveBytes() << " bytes), expected "
+                << steady.liveCount() << " (" << steady.liveBytes()
+                << " bytes)  FAIL" << std::endl;
+      passed = false;
+    }
+  }
+
+  // shrinking and growing back to the same size must reuse the buffers
+  ClothParameters smaller = parameters;
+  smaller.width /= 2;
+  smaller.height /= 2;
+  cloth.reconfigure(smaller, device);
+  cloth.processFrame(device);
+  cloth.reconfigure(parameters, device);
+  cloth.processFrame(device);
+  ClothObject::waitIdle(device);
+  if (!GpuTracker::snapshot().sameLiveState(steady)) {
+    std::cout << backendName << ": resizing changed the live objects  FAIL"
+              << std::endl;
+    passed = false;
+  }
+
+  // growing past the capacity reallocates the particle and vertex buffers,
+  // with the pool's idle buffers released the same objects must be alive
+  BufferPool::releaseIdle();
+  GpuTracker::Snapshot beforeGrow = GpuTracker::snapshot();
+  ClothParameters larger = parameters;
+  larger.width *= 2;
+  larger.height *= 2;
+  cloth.reconfigure(larger, device);
+  cloth.processFrame(device);
+  ClothObject::waitIdle(device);
+  BufferPool::releaseIdle();
+  GpuTracker::Snapshot grown = GpuTracker::snapshot();
+  if (grown.liveCount() != beforeGrow.liveCount()) {
+    std::cout << backendName << ": growing past the capacity holds "
+              << grown.liveCount() << " objects, expected "
+              << beforeGrow.liveCount() << "  FAIL" << std::endl;
+    passed = false;
+  }
+
+  // the buffers went back to the pool, which has to hand them to the device
+  cloth.terminateAll();
+  BufferPool::releaseIdle();
+  GpuTracker::Snapshot after = GpuTracker::snapshot();
+  if (!after.sameLiveState(baseline)) {
+    std::cout << backendName << ": " << after.liveCount() - baseline.liveCount()
+              << " objects still alive after terminateAll  FAIL" << std::endl;
+    passed = false;
+  }
+  if (passed) {
+    std::cout << backendName << ": " << resets << " resets, steady at "
+              << steady.liveCount() - baseline.liveCount() << " objects ("
+              << steady.liveBytes() - baseline.liveBytes() << " bytes)"
+              << std::endl;
+  }
+  return passed;
+}
+
+bool GoldenRegression::checkNumaPool() {
+  // a restarted pool must only run what it is given after the restart - a
+  // thread that took an earlier run for a new one would step items twice
+  const int restarts = 3;
+  const int count = 1000;
+  std::vector<int> hits;
+  auto body = [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      hits[i]++;
+    }
+  };
+
+  NumaPool pool;
+  bool passed = true;
+  for (int restart = 0; restart <= restarts; restart++) {
+    hits.assign(count, 0);
+    pool.start((int)NumaPool::systemNodes().size());
+    // the new threads get to wait before the run, where a stale generation
+    // would make them step the items of the previous one
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    pool.run(count, 1, body);
+    pool.stop();
+    if (std::count(hits.begin(), hits.end(), 1) != count) {
+      std::cout << "numa pool: start " << restart
+                << " did not run every item once  FAIL" << std::endl;
+      passed = false;
+    }
+  }
+  if (passed) {
+    std::cout << "numa pool: " << restarts << " restarts, every item once"
+              << std::endl;
+  }
+  return passed;
+}
+
+bool GoldenRegression::checkRollback(const char *backendName, Device device) {
+  // a rollback rewinds the simulated time to the good snapshot and halves the
+  // step, the sphere has to carry on from where it was at that snapshot
+  // instead of jumping to another phase
+  const int poisonFrame = 20;
+  const int maxFrames = 200;
+  ClothParameters parameters = presets().front().parameters;
+  parameters.solverMode = SolverMode::Standard;
+  parameters.statsInterval = 1;
+  parameters.snapshotInterval = 4;
+  parameters.spherePeriod = 1.0f;
+
+  ClothObject cloth;
+  cloth.initiateNewCloth(parameters, device);
+  std::map<int, std::pair<double, float>> sphereAt = {
+      {cloth.frame, {cloth.simTime, cloth.uniforms.sphereZ}}};
+  bool passed = false;
+  bool rolledBack = false;
+  for (int i = 0; i < maxFrames && !rolledBack; i++) {
+    if (cloth.frame == poisonFrame) {
+      // a non-finite particle is what a diverged state looks like
+      float nan = NAN;
+      device.getQueue().writeBuffer(cloth.particleBuffers[1 - cloth.frame % 2],
+                                    0, &nan, sizeof(nan));
+    }
+    cloth.processFrame(device);
+    ClothObject::waitIdle(device);
+    rolledBack = cloth.m_watchdog.rollbacks() > 0;
+    if (!rolledBack) {
+      sphereAt[cloth.frame] = {cloth.simTime, cloth.uniforms.sphereZ};
+      continue;
+    }
+
+    // the frame after the good one, stepped with the halved step
+    auto good = sphereAt.find(cloth.frame - 1);
+    float deltaT = cloth.parameters.deltaT;
+    float maxSpeed = 2.0f * parameters.sphereRange / parameters.spherePeriod;
+    if (good == sphereAt.end()) {
+      std::cout << backendName << ": rolled back to unknown frame "
+                << cloth.frame - 1 << "  FAIL" << std::endl;
+    } else {
+      double timeError =
+          std::abs(cloth.simTime - (good->second.first + deltaT));
+      float sphereStep = std::abs(cloth.uniforms.sphereZ - good->second.second);
+      passed = timeError < 1e-9 && sphereStep <= 1.01f * maxSpeed * deltaT;
+      std::cout << backendName << ": rolled back to frame " << good->first
+                << ", sphere moved " << sphereStep << " (at most "
+                << maxSpeed * deltaT << ")" << (passed ? "" : "  FAIL")
+                << std::endl;
+    }
+  }
+  if (!rolledBack) {
+    std::cout << backendName << ": a non-finite particle was not rolled back"
+              << "  FAIL" << std::endl;
+  }
+  cloth.terminateAll();
+  return passed;
+}
+
+bool GoldenRegression::checkTiles(const char *backendName, Device device) {
+  // the halo copies between tiles have to give the same states as stepping
+  // the whole grid at once - 27 rows leave the last tile of both splits short
+  const int frames = 30;
+  const int tileRows[] = {4, 7};
+  ClothParameters parameters = presets().front().parameters;
+  parameters.height = 27;
+
+  std::vector<uint64_t> expected;
+  ClothObject cloth;
+  cloth.initiateNewCloth(parameters, device);
+  for (int frame = 0; frame < frames; frame++) {
+    cloth.processFrame(device);
+    expected.push_back(cloth.lastStateHash);
+  }
+  cloth.terminateAll();
+
+  bool passed = true;
+  for (int rows : tileRows) {
+    ClothParameters tiledParameters = parameters;
+    tiledParameters.tileRows = rows;
+    cloth.initiateNewCloth(tiledParameters, device);
+    int firstDiff = cloth.tiled() ? 0 : -1;
+    for (int frame = 0; frame < frames && firstDiff == 0; frame++) {
+      cloth.processFrame(device);
+      if (cloth.lastStateHash != expected[frame]) {
+        firstDiff = frame + 1;
+      }
+    }
+    cloth.terminateAll();
+
+    std::cout << backendName << ": tiles of " << rows << " rows ";
+    if (firstDiff < 0) {
+      std::cout << "were not used  FAIL" << std::endl;
+    } else if (firstDiff > 0) {
+      std::cout << "differ from the untiled grid at frame " << firstDiff
+                << "  FAIL" << std::endl;
+    } else {
+      std::cout << "match the untiled grid for " << frames << " frames"
+                << std::endl;
+    }
+    passed = firstDiff == 0 && passed;
+  }
+  return passed;
+}
+
+bool GoldenRegression::checkInitialStates(const Options &options,
+                                          const char *backendName,
+                                          Device device) {
+  // standard mode is the one that generates the initial state on the GPU
+  const std::pair<InitialState, const char *> generators[] = {
+      {InitialState::Flat, "flat"},
+      {InitialState::Draped, "draped"},
+      {InitialState::Crumpled, "crumpled"},
+      {InitialState::Mesh, "mesh"}};
+
+  bool passed = true;
+  for (const auto &generator : generators) {
+    ClothParameters parameters = presets().front().parameters;
+    parameters.solverMode = SolverMode::Standard;
+    parameters.initialState = generator.first;
+    parameters.initMesh = RESOURCE_DIR "/plane.obj";
+
+    std::vector<ClothInitializer::MeshVertex> mesh;
+    if (generator.first == InitialState::Mesh &&
+        !ClothInitializer::loadMesh(parameters.initMesh, mesh)) {
+      std::cerr << "Could not load " << parameters.initMesh << std::endl;
+      passed = false;
+      continue;
+    }
+    std::vector<ClothParticle> expected(parameters.width * parameters.height);
+    ClothInitializer::generate(parameters, mesh, expected.data());
+    std::vector<vec3> golden = positions(expected);
+
+    ClothObject cloth;
+    cloth.initiateNewCloth(parameters, device);
+    std::vector<ClothParticle> state;
+    if (!cloth.readParticles(device, state)) {
+      std::cerr << "Could not read back particles from " << backendName
+                << std::endl;
+      passed = false;
+    } else {
+      Preset preset = {std::string("init-") + generator.second, parameters,
+                       ""};
+      passed = checkFrame(options, preset, backendName, 0, golden, state) &&
+               passed;
+    }
+    cloth.terminateAll();
+  }
+  return passed;
+}
+
+int GoldenRegression::run(const Options &options) {
+  if (options.invalid) {
+    return 1;
+  }
+  std::vector<Preset> cases = presets();
+  bool passed = true;
+
+  if (options.record) {
+    // golden states always come from the CPU reference backend
+    std::filesystem::create_directories(options.directory);
+    for (const Preset &preset : cases) {
+      ClothCPU cloth;
+      cloth.initiateNewCloth(preset.parameters);
+
+      std::vector<std::vector<vec3>> frames;
+      for (int frame = 1; frame <= options.frames; frame++) {
+        cloth.processFrame();
+        frames.push_back(positions(cloth.currentParticles()));
+      }
+
+      path file = options.directory / (preset.name + ".golden");
+      if (!writeGolden(file, cloth.numParticles, frames)) {
+        std::cerr << "Could not write " << file << std::endl;
+        passed = false;
+      } else {
+        std::cout << "Recorded " << file << std::endl;
+      }
+    }
+    return passed ? 0 : 1;
+  }
+
+  passed = checkNumaPool() && passed;
+
+  Instance instance = wgpuCreateInstance(nullptr);
+  Device software = nullptr;
+  Device hardware = nullptr;
+  if (instance) {
+    software = HeadlessDevice::create(instance, true);
+    if (software) {
+      std::cout << "Software adapter: " << HeadlessDevice::lastAdapterName()
+                << std::endl;
+    }
+    hardware = HeadlessDevice::create(instance, false);
+    if (hardware) {
+      std::cout << "Hardware adapter: " << HeadlessDevice::lastAdapterName()
+                << std::endl;
+    }
+  }
+  if (!software) {
+    std::cout << "No software adapter, skipping that backend" << std::endl;
+  }
+  if (!hardware) {
+    std::cout << "No hardware adapter, skipping that backend" << std::endl;
+  }
+
+  if (software) {
+    passed = checkResets("software", software) && passed;
+  }
+  if (hardware) {
+    passed = checkResets("gpu", hardware) && passed;
+  }
+  if (software) {
+    passed = checkRollback("software", software) && passed;
+  }
+  if (hardware) {
+    passed = checkRollback("gpu", hardware) && passed;
+  }
+  if (software) {
+    passed = checkTiles("software", software) && passed;
+  }
+  if (hardware) {
+    passed = checkTiles("gpu", hardware) && passed;
+  }
+
+  std::cout << "preset    backend    frame   max error   rms error"
+            << std::endl;
+  if (software) {
+    passed = checkInitialStates(options, "software", software) && passed;
+  }
+  if (hardware) {
+    passed = checkInitialStates(options, "gpu", hardware) && passed;
+  }
+  std::map<std::string, std::vector<std::vector<vec3>>> references;
+  for (const Preset &preset : cases) {
+    // the GPU backends are checked against the CPU reference of this run, a
+    // golden file checks the CPU reference itself (a garment's particle count
+    // comes from its mesh)
+    ClothCPU cpu;
+    cpu.initiateNewCloth(preset.parameters);
+    std::vector<std::vector<vec3>> golden;
+    bool hasGolden = false;
+    if (!options.directory.empty()) {
+      path file = options.directory / (preset.name + ".golden");
+      hasGolden = readGolden(file, cpu.numParticles, golden) &&
+                  (int)golden.size() >= options.frames;
+      if (!hasGolden) {
+        std::cerr << "Missing or incomplete golden file " << file
+                  << std::endl;
+        passed = false;
+      }
+    }
+
+    std::vector<std::vector<vec3>> &reference = references[preset.name];
+    for (int frame = 1; frame <= options.frames; frame++) {
+      cpu.processFrame();
+      std::vector<ClothParticle> state = cpu.currentParticles();
+      if (hasGolden) {
+        passed = checkFrame(options, preset, "cpu", frame, golden[frame - 1],
+                            state) &&
+                 passed;
+      }
+      reference.push_back(positions(state));
+    }
+
+    if (!preset.sameAs.empty()) {
+      bool same = reference == references[preset.sameAs];
+      std::cout << std::left << std::setw(10) << preset.name << std::setw(10)
+                << "cpu" << (same ? "same as " : "differs from ")
+                << preset.sameAs << (same ? "" : "  FAIL") << std::endl;
+      passed = same && passed;
+    }
+
+    if (software) {
+      passed = checkGpu(options, preset, "software", software, reference) &&
+               passed;
+    }
+    if (hardware) {
+      passed = checkGpu(options, preset, "gpu", hardware, reference) &&
+               passed;
+    }
+  }
+
+  BufferPool::releaseIdle();
+  if (software) {
+    software.release();
+  }
+  if (hardware) {
+    hardware.release();
+  }
+  if (instance) {
+    instance.release();
+  }
+
+  // without golden files or an adapter the CPU was only checked against
+  // itself, which must not look like a pass
+  if (passed && !software && !hardware && options.directory.empty()) {
+    std::cout << "SKIPPED, no WebGPU adapter to compare" << std::endl;
+    return SkippedExitCode;
+  }
+  std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+  return passed ? 0 : 1;
+}
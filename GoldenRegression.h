@@ -0,0 +1,105 @@
+#pragma once
+
+#include "ClothObject.h"
+
+#include <glm/glm.hpp>
+#include <webgpu/webgpu.hpp>
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// Headless golden-state regression harness. A set of preset cloths is run for
+// a fixed number of frames on the CPU reference and the particle positions of
+// every available WebGPU backend (a software adapter and the default GPU
+// adapter) are compared against it in the same run. Golden files recorded
+// from the CPU reference earlier (golden/ in the repository) additionally
+// check the CPU reference itself for regressions. Resetting a cloth is
+// checked not to leak WebGPU objects, a diverged cloth to be rolled back
+// smoothly, a tiled cloth to step like an untiled one and the GPU initial
+// state generators to match their CPU equivalents.
+// Invoked through `App --golden-compare`, `App --golden-record <dir>` and
+// `App --golden-check <dir>`.
+class GoldenRegression {
+public:
+  // (Just aliases to make notations lighter)
+  using path = std::filesystem::path;
+  using vec3 = glm::vec3;
+  using ClothParameters = ClothObject::ClothParameters;
+  using ClothParticle = ClothObject::ClothParticle;
+
+  struct Preset {
+    std::string name;
+    ClothParameters parameters;
+    // an earlier preset whose CPU states this one must match bit for bit
+    std::string sameAs;
+  };
+
+  // position error of one frame against the golden state
+  struct FrameError {
+    float maxError = 0.0f;
+    float rmsError = 0.0f;
+  };
+
+  struct Options {
+    // golden files, none to only compare the backends with each other
+    path directory;
+    bool record = false;
+    int frames = 120;
+    float tolerance = 1e-3f;
+    // a value on the command line could not be parsed
+    bool invalid = false;
+  };
+
+  // parses the command line, returns false if no regression run was asked for
+  // - an invalid harness option asks for a run that fails right away
+  static bool parseArguments(int argc, char **argv, Options &options);
+
+  // exit code of a comparison that found no WebGPU backend to compare (the
+  // SKIP_RETURN_CODE of the ctest)
+  static constexpr int SkippedExitCode = 77;
+
+  // runs the harness and returns a process exit code
+  static int run(const Options &options);
+
+  // the cloths covered by the harness
+  static std::vector<Preset> presets();
+
+  // golden files store the positions of every frame of one preset
+  static bool writeGolden(const path &path, int particleCount,
+                          const std::vector<std::vector<vec3>> &frames);
+  static bool readGolden(const path &path, int particleCount,
+                         std::vector<std::vector<vec3>> &frames);
+
+  static std::vector<vec3> positions(const std::vector<ClothParticle> &state);
+  static FrameError compare(const std::vector<vec3> &golden,
+                            const std::vector<ClothParticle> &state);
+
+private:
+  // runs a preset on the GPU backend and checks every frame against the CPU
+  // reference, returns false if any frame exceeds the tolerance
+  static bool checkGpu(const Options &options, const Preset &preset,
+                       const char *backendName, wgpu::Device device,
+                       const std::vector<std::vector<vec3>> &reference);
+  // resets the cloth repeatedly and checks that the live WebGPU objects return
+  // to the same baseline every time (see GpuTracker)
+  static bool checkResets(const char *backendName, wgpu::Device device);
+  // starts, runs and stops a NumaPool repeatedly and checks that every run
+  // covers each item exactly once
+  static bool checkNumaPool();
+  // poisons a cloth with a non-finite particle and checks that the watchdog
+  // rolls it back without the sphere jumping (see ClothWatchdog)
+  static bool checkRollback(const char *backendName, wgpu::Device device);
+  // runs a deterministic grid untiled and split into tiles of a few row
+  // counts, the state hashes of every frame must match (see ClothTiles)
+  static bool checkTiles(const char *backendName, wgpu::Device device);
+  // runs every initial state generator on the GPU and compares the state it
+  // leaves in the particle buffers with the CPU generator
+  static bool checkInitialStates(const Options &options,
+                                 const char *backendName,
+                                 wgpu::Device device);
+  static bool checkFrame(const Options &options, const Preset &preset,
+                         const char *backendName, int frame,
+                         const std::vector<vec3> &golden,
+                         const std::vector<ClothParticle> &state);
+};
@@ -0,0 +1,269 @@
+#include "GpuTracker.h"
+
+#include <algorithm>
+#include <cassert>
+#include <mutex>
+#include <unordered_map>
+
+using namespace wgpu;
+using Category = GpuTracker::Category;
+using Snapshot = GpuTracker::Snapshot;
+
+namespace {
+struct LiveObject {
+  Category category;
+  uint64_t bytes;
+};
+
+// every tracked object that has not been released yet, keyed by its handle
+std::mutex s_mutex;
+std::unordered_map<const void *, LiveObject> s_liveObjects;
+Snapshot s_stats;
+
+uint32_t bytesPerTexel(WGPUTextureFormat format) {
+  switch (format) {
+  case WGPUTextureFormat_R8Unorm:
+  case WGPUTextureFormat_Stencil8:
+    return 1;
+  case WGPUTextureFormat_RG8Unorm:
+  case WGPUTextureFormat_R16Float:
+  case WGPUTextureFormat_Depth16Unorm:
+    return 2;
+  case WGPUTextureFormat_RGBA16Float:
+  case WGPUTextureFormat_RG32Float:
+  case WGPUTextureFormat_Depth32FloatStencil8:
+    return 8;
+  case WGPUTextureFormat_RGBA32Float:
+    return 16;
+  default:
+    // 8 bit RGBA/BGRA, depth24plus and depth32float
+    return 4;
+  }
+}
+} // namespace
+
+int64_t Snapshot::liveCount() const {
+  int64_t count = 0;
+  for (const CategoryStats &stats : categories) {
+    count += stats.liveCount;
+  }
+  return count;
+}
+
+uint64_t Snapshot::liveBytes() const {
+  uint64_t bytes = 0;
+  for (const CategoryStats &stats : categories) {
+    bytes += stats.liveBytes;
+  }
+  return bytes;
+}
+
+bool Snapshot::sameLiveState(const Snapshot &other) const {
+  for (size_t i = 0; i < categories.size(); i++) {
+    if (categories[i].liveCount != other.categories[i].liveCount ||
+        categories[i].liveBytes != other.categories[i].liveBytes) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void GpuTracker::onCreate(const void *handle, Category category,
+                          uint64_t bytes) {
+  if (handle == nullptr) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(s_mutex);
+  s_liveObjects[handle] = {category, bytes};
+  CategoryStats &stats = s_stats.categories[(size_t)category];
+  stats.liveCount++;
+  stats.liveBytes += bytes;
+  stats.created++;
+}
+
+void GpuTracker::onRelease(const void *handle) {
+  std::lock_guard<std::mutex> lock(s_mutex);
+  auto it = s_liveObjects.find(handle);
+  // releasing an object the tracker never saw is a bookkeeping bug
+  assert(it != s_liveObjects.end());
+  if (it == s_liveObjects.end()) {
+    return;
+  }
+  CategoryStats &stats = s_stats.categories[(size_t)it->second.category];
+  stats.liveCount--;
+  stats.liveBytes -= it->second.bytes;
+  stats.released++;
+  s_liveObjects.erase(it);
+}
+
+uint64_t GpuTracker::textureBytes(const TextureDescriptor &desc) {
+  // sum of every mip level, each level halves the width and height
+  uint64_t texel = bytesPerTexel(desc.format) * desc.sampleCount;
+  uint64_t bytes = 0;
+  uint32_t width = desc.size.width;
+  uint32_t height = desc.size.height;
+  for (uint32_t level = 0; level < desc.mipLevelCount; level++) {
+    bytes += (uint64_t)width * height * desc.size.depthOrArrayLayers * texel;
+    width = std::max(width / 2, 1u);
+    height = std::max(height / 2, 1u);
+  }
+  return bytes;
+}
+
+Buffer GpuTracker::createBuffer(Device &device, const BufferDescriptor &desc) {
+  Buffer buffer = device.createBuffer(desc);
+  onCreate((WGPUBuffer)buffer, Category::Buffer, desc.size);
+  return buffer;
+}
+
+Texture GpuTracker::createTexture(Device &device,
+                                  const TextureDescriptor &desc) {
+  Texture texture = device.createTexture(desc);
+  onCreate((WGPUTexture)texture, Category::Texture, textureBytes(desc));
+  return texture;
+}
+
+BindGroup GpuTracker::createBindGroup(Device &device,
+                                      const BindGroupDescriptor &desc) {
+  BindGroup bindGroup = device.createBindGroup(desc);
+  onCreate((WGPUBindGroup)bindGroup, Category::BindGroup, 0);
+  return bindGroup;
+}
+
+BindGroupLayout
+GpuTracker::createBindGroupLayout(Device &device,
+                                  const BindGroupLayoutDescriptor &desc) {
+  BindGroupLayout layout = device.createBindGroupLayout(desc);
+  onCreate((WGPUBindGroupLayout)layout, Category::BindGroupLayout, 0);
+  return layout;
+}
+
+PipelineLayout
+GpuTracker::createPipelineLayout(Device &device,
+                                 const PipelineLayoutDescriptor &desc) {
+  PipelineLayout layout = device.createPipelineLayout(desc);
+  onCreate((WGPUPipelineLayout)layout, Category::Pipeline, 0);
+  return layout;
+}
+
+ComputePipeline
+GpuTracker::createComputePipeline(Device &device,
+                                  const ComputePipelineDescriptor &desc) {
+  ComputePipeline pipeline = device.createComputePipeline(desc);
+  onCreate((WGPUComputePipeline)pipeline, Category::Pipeline, 0);
+  return pipeline;
+}
+
+RenderPipeline
+GpuTracker::createRenderPipeline(Device &device,
+                                 const RenderPipelineDescriptor &desc) {
+  RenderPipeline pipeline = device.createRenderPipeline(desc);
+  onCreate((WGPURenderPipeline)pipeline, Category::Pipeline, 0);
+  return pipeline;
+}
+
+ShaderModule
+GpuTracker::createShaderModule(Device &device,
+                               const ShaderModuleDescriptor &desc) {
+  ShaderModule module = device.createShaderModule(desc);
+  onCreate((WGPUShaderModule)module, Category::ShaderModule, 0);
+  return module;
+}
+
+void GpuTracker::release(Buffer &buffer) {
+  if (!buffer) {
+    return;
+  }
+  onRelease((WGPUBuffer)buffer);
+  buffer.destroy();
+  buffer.release();
+  buffer = nullptr;
+}
+
+void GpuTracker::release(Texture &texture) {
+  if (!texture) {
+    return;
+  }
+  onRelease((WGPUTexture)texture);
+  texture.destroy();
+  texture.release();
+  texture = nullptr;
+}
+
+void GpuTracker::release(BindGroup &bindGroup) {
+  if (!bindGroup) {
+    return;
+  }
+  onRelease((WGPUBindGroup)bindGroup);
+  bindGroup.release();
+  bindGroup = nullptr;
+}
+
+void GpuTracker::release(BindGroupLayout &layout) {
+  if (!layout) {
+    return;
+  }
+  onRelease((WGPUBindGroupLayout)layout);
+  layout.release();
+  layout = nullptr;
+}
+
+void GpuTracker::release(PipelineLayout &layout) {
+  if (!layout) {
+    return;
+  }
+  onRelease((WGPUPipelineLayout)layout);
+  layout.release();
+  layout = nullptr;
+}
+
+void GpuTracker::release(ComputePipeline &pipeline) {
+  if (!pipeline) {
+    return;
+  }
+  onRelease((WGPUComputePipeline)pipeline);
+  pipeline.release();
+  pipeline = nullptr;
+}
+
+void GpuTracker::release(RenderPipeline &pipeline) {
+  if (!pipeline) {
+    return;
+  }
+  onRelease((WGPURenderPipeline)pipeline);
+  pipeline.release();
+  pipeline = nullptr;
+}
+
+void GpuTracker::release(ShaderModule &module) {
+  if (!module) {
+    return;
+  }
+  onRelease((WGPUShaderModule)module);
+  module.release();
+  module = nullptr;
+}
+
+Snapshot GpuTracker::snapshot() {
+  std::lock_guard<std::mutex> lock(s_mutex);
+  return s_stats;
+}
+
+const char *GpuTracker::categoryName(Category category) {
+  switch (category) {
+  case Category::Buffer:
+    return "Buffers";
+  case Category::Texture:
+    return "Textures";
+  case Category::BindGroup:
+    return "Bind groups";
+  case Category::BindGroupLayout:
+    return "Bind group layouts";
+  case Category::Pipeline:
+    return "Pipelines";
+  case Category::ShaderModule:
+    return "Shader modules";
+  default:
+    return "Unknown";
+  }
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <array>
+#include <cstdint>
+
+// Accounting layer for WebGPU objects. Objects created through GpuTracker are
+// counted by category (with their size for buffers and textures) until they
+// are released through GpuTracker::release, so a leak shows up as a live
+// count that keeps growing. The totals are shown in the "GPU memory" panel
+// and checked by the regression harness.
+class GpuTracker {
+public:
+  enum class Category {
+    Buffer = 0,
+    Texture,
+    BindGroup,
+    BindGroupLayout,
+    Pipeline,
+    ShaderModule,
+    Count
+  };
+
+  struct CategoryStats {
+    int64_t liveCount = 0;
+    uint64_t liveBytes = 0;
+    uint64_t created = 0;
+    uint64_t released = 0;
+  };
+
+  struct Snapshot {
+    std::array<CategoryStats, (size_t)Category::Count> categories;
+
+    const CategoryStats &operator[](Category category) const {
+      return categories[(size_t)category];
+    }
+    int64_t liveCount() const;
+    uint64_t liveBytes() const;
+    // true if both snapshots hold the same live objects and bytes
+    bool sameLiveState(const Snapshot &other) const;
+  };
+
+  // creation - same as the Device methods, plus accounting
+  static wgpu::Buffer createBuffer(wgpu::Device &device,
+                                   const wgpu::BufferDescriptor &desc);
+  static wgpu::Texture createTexture(wgpu::Device &device,
+                                     const wgpu::TextureDescriptor &desc);
+  static wgpu::BindGroup
+  createBindGroup(wgpu::Device &device, const wgpu::BindGroupDescriptor &desc);
+  static wgpu::BindGroupLayout
+  createBindGroupLayout(wgpu::Device &device,
+                        const wgpu::BindGroupLayoutDescriptor &desc);
+  static wgpu::PipelineLayout
+  createPipelineLayout(wgpu::Device &device,
+                       const wgpu::PipelineLayoutDescriptor &desc);
+  static wgpu::ComputePipeline
+  createComputePipeline(wgpu::Device &device,
+                        const wgpu::ComputePipelineDescriptor &desc);
+  static wgpu::RenderPipeline
+  createRenderPipeline(wgpu::Device &device,
+                       const wgpu::RenderPipelineDescriptor &desc);
+  static wgpu::ShaderModule
+  createShaderModule(wgpu::Device &device,
+                     const wgpu::ShaderModuleDescriptor &desc);
+
+  // release - buffers and textures are destroyed first, the handle is reset
+  // to null and releasing a null handle does nothing
+  static void release(wgpu::Buffer &buffer);
+  static void release(wgpu::Texture &texture);
+  static void release(wgpu::BindGroup &bindGroup);
+  static void release(wgpu::BindGroupLayout &layout);
+  static void release(wgpu::PipelineLayout &layout);
+  static void release(wgpu::ComputePipeline &pipeline);
+  static void release(wgpu::RenderPipeline &pipeline);
+  static void release(wgpu::ShaderModule &module);
+
+  static Snapshot snapshot();
+  static const char *categoryName(Category category);
+
+  // approximate size of a texture including its mip chain
+  static uint64_t textureBytes(const wgpu::TextureDescriptor &desc);
+
+private:
+  static void onCreate(const void *handle, Category category, uint64_t bytes);
+  static void onRelease(const void *handle);
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+// Where the particle of grid cell (x, y) is stored in the particle buffers.
+//
+// Row-major storage puts the vertical neighbours of a particle a whole row
+// apart, so for wide cloths every step of forces() touches three distant
+// cache lines. The Morton tiled order stores the grid as 8x8 tiles, tile rows
+// one after the other, with the particles of a full tile in Morton (Z) order
+// and those of the partial tiles at the right and bottom edges row by row.
+// The 8 neighbours of most particles then lie within the same 2 KiB tile.
+//
+// Must match grid_layout_index() and grid_layout_coords() in compute.wgsl and
+// init.wgsl. Everything outside the kernels (readback, hashes, golden files)
+// sees the particles in row-major grid order.
+struct GridLayout {
+  enum class Order { RowMajor = 0, MortonTiles };
+
+  static constexpr uint32_t TileSize = 8;
+
+  uint32_t width = 0;
+  uint32_t height = 0;
+  Order order = Order::RowMajor;
+
+  // storage index of grid cell (x, y)
+  uint32_t index(uint32_t x, uint32_t y) const {
+    if (order == Order::RowMajor) {
+      return y * width + x;
+    }
+    uint32_t tx = x / TileSize;
+    uint32_t ty = y / TileSize;
+    uint32_t tileWidth = std::min(TileSize, width - tx * TileSize);
+    uint32_t tileHeight = std::min(TileSize, height - ty * TileSize);
+    uint32_t lx = x - tx * TileSize;
+    uint32_t ly = y - ty * TileSize;
+    uint32_t local = tileWidth == TileSize && tileHeight == TileSize
+                         ? mortonEncode(lx, ly)
+                         : ly * tileWidth + lx;
+    return ty * TileSize * width + tx * TileSize * tileHeight + local;
+  }
+
+  // grid cell of storage index i
+  void coords(uint32_t i, uint32_t &x, uint32_t &y) const {
+    if (order == Order::RowMajor) {
+      x = i % width;
+      y = i / width;
+      return;
+    }
+    uint32_t ty = i / (TileSize * width);
+    uint32_t rest = i - ty * TileSize * width;
+    uint32_t tileHeight = std::min(TileSize, height - ty * TileSize);
+    uint32_t tx = rest / (TileSize * tileHeight);
+    uint32_t local = rest - tx * TileSize * tileHeight;
+    uint32_t tileWidth = std::min(TileSize, width - tx * TileSize);
+    uint32_t lx, ly;
+    if (tileWidth == TileSize && tileHeight == TileSize) {
+      mortonDecode(local, lx, ly);
+    } else {
+      lx = local % tileWidth;
+      ly = local / tileWidth;
+    }
+    x = tx * TileSize + lx;
+    y = ty * TileSize + ly;
+  }
+
+  // interleaves the 3 low bits of x and y (x in the even bits)
+  static uint32_t mortonEncode(uint32_t x, uint32_t y) {
+    return (x & 1u) | ((y & 1u) << 1) | ((x & 2u) << 1) | ((y & 2u) << 2) |
+           ((x & 4u) << 2) | ((y & 4u) << 3);
+  }
+  static void mortonDecode(uint32_t code, uint32_t &x, uint32_t &y) {
+    x = (code & 1u) | ((code >> 1) & 2u) | ((code >> 2) & 4u);
+    y = ((code >> 1) & 1u) | ((code >> 2) & 2u) | ((code >> 3) & 4u);
+  }
+};
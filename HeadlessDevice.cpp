@@ -0,0 +1,53 @@
+#include "HeadlessDevice.h"
+
+#include <string>
+
+using namespace wgpu;
+
+static std::string s_adapterName;
+
+Device HeadlessDevice::create(Instance instance, bool software) {
+  RequestAdapterOptions adapterOpts = Default;
+  adapterOpts.forceFallbackAdapter = software;
+  adapterOpts.powerPreference = PowerPreference::HighPerformance;
+  Adapter adapter = instance.requestAdapter(adapterOpts);
+  if (!adapter) {
+    return nullptr;
+  }
+
+  // the hardware run is skipped when the only adapter is a software one, it
+  // is already covered by the software run
+  AdapterProperties properties = Default;
+  adapter.getProperties(&properties);
+  if (!software && properties.adapterType == AdapterType::CPU) {
+    adapter.release();
+    return nullptr;
+  }
+  s_adapterName = properties.name ? properties.name : "";
+
+  SupportedLimits supportedLimits;
+  adapter.getLimits(&supportedLimits);
+
+  // only the compute limits matter here - everything else stays default
+  RequiredLimits requiredLimits = Default;
+  requiredLimits.limits.maxBufferSize = supportedLimits.limits.maxBufferSize;
+  requiredLimits.limits.maxStorageBufferBindingSize =
+      supportedLimits.limits.maxStorageBufferBindingSize;
+  requiredLimits.limits.minStorageBufferOffsetAlignment =
+      supportedLimits.limits.minStorageBufferOffsetAlignment;
+  requiredLimits.limits.minUniformBufferOffsetAlignment =
+      supportedLimits.limits.minUniformBufferOffsetAlignment;
+
+  DeviceDescriptor deviceDesc;
+  deviceDesc.label = software ? "Software device" : "Headless device";
+  deviceDesc.requiredFeatureCount = 0;
+  deviceDesc.requiredLimits = &requiredLimits;
+  deviceDesc.defaultQueue.label = "The default queue";
+  Device device = adapter.requestDevice(deviceDesc);
+  adapter.release();
+  return device;
+}
+
+const char *HeadlessDevice::lastAdapterName() {
+  return s_adapterName.c_str();
+}
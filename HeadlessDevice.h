@@ -0,0 +1,16 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+// Creates WebGPU devices without a window or surface, for the regression
+// harness and the benchmarks.
+class HeadlessDevice {
+public:
+  // Request a device from the default adapter, or from the fallback
+  // (software) adapter. Returns nullptr when no such adapter exists, or when
+  // the default adapter is itself a software one.
+  static wgpu::Device create(wgpu::Instance instance, bool software);
+
+  // Name of the adapter the last call to `create` picked
+  static const char *lastAdapterName();
+};
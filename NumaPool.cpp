@@ -0,0 +1,187 @@
+#include "NumaPool.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+namespace {
+// cpu lists of sysfs, like "0-7,16-23"
+std::vector<int> parseCpuList(const std::string &list) {
+  std::vector<int> cpus;
+  std::stringstream stream(list);
+  std::string range;
+  while (std::getline(stream, range, ',')) {
+    if (range.empty() || range[0] < '0' || range[0] > '9') {
+      continue;
+    }
+    size_t dash = range.find('-');
+    int first = std::stoi(range.substr(0, dash));
+    int last =
+        dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+    for (int cpu = first; cpu <= last; cpu++) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+std::vector<NumaPool::Node> readNodes() {
+  std::vector<NumaPool::Node> nodes;
+#ifdef __linux__
+  // node ids may have gaps, stop after a run of missing ones
+  for (int id = 0, missing = 0; missing < 8; id++) {
+    std::ifstream file("/sys/devices/system/node/node" + std::to_string(id) +
+                       "/cpulist");
+    if (!file) {
+      missing++;
+      continue;
+    }
+    missing = 0;
+    std::string list;
+    std::getline(file, list);
+    NumaPool::Node node;
+    node.id = id;
+    node.cpus = parseCpuList(list);
+    // memory-only nodes have no cpus to run on
+    if (!node.cpus.empty()) {
+      nodes.push_back(node);
+    }
+  }
+#endif
+  if (nodes.empty()) {
+    NumaPool::Node node;
+    unsigned count = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned cpu = 0; cpu < count; cpu++) {
+      node.cpus.push_back((int)cpu);
+    }
+    nodes.push_back(node);
+  }
+  return nodes;
+}
+} // namespace
+
+const std::vector<NumaPool::Node> &NumaPool::systemNodes() {
+  static const std::vector<Node> nodes = readNodes();
+  return nodes;
+}
+
+bool NumaPool::pinCurrentThread(const std::vector<int> &cpus) {
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) {
+    if (cpu >= 0 && cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &set);
+    }
+  }
+  return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+  (void)cpus;
+  return false;
+#endif
+}
+
+void NumaPool::partition(int count, int align, int part, int parts,
+                         int &begin, int &end) {
+  align = std::max(align, 1);
+  long long units = (count + (long long)align - 1) / align;
+  begin = (int)std::min<long long>(count, units * part / parts * align);
+  end = (int)std::min<long long>(count, units * (part + 1) / parts * align);
+}
+
+void NumaPool::start(int nodeCount) {
+  stop();
+  const std::vector<Node> &nodes = systemNodes();
+  m_nodeCount = std::clamp(nodeCount, 1, (int)nodes.size());
+  m_stop = false;
+  for (int node = 0; node < m_nodeCount; node++) {
+    const std::vector<int> &cpus = nodes[node].cpus;
+    for (int rank = 0; rank < (int)cpus.size(); rank++) {
+      auto thread = std::make_unique<Thread>();
+      thread->node = node;
+      thread->rank = rank;
+      thread->ranks = (int)cpus.size();
+      m_threads.push_back(std::move(thread));
+    }
+  }
+  // the threads only start once every slot exists, and only wait for runs
+  // after the ones of an earlier start
+  uint64_t generation;
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    generation = m_generation;
+  }
+  for (size_t i = 0; i < m_threads.size(); i++) {
+    m_threads[i]->thread =
+        std::thread(&NumaPool::threadLoop, this, (int)i,
+                    nodes[m_threads[i]->node].cpus, generation);
+  }
+}
+
+void NumaPool::stop() {
+  {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_stop = true;
+  }
+  m_start.notify_all();
+  for (std::unique_ptr<Thread> &thread : m_threads) {
+    thread->thread.join();
+  }
+  m_threads.clear();
+  m_nodeCount = 0;
+}
+
+void NumaPool::run(int count, int align, RangeFunction function,
+                   void *context) {
+  if (count <= 0) {
+    return;
+  }
+  if (m_threads.empty()) {
+    function(context, 0, count);
+    return;
+  }
+  std::unique_lock<std::mutex> lock(m_lock);
+  m_function = function;
+  m_context = context;
+  m_count = count;
+  m_align = align;
+  m_pending = (int)m_threads.size();
+  m_generation++;
+  m_start.notify_all();
+  m_done.wait(lock, [&] { return m_pending == 0; });
+}
+
+void NumaPool::threadLoop(int index, std::vector<int> cpus, uint64_t seen) {
+  // pinned before the thread touches any page
+  pinCurrentThread(cpus);
+  const Thread &self = *m_threads[index];
+  std::unique_lock<std::mutex> lock(m_lock);
+  while (true) {
+    m_start.wait(lock, [&] { return m_stop || m_generation != seen; });
+    if (m_stop) {
+      return;
+    }
+    seen = m_generation;
+    RangeFunction function = m_function;
+    void *context = m_context;
+    int bandBegin, bandEnd;
+    partition(m_count, m_align, self.node, m_nodeCount, bandBegin, bandEnd);
+    lock.unlock();
+
+    int begin, end;
+    partition(bandEnd - bandBegin, 1, self.rank, self.ranks, begin, end);
+    if (begin < end) {
+      function(context, bandBegin + begin, bandBegin + end);
+    }
+
+    lock.lock();
+    if (--m_pending == 0) {
+      m_done.notify_one();
+    }
+  }
+}
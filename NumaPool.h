@@ -0,0 +1,105 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Threads pinned to the NUMA nodes of the machine, for CPU simulations large
+// enough to be bound by memory bandwidth. run() cuts a range into one band per
+// node and each band into one piece per thread of that node, always the same
+// way for the same range. A buffer whose pages are first written through
+// run() therefore lives on the node whose threads later step it, and only the
+// neighbours read across a band boundary (the halo rows) cross between nodes.
+//
+// Unlike TaskScheduler nothing is stolen - affinity matters more than balance
+// here. The nodes come from /sys/devices/system/node on Linux; elsewhere the
+// machine is one node and no thread is pinned.
+class NumaPool {
+public:
+  struct Node {
+    int id = 0;
+    std::vector<int> cpus;
+  };
+
+  using RangeFunction = void (*)(void *context, int begin, int end);
+
+  // nodes of the machine with at least one cpu
+  static const std::vector<Node> &systemNodes();
+  // restricts the calling thread to cpus, false if that is not supported
+  static bool pinCurrentThread(const std::vector<int> &cpus);
+
+  ~NumaPool() { stop(); }
+
+  // starts one pinned thread per cpu of the first nodeCount nodes
+  void start(int nodeCount);
+  void stop();
+  int nodeCount() const { return m_nodeCount; }
+  int threadCount() const { return (int)m_threads.size(); }
+
+  // calls body(begin, end) over the fixed partition of [0, count), node bands
+  // are multiples of align items (a row of the grid) - returns once all
+  // pieces are done
+  template <typename Body> void run(int count, int align, const Body &body) {
+    run(count, align, &callBody<Body>, (void *)&body);
+  }
+  void run(int count, int align, RangeFunction function, void *context);
+
+  // piece part of parts of [0, count), in multiples of align
+  static void partition(int count, int align, int part, int parts, int &begin,
+                        int &end);
+
+private:
+  struct Thread {
+    std::thread thread;
+    int node = 0;
+    // index among the threads of its node
+    int rank = 0;
+    int ranks = 1;
+  };
+
+  template <typename Body>
+  static void callBody(void *context, int begin, int end) {
+    (*(const Body *)context)(begin, end);
+  }
+
+  // seen is the generation of the last run before the thread started
+  void threadLoop(int index, std::vector<int> cpus, uint64_t seen);
+
+  int m_nodeCount = 0;
+  std::vector<std::unique_ptr<Thread>> m_threads;
+
+  std::mutex m_lock;
+  std::condition_variable m_start;
+  std::condition_variable m_done;
+  uint64_t m_generation = 0;
+  int m_pending = 0;
+  bool m_stop = false;
+  // the range of the current run
+  RangeFunction m_function = nullptr;
+  void *m_context = nullptr;
+  int m_count = 0;
+  int m_align = 1;
+};
+
+// allocator whose resize() leaves trivial elements unwritten, so the first
+// thread to write a page (see NumaPool::run) decides the node it lives on
+template <typename T> struct FirstTouchAllocator : std::allocator<T> {
+  template <typename U> struct rebind {
+    using other = FirstTouchAllocator<U>;
+  };
+
+  FirstTouchAllocator() = default;
+  template <typename U>
+  FirstTouchAllocator(const FirstTouchAllocator<U> &) noexcept {}
+
+  template <typename U> void construct(U *p) { ::new ((void *)p) U; }
+  template <typename U, typename... Args>
+  void construct(U *p, Args &&...args) {
+    ::new ((void *)p) U(std::forward<Args>(args)...);
+  }
+};
@@ -0,0 +1,11 @@
+#include "ParallelFor.h"
+#include "TaskScheduler.h"
+
+unsigned ParallelFor::workerCount() {
+  return TaskScheduler::instance().workerCount();
+}
+
+void ParallelFor::run(int count, int grain,
+                      const std::function<void(int begin, int end)> &body) {
+  TaskScheduler::parallelFor(count, grain, body);
+}
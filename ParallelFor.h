@@ -0,0 +1,18 @@
+#pragma once
+
+#include <functional>
+
+// Splits a range of rows into chunks of at most `grain` rows and runs them on
+// the work-stealing pool of TaskScheduler, including the calling thread.
+// Ranges of no more than `grain` rows run inline on the calling thread, as
+// does everything on the web build.
+class ParallelFor {
+public:
+  // calls body(begin, end) over disjoint chunks covering [0, count) and
+  // returns once all of them are done
+  static void run(int count, int grain,
+                  const std::function<void(int begin, int end)> &body);
+
+  // number of threads run() spreads work over
+  static unsigned workerCount();
+};
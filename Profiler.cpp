@@ -0,0 +1,133 @@
+#include "Profiler.h"
+
+#ifdef CLOTH_PROFILING
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <string>
+
+using Zone = Profiler::Zone;
+
+namespace {
+// Ring buffer written by a single thread. The writer publishes each zone by
+// bumping `written` with release semantics. Once the ring wraps, the writer
+// reuses the slot the exporter may be reading, so every slot also carries a
+// sequence number: odd while the slot is being written, 2 * (index + 1) once
+// zone index is complete. The exporter skips slots whose sequence changed
+// under it. Buffers are never freed, so zones of threads that already exited
+// are still exported.
+struct ZoneSlot {
+  std::atomic<uint64_t> sequence{0};
+  std::atomic<const char *> name{nullptr};
+  std::atomic<uint64_t> begin{0};
+  std::atomic<uint64_t> end{0};
+};
+
+struct ThreadBuffer {
+  ZoneSlot slots[Profiler::RingCapacity];
+  std::atomic<uint64_t> written{0};
+  std::atomic<const char *> name{"worker"};
+  uint32_t threadId = 0;
+  ThreadBuffer *next = nullptr;
+};
+
+// Lock-free list of every thread buffer, new buffers are pushed at the head
+std::atomic<ThreadBuffer *> s_threadBuffers{nullptr};
+std::atomic<uint32_t> s_threadCount{0};
+std::filesystem::path s_exitPath;
+
+ThreadBuffer *threadBuffer() {
+  thread_local ThreadBuffer *buffer = nullptr;
+  if (buffer == nullptr) {
+    buffer = new ThreadBuffer();
+    buffer->threadId = s_threadCount.fetch_add(1) + 1;
+    ThreadBuffer *head = s_threadBuffers.load(std::memory_order_relaxed);
+    do {
+      buffer->next = head;
+    } while (!s_threadBuffers.compare_exchange_weak(
+        head, buffer, std::memory_order_release, std::memory_order_relaxed));
+  }
+  return buffer;
+}
+
+void exportAtExitHandler() { Profiler::exportChromeTrace(s_exitPath); }
+} // namespace
+
+uint64_t Profiler::now() {
+  static const auto start = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+void Profiler::record(const char *name, uint64_t begin, uint64_t end) {
+  ThreadBuffer *buffer = threadBuffer();
+  uint64_t index = buffer->written.load(std::memory_order_relaxed);
+  ZoneSlot &slot = buffer->slots[index % RingCapacity];
+  slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.name.store(name, std::memory_order_relaxed);
+  slot.begin.store(begin, std::memory_order_relaxed);
+  slot.end.store(end, std::memory_order_relaxed);
+  slot.sequence.store(2 * index + 2, std::memory_order_release);
+  buffer->written.store(index + 1, std::memory_order_release);
+}
+
+void Profiler::nameThread(const char *name) {
+  threadBuffer()->name.store(name, std::memory_order_release);
+}
+
+bool Profiler::exportChromeTrace(const std::filesystem::path &path) {
+  std::ofstream file(path);
+  if (!file.is_open()) {
+    return false;
+  }
+
+  // complete ("X") events with microsecond timestamps, one track per thread
+  file << std::fixed << std::setprecision(3);
+  file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  bool first = true;
+  for (ThreadBuffer *buffer = s_threadBuffers.load(std::memory_order_acquire);
+       buffer != nullptr; buffer = buffer->next) {
+    file << (first ? "" : ",\n")
+         << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+         << buffer->threadId << ",\"args\":{\"name\":\""
+         << buffer->name.load(std::memory_order_acquire) << "\"}}";
+    first = false;
+
+    // zones older than one ring length were overwritten
+    uint64_t written = buffer->written.load(std::memory_order_acquire);
+    uint64_t oldest = written > RingCapacity ? written - RingCapacity : 0;
+    for (uint64_t i = oldest; i < written; i++) {
+      // a slot the thread is rewriting meanwhile is dropped, not torn
+      const ZoneSlot &slot = buffer->slots[i % RingCapacity];
+      uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+      Zone zone = {slot.name.load(std::memory_order_relaxed),
+                   slot.begin.load(std::memory_order_relaxed),
+                   slot.end.load(std::memory_order_relaxed)};
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (sequence != 2 * i + 2 ||
+          slot.sequence.load(std::memory_order_relaxed) != sequence) {
+        continue;
+      }
+      file << ",\n{\"name\":\"" << zone.name
+           << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->threadId
+           << ",\"ts\":" << zone.begin / 1000.0
+           << ",\"dur\":" << (zone.end - zone.begin) / 1000.0 << "}";
+    }
+  }
+  file << "\n]}\n";
+  return file.good();
+}
+
+void Profiler::exportAtExit(const std::filesystem::path &path) {
+  bool registered = !s_exitPath.empty();
+  s_exitPath = path;
+  if (!registered) {
+    std::atexit(exportAtExitHandler);
+  }
+}
+
+#endif // CLOTH_PROFILING
@@ -0,0 +1,66 @@
+#pragma once
+
+// Lightweight frame phase instrumentation. PROFILE_ZONE("name") records the
+// time spent in the enclosing scope into a lock-free ring buffer owned by the
+// calling thread, and the recorded zones can be exported as a Chrome trace
+// (chrome://tracing or https://ui.perfetto.dev).
+//
+// Everything compiles out unless CLOTH_PROFILING is defined, which the build
+// only does outside of Release configurations.
+
+#ifdef CLOTH_PROFILING
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+
+class Profiler {
+public:
+  // A single completed zone, times are in nanoseconds since startup
+  struct Zone {
+    const char *name;
+    uint64_t begin;
+    uint64_t end;
+  };
+
+  // Records the lifetime of the scope it is declared in
+  class ScopedZone {
+  public:
+    explicit ScopedZone(const char *name) : m_name(name), m_begin(now()) {}
+    ~ScopedZone() { record(m_name, m_begin, now()); }
+
+  private:
+    const char *m_name;
+    uint64_t m_begin;
+  };
+
+  // Number of zones each thread keeps before overwriting the oldest ones
+  static constexpr uint32_t RingCapacity = 1 << 16;
+
+  static uint64_t now();
+  static void record(const char *name, uint64_t begin, uint64_t end);
+  // Names the track of the calling thread in the trace, "worker" otherwise
+  static void nameThread(const char *name);
+
+  // Write all zones currently held by every thread as Chrome trace JSON
+  static bool exportChromeTrace(const std::filesystem::path &path);
+  // Export once more when the process exits
+  static void exportAtExit(const std::filesystem::path &path);
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_ZONE(name)                                                     \
+  Profiler::ScopedZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#define PROFILE_THREAD_NAME(name) Profiler::nameThread(name)
+#define PROFILE_EXPORT(path) Profiler::exportChromeTrace(path)
+#define PROFILE_EXPORT_AT_EXIT(path) Profiler::exportAtExit(path)
+
+#else // CLOTH_PROFILING
+
+#define PROFILE_ZONE(name) ((void)0)
+#define PROFILE_THREAD_NAME(name) ((void)0)
+#define PROFILE_EXPORT(path) false
+#define PROFILE_EXPORT_AT_EXIT(path) ((void)0)
+
+#endif // CLOTH_PROFILING
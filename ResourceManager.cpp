@@ -25,6 +25,7 @@
  */
 
 #include "ResourceManager.h"
+#include "GpuTracker.h"
 
 #include "stb_image.h"
 #include "tiny_obj_loader.h"
@@ -34,16 +35,33 @@
 
 using namespace wgpu;
 
-ShaderModule ResourceManager::loadShaderModule(const path& path, Device device) {
+// Append the contents of a text file to a string
+static bool appendFile(const std::filesystem::path& path, std::string& text) {
 	std::ifstream file(path);
 	if (!file.is_open()) {
-		return nullptr;
+		return false;
 	}
 	file.seekg(0, std::ios::end);
 	size_t size = file.tellg();
-	std::string shaderSource(size, ' ');
+	size_t offset = text.size();
+	text.resize(offset + size);
 	file.seekg(0);
-	file.read(shaderSource.data(), size);
+	file.read(text.data() + offset, size);
+	text.resize(offset + file.gcount());
+	return true;
+}
+
+ShaderModule ResourceManager::loadShaderModule(const path& path, Device device) {
+	// every shader starts with the helpers they share (common.wgsl next to
+	// it), so the line numbers of compilation errors are shifted by its length
+	std::string shaderSource;
+	if (!appendFile(path.parent_path() / "common.wgsl", shaderSource)) {
+		return nullptr;
+	}
+	shaderSource += '\n';
+	if (!appendFile(path, shaderSource)) {
+		return nullptr;
+	}
 
 	ShaderModuleWGSLDescriptor shaderCodeDesc;
 	shaderCodeDesc.chain.next = nullptr;
@@ -56,7 +74,7 @@ ShaderModule ResourceManager::loadShaderModule(const path& path, Device device)
 	shaderDesc.hints = nullptr;
 #endif
 
-	return device.createShaderModule(shaderDesc);
+	return GpuTracker::createShaderModule(device, shaderDesc);
 }
 
 bool ResourceManager::loadGeometryFromObj(const path& path, std::vector<VertexAttributes>& vertexData) {
@@ -210,7 +228,7 @@ Texture ResourceManager::loadTexture(const path& path, Device device, TextureVie
 	textureDesc.usage = TextureUsage::TextureBinding | TextureUsage::CopyDst;
 	textureDesc.viewFormatCount = 0;
 	textureDesc.viewFormats = nullptr;
-	Texture texture = device.createTexture(textureDesc);
+	Texture texture = GpuTracker::createTexture(device, textureDesc);
 
 	// Upload data to the GPU texture
 	writeMipMaps(device, texture, textureDesc.size, textureDesc.mipLevelCount, pixelData);
@@ -58,7 +58,8 @@ public:
     vec2 uv;
   };
 
-  // Load a shader from a WGSL file into a new shader module
+  // Load a shader from a WGSL file into a new shader module, after the
+  // shared helpers of common.wgsl in the same directory
   static wgpu::ShaderModule loadShaderModule(const path &path,
                                              wgpu::Device device);
 
@@ -67,7 +68,7 @@ public:
                                   std::vector<VertexAttributes> &vertexData);
 
   // Load an image from a standard image file into a new texture object
-  // NB: The texture must be destroyed after use
+  // NB: The texture must be released with GpuTracker::release after use
   static wgpu::Texture loadTexture(const path &path, wgpu::Device device,
                                    wgpu::TextureView *pTextureView = nullptr);
 
@@ -0,0 +1,208 @@
+#include "SimulationThread.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <chrono>
+
+void SimulationThread::capture(const ClothObject &cloth, int lodLevel,
+                               View &view) {
+  const ClothParameters &p = cloth.parameters;
+  view.parameters = p;
+  view.frame = cloth.frame;
+  view.simTime = cloth.simTime;
+  view.stateHash = cloth.lastStateHash;
+  view.numParticles = cloth.numParticles;
+  view.numVertices = cloth.numVertices;
+  view.simulatedParticles = cloth.simulatedParticles();
+  view.topologyBandwidth = p.topology == ClothObject::Topology::Mesh
+                               ? cloth.m_topology.bandwidth()
+                               : 0;
+  view.stats = cloth.m_stats.latest();
+  view.statsFrame = cloth.m_stats.latestFrame();
+  view.rollbacks = cloth.m_watchdog.rollbacks();
+  view.lastDivergedFrame = cloth.m_watchdog.lastDivergedFrame();
+  cloth.renderBounds(view.center, view.radius);
+  view.lodLevel = lodLevel;
+
+  view.vertexBuffer = cloth.m_vertexBuffer;
+  view.indexBuffer = cloth.m_indexBuffer;
+  view.indexBufferBytes = cloth.indexBufferBytes();
+  view.renderBindGroup = cloth.renderBindGroup();
+  view.lodFirstIndex = cloth.m_lodFirstIndex;
+  view.lodIndexCount = cloth.m_lodIndexCount;
+  view.tiles.clear();
+  for (const ClothTiles::Tile &tile : cloth.m_tiles.tiles()) {
+    view.tiles.push_back(
+        {tile.vertexBuffer, tile.vertexBytes, tile.vertexCount});
+  }
+  view.tileRows = cloth.m_tileRows;
+}
+
+void SimulationThread::start(const ClothParameters &p, int stepsPerSecond) {
+  stop();
+  setStepsPerSecond(stepsPerSecond);
+  m_gpuCloth = nullptr;
+  m_device = nullptr;
+  m_cloth.initiateNewCloth(p);
+  m_frames.back().stepMs = 0.0f;
+  publish();
+  m_stop.store(false);
+  m_thread = std::thread(&SimulationThread::run, this);
+}
+
+void SimulationThread::startGpu(ClothObject &cloth, wgpu::Device device,
+                                int stepsPerSecond) {
+  stop();
+  setStepsPerSecond(stepsPerSecond);
+  m_gpuCloth = &cloth;
+  m_device = device;
+  m_revision = m_pushedRevision;
+  m_frames.back().stepMs = 0.0f;
+  publish();
+  m_stop.store(false);
+  m_thread = std::thread(&SimulationThread::run, this);
+}
+
+void SimulationThread::stop() {
+  if (!m_thread.joinable()) {
+    return;
+  }
+  m_stop.store(true);
+  m_thread.join();
+  // changes the thread never got to belong to this run
+  Message dropped;
+  while (m_parameters.pop(dropped)) {
+  }
+  m_drawing.store(false);
+  m_replacing.store(false);
+}
+
+bool SimulationThread::pushParameters(const ClothParameters &p) {
+  if (!m_parameters.push({p, m_pushedRevision + 1})) {
+    return false;
+  }
+  m_pushedRevision++;
+  return true;
+}
+
+void SimulationThread::setStepsPerSecond(int stepsPerSecond) {
+  m_stepsPerSecond.store(std::max(stepsPerSecond, 1));
+}
+
+bool SimulationThread::beginDraw() {
+  // both sides store their flag before they load the other one (sequentially
+  // consistent), so either the renderer sees the replacement or the thread
+  // waits for the draw
+  m_drawing.store(true);
+  if (m_replacing.load()) {
+    m_drawing.store(false);
+    return false;
+  }
+  // a replacement published its view before it let the renderer in
+  update();
+  return true;
+}
+
+void SimulationThread::run() {
+  PROFILE_THREAD_NAME("simulation");
+  using Clock = std::chrono::steady_clock;
+  Clock::time_point next = Clock::now();
+  while (!m_stop.load()) {
+    // only the newest parameters matter, the cloth is reconfigured once
+    Message message;
+    bool changed = false;
+    while (m_parameters.pop(message)) {
+      changed = true;
+    }
+    if (changed) {
+      reconfigure(message);
+    }
+
+    Clock::time_point begin = Clock::now();
+    {
+      PROFILE_ZONE("simulation step");
+      step();
+    }
+    m_frames.back().stepMs =
+        std::chrono::duration<float, std::milli>(Clock::now() - begin)
+            .count();
+    publish();
+
+    // fixed rate, a step that ran late does not make the next ones hurry
+    next += std::chrono::nanoseconds(1000000000 / m_stepsPerSecond.load());
+    Clock::time_point now = Clock::now();
+    if (next < now) {
+      next = now;
+    }
+    std::this_thread::sleep_until(next);
+  }
+}
+
+void SimulationThread::reconfigure(const Message &message) {
+  m_revision = message.revision;
+  ClothParameters p = message.parameters;
+  if (!m_gpuCloth) {
+    m_cloth.reconfigure(p);
+    return;
+  }
+
+  // new buffers wait for the renderer to leave the old ones, and their view
+  // is out before it may draw again
+  ClothObject::ReconfigureTier tier =
+      ClothObject::reconfigureTier(m_gpuCloth->parameters, p);
+  bool replace = tier == ClothObject::ReconfigureTier::Resize ||
+                 tier == ClothObject::ReconfigureTier::Rebuild;
+  if (replace) {
+    m_replacing.store(true);
+    while (m_drawing.load()) {
+      std::this_thread::yield();
+    }
+  }
+  m_gpuCloth->reconfigure(p, m_device);
+  if (replace) {
+    m_frames.back().stepMs = 0.0f;
+    publish();
+    m_replacing.store(false);
+  }
+}
+
+void SimulationThread::step() {
+  if (!m_gpuCloth) {
+    m_cloth.processFrame();
+    return;
+  }
+  // one step in flight, a GPU that cannot keep up slows the thread down
+  // instead of filling the queue
+  m_gpuCloth->updateSimulationLod(m_projectedRadius.load());
+  m_gpuCloth->processFrame(m_device);
+  ClothObject::waitIdle(m_device);
+}
+
+void SimulationThread::publish() {
+  Frame &frame = m_frames.back();
+  if (m_gpuCloth) {
+    const ClothObject &cloth = *m_gpuCloth;
+    int lodLevel =
+        cloth.parameters.renderPath == ClothObject::RenderPath::VertexPulling
+            ? cloth.lodLevel(m_projectedRadius.load())
+            : 0;
+    capture(cloth, lodLevel, frame.view);
+    frame.view.revision = m_revision;
+    frame.frame = cloth.frame;
+    m_frames.publish();
+    return;
+  }
+
+  // packs the vertices the way store_vertex() in compute.wgsl would
+  ClothObject::VertexPrecision precision = m_cloth.parameters.vertexPrecision;
+  uint32_t words = ClothObject::vertexStride(precision) / sizeof(uint32_t);
+  frame.vertexWords.resize((size_t)m_cloth.numVertices * words);
+  for (int i = 0; i < m_cloth.numVertices; i++) {
+    ClothObject::packVertex(precision, m_cloth.vertices[i],
+                            frame.vertexWords.data() + (size_t)i * words);
+  }
+  frame.vertexCount = m_cloth.numVertices;
+  frame.vertexPrecision = precision;
+  frame.frame = m_cloth.frame;
+  m_frames.publish();
+}
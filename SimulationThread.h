@@ -0,0 +1,163 @@
+#pragma once
+
+#include "ClothCPU.h"
+#include "ClothObject.h"
+#include "SpscQueue.h"
+#include "TripleBuffer.h"
+
+#include <glm/glm.hpp>
+#include <webgpu/webgpu.hpp>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+// Runs the simulation on its own thread at a fixed rate, so a hitch of the
+// GUI thread no longer stalls the simulation and a slow step no longer stalls
+// the GUI. Either backend can run here:
+//
+// - the CPU backend (ClothCPU) packs the vertices of every step at the
+//   precision of the vertex buffer, and the renderer uploads the latest ones;
+// - the GPU backend (the renderer's ClothObject, handed over by startGpu())
+//   updates its uniforms, encodes and submits every step on this thread, and
+//   publishes a View of the cloth that the renderer draws from and the GUI
+//   shows.
+//
+// Steps are published through a lock-free triple buffer, parameter changes of
+// the GUI reach the thread through a lock-free SPSC queue and are applied
+// between two steps. A GPU parameter change that replaces the cloth's buffers
+// waits until the renderer is outside of beginDraw()/endDraw(), and a renderer
+// that finds one in progress skips the cloth for that frame instead of
+// waiting.
+//
+// The GPU backend takes a device and queue that two threads may use at once,
+// which wgpu-native provides. Not available on the web build, which has no
+// threads.
+class SimulationThread {
+public:
+  using ClothParameters = ClothObject::ClothParameters;
+  using vec3 = glm::vec3;
+
+  // what the renderer draws and the GUI shows of a GPU cloth - the handles
+  // stay valid until the thread replaces them (see beginDraw)
+  struct View {
+    // last parameter change applied (see pushParameters), and the
+    // parameters as the cloth applied them
+    uint64_t revision = 0;
+    ClothParameters parameters;
+
+    int frame = 0;
+    double simTime = 0.0;
+    uint64_t stateHash = 0;
+    int numParticles = 0;
+    int numVertices = 0;
+    int simulatedParticles = 0;
+    uint32_t topologyBandwidth = 0;
+    ClothStats::Stats stats;
+    int statsFrame = 0;
+    int rollbacks = 0;
+    int lastDivergedFrame = 0;
+
+    // bounding sphere, and level of detail for the projected radius the
+    // renderer last set
+    vec3 center = vec3(0.0f);
+    float radius = 0.0f;
+    int lodLevel = 0;
+
+    // what the draws bind, by render path
+    wgpu::Buffer vertexBuffer = nullptr;
+    wgpu::Buffer indexBuffer = nullptr;
+    uint64_t indexBufferBytes = 0;
+    wgpu::BindGroup renderBindGroup = nullptr;
+    std::array<uint32_t, ClothObject::LodLevels> lodFirstIndex = {};
+    std::array<uint32_t, ClothObject::LodLevels> lodIndexCount = {};
+    struct Tile {
+      wgpu::Buffer vertexBuffer = nullptr;
+      uint64_t vertexBytes = 0;
+      uint32_t vertexCount = 0;
+    };
+    std::vector<Tile> tiles;
+    int tileRows = 0;
+  };
+
+  // a completed step - vertices ready to upload for the CPU backend, the
+  // view of the cloth for the GPU backend
+  struct Frame {
+    std::vector<uint32_t> vertexWords;
+    int vertexCount = 0;
+    ClothObject::VertexPrecision vertexPrecision =
+        ClothObject::VertexPrecision::Full;
+    int frame = 0;
+    // time the step took on the simulation thread
+    float stepMs = 0.0f;
+    View view;
+  };
+
+  // parameter changes the queue holds before the GUI has to retry
+  static constexpr size_t QueueCapacity = 16;
+
+  ~SimulationThread() { stop(); }
+
+  // fills view from the cloth as it is, on the thread that steps it
+  static void capture(const ClothObject &cloth, int lodLevel, View &view);
+
+  // starts the CPU backend from p on the calling thread, then hands it over
+  void start(const ClothParameters &p, int stepsPerSecond);
+  // steps cloth, whose buffers and pipelines exist, on the thread - nothing
+  // else may touch it until stop()
+  void startGpu(ClothObject &cloth, wgpu::Device device, int stepsPerSecond);
+  // joins the thread, the cloth stays as it was
+  void stop();
+  bool running() const { return m_thread.joinable(); }
+  bool gpu() const { return running() && m_gpuCloth != nullptr; }
+
+  // queues new parameters, returns false if the queue is full - a GPU cloth
+  // reports the change as applied through View::revision
+  bool pushParameters(const ClothParameters &p);
+  uint64_t pushedRevision() const { return m_pushedRevision; }
+  void setStepsPerSecond(int stepsPerSecond);
+  // radius of the GPU cloth on screen in pixels, for its levels of detail
+  void setProjectedRadius(float radius) { m_projectedRadius.store(radius); }
+
+  // takes the latest published step, returns false if there was none since
+  // the last call - render thread only
+  bool update() { return m_frames.update(); }
+  const Frame &latest() const { return m_frames.front(); }
+
+  // bracket the renderer's use of the View handles of a GPU cloth, and take
+  // the latest step - beginDraw() returns false while the thread replaces
+  // them, endDraw() only follows a successful beginDraw()
+  bool beginDraw();
+  void endDraw() { m_drawing.store(false); }
+
+private:
+  struct Message {
+    ClothParameters parameters;
+    uint64_t revision = 0;
+  };
+
+  void run();
+  void reconfigure(const Message &message);
+  void step();
+  void publish();
+
+  ClothCPU m_cloth;
+  ClothObject *m_gpuCloth = nullptr;
+  wgpu::Device m_device = nullptr;
+  std::thread m_thread;
+  std::atomic<bool> m_stop{false};
+  std::atomic<int> m_stepsPerSecond{60};
+  std::atomic<float> m_projectedRadius{0.0f};
+
+  SpscQueue<Message, QueueCapacity> m_parameters;
+  uint64_t m_pushedRevision = 0;
+  uint64_t m_revision = 0;
+  TripleBuffer<Frame> m_frames;
+
+  // the renderer is between beginDraw() and endDraw(), the thread is
+  // replacing the buffers of the GPU cloth
+  std::atomic<bool> m_drawing{false};
+  std::atomic<bool> m_replacing{false};
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+// Bounded lock-free queue from one producer thread to one consumer thread.
+// Each side only writes its own index, and the release/acquire pair on it
+// hands the slot contents over. Holds Capacity - 1 values.
+template <typename T, size_t Capacity> class SpscQueue {
+  static_assert(Capacity >= 2, "one slot always stays empty");
+
+public:
+  // producer side, returns false if the queue is full
+  bool push(T value) {
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    size_t next = (tail + 1) % Capacity;
+    if (next == m_head.load(std::memory_order_acquire)) {
+      return false;
+    }
+    m_slots[tail] = std::move(value);
+    m_tail.store(next, std::memory_order_release);
+    return true;
+  }
+
+  // consumer side, returns false if the queue is empty
+  bool pop(T &value) {
+    size_t head = m_head.load(std::memory_order_relaxed);
+    if (head == m_tail.load(std::memory_order_acquire)) {
+      return false;
+    }
+    value = std::move(m_slots[head]);
+    m_head.store((head + 1) % Capacity, std::memory_order_release);
+    return true;
+  }
+
+private:
+  std::array<T, Capacity> m_slots;
+  // next slot to pop, written by the consumer only
+  alignas(64) std::atomic<size_t> m_head{0};
+  // next slot to push, written by the producer only
+  alignas(64) std::atomic<size_t> m_tail{0};
+};
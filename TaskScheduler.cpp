@@ -0,0 +1,231 @@
+#include "TaskScheduler.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace {
+// slot of the current thread, -1 outside the pool and outside parallelFor
+thread_local int t_slot = -1;
+// nesting of execute(), only the outermost one counts as busy time
+thread_local int t_depth = 0;
+
+int64_t nowNanoseconds() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+} // namespace
+
+TaskScheduler &TaskScheduler::instance() {
+#ifdef __EMSCRIPTEN__
+  static TaskScheduler scheduler(1);
+#else
+  static TaskScheduler scheduler(
+      std::max(1u, std::thread::hardware_concurrency()));
+#endif
+  return scheduler;
+}
+
+TaskScheduler::TaskScheduler(unsigned workerCount) {
+  for (unsigned i = 0; i < workerCount; i++) {
+    m_workers.push_back(std::make_unique<Worker>());
+  }
+  m_statsBegin = nowNanoseconds();
+  // slot 0 belongs to the callers
+  for (unsigned i = 1; i < workerCount; i++) {
+    m_threads.emplace_back(&TaskScheduler::workerLoop, this, (int)i);
+  }
+}
+
+TaskScheduler::~TaskScheduler() {
+  {
+    std::lock_guard<std::mutex> lock(m_sleepLock);
+    m_stop = true;
+    m_generation++;
+  }
+  m_sleep.notify_all();
+  for (std::thread &thread : m_threads) {
+    thread.join();
+  }
+}
+
+void TaskScheduler::run(int count, int grain, RangeFunction function,
+                        void *context) {
+  if (count <= 0) {
+    return;
+  }
+  grain = std::max(grain, 1);
+  if (m_workers.size() <= 1 || count <= grain) {
+    function(context, 0, count);
+    return;
+  }
+
+  // a nested call runs in the slot of its thread
+  std::unique_lock<std::mutex> external;
+  int self = t_slot;
+  if (self < 0) {
+    external = std::unique_lock<std::mutex>(m_externalLock);
+    self = 0;
+    t_slot = 0;
+  }
+
+  Job job;
+  job.function = function;
+  job.context = context;
+  job.grain = grain;
+  job.remaining.store(count);
+  execute(self, Task{&job, 0, count});
+  // help with whatever is left, this job's or another one's
+  while (job.remaining.load(std::memory_order_acquire) > 0) {
+    Task task;
+    if (pop(self, task) || steal(self, task)) {
+      execute(self, task);
+    } else {
+      std::this_thread::yield();
+    }
+  }
+
+  if (external.owns_lock()) {
+    t_slot = -1;
+  }
+}
+
+void TaskScheduler::execute(int self, Task task) {
+  int64_t begin = t_depth == 0 ? nowNanoseconds() : 0;
+  t_depth++;
+  // the upper halves go to the deque for thieves, a full deque keeps the rest
+  while (task.end - task.begin > task.job->grain) {
+    int middle = task.begin + (task.end - task.begin) / 2;
+    if (!push(self, Task{task.job, middle, task.end})) {
+      break;
+    }
+    task.end = middle;
+  }
+  task.job->function(task.job->context, task.begin, task.end);
+  t_depth--;
+
+  Worker &worker = *m_workers[self];
+  worker.taskCount.fetch_add(1, std::memory_order_relaxed);
+  if (t_depth == 0) {
+    worker.busyNanoseconds.fetch_add(nowNanoseconds() - begin,
+                                     std::memory_order_relaxed);
+  }
+  // the job may be gone as soon as its last items are counted
+  task.job->remaining.fetch_sub(task.end - task.begin,
+                                std::memory_order_acq_rel);
+}
+
+bool TaskScheduler::push(int self, const Task &task) {
+  Worker &worker = *m_workers[self];
+  {
+    std::lock_guard<std::mutex> lock(worker.lock);
+    if (worker.bottom - worker.top == DequeCapacity) {
+      return false;
+    }
+    worker.tasks[worker.bottom % DequeCapacity] = task;
+    worker.bottom++;
+  }
+  wake();
+  return true;
+}
+
+bool TaskScheduler::pop(int self, Task &task) {
+  Worker &worker = *m_workers[self];
+  std::lock_guard<std::mutex> lock(worker.lock);
+  if (worker.bottom == worker.top) {
+    return false;
+  }
+  worker.bottom--;
+  task = worker.tasks[worker.bottom % DequeCapacity];
+  if (worker.bottom == worker.top) {
+    worker.bottom = worker.top = 0;
+  }
+  return true;
+}
+
+bool TaskScheduler::steal(int self, Task &task) {
+  int count = (int)m_workers.size();
+  for (int i = 1; i < count; i++) {
+    Worker &victim = *m_workers[(self + i) % count];
+    std::lock_guard<std::mutex> lock(victim.lock);
+    if (victim.bottom == victim.top) {
+      continue;
+    }
+    task = victim.tasks[victim.top % DequeCapacity];
+    victim.top++;
+    if (victim.bottom == victim.top) {
+      victim.bottom = victim.top = 0;
+    }
+    m_workers[self]->stealCount.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+  return false;
+}
+
+void TaskScheduler::wake() {
+  // a thread counts itself as sleeping before it looks at the deques one last
+  // time, so either it sees the new task or the task's push sees it
+  if (m_sleeping.load() == 0) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(m_sleepLock);
+    m_generation++;
+  }
+  m_sleep.notify_all();
+}
+
+void TaskScheduler::workerLoop(int self) {
+  t_slot = self;
+  while (true) {
+    Task task;
+    if (pop(self, task) || steal(self, task)) {
+      execute(self, task);
+      continue;
+    }
+    // parallel loops tend to come in bursts, look again before sleeping
+    bool found = false;
+    for (int spin = 0; spin < 64 && !found; spin++) {
+      std::this_thread::yield();
+      found = steal(self, task);
+    }
+    if (found) {
+      execute(self, task);
+      continue;
+    }
+
+    uint64_t seen;
+    {
+      std::lock_guard<std::mutex> lock(m_sleepLock);
+      if (m_stop) {
+        return;
+      }
+      seen = m_generation;
+    }
+    m_sleeping.fetch_add(1);
+    found = steal(self, task);
+    if (!found) {
+      std::unique_lock<std::mutex> lock(m_sleepLock);
+      m_sleep.wait(lock, [&] { return m_stop || m_generation != seen; });
+    }
+    m_sleeping.fetch_sub(1);
+    if (found) {
+      execute(self, task);
+    }
+  }
+}
+
+std::vector<TaskScheduler::WorkerStats> TaskScheduler::takeStats() {
+  int64_t now = nowNanoseconds();
+  double elapsed = (double)(now - m_statsBegin) * 1e-9;
+  m_statsBegin = now;
+  std::vector<WorkerStats> stats(m_workers.size());
+  for (size_t i = 0; i < m_workers.size(); i++) {
+    Worker &worker = *m_workers[i];
+    stats[i].busySeconds = (double)worker.busyNanoseconds.exchange(0) * 1e-9;
+    stats[i].elapsedSeconds = elapsed;
+    stats[i].tasks = worker.taskCount.exchange(0);
+    stats[i].steals = worker.stealCount.exchange(0);
+  }
+  return stats;
+}
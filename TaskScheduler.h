@@ -0,0 +1,117 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing scheduler of range tasks on a persistent pool of threads.
+//
+// parallelFor() hands the whole range to the calling thread, which keeps
+// splitting it in halves down to the grain, pushing the upper halves onto its
+// own deque. Idle threads steal from the other end of a deque, where the
+// largest pieces sit, so a range of very uneven cost (or several cloths of
+// very different sizes, each with a nested parallelFor) still keeps every
+// thread busy. The calling thread works on its own range and steals while it
+// waits.
+//
+// Neither scheduling nor waiting allocates. A deque that is full runs the rest
+// of its range inline. Everything runs inline on the web build.
+class TaskScheduler {
+public:
+  // busy time of one thread since the last takeStats(), slot 0 is shared by
+  // the threads that call parallelFor from outside the pool
+  struct WorkerStats {
+    double busySeconds = 0.0;
+    double elapsedSeconds = 0.0;
+    uint64_t tasks = 0;
+    uint64_t steals = 0;
+
+    double utilization() const {
+      return elapsedSeconds > 0.0 ? busySeconds / elapsedSeconds : 0.0;
+    }
+  };
+
+  using RangeFunction = void (*)(void *context, int begin, int end);
+
+  // the pool of hardware_concurrency() - 1 threads, started on first use
+  static TaskScheduler &instance();
+
+  // calls body(begin, end) over disjoint ranges of at most grain items
+  // covering [0, count), returns once all of them are done
+  template <typename Body>
+  static void parallelFor(int count, int grain, const Body &body) {
+    instance().run(count, grain, &callBody<Body>, (void *)&body);
+  }
+  void run(int count, int grain, RangeFunction function, void *context);
+
+  // threads ranges are spread over, including the calling one
+  unsigned workerCount() const { return (unsigned)m_workers.size(); }
+  std::vector<WorkerStats> takeStats();
+
+  ~TaskScheduler();
+
+private:
+  struct Job {
+    RangeFunction function;
+    void *context;
+    int grain;
+    // items not done yet
+    std::atomic<int> remaining;
+  };
+
+  struct Task {
+    Job *job;
+    int begin;
+    int end;
+  };
+
+  // tasks a deque holds, enough for a split depth of 32 per nesting level
+  static constexpr int DequeCapacity = 256;
+
+  struct Worker {
+    // the owner pushes and pops at the bottom, thieves take the top
+    std::mutex lock;
+    std::array<Task, DequeCapacity> tasks;
+    int top = 0;
+    int bottom = 0;
+
+    std::atomic<uint64_t> busyNanoseconds{0};
+    std::atomic<uint64_t> taskCount{0};
+    std::atomic<uint64_t> stealCount{0};
+  };
+
+  template <typename Body>
+  static void callBody(void *context, int begin, int end) {
+    (*(const Body *)context)(begin, end);
+  }
+
+  explicit TaskScheduler(unsigned workerCount);
+  void workerLoop(int self);
+
+  bool push(int self, const Task &task);
+  bool pop(int self, Task &task);
+  bool steal(int self, Task &task);
+  // splits the task down to the grain and runs what is left of it
+  void execute(int self, Task task);
+  void wake();
+
+  std::vector<std::unique_ptr<Worker>> m_workers;
+  std::vector<std::thread> m_threads;
+
+  // idle threads sleep until the generation changes
+  std::mutex m_sleepLock;
+  std::condition_variable m_sleep;
+  uint64_t m_generation = 0;
+  bool m_stop = false;
+  // threads about to sleep or asleep, pushes only wake them if there are any
+  std::atomic<int> m_sleeping{0};
+
+  // callers from outside the pool share slot 0, one at a time
+  std::mutex m_externalLock;
+  int64_t m_statsBegin = 0;
+};
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Lock-free handoff of the latest value from one writer thread to one reader
+// thread. The writer fills back() and publishes it, the reader calls update()
+// and then reads front(). Three slots mean neither side ever waits: the
+// writer always owns one, the reader owns another, and the third holds the
+// latest published value. A value the reader never picked up is overwritten.
+template <typename T> class TripleBuffer {
+public:
+  // writer side - the slot to fill, then hands it over
+  T &back() { return m_slots[m_back]; }
+  void publish() {
+    uint8_t previous =
+        m_middle.exchange(m_back | Fresh, std::memory_order_acq_rel);
+    m_back = previous & Index;
+  }
+
+  // reader side - takes the latest published value, returns false if there
+  // was none since the last call
+  bool update() {
+    if (!(m_middle.load(std::memory_order_relaxed) & Fresh)) {
+      return false;
+    }
+    uint8_t previous = m_middle.exchange(m_front, std::memory_order_acq_rel);
+    m_front = previous & Index;
+    return true;
+  }
+  const T &front() const { return m_slots[m_front]; }
+
+private:
+  static constexpr uint8_t Index = 0x3;
+  static constexpr uint8_t Fresh = 0x4;
+
+  std::array<T, 3> m_slots;
+  uint8_t m_back = 0;
+  uint8_t m_front = 1;
+  // index of the middle slot, with Fresh set while the reader has not seen it
+  std::atomic<uint8_t> m_middle{2};
+};
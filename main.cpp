@@ -25,8 +25,30 @@
  */
 
 #include "Application.h"
+#include "GoldenRegression.h"
+#include "Profiler.h"
+
+#include <string>
+
+int main(int argc, char **argv) {
+  // the GLFW thread records the frame phases, other tracks are workers
+  PROFILE_THREAD_NAME("main");
+#ifndef __EMSCRIPTEN__
+  // headless golden-state regression runs skip the window entirely
+  GoldenRegression::Options regression;
+  if (GoldenRegression::parseArguments(argc, argv, regression))
+    return GoldenRegression::run(regression);
+
+  // `--trace file` writes the frame phase timeline when the app exits
+  for (int i = 1; i + 1 < argc; i++) {
+    if (std::string(argv[i]) == "--trace")
+      PROFILE_EXPORT_AT_EXIT(argv[i + 1]);
+  }
+#else
+  (void)argc;
+  (void)argv;
+#endif
 
-int main(int, char **) {
   Application app;
   if (!app.onInit())
     return 1;
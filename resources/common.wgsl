@@ -0,0 +1,71 @@
+// helpers shared by the compute shaders - ResourceManager::loadShaderModule
+// puts this file in front of every shader it loads
+
+// particle precisions - must match ClothObject::ParticlePrecision
+const PRECISION_HALF_VELOCITY : u32 = 1u;
+
+// the particle buffers hold raw words - a padded Particle (8 words), or the
+// f32 position followed by the velocity as three f16 (5 words)
+fn particle_words(precision : u32) -> u32 {
+  if (precision == PRECISION_HALF_VELOCITY) {
+    return 5u;
+  }
+  return 8u;
+}
+
+// particle storage orders - must match GridLayout (GridLayout.h)
+const ORDER_MORTON_TILES : u32 = 1u;
+const TILE_SIZE : u32 = 8u;
+
+// interleaves the 3 low bits of x and y (x in the even bits)
+fn morton_encode(x : u32, y : u32) -> u32 {
+  return (x & 1u) | ((y & 1u) << 1u) | ((x & 2u) << 1u) | ((y & 2u) << 2u) | ((x & 4u) << 2u) | ((y & 4u) << 3u);
+}
+
+fn morton_decode(code : u32) -> vec2<u32> {
+  return vec2<u32>((code & 1u) | ((code >> 1u) & 2u) | ((code >> 2u) & 4u),
+                   ((code >> 1u) & 1u) | ((code >> 2u) & 2u) | ((code >> 3u) & 4u));
+}
+
+// storage index of grid cell (x, y) - 8x8 tiles in Morton order, partial
+// tiles at the edges row by row (see GridLayout::index)
+fn grid_layout_index(x : u32, y : u32, width : u32, height : u32, order : u32) -> u32 {
+  if (order != ORDER_MORTON_TILES) {
+    return y * width + x;
+  }
+  let tx = x / TILE_SIZE;
+  let ty = y / TILE_SIZE;
+  let tile_width = min(TILE_SIZE, width - tx * TILE_SIZE);
+  let tile_height = min(TILE_SIZE, height - ty * TILE_SIZE);
+  let lx = x - tx * TILE_SIZE;
+  let ly = y - ty * TILE_SIZE;
+  var in_tile = ly * tile_width + lx;
+  if (tile_width == TILE_SIZE && tile_height == TILE_SIZE) {
+    in_tile = morton_encode(lx, ly);
+  }
+  return ty * TILE_SIZE * width + tx * TILE_SIZE * tile_height + in_tile;
+}
+
+// grid cell of a storage index (see GridLayout::coords)
+fn grid_layout_coords(index : u32, width : u32, height : u32, order : u32) -> vec2<u32> {
+  if (order != ORDER_MORTON_TILES) {
+    return vec2<u32>(index % width, index / width);
+  }
+  let ty = index / (TILE_SIZE * width);
+  let rest = index - ty * TILE_SIZE * width;
+  let tile_height = min(TILE_SIZE, height - ty * TILE_SIZE);
+  let tx = rest / (TILE_SIZE * tile_height);
+  let in_tile = rest - tx * TILE_SIZE * tile_height;
+  let tile_width = min(TILE_SIZE, width - tx * TILE_SIZE);
+  var l = vec2<u32>(in_tile % tile_width, in_tile / tile_width);
+  if (tile_width == TILE_SIZE && tile_height == TILE_SIZE) {
+    l = morton_decode(in_tile);
+  }
+  return vec2<u32>(tx * TILE_SIZE + l.x, ty * TILE_SIZE + l.y);
+}
+
+// large cloths fold their workgroups into a second dispatch dimension (see
+// ClothObject::dispatchLinear)
+fn linear_index(global_invocation_id : vec3<u32>, num_workgroups : vec3<u32>) -> u32 {
+  return global_invocation_id.x + global_invocation_id.y * num_workgroups.x * 64u;
+}
@@ -1,15 +1,3 @@
-// input particle structure
-struct Particle {
-  pos : vec3<f32>,
-  vel : vec3<f32>,
-};
-
-// output vertex structure
-struct Vertex {
-  pos : vec3<f32>,
-  norm : vec3<f32>,
-};
-
 // uniform cloth parameters
 struct SimParams {
   // particle specific parameters
@@ -38,37 +26,159 @@ struct SimParams {
   deltaT : f32,
   currentT : f32,
   wind_dir : vec3<f32>,
+
+  // fixed point step of the deterministic mode (0 disables snapping)
+  quantization : f32,
+
+  // storage order of the particle buffers
+  particleOrder : u32,
+
+  // ClothObject::ParticlePrecision and ClothObject::VertexPrecision
+  particlePrecision : u32,
+  vertexPrecision : u32,
+
+  // wind and sphere force multiplier of a simulation proxy (see ClothProxy.h)
+  forceScale : f32,
+
+  // the particle buffers hold grid rows [tileFirstRow, tileFirstRow + tileRows),
+  // rows [tileRowBegin, tileRowEnd) are stepped (see ClothTiles.h)
+  tileFirstRow : u32,
+  tileRowBegin : u32,
+  tileRowEnd : u32,
+  tileRows : u32,
 }
 
 // uniform buffer
 @group(0) @binding(0) var<uniform> params : SimParams;
-// input particle buffer (for first pass)
-@group(0) @binding(1) var<storage, read> particlesSrc : array<Particle>;
+// input particle buffer (for first pass), read through src_pos and src_vel
+@group(0) @binding(1) var<storage, read> particlesSrc : array<u32>;
 // output particle buffer (first and second pass)
-@group(0) @binding(2) var<storage, read_write> particlesDst : array<Particle>;
-// output vertex buffer (only second pass)
-@group(1) @binding(0) var<storage, read_write> vertexOut : array<Vertex>;
+@group(0) @binding(2) var<storage, read_write> particlesDst : array<u32>;
+// output vertex buffer (only second pass), written through store_vertex
+@group(1) @binding(0) var<storage, read_write> vertexOut : array<u32>;
+
+// vertex precisions - must match ClothObject::VertexPrecision (the particle
+// ones are in common.wgsl)
+const VERTEX_HALF : u32 = 1u;
+const VERTEX_OCT_NORMAL : u32 = 2u;
+
+fn src_pos(index : u32) -> vec3<f32> {
+  let base = index * particle_words(params.particlePrecision);
+  return vec3<f32>(bitcast<f32>(particlesSrc[base]), bitcast<f32>(particlesSrc[base + 1u]), bitcast<f32>(particlesSrc[base + 2u]));
+}
+
+fn src_vel(index : u32) -> vec3<f32> {
+  let base = index * particle_words(params.particlePrecision);
+  if (params.particlePrecision == PRECISION_HALF_VELOCITY) {
+    return vec3<f32>(unpack2x16float(particlesSrc[base + 3u]), unpack2x16float(particlesSrc[base + 4u]).x);
+  }
+  return vec3<f32>(bitcast<f32>(particlesSrc[base + 4u]), bitcast<f32>(particlesSrc[base + 5u]), bitcast<f32>(particlesSrc[base + 6u]));
+}
+
+fn dst_pos(index : u32) -> vec3<f32> {
+  let base = index * particle_words(params.particlePrecision);
+  return vec3<f32>(bitcast<f32>(particlesDst[base]), bitcast<f32>(particlesDst[base + 1u]), bitcast<f32>(particlesDst[base + 2u]));
+}
+
+// the error estimate of the step goes into the padding after the position
+// (the spare f16 after the velocity at half precision) for ClothStats
+fn store_particle(index : u32, pos : vec3<f32>, vel : vec3<f32>, error : f32) {
+  let base = index * particle_words(params.particlePrecision);
+  particlesDst[base] = bitcast<u32>(pos.x);
+  particlesDst[base + 1u] = bitcast<u32>(pos.y);
+  particlesDst[base + 2u] = bitcast<u32>(pos.z);
+  if (params.particlePrecision == PRECISION_HALF_VELOCITY) {
+    particlesDst[base + 3u] = pack2x16float(vel.xy);
+    particlesDst[base + 4u] = pack2x16float(vec2<f32>(vel.z, min(error, 65504.0f)));
+  } else {
+    particlesDst[base + 3u] = bitcast<u32>(error);
+    particlesDst[base + 4u] = bitcast<u32>(vel.x);
+    particlesDst[base + 5u] = bitcast<u32>(vel.y);
+    particlesDst[base + 6u] = bitcast<u32>(vel.z);
+    particlesDst[base + 7u] = 0u;
+  }
+}
+
+// the vertex buffer holds a padded Vertex (8 words), an f16 position and
+// normal (4 words) or an f16 position and an octahedral normal (3 words)
+fn vertex_words() -> u32 {
+  if (params.vertexPrecision == VERTEX_HALF) {
+    return 4u;
+  }
+  if (params.vertexPrecision == VERTEX_OCT_NORMAL) {
+    return 3u;
+  }
+  return 8u;
+}
+
+// maps a unit vector onto the [-1, 1] square, the lower hemisphere folded over
+// the diagonals (see oct_decode() in shader.wgsl)
+fn oct_encode(n : vec3<f32>) -> vec2<f32> {
+  let p = n.xy / (abs(n.x) + abs(n.y) + abs(n.z));
+  if (n.z >= 0.0f) {
+    return p;
+  }
+  return (1.0f - abs(p.yx)) * select(vec2<f32>(-1.0f), vec2<f32>(1.0f), p >= vec2<f32>(0.0f));
+}
+
+fn store_vertex(index : u32, pos : vec3<f32>, norm : vec3<f32>) {
+  let base = index * vertex_words();
+  if (params.vertexPrecision == VERTEX_HALF || params.vertexPrecision == VERTEX_OCT_NORMAL) {
+    vertexOut[base] = pack2x16float(pos.xy);
+    vertexOut[base + 1u] = pack2x16float(vec2<f32>(pos.z, 1.0f));
+    if (params.vertexPrecision == VERTEX_HALF) {
+      vertexOut[base + 2u] = pack2x16float(norm.xy);
+      vertexOut[base + 3u] = pack2x16float(vec2<f32>(norm.z, 0.0f));
+    } else {
+      vertexOut[base + 2u] = pack2x16snorm(oct_encode(norm));
+    }
+    return;
+  }
+  vertexOut[base] = bitcast<u32>(pos.x);
+  vertexOut[base + 1u] = bitcast<u32>(pos.y);
+  vertexOut[base + 2u] = bitcast<u32>(pos.z);
+  vertexOut[base + 3u] = 0u;
+  vertexOut[base + 4u] = bitcast<u32>(norm.x);
+  vertexOut[base + 5u] = bitcast<u32>(norm.y);
+  vertexOut[base + 6u] = bitcast<u32>(norm.z);
+  vertexOut[base + 7u] = 0u;
+}
+
+// storage index of the particle at grid position (x, y) - a tile stores its
+// rows from tileFirstRow on
+fn particle_index(x: i32, y: i32) -> u32{
+  return grid_layout_index(u32(x), u32(y) - params.tileFirstRow, u32(params.particleWidth), params.tileRows, params.particleOrder);
+}
+
+// grid position of the particle stored at index
+fn particle_coords(index: u32) -> vec2<i32>{
+  let coords = grid_layout_coords(index, u32(params.particleWidth), params.tileRows, params.particleOrder);
+  return vec2<i32>(coords + vec2<u32>(0u, params.tileFirstRow));
+}
 
 // this function calculates all the forces applied to a single particle in the cloth, based on gravity, wind, and springs connected to other particles
+// the neighbour sums are evaluated in a fixed order (near springs, then far springs, each row by row) so that
+// the CPU backend can reproduce the exact same sequence of operations
 fn forces(index: u32, current_pos: vec3<f32>)->vec3<f32>{
   let width :i32= i32(params.particleWidth);
+  let height :i32= i32(params.particleHeight);
   
   // get particle location
-  let x = i32(index) % width;
-  let y = i32(index) / width;
+  let coords = particle_coords(index);
+  let x = coords.x;
+  let y = coords.y;
 
-  var total_force = vec3<f32>();
   // rest dist determines when forces begin to be applied
   let rest_dist = params.particleDist * 0.95f;
 
   // spring constants
-  let k1 = 73.0f / params.particleScale;
-  let k2 = 12.5f / params.particleScale;
+  let k1 = params.closeSpringStrength / params.particleScale;
+  let k2 = params.farSpringStrength / params.particleScale;
 
-  // all 8 surrounding
-  for (var addx:i32 = -1; addx < 2; addx++){
-    for (var addy:i32 = -1; addy < 2; addy++){
-      // apply short spring forces
+  // short springs to all 8 surrounding particles
+  var near_force = vec3<f32>();
+  for (var addy:i32 = -1; addy < 2; addy++){
+    for (var addx:i32 = -1; addx < 2; addx++){
       var diag_dist = 1.0f;
       if(abs(addx) + abs(addy) == 2){
         diag_dist = 1.41421356237f; //sqrt(2)
@@ -77,46 +187,51 @@ fn forces(index: u32, current_pos: vec3<f32>)->vec3<f32>{
       // getting adjacent particles
       let indx:i32 = x + addx;
       let indy:i32 = y + addy;
-      var new_index: i32 = indx + indy * width;
 
       //check bounds
-      if(indx >= 0 && indx < width && indy >= 0 && indy < i32(params.particleHeight) && (addx != 0 || addy != 0)){
+      if(indx >= 0 && indx < width && indy >= 0 && indy < height && (addx != 0 || addy != 0)){
         // find spring force using spring equation
-        let diff = current_pos - particlesSrc[new_index].pos;
-        if(rest_dist * diag_dist < length(diff)){
-          let spring_force = normalize(diff) * (rest_dist * diag_dist - length(diff)) * k1; // spring equation 
-          total_force = total_force + spring_force;
+        let diff = current_pos - src_pos(particle_index(indx, indy));
+        let dist = length(diff);
+        if(rest_dist * diag_dist < dist){
+          near_force += (diff / dist) * (rest_dist * diag_dist - dist) * k1; // spring equation
         }
       }
+    }
+  }
 
-      // repeated spring equations to particles that are farther away
-      let farx = indx + addx;
-      let fary = indy + addy;
-      var long_new_index: i32 = farx + fary * width;
-
-      if(farx >= 0 && farx < width && fary >= 0 && fary < i32(params.particleHeight) && addx != 0 && addy != 0){
-        let diff = current_pos - particlesSrc[long_new_index].pos;
-        if(rest_dist * diag_dist * 2.0f > length(diff)){
-          let spring_force = normalize(diff) * (rest_dist * diag_dist * 2.0f - length(diff)) * k2; 
-          total_force = total_force + spring_force;
+  // repeated spring equations to the diagonal particles that are two steps away
+  var far_force = vec3<f32>();
+  for (var addy:i32 = -1; addy < 2; addy += 2){
+    for (var addx:i32 = -1; addx < 2; addx += 2){
+      let farx = x + 2 * addx;
+      let fary = y + 2 * addy;
+
+      if(farx >= 0 && farx < width && fary >= 0 && fary < height){
+        let diff = current_pos - src_pos(particle_index(farx, fary));
+        let dist = length(diff);
+        if(rest_dist * 1.41421356237f * 2.0f > dist){
+          far_force += (diff / dist) * (rest_dist * 1.41421356237f * 2.0f - dist) * k2;
         }
       }
     }
   }
 
+  var total_force = near_force + far_force;
+
   // apply force from the moving sphere by direction from center
   let sphere_pos = vec3(params.sphereX, params.sphereY, params.sphereZ);
   let sphere_dist = current_pos - sphere_pos;
   if(length(sphere_dist) < params.sphereRadius){
     let sphere_diff = params.sphereRadius - length(sphere_dist);
-    total_force += normalize(sphere_dist) * sphere_diff * sphere_diff * 200.0f;
+    total_force += normalize(sphere_dist) * sphere_diff * sphere_diff * 200.0f * params.forceScale;
   }
 
   // gravity
   total_force.y -= 9.8 * params.particleMass; 
 
   // wind calculation
-  total_force += params.wind_dir * 0.0005f * params.particleScale * params.wind_strength;
+  total_force += params.wind_dir * 0.0005f * params.particleScale * params.wind_strength * params.forceScale;
 
   // lock top row of particles 
   var multiplier = 1.0f;
@@ -127,37 +242,39 @@ fn forces(index: u32, current_pos: vec3<f32>)->vec3<f32>{
   return total_force * multiplier; 
 }
 
-// converts the position in one cloth square (1,2,3,4) to its relative index position
-fn triangle_pos_conversion(square_pos: u32) -> u32{
-  var diff = 0; //corner case
-  //get proper position index
+// converts the position in one cloth square (1,2,3,4) to its relative grid position
+fn triangle_pos_conversion(square_pos: u32) -> vec2<i32>{
+  var diff = vec2<i32>(0, 0); //corner case
+  //get proper position
   if(square_pos == 1u || square_pos == 3u){
-    diff = i32(params.particleWidth); //down one
+    diff = vec2<i32>(0, 1); //down one
   }
   else if(square_pos == 2u || square_pos == 5u){
-    diff = 1; // right one
+    diff = vec2<i32>(1, 0); // right one
   }
   else if(square_pos == 4u){
-    diff = i32(params.particleWidth) + 1; // down and right one
+    diff = vec2<i32>(1, 1); // down and right one
   }
   
-  return u32(diff);
+  return diff;
 }
 
 // first pass - use RK4 to integrate using force function defined above
 @compute
 @workgroup_size(64)
-fn main(@builtin(global_invocation_id) global_invocation_id: vec3<u32>) {
-  // get index of particle
-  let total = arrayLength(&particlesSrc);
-  let index = global_invocation_id.x;
-  if (index >= total) {
+fn main(@builtin(global_invocation_id) global_invocation_id: vec3<u32>, @builtin(num_workgroups) num_workgroups: vec3<u32>) {
+  // get index of particle - only the stepped rows of a tile, its halo rows
+  // are copied from the neighbouring tiles
+  let width = i32(params.particleWidth);
+  let linear = linear_index(global_invocation_id, num_workgroups);
+  if (linear >= (params.tileRowEnd - params.tileRowBegin) * u32(width)) {
     return;
   }
+  let index = (params.tileRowBegin - params.tileFirstRow) * u32(width) + linear;
 
   // retrieve particle information
-  var vPos : vec3<f32> = particlesSrc[index].pos;
-  var vVel : vec3<f32> = particlesSrc[index].vel;
+  var vPos : vec3<f32> = src_pos(index);
+  var vVel : vec3<f32> = src_vel(index);
 
   //RK4 integration
   let dt = params.deltaT;
@@ -172,14 +289,20 @@ fn main(@builtin(global_invocation_id) global_invocation_id: vec3<u32>) {
   let l3 = dt * forces(index, vPos + k2);
   
   // integration step
-  vPos = vPos + (k0 + 2.0f * k1 + 2.0f * k2 + k3) / 6.0f;
-  vVel = vVel + (l0 + 2.0f * l1 + 2.0f * l2 + l3) / 6.0f;
+  let stepPos = (k0 + 2.0f * k1 + 2.0f * k2 + k3) / 6.0f;
+  let stepVel = (l0 + 2.0f * l1 + 2.0f * l2 + l3) / 6.0f;
+  vPos = vPos + stepPos;
+  vVel = vVel + stepVel;
+
+  // embedded error estimate - distance to the midpoint (second order) step
+  // from the same stages, in particle distances
+  let error = max(length(stepPos - k1), length(stepVel - l1) * dt) / params.particleDist;
 
   // convert index to position
-  let width = i32(params.particleWidth);
   let height = i32(params.particleHeight);
-  let iy:i32 = i32(index) / width;
-  let ix:i32= i32(index) % width; 
+  let coords = particle_coords(index);
+  let iy:i32 = coords.y;
+  let ix:i32 = coords.x;
   
   // constraint loop 
   if(iy < height - 1){
@@ -189,8 +312,8 @@ fn main(@builtin(global_invocation_id) global_invocation_id: vec3<u32>) {
         let indx:i32 = ix + addx;
         let indy:i32 = iy + addy;
         if(indx >= 0 && indx < width && indy >= 0 && indy < height && (addx != 0 || addy != 0)){
-          let new_index : i32 = indx + indy * width;
-          let diff = vPos - particlesSrc[new_index].pos;
+          let new_index : u32 = particle_index(indx, indy);
+          let diff = vPos - src_pos(new_index);
           var diag_dist = 1.0f;
           if(abs(addx) + abs(addy) == 2){
             diag_dist = 1.41421356237f;
@@ -199,27 +322,34 @@ fn main(@builtin(global_invocation_id) global_invocation_id: vec3<u32>) {
 
           // if distance is too far or too low, position is fixed
           if(length(diff) < params.inSpringStretch * diag_dist){
-            vPos = particlesSrc[new_index].pos + normalize(diff) * diag_dist * params.inSpringStretch;
+            vPos = src_pos(new_index) + normalize(diff) * diag_dist * params.inSpringStretch;
           }
           else if(length(diff) > params.outSpringStretch * diag_dist){
-            vPos = particlesSrc[new_index].pos + normalize(diff) * diag_dist * params.outSpringStretch;
+            vPos = src_pos(new_index) + normalize(diff) * diag_dist * params.outSpringStretch;
           }
         }
       }
     }
   }
 
+  // deterministic mode - snap the state to a fixed point grid so that rounding
+  // differences below the grid step cannot accumulate from frame to frame
+  if(params.quantization > 0.0f){
+    vPos = round(vPos / params.quantization) * params.quantization;
+    vVel = round(vVel / params.quantization) * params.quantization;
+  }
+
   // write particle output
-  particlesDst[index] = Particle(vPos, vVel);
+  store_particle(index, vPos, vVel, error);
 }
 
 // second pass - convert particles into vertices and faces, indexed properly
 @compute
 @workgroup_size(64)
-fn particle_to_vertex(@builtin(global_invocation_id) global_invocation_id: vec3<u32>) {
+fn particle_to_vertex(@builtin(global_invocation_id) global_invocation_id: vec3<u32>, @builtin(num_workgroups) num_workgroups: vec3<u32>) {
   // get index of particle
-  let total = arrayLength(&vertexOut);
-  let index = global_invocation_id.x;
+  let total = arrayLength(&vertexOut) / vertex_words();
+  let index = linear_index(global_invocation_id, num_workgroups);
   if (index >= total) {
     return;
   }
@@ -227,27 +357,41 @@ fn particle_to_vertex(@builtin(global_invocation_id) global_invocation_id: vec3<
   // there are about 6 vertices in the buffer per particles - so we map each vertex
   // to their respective face
   let cell: u32 = index / 6u;
-  let row: u32 = cell / u32(i32(params.particleWidth - 1.0f));
-  var cellIdx: u32 = cell + row;
+  let cellsPerRow: u32 = u32(i32(params.particleWidth - 1.0f));
+  let cellPos = vec2<i32>(i32(cell % cellsPerRow), i32(cell / cellsPerRow + params.tileRowBegin));
 
   // retrieve position from particle
   // particle position is found by finding relative position in square, then triangle
   let square_pos: u32 = index % 6u;
-  let vIdx = cellIdx + triangle_pos_conversion(square_pos);
-  let vpos :vec3<f32> = particlesDst[vIdx].pos;
+  let vPos = cellPos + triangle_pos_conversion(square_pos);
+  let vpos :vec3<f32> = dst_pos(particle_index(vPos.x, vPos.y));
 
   // choose normal calculation method - normals_by_average is smooth, whil normals_by_face shows each face more visibly
-  //let norm = normals_by_face(square_pos, cellIdx, vpos);
-  let norm = normals_by_average(vIdx, vpos);
+  //let norm = normals_by_face(square_pos, cellPos, vpos);
+  let norm = normals_by_average(vPos, vpos);
 
   // switch dimensions
   let nv :vec3<f32> = vec3(vpos[2], vpos[0], vpos[1]);
   let nn : vec3<f32> = vec3(norm[2], norm[0], norm[1]);
-  vertexOut[index] = Vertex(nv / (0.3f * params.particleScale), nn);
+  store_vertex(index, nv / (0.3f * params.particleScale), nn);
+}
+
+// normals of the vertex pulling path - one octahedral normal per particle, in
+// simulation axes (shader.wgsl swaps them together with the position)
+@compute
+@workgroup_size(64)
+fn particle_normals(@builtin(global_invocation_id) global_invocation_id: vec3<u32>, @builtin(num_workgroups) num_workgroups: vec3<u32>) {
+  let index = linear_index(global_invocation_id, num_workgroups);
+  if (index >= arrayLength(&vertexOut)) {
+    return;
+  }
+
+  let norm = normals_by_average(particle_coords(index), dst_pos(index));
+  vertexOut[index] = pack2x16snorm(oct_encode(norm));
 }
 
 // method for generating normals by face - will produce the same normal for all 3 vertices of the same face
-fn normals_by_face(square_pos : u32, cellIdx : u32, vpos : vec3<f32>) -> vec3<f32>{
+fn normals_by_face(square_pos : u32, cellPos : vec2<i32>, vpos : vec3<f32>) -> vec3<f32>{
   // check for which side of the square we are on - direction is reversed if on other side
   var add_to_lr: u32 = 0u;
   if(square_pos > 2u){
@@ -258,23 +402,23 @@ fn normals_by_face(square_pos : u32, cellIdx : u32, vpos : vec3<f32>) -> vec3<f3
   let left: u32 = ((square_pos + 2u) % 3u) + add_to_lr;
   let right: u32 = ((square_pos + 1u) % 3u) + add_to_lr;
 
-  // backtracking to particle idx from triangle position 
-  let lcellIdx = cellIdx + triangle_pos_conversion(left);
-  let rcellIdx = cellIdx + triangle_pos_conversion(right);
+  // backtracking to particle position from triangle position 
+  let lcellPos = cellPos + triangle_pos_conversion(left);
+  let rcellPos = cellPos + triangle_pos_conversion(right);
   
-  let lvec :vec3<f32> = vpos - particlesDst[lcellIdx].pos;
-  let rvec :vec3<f32> = vpos - particlesDst[rcellIdx].pos;
+  let lvec :vec3<f32> = vpos - dst_pos(particle_index(lcellPos.x, lcellPos.y));
+  let rvec :vec3<f32> = vpos - dst_pos(particle_index(rcellPos.x, rcellPos.y));
   return normalize(cross(lvec, rvec));
 }
 
 // get normal by averaging normals of all adjacent faces
-fn normals_by_average(cellIdx: u32, vpos: vec3<f32>) -> vec3<f32>{  
+fn normals_by_average(cellPos: vec2<i32>, vpos: vec3<f32>) -> vec3<f32>{  
   // get particle location
   let width :i32= i32(params.particleWidth);
   let height :i32= i32(params.particleHeight);
 
-  let x :i32 = i32(cellIdx) % width;
-  let y :i32 = i32(cellIdx) / width;
+  let x :i32 = cellPos.x;
+  let y :i32 = cellPos.y;
 
   // get surrounding particle vectors to origin particle
   var up_particle = vec3<f32>();
@@ -283,16 +427,16 @@ fn normals_by_average(cellIdx: u32, vpos: vec3<f32>) -> vec3<f32>{
   var right_particle = vec3<f32>();
 
   if(y > 0){
-    up_particle = normalize(vpos - particlesDst[cellIdx - u32(width)].pos);
+    up_particle = normalize(vpos - dst_pos(particle_index(x, y - 1)));
   }
   if(y < height - 1){
-    down_particle = normalize(vpos - particlesDst[cellIdx + u32(width)].pos);
+    down_particle = normalize(vpos - dst_pos(particle_index(x, y + 1)));
   }
   if(x > 0){
-    left_particle = normalize(vpos - particlesDst[cellIdx - 1u].pos);
+    left_particle = normalize(vpos - dst_pos(particle_index(x - 1, y)));
   }
   if(x < width - 1){
-    right_particle = normalize(vpos - particlesDst[cellIdx + 1u].pos);
+    right_particle = normalize(vpos - dst_pos(particle_index(x + 1, y)));
   }
 
   // average normals from surrounding existing faces, weighted by the angle of the corresponding "face" 
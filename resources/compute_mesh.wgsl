@@ -0,0 +1,330 @@
+// simulation of an unstructured (triangle mesh) cloth - the same integration
+// as compute.wgsl, but the neighbours come from the CSR lists of ClothTopology
+// instead of the width x height grid
+
+// uniform cloth parameters (see compute.wgsl)
+struct SimParams {
+  particleWidth : f32,
+  particleHeight : f32,
+  particleDist : f32,
+  particleMass : f32,
+  particleScale : f32,
+
+  closeSpringStrength : f32,
+  farSpringStrength : f32,
+  outSpringStretch : f32,
+  inSpringStretch : f32,
+
+  wind_strength : f32,
+
+  sphereRadius : f32,
+  sphereX : f32,
+  sphereY : f32,
+  sphereZ : f32,
+
+  deltaT : f32,
+  currentT : f32,
+  wind_dir : vec3<f32>,
+
+  quantization : f32,
+
+  // unused, garments keep their own order
+  particleOrder : u32,
+  particlePrecision : u32,
+  vertexPrecision : u32,
+  forceScale : f32,
+
+  // unused, garments are never split into tiles
+  tileFirstRow : u32,
+  tileRowBegin : u32,
+  tileRowEnd : u32,
+  tileRows : u32,
+}
+
+@group(0) @binding(0) var<uniform> params : SimParams;
+// particle and vertex buffers as raw words (see compute.wgsl)
+@group(0) @binding(1) var<storage, read> particlesSrc : array<u32>;
+@group(0) @binding(2) var<storage, read_write> particlesDst : array<u32>;
+@group(1) @binding(0) var<storage, read_write> vertexOut : array<u32>;
+// packed topology - the first words are the offsets of the sections below
+@group(1) @binding(1) var<storage, read> topology : array<u32>;
+
+// particle and vertex storage, identical to compute.wgsl
+const VERTEX_HALF : u32 = 1u;
+const VERTEX_OCT_NORMAL : u32 = 2u;
+
+fn src_pos(index : u32) -> vec3<f32> {
+  let base = index * particle_words(params.particlePrecision);
+  return vec3<f32>(bitcast<f32>(particlesSrc[base]), bitcast<f32>(particlesSrc[base + 1u]), bitcast<f32>(particlesSrc[base + 2u]));
+}
+
+fn src_vel(index : u32) -> vec3<f32> {
+  let base = index * particle_words(params.particlePrecision);
+  if (params.particlePrecision == PRECISION_HALF_VELOCITY) {
+    return vec3<f32>(unpack2x16float(particlesSrc[base + 3u]), unpack2x16float(particlesSrc[base + 4u]).x);
+  }
+  return vec3<f32>(bitcast<f32>(particlesSrc[base + 4u]), bitcast<f32>(particlesSrc[base + 5u]), bitcast<f32>(particlesSrc[base + 6u]));
+}
+
+fn dst_pos(index : u32) -> vec3<f32> {
+  let base = index * particle_words(params.particlePrecision);
+  return vec3<f32>(bitcast<f32>(particlesDst[base]), bitcast<f32>(particlesDst[base + 1u]), bitcast<f32>(particlesDst[base + 2u]));
+}
+
+// error estimate in the padding, see compute.wgsl
+fn store_particle(index : u32, pos : vec3<f32>, vel : vec3<f32>, error : f32) {
+  let base = index * particle_words(params.particlePrecision);
+  particlesDst[base] = bitcast<u32>(pos.x);
+  particlesDst[base + 1u] = bitcast<u32>(pos.y);
+  particlesDst[base + 2u] = bitcast<u32>(pos.z);
+  if (params.particlePrecision == PRECISION_HALF_VELOCITY) {
+    particlesDst[base + 3u] = pack2x16float(vel.xy);
+    particlesDst[base + 4u] = pack2x16float(vec2<f32>(vel.z, min(error, 65504.0f)));
+  } else {
+    particlesDst[base + 3u] = bitcast<u32>(error);
+    particlesDst[base + 4u] = bitcast<u32>(vel.x);
+    particlesDst[base + 5u] = bitcast<u32>(vel.y);
+    particlesDst[base + 6u] = bitcast<u32>(vel.z);
+    particlesDst[base + 7u] = 0u;
+  }
+}
+
+fn vertex_words() -> u32 {
+  if (params.vertexPrecision == VERTEX_HALF) {
+    return 4u;
+  }
+  if (params.vertexPrecision == VERTEX_OCT_NORMAL) {
+    return 3u;
+  }
+  return 8u;
+}
+
+fn oct_encode(n : vec3<f32>) -> vec2<f32> {
+  let p = n.xy / (abs(n.x) + abs(n.y) + abs(n.z));
+  if (n.z >= 0.0f) {
+    return p;
+  }
+  return (1.0f - abs(p.yx)) * select(vec2<f32>(-1.0f), vec2<f32>(1.0f), p >= vec2<f32>(0.0f));
+}
+
+fn store_vertex(index : u32, pos : vec3<f32>, norm : vec3<f32>) {
+  let base = index * vertex_words();
+  if (params.vertexPrecision == VERTEX_HALF || params.vertexPrecision == VERTEX_OCT_NORMAL) {
+    vertexOut[base] = pack2x16float(pos.xy);
+    vertexOut[base + 1u] = pack2x16float(vec2<f32>(pos.z, 1.0f));
+    if (params.vertexPrecision == VERTEX_HALF) {
+      vertexOut[base + 2u] = pack2x16float(norm.xy);
+      vertexOut[base + 3u] = pack2x16float(vec2<f32>(norm.z, 0.0f));
+    } else {
+      vertexOut[base + 2u] = pack2x16snorm(oct_encode(norm));
+    }
+    return;
+  }
+  vertexOut[base] = bitcast<u32>(pos.x);
+  vertexOut[base + 1u] = bitcast<u32>(pos.y);
+  vertexOut[base + 2u] = bitcast<u32>(pos.z);
+  vertexOut[base + 3u] = 0u;
+  vertexOut[base + 4u] = bitcast<u32>(norm.x);
+  vertexOut[base + 5u] = bitcast<u32>(norm.y);
+  vertexOut[base + 6u] = bitcast<u32>(norm.z);
+  vertexOut[base + 7u] = 0u;
+}
+
+// sections - must match ClothTopology::Section
+const NEAR_OFFSETS : u32 = 0u;
+const NEAR_SPRINGS : u32 = 1u;
+const FAR_OFFSETS : u32 = 2u;
+const FAR_SPRINGS : u32 = 3u;
+const FACE_OFFSETS : u32 = 4u;
+const FACES : u32 = 5u;
+const TRIANGLES : u32 = 6u;
+const FLAGS : u32 = 7u;
+
+// particle flags - must match ClothTopology::Pinned
+const PINNED : u32 = 1u;
+
+// springs are (neighbor, rest length bits) word pairs
+fn spring_neighbor(section : u32, spring : u32) -> u32 {
+  return topology[topology[section] + 2u * spring];
+}
+
+fn spring_rest(section : u32, spring : u32) -> f32 {
+  return bitcast<f32>(topology[topology[section] + 2u * spring + 1u]) * params.particleScale;
+}
+
+fn is_pinned(index : u32) -> bool {
+  return (topology[topology[FLAGS] + index] & PINNED) != 0u;
+}
+
+// forces on one particle - the neighbour sums run in list order (increasing
+// index) so that the CPU backend can reproduce the same operations
+fn forces(index : u32, current_pos : vec3<f32>) -> vec3<f32> {
+  // spring constants
+  let k1 = params.closeSpringStrength / params.particleScale;
+  let k2 = params.farSpringStrength / params.particleScale;
+
+  // near springs along the mesh edges
+  var near_force = vec3<f32>();
+  let near_begin = topology[topology[NEAR_OFFSETS] + index];
+  let near_end = topology[topology[NEAR_OFFSETS] + index + 1u];
+  for (var s : u32 = near_begin; s < near_end; s++) {
+    let rest_dist = spring_rest(NEAR_SPRINGS, s) * 0.95f;
+    let diff = current_pos - src_pos(spring_neighbor(NEAR_SPRINGS, s));
+    let dist = length(diff);
+    if (rest_dist < dist) {
+      near_force += (diff / dist) * (rest_dist - dist) * k1;
+    }
+  }
+
+  // far springs across the edges, they only push apart like the far grid
+  // springs
+  var far_force = vec3<f32>();
+  let far_begin = topology[topology[FAR_OFFSETS] + index];
+  let far_end = topology[topology[FAR_OFFSETS] + index + 1u];
+  for (var s : u32 = far_begin; s < far_end; s++) {
+    let rest_dist = spring_rest(FAR_SPRINGS, s) * 0.95f;
+    let diff = current_pos - src_pos(spring_neighbor(FAR_SPRINGS, s));
+    let dist = length(diff);
+    if (rest_dist > dist) {
+      far_force += (diff / dist) * (rest_dist - dist) * k2;
+    }
+  }
+
+  var total_force = near_force + far_force;
+
+  // apply force from the moving sphere by direction from center
+  let sphere_pos = vec3(params.sphereX, params.sphereY, params.sphereZ);
+  let sphere_dist = current_pos - sphere_pos;
+  if (length(sphere_dist) < params.sphereRadius) {
+    let sphere_diff = params.sphereRadius - length(sphere_dist);
+    total_force += normalize(sphere_dist) * sphere_diff * sphere_diff * 200.0f * params.forceScale;
+  }
+
+  // gravity
+  total_force.y -= 9.8 * params.particleMass;
+
+  // wind calculation
+  total_force += params.wind_dir * 0.0005f * params.particleScale * params.wind_strength * params.forceScale;
+
+  // pinned particles hold the garment up
+  var multiplier = 1.0f;
+  if (is_pinned(index)) {
+    multiplier = 0.0f;
+  }
+
+  return total_force * multiplier;
+}
+
+// first pass - use RK4 to integrate using force function defined above
+@compute
+@workgroup_size(64)
+fn main(@builtin(global_invocation_id) global_invocation_id : vec3<u32>, @builtin(num_workgroups) num_workgroups : vec3<u32>) {
+  let total = arrayLength(&particlesSrc) / particle_words(params.particlePrecision);
+  let index = linear_index(global_invocation_id, num_workgroups);
+  if (index >= total) {
+    return;
+  }
+
+  var vPos : vec3<f32> = src_pos(index);
+  var vVel : vec3<f32> = src_vel(index);
+
+  //RK4 integration
+  let dt = params.deltaT;
+
+  let k0 = dt * vVel;
+  let l0 = dt * forces(index, vPos);
+  let k1 = dt * (vVel + l0 * 0.5f);
+  let l1 = dt * forces(index, vPos + k0 * 0.5f);
+  let k2 = dt * (vVel + l1 * 0.5f);
+  let l2 = dt * forces(index, vPos + k1 * 0.5f);
+  let k3 = dt * (vVel + l2);
+  let l3 = dt * forces(index, vPos + k2);
+
+  // integration step
+  let stepPos = (k0 + 2.0f * k1 + 2.0f * k2 + k3) / 6.0f;
+  let stepVel = (l0 + 2.0f * l1 + 2.0f * l2 + l3) / 6.0f;
+  vPos = vPos + stepPos;
+  vVel = vVel + stepVel;
+
+  // embedded error estimate, see compute.wgsl
+  let error = max(length(stepPos - k1), length(stepVel - l1) * dt) / params.particleDist;
+
+  // stretch constraints along the edges
+  if (!is_pinned(index)) {
+    let near_begin = topology[topology[NEAR_OFFSETS] + index];
+    let near_end = topology[topology[NEAR_OFFSETS] + index + 1u];
+    for (var s : u32 = near_begin; s < near_end; s++) {
+      let neighbor_pos = src_pos(spring_neighbor(NEAR_SPRINGS, s));
+      let rest_dist = spring_rest(NEAR_SPRINGS, s);
+      let diff = vPos - neighbor_pos;
+
+      // if distance is too far or too low, position is fixed
+      if (length(diff) < params.inSpringStretch * rest_dist) {
+        vPos = neighbor_pos + normalize(diff) * rest_dist * params.inSpringStretch;
+      }
+      else if (length(diff) > params.outSpringStretch * rest_dist) {
+        vPos = neighbor_pos + normalize(diff) * rest_dist * params.outSpringStretch;
+      }
+    }
+  }
+
+  // deterministic mode - snap the state to a fixed point grid
+  if (params.quantization > 0.0f) {
+    vPos = round(vPos / params.quantization) * params.quantization;
+    vVel = round(vVel / params.quantization) * params.quantization;
+  }
+
+  store_particle(index, vPos, vVel, error);
+}
+
+// face normal scaled by twice the triangle area
+fn face_normal(triangle : u32) -> vec3<f32> {
+  let base = topology[TRIANGLES] + 3u * triangle;
+  let a = dst_pos(topology[base]);
+  let b = dst_pos(topology[base + 1u]);
+  let c = dst_pos(topology[base + 2u]);
+  return cross(b - a, c - a);
+}
+
+// area weighted average of the faces around a particle
+fn particle_normal(vIdx : u32) -> vec3<f32> {
+  var total_norm = vec3<f32>();
+  let face_begin = topology[topology[FACE_OFFSETS] + vIdx];
+  let face_end = topology[topology[FACE_OFFSETS] + vIdx + 1u];
+  for (var f : u32 = face_begin; f < face_end; f++) {
+    total_norm += face_normal(topology[topology[FACES] + f]);
+  }
+  return normalize(total_norm);
+}
+
+// second pass - three vertices per triangle
+@compute
+@workgroup_size(64)
+fn particle_to_vertex(@builtin(global_invocation_id) global_invocation_id : vec3<u32>, @builtin(num_workgroups) num_workgroups : vec3<u32>) {
+  let total = arrayLength(&vertexOut) / vertex_words();
+  let index = linear_index(global_invocation_id, num_workgroups);
+  if (index >= total) {
+    return;
+  }
+
+  let vIdx = topology[topology[TRIANGLES] + index];
+  let vpos : vec3<f32> = dst_pos(vIdx);
+  let norm = particle_normal(vIdx);
+
+  // switch dimensions
+  let nv : vec3<f32> = vec3(vpos[2], vpos[0], vpos[1]);
+  let nn : vec3<f32> = vec3(norm[2], norm[0], norm[1]);
+  store_vertex(index, nv / (0.3f * params.particleScale), nn);
+}
+
+// one octahedral normal per particle for the vertex pulling path (see
+// compute.wgsl)
+@compute
+@workgroup_size(64)
+fn particle_normals(@builtin(global_invocation_id) global_invocation_id : vec3<u32>, @builtin(num_workgroups) num_workgroups : vec3<u32>) {
+  let index = linear_index(global_invocation_id, num_workgroups);
+  if (index >= arrayLength(&vertexOut)) {
+    return;
+  }
+  vertexOut[index] = pack2x16snorm(oct_encode(particle_normal(index)));
+}
@@ -0,0 +1,136 @@
+// bounds and frustum test of a cloth (see ClothCuller.h)
+struct CullParams {
+  clipFromWorld : mat4x4<f32>,
+
+  particleCount : u32,
+  particleWords : u32,
+  indexCount : u32,
+  firstIndex : u32,
+
+  vertexCount : u32,
+  particleScale : f32,
+}
+
+@group(0) @binding(0) var<uniform> params : CullParams;
+// latest particles as raw words, see store_particle() in compute.wgsl
+@group(0) @binding(1) var<storage, read> particles : array<u32>;
+// order keys of the box, min x y z then max x y z, then a flag raised by any
+// nan or infinite particle
+@group(0) @binding(2) var<storage, read_write> bounds : array<atomic<u32>, 8>;
+// drawIndexedIndirect arguments in words 0-4, drawIndirect in words 8-11
+@group(0) @binding(3) var<storage, read_write> drawArgs : array<u32, 16>;
+
+// unsigned keys that sort like the floats they encode
+fn order_key(value : f32) -> u32 {
+  let bits = bitcast<u32>(value);
+  if ((bits & 0x80000000u) != 0u) {
+    return ~bits;
+  }
+  return bits | 0x80000000u;
+}
+
+// no isNan in wgsl, and x != x may be folded away - test the exponent bits
+fn is_finite(v : vec3<f32>) -> bool {
+  let exponent = bitcast<vec3<u32>>(v) & vec3<u32>(0x7f800000u);
+  return all(exponent != vec3<u32>(0x7f800000u));
+}
+
+fn from_order_key(key : u32) -> f32 {
+  if ((key & 0x80000000u) != 0u) {
+    return bitcast<f32>(key & 0x7fffffffu);
+  }
+  return bitcast<f32>(~key);
+}
+
+var<workgroup> box_min : array<vec3<f32>, 64>;
+var<workgroup> box_max : array<vec3<f32>, 64>;
+
+// workgroup tree reduction, one atomic min and max per workgroup and axis
+@compute
+@workgroup_size(64)
+fn particle_bounds(@builtin(global_invocation_id) global_invocation_id : vec3<u32>, @builtin(local_invocation_index) local_index : u32, @builtin(num_workgroups) num_workgroups : vec3<u32>) {
+  let index = linear_index(global_invocation_id, num_workgroups);
+  var lo = vec3<f32>(3.4e38f);
+  var hi = vec3<f32>(-3.4e38f);
+  if (index < params.particleCount) {
+    let base = index * params.particleWords;
+    let pos = vec3<f32>(bitcast<f32>(particles[base]), bitcast<f32>(particles[base + 1u]), bitcast<f32>(particles[base + 2u]));
+    if (is_finite(pos)) {
+      // same axis switch and scale as the vertex shaders
+      lo = pos.zxy / (0.3f * params.particleScale);
+      hi = lo;
+    } else {
+      atomicStore(&bounds[6], 1u);
+    }
+  }
+  box_min[local_index] = lo;
+  box_max[local_index] = hi;
+  workgroupBarrier();
+
+  for (var stride : u32 = 32u; stride > 0u; stride = stride / 2u) {
+    if (local_index < stride) {
+      box_min[local_index] = min(box_min[local_index], box_min[local_index + stride]);
+      box_max[local_index] = max(box_max[local_index], box_max[local_index + stride]);
+    }
+    workgroupBarrier();
+  }
+
+  if (local_index == 0u) {
+    atomicMin(&bounds[0], order_key(box_min[0].x));
+    atomicMin(&bounds[1], order_key(box_min[0].y));
+    atomicMin(&bounds[2], order_key(box_min[0].z));
+    atomicMax(&bounds[3], order_key(box_max[0].x));
+    atomicMax(&bounds[4], order_key(box_max[0].y));
+    atomicMax(&bounds[5], order_key(box_max[0].z));
+  }
+}
+
+// the box is off screen when its 8 corners are all outside the same clip
+// plane - the instance count then drops to 0, and so it does for a diverged
+// cloth that should not reach the screen (see ClothWatchdog)
+@compute
+@workgroup_size(1)
+fn cull_draw() {
+  let lo = vec3<f32>(from_order_key(atomicLoad(&bounds[0])), from_order_key(atomicLoad(&bounds[1])), from_order_key(atomicLoad(&bounds[2])));
+  let hi = vec3<f32>(from_order_key(atomicLoad(&bounds[3])), from_order_key(atomicLoad(&bounds[4])), from_order_key(atomicLoad(&bounds[5])));
+
+  let diverged = atomicLoad(&bounds[6]) != 0u;
+
+  // empty box for the next frame
+  for (var i : u32 = 0u; i < 3u; i++) {
+    atomicStore(&bounds[i], 0xffffffffu);
+    atomicStore(&bounds[i + 3u], 0u);
+  }
+  atomicStore(&bounds[6], 0u);
+
+  var left = true;
+  var right = true;
+  var bottom = true;
+  var top = true;
+  var near = true;
+  var far = true;
+  for (var i : u32 = 0u; i < 8u; i++) {
+    let corner = select(lo, hi, vec3<bool>((i & 1u) != 0u, (i & 2u) != 0u, (i & 4u) != 0u));
+    let clip = params.clipFromWorld * vec4<f32>(corner, 1.0f);
+    left = left && clip.x < -clip.w;
+    right = right && clip.x > clip.w;
+    bottom = bottom && clip.y < -clip.w;
+    top = top && clip.y > clip.w;
+    // depth is zero to one (GLM_FORCE_DEPTH_ZERO_TO_ONE)
+    near = near && clip.z < 0.0f;
+    far = far && clip.z > clip.w;
+  }
+  let visible = !(left || right || bottom || top || near || far || diverged);
+  let instances = select(0u, 1u, visible);
+
+  drawArgs[0] = params.indexCount;
+  drawArgs[1] = instances;
+  drawArgs[2] = params.firstIndex;
+  drawArgs[3] = 0u;
+  drawArgs[4] = 0u;
+
+  drawArgs[8] = params.vertexCount;
+  drawArgs[9] = instances;
+  drawArgs[10] = 0u;
+  drawArgs[11] = 0u;
+}
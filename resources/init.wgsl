@@ -0,0 +1,155 @@
+// mesh vertex for the mesh generator, triangles are consecutive triplets
+struct MeshVertex {
+  pos : vec3<f32>,
+  u : f32,
+  v : f32,
+};
+
+// initial state parameters (see ClothInitializer::InitUniforms)
+struct InitParams {
+  width : u32,
+  height : u32,
+  generator : u32,
+  seed : u32,
+
+  // flat grid layout
+  particleDist : f32,
+  offsetX : f32,
+  offsetY : f32,
+  // height of the crumple folds relative to their width
+  amount : f32,
+
+  // sphere the draped generator lays the cloth over
+  collider : vec3<f32>,
+  colliderRadius : f32,
+
+  meshVertexCount : u32,
+  // storage order and precision of the particle buffer
+  particleOrder : u32,
+  particlePrecision : u32,
+}
+
+@group(0) @binding(0) var<uniform> params : InitParams;
+// particles as raw words, see store_particle() in compute.wgsl
+@group(0) @binding(1) var<storage, read_write> particlesOut : array<u32>;
+@group(0) @binding(2) var<storage, read> mesh : array<MeshVertex>;
+
+// generators - must match ClothObject::InitialState
+const GENERATOR_FLAT : u32 = 0u;
+const GENERATOR_DRAPED : u32 = 1u;
+const GENERATOR_CRUMPLED : u32 = 2u;
+const GENERATOR_MESH : u32 = 3u;
+
+// crumple folds are interpolated between random heights every CRUMPLE_CELL
+// particles
+const CRUMPLE_CELL : u32 = 8u;
+
+fn store_particle(index : u32, pos : vec3<f32>, vel : vec3<f32>) {
+  let base = index * particle_words(params.particlePrecision);
+  particlesOut[base] = bitcast<u32>(pos.x);
+  particlesOut[base + 1u] = bitcast<u32>(pos.y);
+  particlesOut[base + 2u] = bitcast<u32>(pos.z);
+  if (params.particlePrecision == PRECISION_HALF_VELOCITY) {
+    particlesOut[base + 3u] = pack2x16float(vel.xy);
+    particlesOut[base + 4u] = pack2x16float(vec2<f32>(vel.z, 0.0f));
+  } else {
+    particlesOut[base + 3u] = 0u;
+    particlesOut[base + 4u] = bitcast<u32>(vel.x);
+    particlesOut[base + 5u] = bitcast<u32>(vel.y);
+    particlesOut[base + 6u] = bitcast<u32>(vel.z);
+    particlesOut[base + 7u] = 0u;
+  }
+}
+
+// integer hash (PCG output permutation), identical on the CPU backend
+fn hash(value : u32) -> u32 {
+  let state = value * 747796405u + 2891336453u;
+  let word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+  return (word >> 22u) ^ word;
+}
+
+// random height in [-1, 1) of one crumple lattice point
+fn lattice_height(cx : u32, cy : u32) -> f32 {
+  let h = hash(cx ^ hash(cy ^ hash(params.seed)));
+  return f32(h) / 4294967296.0f * 2.0f - 1.0f;
+}
+
+fn crumple_height(ix : u32, iy : u32) -> f32 {
+  let cx = ix / CRUMPLE_CELL;
+  let cy = iy / CRUMPLE_CELL;
+  // smoothstep weights between the four surrounding lattice points
+  var fx = f32(ix % CRUMPLE_CELL) / f32(CRUMPLE_CELL);
+  var fy = f32(iy % CRUMPLE_CELL) / f32(CRUMPLE_CELL);
+  fx = fx * fx * (3.0f - 2.0f * fx);
+  fy = fy * fy * (3.0f - 2.0f * fy);
+  let bottom = mix(lattice_height(cx, cy), lattice_height(cx + 1u, cy), fx);
+  let top = mix(lattice_height(cx, cy + 1u), lattice_height(cx + 1u, cy + 1u), fx);
+  let cellLength = f32(CRUMPLE_CELL) * params.particleDist;
+  return mix(bottom, top, fy) * params.amount * cellLength;
+}
+
+fn draped_position(grid_pos : vec3<f32>) -> vec3<f32> {
+  // the cloth lies in the plane of the sphere center and wraps the half of the
+  // sphere facing -z, half a particle away from its surface
+  let radius = params.colliderRadius + params.particleDist * 0.5f;
+  let d = grid_pos.xy - params.collider.xy;
+  let d2 = dot(d, d);
+  var z = params.collider.z;
+  if (d2 < radius * radius) {
+    z -= sqrt(radius * radius - d2);
+  }
+  return vec3<f32>(grid_pos.x, grid_pos.y, z);
+}
+
+fn mesh_position(grid_pos : vec3<f32>, ix : u32, iy : u32) -> vec3<f32> {
+  // the particle's grid coordinates are looked up in the mesh uv layout and
+  // the position is interpolated inside the triangle that contains them
+  let uv = vec2<f32>(f32(ix) / f32(max(params.width, 2u) - 1u),
+                     f32(iy) / f32(max(params.height, 2u) - 1u));
+  for (var i : u32 = 0u; i + 2u < params.meshVertexCount; i += 3u) {
+    let a = vec2<f32>(mesh[i].u, mesh[i].v);
+    let b = vec2<f32>(mesh[i + 1u].u, mesh[i + 1u].v);
+    let c = vec2<f32>(mesh[i + 2u].u, mesh[i + 2u].v);
+    let area = (b.x - a.x) * (c.y - a.y) - (c.x - a.x) * (b.y - a.y);
+    if (area == 0.0f) {
+      continue;
+    }
+    let wb = ((uv.x - a.x) * (c.y - a.y) - (c.x - a.x) * (uv.y - a.y)) / area;
+    let wc = ((b.x - a.x) * (uv.y - a.y) - (uv.x - a.x) * (b.y - a.y)) / area;
+    let wa = 1.0f - wb - wc;
+    if (wa >= -1e-5f && wb >= -1e-5f && wc >= -1e-5f) {
+      return wa * mesh[i].pos + wb * mesh[i + 1u].pos + wc * mesh[i + 2u].pos;
+    }
+  }
+  // outside the uv layout - keep the flat grid
+  return grid_pos;
+}
+
+@compute
+@workgroup_size(64)
+fn init_particles(@builtin(global_invocation_id) global_invocation_id : vec3<u32>, @builtin(num_workgroups) num_workgroups : vec3<u32>) {
+  let index = linear_index(global_invocation_id, num_workgroups);
+  if (index >= params.width * params.height) {
+    return;
+  }
+
+  // flat grid centered on 0,0 (see ClothObject::fillGridRows), invocations
+  // follow the storage order
+  let cell = grid_layout_coords(index, params.width, params.height, params.particleOrder);
+  let ix = cell.x;
+  let iy = cell.y;
+  let x = i32(ix) - i32(params.width / 2u);
+  let y = i32(iy) - i32(params.height / 2u);
+  var pos = vec3<f32>(f32(x) * params.particleDist + params.offsetX,
+                      f32(y) * params.particleDist + params.offsetY, 0.0f);
+
+  if (params.generator == GENERATOR_DRAPED) {
+    pos = draped_position(pos);
+  } else if (params.generator == GENERATOR_CRUMPLED) {
+    pos.z = crumple_height(ix, iy);
+  } else if (params.generator == GENERATOR_MESH) {
+    pos = mesh_position(pos, ix, iy);
+  }
+
+  store_particle(index, pos, vec3<f32>(0.0f));
+}
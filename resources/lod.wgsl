@@ -0,0 +1,183 @@
+// transfers between a grid cloth and its coarse proxy (see ClothProxy.h)
+struct LodParams {
+  fullWidth : u32,
+  fullHeight : u32,
+  proxyWidth : u32,
+  proxyHeight : u32,
+
+  step : u32,
+  // full grid row of proxy row 0, zero or negative
+  rowOffset : i32,
+  particleOrder : u32,
+  particlePrecision : u32,
+
+  // weight of the detail captured when the proxy was taken
+  detailWeight : f32,
+}
+
+@group(0) @binding(0) var<uniform> params : LodParams;
+// both grids hold raw particle words, see store_particle() in compute.wgsl
+@group(0) @binding(1) var<storage, read_write> fullParticles : array<u32>;
+@group(0) @binding(2) var<storage, read_write> proxyParticles : array<u32>;
+// position offsets of the full grid the proxy cannot represent
+@group(0) @binding(3) var<storage, read_write> detail : array<vec4<f32>>;
+
+// particle storage - identical to compute.wgsl
+fn full_pos(index : u32) -> vec3<f32> {
+  let base = index * particle_words(params.particlePrecision);
+  return vec3<f32>(bitcast<f32>(fullParticles[base]), bitcast<f32>(fullParticles[base + 1u]), bitcast<f32>(fullParticles[base + 2u]));
+}
+
+fn full_vel(index : u32) -> vec3<f32> {
+  let base = index * particle_words(params.particlePrecision);
+  if (params.particlePrecision == PRECISION_HALF_VELOCITY) {
+    return vec3<f32>(unpack2x16float(fullParticles[base + 3u]), unpack2x16float(fullParticles[base + 4u]).x);
+  }
+  return vec3<f32>(bitcast<f32>(fullParticles[base + 4u]), bitcast<f32>(fullParticles[base + 5u]), bitcast<f32>(fullParticles[base + 6u]));
+}
+
+// the error estimate of the step sits in the padding, see store_particle()
+fn store_full(index : u32, pos : vec3<f32>, vel : vec3<f32>, error : f32) {
+  let base = index * particle_words(params.particlePrecision);
+  fullParticles[base] = bitcast<u32>(pos.x);
+  fullParticles[base + 1u] = bitcast<u32>(pos.y);
+  fullParticles[base + 2u] = bitcast<u32>(pos.z);
+  if (params.particlePrecision == PRECISION_HALF_VELOCITY) {
+    fullParticles[base + 3u] = pack2x16float(vel.xy);
+    fullParticles[base + 4u] = pack2x16float(vec2<f32>(vel.z, error));
+  } else {
+    fullParticles[base + 3u] = bitcast<u32>(error);
+    fullParticles[base + 4u] = bitcast<u32>(vel.x);
+    fullParticles[base + 5u] = bitcast<u32>(vel.y);
+    fullParticles[base + 6u] = bitcast<u32>(vel.z);
+    fullParticles[base + 7u] = 0u;
+  }
+}
+
+fn proxy_pos(index : u32) -> vec3<f32> {
+  let base = index * particle_words(params.particlePrecision);
+  return vec3<f32>(bitcast<f32>(proxyParticles[base]), bitcast<f32>(proxyParticles[base + 1u]), bitcast<f32>(proxyParticles[base + 2u]));
+}
+
+fn proxy_vel(index : u32) -> vec3<f32> {
+  let base = index * particle_words(params.particlePrecision);
+  if (params.particlePrecision == PRECISION_HALF_VELOCITY) {
+    return vec3<f32>(unpack2x16float(proxyParticles[base + 3u]), unpack2x16float(proxyParticles[base + 4u]).x);
+  }
+  return vec3<f32>(bitcast<f32>(proxyParticles[base + 4u]), bitcast<f32>(proxyParticles[base + 5u]), bitcast<f32>(proxyParticles[base + 6u]));
+}
+
+fn proxy_error(index : u32) -> f32 {
+  let base = index * particle_words(params.particlePrecision);
+  if (params.particlePrecision == PRECISION_HALF_VELOCITY) {
+    return unpack2x16float(proxyParticles[base + 4u]).y;
+  }
+  return bitcast<f32>(proxyParticles[base + 3u]);
+}
+
+fn store_proxy(index : u32, pos : vec3<f32>, vel : vec3<f32>) {
+  let base = index * particle_words(params.particlePrecision);
+  proxyParticles[base] = bitcast<u32>(pos.x);
+  proxyParticles[base + 1u] = bitcast<u32>(pos.y);
+  proxyParticles[base + 2u] = bitcast<u32>(pos.z);
+  if (params.particlePrecision == PRECISION_HALF_VELOCITY) {
+    proxyParticles[base + 3u] = pack2x16float(vel.xy);
+    proxyParticles[base + 4u] = pack2x16float(vec2<f32>(vel.z, 0.0f));
+  } else {
+    proxyParticles[base + 3u] = 0u;
+    proxyParticles[base + 4u] = bitcast<u32>(vel.x);
+    proxyParticles[base + 5u] = bitcast<u32>(vel.y);
+    proxyParticles[base + 6u] = bitcast<u32>(vel.z);
+    proxyParticles[base + 7u] = 0u;
+  }
+}
+
+fn full_index(x : i32, y : i32) -> u32 {
+  return grid_layout_index(u32(x), u32(y), params.fullWidth, params.fullHeight, params.particleOrder);
+}
+
+fn proxy_index(x : u32, y : u32) -> u32 {
+  return grid_layout_index(x, y, params.proxyWidth, params.proxyHeight, params.particleOrder);
+}
+
+// bilinear interpolation of the proxy at full grid cell (x, y)
+struct Sample {
+  pos : vec3<f32>,
+  vel : vec3<f32>,
+  // largest error estimate of the four proxy particles
+  error : f32,
+}
+
+fn interpolate(x : i32, y : i32) -> Sample {
+  let u = f32(x) / f32(params.step);
+  let v = f32(y - params.rowOffset) / f32(params.step);
+  let i0 = min(u32(u), params.proxyWidth - 2u);
+  let j0 = min(u32(v), params.proxyHeight - 2u);
+  let fu = u - f32(i0);
+  let fv = v - f32(j0);
+
+  let a = proxy_index(i0, j0);
+  let b = proxy_index(i0 + 1u, j0);
+  let c = proxy_index(i0, j0 + 1u);
+  let d = proxy_index(i0 + 1u, j0 + 1u);
+  var s : Sample;
+  s.pos = mix(mix(proxy_pos(a), proxy_pos(b), fu), mix(proxy_pos(c), proxy_pos(d), fu), fv);
+  s.vel = mix(mix(proxy_vel(a), proxy_vel(b), fu), mix(proxy_vel(c), proxy_vel(d), fu), fv);
+  s.error = max(max(proxy_error(a), proxy_error(b)), max(proxy_error(c), proxy_error(d)));
+  return s;
+}
+
+// proxy particle = every step-th full particle, virtual particles past the
+// right and bottom edges continue the edge linearly
+@compute
+@workgroup_size(64)
+fn restrict_to_proxy(@builtin(global_invocation_id) global_invocation_id : vec3<u32>, @builtin(num_workgroups) num_workgroups : vec3<u32>) {
+  let index = linear_index(global_invocation_id, num_workgroups);
+  if (index >= params.proxyWidth * params.proxyHeight) {
+    return;
+  }
+
+  let cell = grid_layout_coords(index, params.proxyWidth, params.proxyHeight, params.particleOrder);
+  let x = i32(cell.x * params.step);
+  let y = params.rowOffset + i32(cell.y * params.step);
+  let cx = min(x, i32(params.fullWidth) - 1);
+  let cy = max(y, 0);
+
+  let edge = full_pos(full_index(cx, cy));
+  var pos = edge;
+  if (x > cx) {
+    pos += (edge - full_pos(full_index(cx - 1, cy))) * f32(x - cx);
+  }
+  if (y < cy) {
+    pos += (edge - full_pos(full_index(cx, cy + 1))) * f32(cy - y);
+  }
+  store_proxy(index, pos, full_vel(full_index(cx, cy)));
+}
+
+// what the proxy loses of the full grid when it is taken
+@compute
+@workgroup_size(64)
+fn capture_detail(@builtin(global_invocation_id) global_invocation_id : vec3<u32>, @builtin(num_workgroups) num_workgroups : vec3<u32>) {
+  let index = linear_index(global_invocation_id, num_workgroups);
+  if (index >= params.fullWidth * params.fullHeight) {
+    return;
+  }
+
+  let cell = vec2<i32>(grid_layout_coords(index, params.fullWidth, params.fullHeight, params.particleOrder));
+  let s = interpolate(cell.x, cell.y);
+  detail[index] = vec4<f32>(full_pos(index) - s.pos, 0.0f);
+}
+
+// full grid from the proxy, with the fading detail added back
+@compute
+@workgroup_size(64)
+fn prolong_to_full(@builtin(global_invocation_id) global_invocation_id : vec3<u32>, @builtin(num_workgroups) num_workgroups : vec3<u32>) {
+  let index = linear_index(global_invocation_id, num_workgroups);
+  if (index >= params.fullWidth * params.fullHeight) {
+    return;
+  }
+
+  let cell = vec2<i32>(grid_layout_coords(index, params.fullWidth, params.fullHeight, params.particleOrder));
+  let s = interpolate(cell.x, cell.y);
+  store_full(index, s.pos + detail[index].xyz * params.detailWeight, s.vel, s.error);
+}
@@ -3,6 +3,14 @@ struct VertexInput {
 	@location(1) normal: vec3f,
 };
 
+/**
+ * Vertex with an octahedral normal (ClothObject::VertexPrecision::OctNormal)
+ */
+struct OctVertexInput {
+	@location(0) position: vec3f,
+	@location(1) octNormal: vec2f,
+};
+
 struct VertexOutput {
 	@builtin(position) position: vec4f,
 	@location(1) normal: vec3f,
@@ -37,16 +45,90 @@ struct LightingUniforms {
 @group(0) @binding(3) var textureSampler: sampler;
 @group(0) @binding(4) var<uniform> uLighting: LightingUniforms;
 
-@vertex
-fn vs_main(in: VertexInput) -> VertexOutput {
+/**
+ * Cloth uniforms of the vertex pulling path, same layout as SimParams in
+ * compute.wgsl (ClothObject::ClothUniforms)
+ */
+struct ClothParams {
+	particleWidth: f32,
+	particleHeight: f32,
+	particleDist: f32,
+	particleMass: f32,
+	particleScale: f32,
+	closeSpringStrength: f32,
+	farSpringStrength: f32,
+	outSpringStretch: f32,
+	inSpringStretch: f32,
+	wind_strength: f32,
+	sphereRadius: f32,
+	sphereX: f32,
+	sphereY: f32,
+	sphereZ: f32,
+	deltaT: f32,
+	currentT: f32,
+	wind_dir: vec3f,
+	quantization: f32,
+	particleOrder: u32,
+	particlePrecision: u32,
+	vertexPrecision: u32,
+	forceScale: f32,
+	tileFirstRow: u32,
+	tileRowBegin: u32,
+	tileRowEnd: u32,
+	tileRows: u32,
+}
+
+// the particles of the latest step and their packed normals, only bound by the
+// vertex pulling pipeline
+@group(1) @binding(0) var<uniform> uCloth: ClothParams;
+@group(1) @binding(1) var<storage, read> particles: array<u32>;
+@group(1) @binding(2) var<storage, read> particleNormals: array<u32>;
+
+fn transform_vertex(position: vec3f, normal: vec3f) -> VertexOutput {
 	var out: VertexOutput;
-	let worldPosition = uMyUniforms.modelMatrix * vec4<f32>(in.position, 1.0);
+	let worldPosition = uMyUniforms.modelMatrix * vec4<f32>(position, 1.0);
 	out.position = uMyUniforms.projectionMatrix * uMyUniforms.viewMatrix * worldPosition;
-	out.normal = (uMyUniforms.modelMatrix * vec4f(in.normal, 0.0)).xyz;
+	out.normal = (uMyUniforms.modelMatrix * vec4f(normal, 0.0)).xyz;
 	out.viewDirection = uMyUniforms.cameraWorldPosition - worldPosition.xyz;
 	return out;
 }
 
+/**
+ * Inverse of oct_encode() in compute.wgsl
+ */
+fn oct_decode(e: vec2f) -> vec3f {
+	var n = vec3f(e, 1.0 - abs(e.x) - abs(e.y));
+	let t = max(-n.z, 0.0);
+	n.x += select(t, -t, n.x >= 0.0);
+	n.y += select(t, -t, n.y >= 0.0);
+	return normalize(n);
+}
+
+@vertex
+fn vs_main(in: VertexInput) -> VertexOutput {
+	return transform_vertex(in.position, in.normal);
+}
+
+@vertex
+fn vs_main_oct(in: OctVertexInput) -> VertexOutput {
+	return transform_vertex(in.position, oct_decode(in.octNormal));
+}
+
+/**
+ * Reads the particle behind the index buffer entry directly, see
+ * particle_to_vertex() in compute.wgsl
+ */
+@vertex
+fn vs_pull(@builtin(vertex_index) index: u32) -> VertexOutput {
+	let base = index * particle_words(uCloth.particlePrecision);
+	let position = vec3f(bitcast<f32>(particles[base]),
+	                     bitcast<f32>(particles[base + 1u]),
+	                     bitcast<f32>(particles[base + 2u]));
+	let normal = oct_decode(unpack2x16snorm(particleNormals[index]));
+	// same axis switch and scale as the vertex buffer path
+	return transform_vertex(position.zxy / (0.3 * uCloth.particleScale), normal.zxy);
+}
+
 @fragment
 fn fs_main(in: VertexOutput) -> @location(0) vec4f {
 	// Sample normal
@@ -0,0 +1,238 @@
+// per-frame statistics of a cloth (see ClothStats.h) - every workgroup
+// reduces its particles in shared memory to one partial summary, a single
+// workgroup then reduces the partials to the final one
+struct StatsParams {
+  width : u32,
+  height : u32,
+  particleCount : u32,
+  particleWords : u32,
+
+  particleOrder : u32,
+  particlePrecision : u32,
+  // workgroups of the first level
+  partialCount : u32,
+  garbage : u32,
+
+  particleMass : f32,
+  particleDist : f32,
+  particleScale : f32,
+}
+
+// reduction element - bounds, sums and maxima of a set of particles. The
+// final summary holds the center of mass in sum (must match ClothStats::Stats)
+struct Summary {
+  lo : vec3<f32>,
+  // kinetic energy
+  energy : f32,
+  hi : vec3<f32>,
+  // largest length / rest length of a near spring
+  strain : f32,
+  sum : vec3<f32>,
+  speed : f32,
+  // finite particles, and particles with a nan or infinite component
+  count : u32,
+  nonFinite : u32,
+  // largest error estimate of the step, see store_particle() in compute.wgsl
+  error : f32,
+}
+
+@group(0) @binding(0) var<uniform> params : StatsParams;
+// latest particles as raw words, see store_particle() in compute.wgsl
+@group(0) @binding(1) var<storage, read> particles : array<u32>;
+@group(0) @binding(2) var<storage, read_write> partials : array<Summary>;
+@group(0) @binding(3) var<storage, read_write> result : Summary;
+// packed topology of a garment, see compute_mesh.wgsl
+@group(0) @binding(4) var<storage, read> topology : array<u32>;
+
+// ---------------- reduction ----------------
+
+fn empty_summary() -> Summary {
+  var s : Summary;
+  s.lo = vec3<f32>(3.4e38f);
+  s.energy = 0.0f;
+  s.hi = vec3<f32>(-3.4e38f);
+  s.strain = 0.0f;
+  s.sum = vec3<f32>(0.0f);
+  s.speed = 0.0f;
+  s.count = 0u;
+  s.nonFinite = 0u;
+  s.error = 0.0f;
+  return s;
+}
+
+fn combine(a : Summary, b : Summary) -> Summary {
+  var s : Summary;
+  s.lo = min(a.lo, b.lo);
+  s.energy = a.energy + b.energy;
+  s.hi = max(a.hi, b.hi);
+  s.strain = max(a.strain, b.strain);
+  s.sum = a.sum + b.sum;
+  s.speed = max(a.speed, b.speed);
+  s.count = a.count + b.count;
+  s.nonFinite = a.nonFinite + b.nonFinite;
+  s.error = max(a.error, b.error);
+  return s;
+}
+
+var<workgroup> scratch : array<Summary, 64>;
+
+// tree reduction over the 64 invocations of a workgroup, every invocation
+// gets the result - call from uniform control flow
+fn workgroup_reduce(local_index : u32, value : Summary) -> Summary {
+  scratch[local_index] = value;
+  workgroupBarrier();
+  for (var stride : u32 = 32u; stride > 0u; stride = stride / 2u) {
+    if (local_index < stride) {
+      scratch[local_index] = combine(scratch[local_index], scratch[local_index + stride]);
+    }
+    workgroupBarrier();
+  }
+  let total = scratch[0];
+  workgroupBarrier();
+  return total;
+}
+
+// ---------------- particles ----------------
+
+// particle storage - identical to compute.wgsl
+fn pos(index : u32) -> vec3<f32> {
+  let base = index * params.particleWords;
+  return vec3<f32>(bitcast<f32>(particles[base]), bitcast<f32>(particles[base + 1u]), bitcast<f32>(particles[base + 2u]));
+}
+
+fn vel(index : u32) -> vec3<f32> {
+  let base = index * params.particleWords;
+  if (params.particlePrecision == PRECISION_HALF_VELOCITY) {
+    return vec3<f32>(unpack2x16float(particles[base + 3u]), unpack2x16float(particles[base + 4u]).x);
+  }
+  return vec3<f32>(bitcast<f32>(particles[base + 4u]), bitcast<f32>(particles[base + 5u]), bitcast<f32>(particles[base + 6u]));
+}
+
+fn step_error(index : u32) -> f32 {
+  let base = index * params.particleWords;
+  if (params.particlePrecision == PRECISION_HALF_VELOCITY) {
+    return unpack2x16float(particles[base + 4u]).y;
+  }
+  return bitcast<f32>(particles[base + 3u]);
+}
+
+// no isNan in wgsl, and x != x may be folded away - test the exponent bits
+fn is_finite(v : vec3<f32>) -> bool {
+  let exponent = bitcast<vec3<u32>>(v) & vec3<u32>(0x7f800000u);
+  return all(exponent != vec3<u32>(0x7f800000u));
+}
+
+fn particle_summary(index : u32) -> Summary {
+  var s = empty_summary();
+  let p = pos(index);
+  let v = vel(index);
+  if (!is_finite(p) || !is_finite(v)) {
+    s.nonFinite = 1u;
+    return s;
+  }
+  s.lo = p;
+  s.hi = p;
+  s.sum = p;
+  s.energy = 0.5f * params.particleMass * dot(v, v);
+  s.speed = length(v);
+  s.count = 1u;
+  s.error = step_error(index);
+  return s;
+}
+
+fn spring_strain(a : vec3<f32>, b : vec3<f32>, rest : f32) -> f32 {
+  if (!is_finite(b)) {
+    return 0.0f;
+  }
+  return distance(a, b) / rest;
+}
+
+// storage index of grid cell (x, y) and back
+fn grid_index(x : u32, y : u32) -> u32 {
+  return grid_layout_index(x, y, params.width, params.height, params.particleOrder);
+}
+
+fn grid_coords(index : u32) -> vec2<u32> {
+  return grid_layout_coords(index, params.width, params.height, params.particleOrder);
+}
+
+// sections and spring words - must match ClothTopology::Section
+const NEAR_OFFSETS : u32 = 0u;
+const NEAR_SPRINGS : u32 = 1u;
+
+fn workgroup_index(workgroup_id : vec3<u32>, num_workgroups : vec3<u32>) -> u32 {
+  return workgroup_id.x + workgroup_id.y * num_workgroups.x;
+}
+
+// ---------------- kernels ----------------
+
+// first level on the grid, strain of the springs to the right and below
+@compute
+@workgroup_size(64)
+fn reduce_grid(@builtin(global_invocation_id) global_invocation_id : vec3<u32>, @builtin(local_invocation_index) local_index : u32, @builtin(workgroup_id) workgroup_id : vec3<u32>, @builtin(num_workgroups) num_workgroups : vec3<u32>) {
+  let index = linear_index(global_invocation_id, num_workgroups);
+  var s = empty_summary();
+  if (index < params.particleCount) {
+    s = particle_summary(index);
+    if (s.count == 1u) {
+      let cell = grid_coords(index);
+      let p = s.sum;
+      if (cell.x + 1u < params.width) {
+        s.strain = max(s.strain, spring_strain(p, pos(grid_index(cell.x + 1u, cell.y)), params.particleDist));
+      }
+      if (cell.y + 1u < params.height) {
+        s.strain = max(s.strain, spring_strain(p, pos(grid_index(cell.x, cell.y + 1u)), params.particleDist));
+      }
+    }
+  }
+
+  let total = workgroup_reduce(local_index, s);
+  let group = workgroup_index(workgroup_id, num_workgroups);
+  if (local_index == 0u && group < params.partialCount) {
+    partials[group] = total;
+  }
+}
+
+// first level on a garment, strain of the near springs
+@compute
+@workgroup_size(64)
+fn reduce_mesh(@builtin(global_invocation_id) global_invocation_id : vec3<u32>, @builtin(local_invocation_index) local_index : u32, @builtin(workgroup_id) workgroup_id : vec3<u32>, @builtin(num_workgroups) num_workgroups : vec3<u32>) {
+  let index = linear_index(global_invocation_id, num_workgroups);
+  var s = empty_summary();
+  if (index < params.particleCount) {
+    s = particle_summary(index);
+    if (s.count == 1u) {
+      let p = s.sum;
+      let near_begin = topology[topology[NEAR_OFFSETS] + index];
+      let near_end = topology[topology[NEAR_OFFSETS] + index + 1u];
+      for (var spring = near_begin; spring < near_end; spring++) {
+        let neighbor = topology[topology[NEAR_SPRINGS] + 2u * spring];
+        let rest = bitcast<f32>(topology[topology[NEAR_SPRINGS] + 2u * spring + 1u]) * params.particleScale;
+        s.strain = max(s.strain, spring_strain(p, pos(neighbor), rest));
+      }
+    }
+  }
+
+  let total = workgroup_reduce(local_index, s);
+  let group = workgroup_index(workgroup_id, num_workgroups);
+  if (local_index == 0u && group < params.partialCount) {
+    partials[group] = total;
+  }
+}
+
+// second level, one workgroup striding over the partials
+@compute
+@workgroup_size(64)
+fn reduce_partials(@builtin(local_invocation_index) local_index : u32) {
+  var s = empty_summary();
+  for (var i = local_index; i < params.partialCount; i += 64u) {
+    s = combine(s, partials[i]);
+  }
+
+  var total = workgroup_reduce(local_index, s);
+  if (local_index == 0u) {
+    // the sum of the positions becomes the center of mass
+    total.sum = total.sum / f32(max(total.count, 1u));
+    result = total;
+  }
+}